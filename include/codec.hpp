@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "encoding.hpp"
+#include "string.hpp"
+
+/**
+ * @file codec.hpp
+ * @brief Defines the Decoder and Encoder classes for text that arrives or leaves in chunks
+ */
+
+namespace simple {
+
+/**
+ * @class Decoder
+ * @brief Decodes a stream of bytes into Strings one chunk at a time
+ *
+ * Chunks may end anywhere, also inside a multi-byte sequence, a code unit or
+ * a surrogate pair. The incomplete end of a chunk (at most 3 bytes) is kept
+ * and decoded with the next chunk, so the text of each chunk is returned as
+ * soon as it is complete, and memory does not grow with the stream.
+ *
+ * The decoded chunks concatenate to what String::fromBytes() returns for the
+ * whole stream: the BOM policy applies to the start of the stream, errors are
+ * handled the same way, and exceptions report the byte offset in the stream.
+ * With THROW, the text of earlier chunks has already been returned when an
+ * error is found.
+ */
+class Decoder {
+public:
+    /**
+     * @brief Creates a decoder at the start of a stream
+     *
+     * @param encoding The encoding of the stream
+     * @param bomPolicy The BOM policy for the start of the stream
+     * @param errorHandling The error handling strategy to use
+     */
+    explicit Decoder(Encoding encoding = Encoding::UTF_8,
+                     BOMPolicy bomPolicy = BOMPolicy::AUTO,
+                     EncodingErrorHandling errorHandling = EncodingErrorHandling::THROW) noexcept;
+
+    /**
+     * @brief Decodes the next chunk of the stream
+     *
+     * @param bytes The first byte of the chunk
+     * @param size The number of bytes in the chunk
+     * @return The text completed by the chunk
+     * @throws EncodingException if the stream cannot be decoded and the error
+     *         handling strategy is THROW (the decoder is then reset)
+     */
+    String decode(const uint8_t* bytes, std::size_t size);
+
+    /**
+     * @brief Decodes the next chunk of the stream
+     *
+     * @param bytes The chunk
+     * @return The text completed by the chunk
+     * @throws EncodingException as decode(const uint8_t*, std::size_t)
+     */
+    String decode(const std::vector<uint8_t>& bytes);
+
+    /**
+     * @brief Ends the stream, decoding the bytes kept from the last chunk
+     *
+     * An incomplete sequence at the end of the stream is an error. The decoder
+     * is then reset for the next stream.
+     *
+     * @return The rest of the text
+     * @throws EncodingException as decode(const uint8_t*, std::size_t)
+     */
+    String finish();
+
+    /**
+     * @brief Drops the bytes kept from the last chunk and starts a new stream
+     */
+    void reset() noexcept;
+
+    /**
+     * @brief Gets the number of bytes of the stream decoded so far
+     *
+     * @return The offset in the stream of the first byte that is kept
+     */
+    std::size_t getByteOffset() const noexcept;
+
+private:
+    /// The longest incomplete sequence at the end of a chunk
+    static constexpr std::size_t PENDING_CAPACITY = 3;
+
+    // Decode complete text at the current offset
+    String decode_complete(const uint8_t* bytes, std::size_t size);
+
+    Encoding encoding_;
+    BOMPolicy bomPolicy_;
+    EncodingErrorHandling errorHandling_;
+    std::size_t offset_;          ///< Stream offset of the pending bytes
+    bool started_;                ///< Whether the start of the stream has been decoded
+    std::size_t pendingSize_;
+    uint8_t pending_[PENDING_CAPACITY];
+};
+
+/**
+ * @class Encoder
+ * @brief Encodes UTF-8 text into a stream of bytes one chunk at a time
+ *
+ * Chunks may end inside a UTF-8 sequence, whose bytes (at most 3) are kept
+ * and encoded with the next chunk. The encoded chunks concatenate to what
+ * String::getBytes() returns for the whole text: a BOM is written before the
+ * first chunk when the policy is INCLUDE, errors are handled the same way, and
+ * exceptions report the offset in the text of the chunk being encoded.
+ */
+class Encoder {
+public:
+    /**
+     * @brief Creates an encoder at the start of a stream
+     *
+     * @param encoding The encoding of the stream
+     * @param bomPolicy The BOM policy for the start of the stream
+     * @param errorHandling The error handling strategy to use
+     */
+    explicit Encoder(Encoding encoding = Encoding::UTF_8,
+                     BOMPolicy bomPolicy = BOMPolicy::AUTO,
+                     EncodingErrorHandling errorHandling = EncodingErrorHandling::THROW) noexcept;
+
+    /**
+     * @brief Encodes the next chunk of UTF-8 text
+     *
+     * @param utf8 The chunk
+     * @return The bytes of the text completed by the chunk
+     * @throws EncodingException if the text cannot be encoded and the error
+     *         handling strategy is THROW (the encoder is then reset)
+     */
+    std::vector<uint8_t> encode(std::string_view utf8);
+
+    /**
+     * @brief Ends the stream, encoding the bytes kept from the last chunk
+     *
+     * The encoder is then reset for the next stream.
+     *
+     * @return The rest of the bytes
+     * @throws EncodingException as encode()
+     */
+    std::vector<uint8_t> finish();
+
+    /**
+     * @brief Drops the bytes kept from the last chunk and starts a new stream
+     */
+    void reset() noexcept;
+
+private:
+    static constexpr std::size_t PENDING_CAPACITY = 3;
+
+    // Encode complete text at the current offset, appending the bytes
+    void encode_complete(const char* utf8, std::size_t size, std::vector<uint8_t>& out);
+
+    Encoding encoding_;
+    BOMPolicy bomPolicy_;
+    EncodingErrorHandling errorHandling_;
+    std::size_t offset_;          ///< Text offset of the pending bytes
+    bool started_;                ///< Whether any bytes have been written
+    std::size_t pendingSize_;
+    char pending_[PENDING_CAPACITY];
+};
+
+} // namespace simple
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <memory_resource>
+#include <span>
 #include <stdexcept>
 #include <sstream>
 #include <variant>
@@ -11,6 +16,7 @@
 #include "code_point.hpp"
 #include "index.hpp"
 #include "encoding.hpp"
+#include "transcode.hpp"
 
 namespace simple {
 
@@ -79,80 +85,130 @@ void init_locale();
 // Forward declaration of the StringImpl class
 class StringImpl;
 
+// Reference counting of StringImpl blocks (implemented in string.cpp)
+void retain(const StringImpl* impl) noexcept;
+void release(const StringImpl* impl) noexcept;
 
-// Count UTF-16 code units, treating each byte of invalid UTF-8 as a separate code unit
-inline std::size_t count_utf16_code_units(const std::string& utf8_str) {
-    std::size_t count = 0;
-    const unsigned char* str = reinterpret_cast<const unsigned char*>(utf8_str.c_str());
-    const unsigned char* end = str + utf8_str.length();
-
-    while (str < end) {
-        if (*str < 0x80) {
-            // ASCII character
-            count++;
-            str++;
-        } else if ((*str & 0xE0) == 0xC0) {
-            // 2-byte UTF-8 sequence
-            if (str + 1 >= end || (str[1] & 0xC0) != 0x80) {
-                // Invalid or incomplete sequence, treat each byte separately
-                count++;
-                str++;
-                continue;
-            }
-            // Check for overlong encoding (should have used fewer bytes)
-            unsigned int codepoint = ((str[0] & 0x1F) << 6) | (str[1] & 0x3F);
-            if (codepoint < 0x80) {
-                // Overlong encoding, treat each byte separately
-                count += 2;
-                str += 2;
-                continue;
-            }
-            count++;
-            str += 2;
-        } else if ((*str & 0xF0) == 0xE0) {
-            // 3-byte UTF-8 sequence
-            if (str + 2 >= end || (str[1] & 0xC0) != 0x80 || (str[2] & 0xC0) != 0x80) {
-                // Invalid or incomplete sequence, treat each byte separately
-                count++;
-                str++;
-                continue;
-            }
-            // Check for overlong encoding and surrogate range
-            unsigned int codepoint = ((str[0] & 0x0F) << 12) | ((str[1] & 0x3F) << 6) | (str[2] & 0x3F);
-            if (codepoint < 0x800 || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
-                // Overlong encoding or surrogate range, treat each byte separately
-                count += 3;
-                str += 3;
-                continue;
-            }
-            count++;
-            str += 3;
-        } else if ((*str & 0xF8) == 0xF0) {
-            // 4-byte UTF-8 sequence (surrogate pair in UTF-16)
-            if (str + 3 >= end || (str[1] & 0xC0) != 0x80 || (str[2] & 0xC0) != 0x80 || (str[3] & 0xC0) != 0x80) {
-                // Invalid or incomplete sequence, treat each byte separately
-                count++;
-                str++;
-                continue;
-            }
-            // Check for overlong encoding and valid Unicode range
-            unsigned int codepoint = ((str[0] & 0x07) << 18) | ((str[1] & 0x3F) << 12) |
-                                    ((str[2] & 0x3F) << 6)  | (str[3] & 0x3F);
-            if (codepoint < 0x10000 || codepoint > 0x10FFFF) {
-                // Overlong encoding or outside Unicode range, treat each byte separately
-                count += 4;
-                str += 4;
-                continue;
-            }
-            count += 2;  // Surrogate pair counts as two UTF-16 code units
-            str += 4;
-        } else {
-            // Invalid UTF-8 byte, treat as a single code unit
-            count++;
-            str++;
+// Create an immortal block viewing bytes in static storage (implemented in string.cpp)
+const StringImpl* create_static(const char* data, std::size_t length);
+
+// Hash of UTF-8 bytes, as returned by String::hash_code() (implemented in string.cpp)
+std::size_t hash_bytes(std::string_view bytes) noexcept;
+
+/**
+ * @brief Owning handle to an intrusively reference-counted StringImpl
+ *
+ * The reference count lives inside the StringImpl block itself, next to the
+ * offset/length header and the UTF-8 bytes, so a String costs a single
+ * allocation instead of separate control blocks for the impl and its data.
+ * Handles to immortal blocks (string literals) carry a tag bit instead, so
+ * copying and destroying them never touches the reference count.
+ */
+class ImplRef {
+public:
+    ImplRef() noexcept = default;
+
+    // Adopts an impl whose reference has already been counted
+    explicit ImplRef(const StringImpl* impl) noexcept : bits_(reinterpret_cast<std::uintptr_t>(impl)) {}
+
+    // Refers to an impl that is never freed, without counting the reference
+    static ImplRef immortal(const StringImpl* impl) noexcept {
+        ImplRef ref(impl);
+        ref.bits_ |= IMMORTAL;
+        return ref;
+    }
+
+    ImplRef(const ImplRef& other) noexcept : bits_(other.bits_) {
+        if (counted()) retain(get());
+    }
+
+    ImplRef(ImplRef&& other) noexcept : bits_(other.bits_) {
+        other.bits_ = 0;
+    }
+
+    ImplRef& operator=(const ImplRef& other) noexcept {
+        ImplRef(other).swap(*this);
+        return *this;
+    }
+
+    ImplRef& operator=(ImplRef&& other) noexcept {
+        ImplRef(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~ImplRef() {
+        if (counted()) release(get());
+    }
+
+    void swap(ImplRef& other) noexcept { std::swap(bits_, other.bits_); }
+
+    const StringImpl* get() const noexcept { return reinterpret_cast<const StringImpl*>(bits_ & ~IMMORTAL); }
+    const StringImpl* operator->() const noexcept { return get(); }
+    const StringImpl& operator*() const noexcept { return *get(); }
+    explicit operator bool() const noexcept { return bits_ != 0; }
+
+    // Check if this handle holds a counted reference
+    bool counted() const noexcept { return bits_ != 0 && !(bits_ & IMMORTAL); }
+
+private:
+    // Tag bit marking immortal impls (StringImpl blocks are at least pointer-aligned)
+    static constexpr std::uintptr_t IMMORTAL = 1;
+
+    std::uintptr_t bits_ = 0;
+};
+
+/**
+ * @brief Characters of a string literal used as a template argument
+ *
+ * Template parameter objects have static storage duration, so a String can
+ * refer to these characters without copying them.
+ */
+template<std::size_t N>
+struct FixedString {
+    char chars[N];
+
+    constexpr FixedString(const char (&str)[N]) {
+        for (std::size_t i = 0; i < N; ++i) {
+            chars[i] = str[i];
         }
     }
-    return count;
+
+    // Length without the terminating null character
+    static constexpr std::size_t length() { return N - 1; }
+};
+
+/**
+ * @brief Location of a UTF-16 code unit within UTF-8 bytes
+ *
+ * Refers to the UTF-8 sequence ("group") the code unit was decoded from. A
+ * group yields one code unit, or two for a surrogate pair, so the unit may be
+ * the second one of its group. Past the end, byte is the byte length and unit
+ * the UTF-16 length.
+ */
+struct Utf16Position {
+    std::size_t byte;  ///< Byte offset of the group
+    std::size_t unit;  ///< UTF-16 index of the first code unit of the group
+};
+
+// Marks a count that has not been computed yet
+constexpr std::size_t UNKNOWN_COUNT = static_cast<std::size_t>(-1);
+
+// Part of UTF-8 bytes, with its UTF-16 length if known (UNKNOWN_COUNT otherwise)
+struct ByteSpan {
+    std::size_t offset;
+    std::size_t length;
+    std::size_t utf16_length;
+};
+
+// Read-only queries shared by String and StringView (implemented in string.cpp)
+struct TextQueries;
+
+// Operations on ropes, blocks concatenating two other blocks (implemented in string.cpp)
+struct Rope;
+
+// Count UTF-16 code units, treating each byte of invalid UTF-8 as a separate code unit
+inline std::size_t count_utf16_code_units(std::string_view utf8_str) noexcept {
+    return count_utf16(utf8_str.data(), utf8_str.size()).units;
 }
 
 // Compare two strings using byte-by-byte comparison for exact Java behavior
@@ -186,6 +242,35 @@ inline int compare_utf8_strings(const std::string& str1, const std::string& str2
  * @section memory Memory Efficiency
  * The String class uses copy-on-write semantics to efficiently share memory between
  * string instances. Substrings share the same underlying data without copying.
+ * A short substring therefore keeps its whole parent buffer alive; compact()
+ * and set_compaction_threshold() copy such substrings out.
+ * concat() and insert() build long strings as ropes: balanced trees whose
+ * leaves are the blocks of the parts, so joining, inserting and slicing take
+ * logarithmic time and share the parts instead of copying them. Each node
+ * knows the UTF-16 length below it, so char_at() and substring() walk the tree;
+ * the bytes are copied into one buffer on first use by any other operation
+ * (to_string(), getBytes(), searching and so on).
+ * The reference count, the offset/length header and the UTF-8 bytes of a string
+ * are kept in one intrusively reference-counted block, so constructing a string
+ * costs a single allocation. Short strings (up to INLINE_CAPACITY bytes of UTF-8)
+ * are stored inline in the String object itself: they need no heap allocation
+ * and copying them touches no reference count.
+ * String literals created with the _s suffix (see String::literal) refer to
+ * their characters in place and are never reference-counted either.
+ * Reference counts are atomic, so strings can be shared between threads. Builds
+ * configured with ENABLE_NONATOMIC_REFCOUNT (defining SSTRING_NONATOMIC_REFCOUNT)
+ * count with plain loads and stores instead, for single-threaded workers: every
+ * string must then stay on the thread that created it, which debug builds check,
+ * and intern() must only be used from one thread.
+ * UTF-16 indices are mapped to UTF-8 byte offsets through a sparse index that
+ * records one checkpoint per 64 code units as lookups reach them, so random
+ * access decodes only a short span and no UTF-16 copy of the text is kept.
+ * prewarm_utf16() builds the index ahead of use, release_caches() frees it,
+ * and Utf16CachePolicy::NEVER has lookups scan from the start instead.
+ * Pure ASCII strings need no index at all, since their UTF-16 indices are byte
+ * offsets; this is detected when the bytes are stored.
+ * memory_usage() reports the heap memory a string refers to, and memory_stats()
+ * the blocks and caches of all strings, from counters that are always on.
  */
 
 /**
@@ -204,8 +289,26 @@ public:
         : std::out_of_range(msg) {}
 };
 
+class StringView;
+
 class String {
 public:
+    /**
+     * @brief Maximum number of UTF-8 bytes stored inline in a String object
+     *
+     * Strings of up to this many bytes are kept in the String object itself,
+     * in the bytes that hold the block pointer of longer strings, so a String
+     * is INLINE_CAPACITY + 1 (24) bytes in size whichever way it is stored.
+     */
+    static constexpr std::size_t INLINE_CAPACITY = 23;
+
+    /**
+     * @brief The empty string
+     *
+     * Shared by all code returning an empty string; copying it allocates nothing.
+     */
+    static const String EMPTY;
+
     /**
      * @name valueOf
      * @brief Static methods to convert primitive types to String
@@ -285,6 +388,16 @@ public:
      * @param str The std::string to convert
      */
     explicit String(const std::string& str);
+
+    /**
+     * @brief Constructor taking over a std::string
+     *
+     * The string's buffer becomes the storage of this String without copying
+     * its bytes. Strings short enough to be stored inline are copied instead.
+     *
+     * @param str The std::string to take over (left in a valid but unspecified state)
+     */
+    explicit String(std::string&& str);
     
     /**
      * @brief Constructor from C string with explicit length
@@ -295,6 +408,66 @@ public:
      * @param length The number of characters to use from the C string
      */
     String(const char* str, std::size_t length);
+
+    /**
+     * @brief Constructor copying a std::string into memory from a memory resource
+     *
+     * @param str The std::string to convert
+     * @param resource The resource to allocate the bytes from (nullptr for the global heap)
+     * @see MemoryScope
+     */
+    String(const std::string& str, std::pmr::memory_resource* resource);
+
+    /**
+     * @brief Constructor copying characters into memory from a memory resource
+     *
+     * @param str The characters to convert (may contain null characters)
+     * @param length The number of characters to use
+     * @param resource The resource to allocate the bytes from (nullptr for the global heap)
+     * @see MemoryScope
+     */
+    String(const char* str, std::size_t length, std::pmr::memory_resource* resource);
+
+    String(const String& other);
+    String(String&& other) noexcept;
+    String& operator=(const String& other);
+    String& operator=(String&& other) noexcept;
+    ~String();
+
+    /**
+     * @brief Directs the allocations of the Strings created by a thread to a memory resource
+     *
+     * While a MemoryScope is alive, the strings created by its thread without an
+     * explicit resource (by constructors, valueOf(), fromBytes(), replace() and
+     * the like) allocate their blocks from its resource, so request-scoped work
+     * can allocate from a std::pmr::monotonic_buffer_resource and release
+     * everything at once. Substrings always allocate from the resource of the
+     * string they share their bytes with. Scopes nest; destroying one restores
+     * the resource of the enclosing scope.
+     *
+     * The resource must outlive every string allocated from it. Short strings
+     * are stored inline and allocate nothing. Lazily built caches (the UTF-16
+     * index and the std::string returned by to_string()) and interned strings
+     * still come from the global heap.
+     */
+    class MemoryScope {
+    public:
+        explicit MemoryScope(std::pmr::memory_resource* resource);
+        ~MemoryScope();
+
+        MemoryScope(const MemoryScope&) = delete;
+        MemoryScope& operator=(const MemoryScope&) = delete;
+
+    private:
+        std::pmr::memory_resource* previous_;
+    };
+
+    /**
+     * @brief Returns the memory resource of the innermost MemoryScope of this thread
+     *
+     * @return the resource new strings allocate from (nullptr for the global heap)
+     */
+    static std::pmr::memory_resource* memory_resource();
     
     // Get the length of the string in UTF-16 code units
     std::size_t length() const;
@@ -391,6 +564,8 @@ public:
     // Get the underlying string data
     // For substrings, returns a new string with just the substring portion
     // For full strings (offset_=0, length_=data_->length()), returns a reference to the original data
+    // For strings stored inline, returns a copy in a buffer of the calling thread, valid until
+    // the thread calls to_string() on an inline string again
     const std::string& to_string() const;
 
     /**
@@ -417,6 +592,31 @@ public:
      */
     String substring(Index beginIndex, Index endIndex) const;
 
+    /**
+     * Concatenates the specified string to the end of this string.
+     *
+     * Long results are ropes sharing the blocks of both strings, built in
+     * logarithmic time; short ones are copied into a single buffer.
+     *
+     * @param str the string to append
+     * @return a string with the characters of this string followed by those of str
+     */
+    String concat(const String& str) const;
+
+    /**
+     * Inserts the specified string at the specified index of this string.
+     *
+     * Like concat(), this shares the parts of both strings in a rope when the
+     * result is long. An index between the two halves of a surrogate pair rounds
+     * up to the end of the pair, as in substring().
+     *
+     * @param offset the UTF-16 index to insert at
+     * @param str the string to insert
+     * @return a string with str inserted before the character at offset
+     * @throws StringIndexOutOfBoundsException if offset is larger than length()
+     */
+    String insert(Index offset, const String& str) const;
+
     /**
      * Returns a string resulting from replacing all occurrences of oldChar in this
      * string with newChar.
@@ -437,6 +637,212 @@ public:
      */
     String replace(const String& target, const String& replacement) const;
 
+    /**
+     * @brief Statistics of the table of interned strings
+     */
+    struct InternStats {
+        std::size_t entries;      ///< Number of canonical strings in the table
+        std::size_t bytes;        ///< UTF-8 bytes held by the canonical strings
+        std::size_t hits;         ///< Calls to intern() answered by an existing entry
+        std::size_t bytes_saved;  ///< UTF-8 bytes of the strings replaced by existing entries
+    };
+
+    /**
+     * Returns a canonical representation for this string, like Java's String.intern().
+     *
+     * Equal strings intern to Strings sharing the same block, so equals() on them
+     * is decided by comparing pointers. The table is sharded and safe to use
+     * from several threads. Entries no longer referenced outside the table are
+     * dropped by purge_interned(), and automatically whenever a shard of the
+     * table has doubled in size since it was last swept, so the table stays
+     * within a constant factor of the interned strings still in use.
+     *
+     * @return a string equal to this one, shared by all equal interned strings
+     */
+    String intern() const;
+
+    /**
+     * Drops the interned strings that are no longer referenced outside the table.
+     *
+     * Strings referring to string literals are kept, since they cost no memory.
+     *
+     * @return the number of entries removed
+     */
+    static std::size_t purge_interned();
+
+    /**
+     * Returns statistics of the table of interned strings.
+     *
+     * @return the current size of the table and its cumulative savings
+     */
+    static InternStats intern_stats();
+
+    /**
+     * Returns a string equal to this one that keeps only its own bytes alive.
+     *
+     * Substrings share the buffer of the string they were taken from, so a short
+     * substring of a large string keeps the whole buffer in memory. The result
+     * of compact() holds a copy of just the visible bytes when this string is
+     * such a substring, and is this string itself otherwise.
+     *
+     * @return a string equal to this one whose retained bytes are its visible bytes
+     */
+    String compact() const;
+
+    /**
+     * Returns the number of UTF-8 bytes this string keeps in memory: the whole
+     * buffer it shares with the string it was taken from, if any.
+     *
+     * @return the retained bytes, at least visible_bytes()
+     */
+    std::size_t retained_bytes() const;
+
+    /**
+     * Returns the number of UTF-8 bytes of this string itself.
+     *
+     * @return the visible bytes
+     */
+    std::size_t visible_bytes() const;
+
+    /**
+     * Sets the fraction of its buffer below which a substring is compacted as it
+     * is created.
+     *
+     * With a threshold of 0.25, a substring covering less than a quarter of the
+     * bytes of the buffer it would share is copied instead, as if compact() was
+     * called on it. The default of 0 disables automatic compaction, so all
+     * substrings share their buffer.
+     *
+     * @param fraction the threshold, between 0 and 1
+     * @throws std::invalid_argument if fraction is outside [0, 1]
+     */
+    static void set_compaction_threshold(double fraction);
+
+    /**
+     * Returns the fraction of its buffer below which a substring is compacted.
+     *
+     * @return the threshold set by set_compaction_threshold() (0 by default)
+     */
+    static double compaction_threshold();
+
+    /**
+     * @brief Heap memory referenced by one string
+     */
+    struct MemoryUsage {
+        std::size_t owned_bytes;   ///< Bytes no other string refers to, freed with this string
+        std::size_t shared_bytes;  ///< Bytes shared with other strings, freed with the last of them
+        std::size_t cache_bytes;   ///< Part of the above taken by caches (UTF-16 index, std::string copy)
+        bool utf16_index;          ///< Whether the UTF-16 index of this string has been built
+    };
+
+    /**
+     * @brief Heap memory held by all strings of the process
+     */
+    struct MemoryStats {
+        std::size_t live_blocks;   ///< Blocks allocated and not yet freed (strings not stored inline)
+        std::size_t block_bytes;   ///< Bytes of these blocks, including buffers they adopted
+        std::size_t live_caches;   ///< Caches built for blocks and not yet freed
+        std::size_t cache_bytes;   ///< Bytes of these caches
+        std::size_t cache_builds;  ///< Caches built since the start of the process
+    };
+
+    /**
+     * Returns the heap memory this string refers to.
+     *
+     * Counts the block of this string, the block owning its bytes if it is a
+     * substring, the parts of a rope and the caches built for each of them.
+     * Bytes are owned when no other string refers to them. Strings stored
+     * inline use no heap memory.
+     *
+     * @return the owned and shared bytes of this string
+     */
+    MemoryUsage memory_usage() const;
+
+    /**
+     * Returns the heap memory held by all strings.
+     *
+     * The counters are updated by each thread in its own cache line, so they are
+     * cheap enough to leave on, and are added up when read. Blocks of string
+     * literals are counted once they are created and never freed.
+     *
+     * @return the current totals
+     */
+    static MemoryStats memory_stats();
+
+    /**
+     * @brief Whether strings keep the index mapping their UTF-16 indices to bytes
+     */
+    enum class Utf16CachePolicy {
+        CACHE,  ///< Build the index on first random access and keep it (the default)
+        NEVER,  ///< Never build it: scan the bytes from the start on every access
+    };
+
+    /**
+     * Builds the UTF-16 index of this string completely, for strings about to
+     * be accessed at random indices many times.
+     *
+     * Does nothing for strings that need no index (inline or ASCII strings) and
+     * for strings whose policy is Utf16CachePolicy::NEVER. Ropes are flattened.
+     */
+    void prewarm_utf16() const;
+
+    /**
+     * Frees the caches built for this string: its UTF-16 index, the std::string
+     * returned by to_string() and the flattened copy of a rope, as well as those
+     * of the buffer of a substring or the parts of a rope that no other string
+     * refers to.
+     *
+     * Caches of a block shared with other strings are kept, since they may be
+     * in use; this string is then left as it is. The flattened copy of a rope
+     * is kept as well while StringViews of the rope or substrings refer to it.
+     * References returned by to_string() are invalidated. The caches are
+     * rebuilt when needed again.
+     *
+     * @return the number of heap bytes freed
+     */
+    std::size_t release_caches();
+
+    /**
+     * Sets the policy for the UTF-16 index of this string, overriding the
+     * default policy.
+     *
+     * Copies of this string made later, and substrings taken from it, inherit
+     * the policy. Copies made before keep theirs. An index built already is
+     * kept until release_caches() is called.
+     *
+     * @param policy the policy for this string
+     */
+    void set_utf16_cache_policy(Utf16CachePolicy policy);
+
+    /**
+     * Sets the policy for the UTF-16 index of strings without a policy of their
+     * own (see set_utf16_cache_policy()).
+     *
+     * @param policy the default policy, initially Utf16CachePolicy::CACHE
+     */
+    static void set_default_utf16_cache_policy(Utf16CachePolicy policy);
+
+    /**
+     * Returns the policy for the UTF-16 index of strings without a policy of their own.
+     *
+     * @return the default policy
+     */
+    static Utf16CachePolicy default_utf16_cache_policy();
+
+    /**
+     * Returns a hash code for this string.
+     *
+     * The hash is computed from the UTF-8 bytes with wyhash and cached in the
+     * block holding the string, like Java's String.hashCode, so it is computed
+     * once per string however often it is asked for. Equal strings have equal
+     * hash codes, and the hash code of a string equals the StringHash of a
+     * std::string_view of the same bytes. The value may differ between
+     * platforms and versions and should not be persisted.
+     *
+     * @return a hash code for this string
+     */
+    std::size_t hash_code() const;
+
     // C++ operator overloads for comparison
     bool operator==(const String& other) const;
     bool operator!=(const String& other) const;
@@ -628,6 +1034,44 @@ public:
     std::vector<uint8_t> getBytes(Encoding encoding, BOMPolicy bomPolicy, 
                                  EncodingErrorHandling errorHandling = EncodingErrorHandling::THROW) const;
 
+    /**
+     * Returns the number of bytes getBytes() returns for this string, without encoding it.
+     * 
+     * UTF sizes are counted with the vectorized kernels of the transcoder (and
+     * are known at once for ASCII strings). ISO-8859-1 and ASCII sizes depend
+     * on the error handling strategy.
+     * 
+     * @param encoding the encoding to use
+     * @param bomPolicy the BOM policy to use, defaults to EXCLUDE
+     * @param errorHandling the error handling strategy to use, defaults to THROW
+     * @return the exact number of bytes of the encoded string
+     * @throws EncodingException if the string cannot be encoded in the specified encoding
+     *         and the error handling strategy is THROW
+     */
+    std::size_t encoded_size(Encoding encoding, 
+                             BOMPolicy bomPolicy = BOMPolicy::EXCLUDE,
+                             EncodingErrorHandling errorHandling = EncodingErrorHandling::THROW) const;
+
+    /**
+     * Writes the bytes getBytes() returns for this string into a buffer the caller provides.
+     * 
+     * Nothing is allocated, whatever the alignment of the buffer, and the
+     * bytes past the ones written are left alone.
+     * 
+     * @param buffer the buffer to write to, with room for at least encoded_size() bytes
+     * @param encoding the encoding to use
+     * @param bomPolicy the BOM policy to use, defaults to EXCLUDE
+     * @param errorHandling the error handling strategy to use, defaults to THROW
+     * @return the number of bytes written
+     * @throws std::length_error if the buffer is smaller than encoded_size()
+     * @throws EncodingException if the string cannot be encoded in the specified encoding
+     *         and the error handling strategy is THROW
+     */
+    std::size_t encode_into(std::span<uint8_t> buffer, 
+                            Encoding encoding, 
+                            BOMPolicy bomPolicy = BOMPolicy::EXCLUDE,
+                            EncodingErrorHandling errorHandling = EncodingErrorHandling::THROW) const;
+
     /**
      * Returns a standard C++ string representation of this string.
      * This is a convenience method that uses UTF-8 encoding.
@@ -667,6 +1111,60 @@ public:
                            BOMPolicy bomPolicy,
                            EncodingErrorHandling errorHandling = EncodingErrorHandling::THROW);
 
+    /**
+     * Creates a new String from a range of bytes using the specified encoding,
+     * with control over Byte Order Mark (BOM) handling.
+     * 
+     * @param bytes the first byte to decode
+     * @param size the number of bytes to decode
+     * @param encoding the encoding to use
+     * @param bomPolicy the BOM policy to use
+     * @param errorHandling the error handling strategy to use, defaults to THROW
+     * @return a new String created from the bytes
+     * @throws EncodingException if the bytes cannot be decoded using the specified encoding
+     *         and the error handling strategy is THROW
+     */
+    static String fromBytes(const uint8_t* bytes, 
+                           std::size_t size,
+                           Encoding encoding, 
+                           BOMPolicy bomPolicy,
+                           EncodingErrorHandling errorHandling = EncodingErrorHandling::THROW);
+
+    /**
+     * Creates a new String from a byte array that is no longer needed by the caller.
+     * 
+     * Valid UTF-8 is validated in place and the byte array is taken over without
+     * copying (minus a skipped BOM). Other encodings and invalid UTF-8 are decoded
+     * as by the copying overload.
+     * 
+     * @param bytes the byte array to decode (left in a valid but unspecified state)
+     * @param encoding the encoding to use, defaults to UTF_8
+     * @param errorHandling the error handling strategy to use, defaults to THROW
+     * @return a new String created from the byte array
+     * @throws EncodingException if the byte array cannot be decoded using the specified encoding
+     *         and the error handling strategy is THROW
+     */
+    static String fromBytes(std::vector<uint8_t>&& bytes, 
+                           Encoding encoding = Encoding::UTF_8,
+                           EncodingErrorHandling errorHandling = EncodingErrorHandling::THROW);
+
+    /**
+     * Creates a new String from a byte array that is no longer needed by the caller,
+     * with control over Byte Order Mark (BOM) handling.
+     * 
+     * @param bytes the byte array to decode (left in a valid but unspecified state)
+     * @param encoding the encoding to use
+     * @param bomPolicy the BOM policy to use
+     * @param errorHandling the error handling strategy to use, defaults to THROW
+     * @return a new String created from the byte array
+     * @throws EncodingException if the byte array cannot be decoded using the specified encoding
+     *         and the error handling strategy is THROW
+     */
+    static String fromBytes(std::vector<uint8_t>&& bytes, 
+                           Encoding encoding, 
+                           BOMPolicy bomPolicy,
+                           EncodingErrorHandling errorHandling = EncodingErrorHandling::THROW);
+
     /**
      * Creates a new String from a standard C++ string.
      * This is a convenience method that assumes UTF-8 encoding.
@@ -676,24 +1174,131 @@ public:
      */
     static String fromStdString(const std::string& str);
 
+    /**
+     * Creates a new String taking over a standard C++ string without copying its bytes.
+     * This is a convenience method that assumes UTF-8 encoding.
+     * 
+     * @param str the standard C++ string to take over
+     * @return a new String using the buffer of the standard C++ string
+     */
+    static String fromStdString(std::string&& str);
+
+    /**
+     * @brief Creates a String holding a copy of the text of a StringView
+     *
+     * @param view The text to copy
+     * @return A String owning its copy of the text
+     */
+    static String fromStringView(const StringView& view);
+
+    /**
+     * @brief Creates a String referring to a string literal
+     *
+     * The characters of the literal are used in place: the String needs no
+     * heap allocation for its bytes, and copying it touches no reference count.
+     * The header describing the literal is created once, on first use, and
+     * shared by all calls. Usually spelled with the _s suffix:
+     * @code
+     * using namespace simple::literals;
+     * String yes = "true"_s;  // same as String::literal<"true">()
+     * @endcode
+     *
+     * @tparam Text The string literal (UTF-8)
+     * @return A String referring to the characters of the literal
+     */
+    template<detail::FixedString Text>
+    static String literal() {
+        static const detail::StringImpl* const impl = detail::create_static(Text.chars, Text.length());
+        return String(detail::ImplRef::immortal(impl));
+    }
+
 private:
     /**
-     * @brief Private constructor for creating substrings with shared data
+     * @brief Private constructor for creating strings from an existing StringImpl
      *
      * This constructor is used internally to create substrings that share
-     * the same underlying data as the original string, avoiding unnecessary copying.
+     * the same underlying block as the original string, avoiding unnecessary copying.
      *
-     * @param data Shared pointer to the underlying string data
-     * @param offset Start offset in the data (in bytes)
-     * @param length Length of the substring (in bytes)
+     * @param impl Reference to the implementation block
      */
-    String(std::shared_ptr<const std::string> data, std::size_t offset, std::size_t length);
+    explicit String(detail::ImplRef impl);
 
-    // Implementation details are hidden using the PIMPL idiom
-    std::shared_ptr<detail::StringImpl> pimpl_;
-    
-    // Get or create UTF-16 representation
-    const std::u16string& get_utf16() const;
+    // Tag in the last byte of storage_ marking strings that are not inline
+    static constexpr unsigned char HEAP = 0xFF;
+
+    // The block of a heap string (an ImplRef), or the bytes of a string stored
+    // inline; the last byte holds the byte length of an inline string, or HEAP
+    alignas(detail::ImplRef) char storage_[INLINE_CAPACITY + 1] = {};
+
+    // Check if this string is stored inline
+    bool is_inline() const { return static_cast<unsigned char>(storage_[INLINE_CAPACITY]) != HEAP; }
+
+    // Check if a string of the given byte length is stored inline
+    static bool fits_inline(std::size_t length) { return length <= INLINE_CAPACITY; }
+
+    // Get the implementation block (null for strings stored inline)
+    const detail::ImplRef& pimpl() const;
+
+    // Get the bytes of a string stored inline
+    std::string_view inline_bytes() const {
+        return std::string_view(storage_, static_cast<unsigned char>(storage_[INLINE_CAPACITY]));
+    }
+
+    // Store bytes short enough to be inline, or a block, in place of the
+    // current contents
+    void store_inline(const char* bytes, std::size_t length);
+    void store_block(detail::ImplRef impl);
+
+    // Free the contents: the reference to the block, if not inline
+    void release_storage() noexcept;
+
+    // Create a string from a byte range of this string, sharing its data if not inline
+    String slice(std::size_t offset, std::size_t length) const;
+
+    // Create a string from a byte range of this string whose UTF-16 length is known
+    String slice(std::size_t offset, std::size_t length, std::size_t utf16_length) const;
+
+    // Create a string from a part of this string: this string itself if the part
+    // is all of it, EMPTY if it is empty, and a slice otherwise
+    String subspan(const detail::ByteSpan& span) const;
+
+    // Get the UTF-16 length if it is known without counting (UNKNOWN_COUNT otherwise)
+    std::size_t known_utf16_length() const;
+
+    // Get the block of this string, copying inline strings into a new block
+    detail::ImplRef to_block() const;
+
+    // Check if this string is a rope whose bytes have not been flattened yet
+    bool is_unflattened_rope() const;
+
+    // Depth of the rope tree of this string (0 if it is not a rope); for testing
+    std::size_t rope_depth() const;
+
+    // Take over valid UTF-8 bytes (after a BOM the policy skips) into result;
+    // returns false, leaving bytes untouched, if they have to be decoded instead
+    static bool adopt_utf8(std::vector<uint8_t>& bytes, BOMPolicy bomPolicy, String& result);
+
+    // Get the UTF-8 bytes of this string (without copying)
+    std::string_view view() const;
+
+    // Decode the UTF-16 code units of this string (not cached)
+    std::u16string get_utf16() const;
+
+    // Check if all bytes are ASCII, making UTF-16 indices byte offsets
+    bool is_ascii() const;
+
+    // Check if the string has no supplementary characters (surrogate pairs)
+    bool is_bmp() const;
+
+    // Count the UTF-16 code units and code points of the valid UTF-8 of the
+    // string, which is all getBytes() encodes as UTF-16 or UTF-32
+    detail::Utf16Counts encoded_counts() const;
+
+    // Locate the UTF-8 group holding the UTF-16 code unit at the given index
+    detail::Utf16Position locate(std::size_t index) const;
+
+    // Get the UTF-16 index of the group starting at the given byte offset
+    std::size_t index_of_byte(std::size_t byte) const;
 
     /**
      * Check if this string shares the same underlying data with another string.
@@ -710,6 +1315,15 @@ private:
     // Allow test fixtures to access private members
     friend class StringTest;
     friend class StringSharing;  // Test fixture for string sharing tests
+    friend class StringAdoptionTest;  // Test fixture for buffer adoption tests
+    friend class StringLiteralTest;  // Test fixture for string literal tests
+    friend class StringInternTest;  // Test fixture for string interning tests
+    friend class StringRopeTest;  // Test fixture for rope tests
+    friend class DecoderTest;  // Test fixture for decoder tests
+    friend struct StringEqual;  // Compares the bytes of strings with string views
+    friend class StringView;
+    friend struct detail::TextQueries;
+    friend struct detail::Rope;
 
 private:
     /**
@@ -782,4 +1396,57 @@ private:
     }
 };
 
+/**
+ * @brief Transparent hash function for Strings
+ *
+ * Hashes Strings, std::string_views and C strings alike, so unordered
+ * containers keyed by String can be probed without building a String:
+ * @code
+ * std::unordered_map<String, int, StringHash, StringEqual> counts;
+ * auto found = counts.find(std::string_view("key"));
+ * @endcode
+ */
+struct StringHash {
+    using is_transparent = void;
+
+    std::size_t operator()(const String& str) const { return str.hash_code(); }
+    std::size_t operator()(std::string_view bytes) const noexcept { return detail::hash_bytes(bytes); }
+    std::size_t operator()(const char* str) const noexcept { return detail::hash_bytes(str); }
+};
+
+/**
+ * @brief Transparent equality for Strings, std::string_views and C strings
+ * @see StringHash
+ */
+struct StringEqual {
+    using is_transparent = void;
+
+    bool operator()(const String& a, const String& b) const { return a.equals(b); }
+    bool operator()(const String& a, std::string_view b) const { return a.view() == b; }
+    bool operator()(std::string_view a, const String& b) const { return a == b.view(); }
+    bool operator()(const String& a, const char* b) const { return a.view() == b; }
+    bool operator()(const char* a, const String& b) const { return a == b.view(); }
+};
+
+namespace literals {
+
+/**
+ * @brief Creates a String referring to a string literal, without copying it
+ * @see String::literal
+ */
+template<detail::FixedString Text>
+String operator""_s() {
+    return String::literal<Text>();
+}
+
+} // namespace literals
+
 } // namespace simple
+
+/**
+ * @brief Hash support for using simple::String as a key of unordered containers
+ */
+template<>
+struct std::hash<simple::String> {
+    std::size_t operator()(const simple::String& str) const { return str.hash_code(); }
+};
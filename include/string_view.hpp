@@ -0,0 +1,230 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "string.hpp"
+
+namespace simple {
+
+/**
+ * @brief A non-owning, read-only view of UTF-8 text with the query API of String
+ *
+ * A StringView is a pointer and a byte length, plus the UTF-16 length and
+ * character classes of the text, found by the first query that needs them and
+ * remembered (views of a String or of another view take them over where known),
+ * so creating a view does not read the text. It answers the same queries as
+ * String (length(), char_at(), indexOf(), startsWith(), strip() and so on) with
+ * the same UTF-16 indices, but substring(), trim() and strip() return views of
+ * the same bytes, so inspecting text touches no reference count (except for
+ * views of a rope, which hold its flattened copy) and allocates nothing.
+ * String::fromStringView() copies the text of a view when it has to be owned.
+ *
+ * A StringView converts implicitly from String, std::string_view, std::string
+ * and C strings. Like std::string_view, it does not keep the viewed bytes alive:
+ * the String or buffer it was created from must outlive it.
+ *
+ * UTF-16 indices are mapped to byte offsets by scanning from the position of
+ * the previous lookup (or from the start, if nearer), except in ASCII text,
+ * where they are byte offsets. Walking the text forward or backward with
+ * char_at() or code_point_at() is therefore linear; use String for random
+ * access deep into long non-ASCII text, which String speeds up with its sparse
+ * index.
+ */
+class StringView {
+public:
+    /**
+     * @brief Creates an empty view
+     */
+    StringView() noexcept = default;
+
+    StringView(const StringView& other) noexcept;
+    StringView& operator=(const StringView& other) noexcept;
+
+    /**
+     * @brief Creates a view of the text of a String
+     *
+     * The view takes over the UTF-16 length and character classes the String
+     * already knows. Ropes are flattened to be viewed; the view and the views
+     * made from it keep the flattened copy alive, so String::release_caches()
+     * leaves it in place while they exist.
+     *
+     * @param str The String to view (must outlive the view)
+     */
+    StringView(const String& str);
+
+    /**
+     * @brief Creates a view of UTF-8 bytes
+     *
+     * @param bytes The bytes to view (must outlive the view)
+     */
+    StringView(std::string_view bytes) noexcept : StringView(bytes.data(), bytes.size()) {}
+
+    /**
+     * @brief Creates a view of the bytes of a std::string
+     *
+     * @param str The std::string to view (must outlive the view)
+     */
+    StringView(const std::string& str) noexcept : StringView(std::string_view(str)) {}
+
+    /**
+     * @brief Creates a view of a null-terminated UTF-8 C string
+     *
+     * @param str The C string to view (must outlive the view)
+     */
+    StringView(const char* str) noexcept : StringView(std::string_view(str)) {}
+
+    /**
+     * @brief Creates a view of UTF-8 bytes that may contain null characters
+     *
+     * @param str The first byte to view
+     * @param length The number of bytes to view
+     */
+    StringView(const char* str, std::size_t length) noexcept;
+
+    /**
+     * @brief Returns the UTF-8 bytes of the view
+     */
+    std::string_view view() const noexcept { return std::string_view(data_, size_); }
+
+    /**
+     * @brief Returns a copy of the UTF-8 bytes of the view
+     */
+    std::string to_string() const { return std::string(data_, size_); }
+
+    /**
+     * @brief Returns the length of the text in UTF-16 code units
+     * @see String::length
+     */
+    std::size_t length() const;
+
+    /**
+     * @brief Checks if the view is empty
+     */
+    bool is_empty() const noexcept { return size_ == 0; }
+
+    /**
+     * @brief Returns the UTF-16 code unit at the specified index
+     * @throws StringIndexOutOfBoundsException if the index is out of range
+     * @see String::char_at
+     */
+    Char char_at(Index index) const;
+
+    /**
+     * @brief Returns the UTF-16 code unit at the specified index
+     * @see char_at
+     */
+    Char operator[](Index index) const { return char_at(index); }
+
+    /**
+     * @brief Returns the code point starting at the specified index
+     * @throws StringIndexOutOfBoundsException if the index is out of range
+     * @see String::code_point_at
+     */
+    CodePoint code_point_at(Index index) const;
+
+    /**
+     * @brief Returns the code point ending before the specified index
+     * @throws StringIndexOutOfBoundsException if the index is out of range
+     * @see String::code_point_before
+     */
+    CodePoint code_point_before(Index index) const;
+
+    /**
+     * @brief Returns the number of code points in the specified range
+     * @throws StringIndexOutOfBoundsException if the range is invalid
+     * @see String::code_point_count
+     */
+    std::size_t code_point_count(Index begin_index, Index end_index) const;
+
+    /**
+     * @brief Compares the text with another text, byte by byte
+     */
+    bool equals(StringView other) const noexcept { return view() == other.view(); }
+
+    /**
+     * @brief Compares the text lexicographically with another text, byte by byte
+     */
+    CompareResult compare_to(StringView other) const;
+
+    /**
+     * @name Searching
+     * @brief Searches with the semantics of the String methods of the same names
+     * @{
+     */
+    Index indexOf(Char ch) const;
+    Index indexOf(Char ch, Index fromIndex) const;
+    Index indexOf(StringView str) const;
+    Index indexOf(StringView str, Index fromIndex) const;
+    Index lastIndexOf(Char ch) const;
+    Index lastIndexOf(Char ch, Index fromIndex) const;
+    Index lastIndexOf(StringView str) const;
+    Index lastIndexOf(StringView str, Index fromIndex) const;
+    bool contains(StringView str) const;
+    bool startsWith(StringView prefix) const;
+    bool startsWith(StringView prefix, Index offset) const;
+    bool endsWith(StringView suffix) const;
+    /** @} */
+
+    /**
+     * @name Slicing
+     * @brief Views of parts of the text, with the semantics of the String methods of the same names
+     * @{
+     */
+    StringView substring(Index beginIndex) const;
+    StringView substring(Index beginIndex, Index endIndex) const;
+    StringView trim() const;
+    StringView strip() const;
+    StringView stripLeading() const;
+    StringView stripTrailing() const;
+    bool isStripped() const;
+    /** @} */
+
+    /**
+     * @brief Returns the hash code of the text, equal to that of an equal String
+     */
+    std::size_t hash_code() const noexcept { return detail::hash_bytes(view()); }
+
+    bool operator==(StringView other) const noexcept { return equals(other); }
+    bool operator!=(StringView other) const noexcept { return !equals(other); }
+    bool operator< (StringView other) const noexcept { return view() <  other.view(); }
+    bool operator<=(StringView other) const noexcept { return view() <= other.view(); }
+    bool operator> (StringView other) const noexcept { return view() >  other.view(); }
+    bool operator>=(StringView other) const noexcept { return view() >= other.view(); }
+
+private:
+    // Create a view with the UTF-16 length and traits if known (UNKNOWN_COUNT and 0 otherwise)
+    StringView(const char* str, std::size_t length, std::size_t utf16_length, std::uint8_t traits) noexcept;
+
+    // Create a view of a part of this text (see String::subspan)
+    StringView subspan(const detail::ByteSpan& span) const;
+
+    // Get the Utf8Traits of the bytes, scanning them on first use
+    std::uint8_t traits() const;
+
+    bool is_ascii() const;
+    bool is_bmp() const;
+    std::size_t known_utf16_length() const { return utf16_length_.load(std::memory_order_relaxed); }
+    detail::Utf16Position locate(std::size_t index) const;
+    std::size_t index_of_byte(std::size_t byte) const;
+
+    // Get or set the position of the previous lookup
+    detail::Utf16Position cursor() const;
+    void set_cursor(const detail::Utf16Position& position) const;
+
+    friend struct detail::TextQueries;
+
+    // Utf8Traits of empty text (ASCII, BMP and known; see string.cpp)
+    static constexpr std::uint8_t EMPTY_TRAITS = 0x07;
+
+    const char* data_ = "";
+    std::size_t size_ = 0;
+    // Found on first use; any thread finding them finds the same values
+    mutable std::atomic<std::size_t> utf16_length_{0};          ///< UTF-16 length, or UNKNOWN_COUNT
+    mutable std::atomic<std::uint8_t> traits_{EMPTY_TRAITS};    ///< Utf8Traits of the bytes, or 0
+    mutable std::atomic<std::uint64_t> cursor_{0};              ///< Byte offset (high half) and UTF-16 index (low half) of the previous lookup
+    detail::ImplRef flat_;                                      ///< Flattened copy of a viewed rope, if any
+};
+
+} // namespace simple
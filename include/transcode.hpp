@@ -0,0 +1,386 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace simple {
+namespace detail {
+
+/**
+ * @brief Instruction sets the transcoding kernels are compiled for
+ *
+ * Every kernel has a portable SCALAR version. The others are compiled on x86
+ * with GCC and Clang, and used only when the CPU supports them.
+ */
+enum class SimdLevel : std::uint8_t {
+    SCALAR,  ///< Portable C++
+    SSE42,   ///< SSE4.2 (16-byte blocks)
+    AVX2,    ///< AVX2 (32-byte blocks)
+    AVX512   ///< AVX-512 F and BW, with BMI2 (64-byte blocks)
+};
+
+/**
+ * @brief Instruction set extensions of this CPU the kernels use
+ *
+ * Detected once with cpuid, and only set if the operating system also saves
+ * the registers they need.
+ */
+struct CpuFeatures {
+    bool sse42;        ///< SSE4.2
+    bool avx2;         ///< AVX2
+    bool avx512bw;     ///< AVX-512 F and BW
+    bool avx512vbmi2;  ///< AVX-512 VBMI2 (byte and word compression)
+    bool bmi2;         ///< BMI2
+};
+
+/**
+ * @brief The features of this CPU (all unset where no kernels are compiled)
+ */
+const CpuFeatures& cpu_features() noexcept;
+
+/**
+ * @brief Checks if the kernels for a level are compiled in and supported by this CPU
+ */
+bool simd_supported(SimdLevel level) noexcept;
+
+/**
+ * @brief The highest level supported by this CPU
+ */
+SimdLevel best_simd_level() noexcept;
+
+/**
+ * @brief The level of the kernels used by the functions that take no level
+ *
+ * On first use, this is the best level, or the level named by the
+ * SSTRING_SIMD_LEVEL environment variable ("scalar", "sse4.2", "avx2" or
+ * "avx512") if it is set to one of them. A level the CPU does not support is
+ * lowered to the highest one it does.
+ */
+SimdLevel active_simd_level() noexcept;
+
+/**
+ * @brief Switches the functions that take no level to the kernels of a level
+ *
+ * Meant for benchmarks and for reproducing bugs of one kernel. Calls already
+ * running finish with the kernels they started with.
+ *
+ * @return The level now active, lowered as for active_simd_level()
+ */
+SimdLevel set_simd_level(SimdLevel level) noexcept;
+
+// UTF-16 code units decoded from one UTF-8 sequence
+struct Utf16Group {
+    std::size_t bytes;   ///< Number of bytes consumed
+    std::size_t units;   ///< Number of UTF-16 code units (1, or 2 for a surrogate pair)
+    char16_t unit[2];    ///< The code units
+};
+
+// Decode the UTF-8 sequence starting at str.
+//
+// A byte that does not start a valid sequence decodes to one U+FFFD on its own.
+// The remaining bytes of an overlong, surrogate or out-of-range sequence are
+// continuation bytes, which then decode to one U+FFFD each as well, so every
+// invalid byte maps to exactly one UTF-16 code unit.
+inline Utf16Group decode_group(const unsigned char* str, const unsigned char* end) {
+    const unsigned char lead = *str;
+    if (lead < 0x80) {
+        // ASCII character
+        return {1, 1, {lead, 0}};
+    }
+    if ((lead & 0xE0) == 0xC0) {
+        // 2-byte UTF-8 sequence
+        if (end - str >= 2 && (str[1] & 0xC0) == 0x80) {
+            unsigned int codepoint = ((lead & 0x1F) << 6) | (str[1] & 0x3F);
+            if (codepoint >= 0x80) {
+                return {2, 1, {static_cast<char16_t>(codepoint), 0}};
+            }
+        }
+    } else if ((lead & 0xF0) == 0xE0) {
+        // 3-byte UTF-8 sequence
+        if (end - str >= 3 && (str[1] & 0xC0) == 0x80 && (str[2] & 0xC0) == 0x80) {
+            unsigned int codepoint = ((lead & 0x0F) << 12) | ((str[1] & 0x3F) << 6) | (str[2] & 0x3F);
+            if (codepoint >= 0x800 && (codepoint < 0xD800 || codepoint > 0xDFFF)) {
+                return {3, 1, {static_cast<char16_t>(codepoint), 0}};
+            }
+        }
+    } else if ((lead & 0xF8) == 0xF0) {
+        // 4-byte UTF-8 sequence (surrogate pair in UTF-16)
+        if (end - str >= 4 && (str[1] & 0xC0) == 0x80 && (str[2] & 0xC0) == 0x80 && (str[3] & 0xC0) == 0x80) {
+            unsigned int codepoint = ((lead & 0x07) << 18) | ((str[1] & 0x3F) << 12) |
+                                     ((str[2] & 0x3F) << 6)  | (str[3] & 0x3F);
+            if (codepoint >= 0x10000 && codepoint <= 0x10FFFF) {
+                codepoint -= 0x10000;
+                return {4, 2, {static_cast<char16_t>(0xD800 + (codepoint >> 10)),
+                               static_cast<char16_t>(0xDC00 + (codepoint & 0x3FF))}};
+            }
+        }
+    }
+    // Invalid, incomplete, overlong or out-of-range sequence
+    return {1, 1, {0xFFFD, 0}};
+}
+
+/**
+ * @brief Finds the first byte that is not part of a valid UTF-8 sequence
+ *
+ * The offset is that of the first byte decode_group() turns into U+FFFD. The
+ * vectorized versions check whole blocks with the lookup tables of Keiser and
+ * Lemire ("Validating UTF-8 In Less Than One Instruction Per Byte") and rescan
+ * only the block with the first error to find its exact offset.
+ *
+ * @return The offset of the byte, or std::string_view::npos if all bytes are valid
+ */
+std::size_t validate_utf8(const char* data, std::size_t length) noexcept;
+
+/**
+ * @brief validate_utf8() with the kernel of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+std::size_t validate_utf8(const char* data, std::size_t length, SimdLevel level) noexcept;
+
+/**
+ * @brief Decodes UTF-8 into UTF-16
+ *
+ * Each invalid byte becomes one U+FFFD, as with decode_group(), so the output
+ * has at most one code unit per input byte. The vectorized versions widen
+ * ASCII 64 bytes at a time, and decode other text in blocks of 64 bytes that
+ * the lookup tables of validate_utf8() find valid: in overlapping windows of
+ * 16 bytes with SSE4.2 and AVX2, and in halves of 32 bytes packed with
+ * vpcompressw with AVX-512 (which falls back to the AVX2 kernel on CPUs
+ * without VBMI2). Blocks with invalid bytes go through decode_group().
+ *
+ * @param out Room for at least length code units
+ * @return The number of code units written
+ */
+std::size_t utf8_to_utf16(const char* data, std::size_t length, char16_t* out) noexcept;
+
+/**
+ * @brief utf8_to_utf16() with the kernel of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+std::size_t utf8_to_utf16(const char* data, std::size_t length, char16_t* out, SimdLevel level) noexcept;
+
+// Number of UTF-16 code units and code points of UTF-8 bytes
+struct Utf16Counts {
+    std::size_t units;
+    std::size_t code_points;
+};
+
+/**
+ * @brief Counts the UTF-16 code units and code points of UTF-8
+ *
+ * Each invalid byte counts as one code unit and one code point, as it decodes
+ * to one U+FFFD with decode_group(). The vectorized versions find the invalid
+ * bytes with validate_utf8() and count the valid text between them with byte
+ * compares: one code point per byte that is not a continuation byte, and one
+ * more code unit per 4-byte lead.
+ */
+Utf16Counts count_utf16(const char* data, std::size_t length) noexcept;
+
+/**
+ * @brief count_utf16() with the kernel of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+Utf16Counts count_utf16(const char* data, std::size_t length, SimdLevel level) noexcept;
+
+inline Utf16Counts count_utf16(std::string_view bytes) noexcept {
+    return count_utf16(bytes.data(), bytes.size());
+}
+
+/**
+ * @brief Byte order of UTF-16 and UTF-32 output
+ */
+enum class ByteOrder : std::uint8_t {
+    LITTLE,  ///< Least significant byte first
+    BIG      ///< Most significant byte first
+};
+
+/**
+ * @brief Code units encode_utf16() may write past the end of its output
+ */
+constexpr std::size_t ENCODE_UTF16_SLACK = 32;
+
+/**
+ * @brief Encodes UTF-8 as UTF-16 in a byte order, skipping invalid bytes
+ *
+ * Invalid bytes are dropped, as String::getBytes() has always done. The valid
+ * text between them is decoded by the kernels of utf8_to_utf16(), which put
+ * the code units in the other byte order with the same shuffles that pack
+ * them.
+ *
+ * @param out Room for at least count_utf16().units + ENCODE_UTF16_SLACK code units
+ * @return The number of code units written
+ */
+std::size_t encode_utf16(const char* data, std::size_t length, ByteOrder order, char16_t* out) noexcept;
+
+/**
+ * @brief encode_utf16() with the kernels of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+std::size_t encode_utf16(const char* data, std::size_t length, ByteOrder order, char16_t* out,
+                         SimdLevel level) noexcept;
+
+/**
+ * @brief Counts the UTF-16 code units and code points encode_utf16() and
+ * encode_utf32() write for UTF-8
+ *
+ * Unlike count_utf16(), invalid bytes are skipped rather than counted as one
+ * code unit each. The valid text between them is counted by the kernels of
+ * count_utf16().
+ */
+Utf16Counts count_encoded_utf16(const char* data, std::size_t length) noexcept;
+
+/**
+ * @brief count_encoded_utf16() with the kernels of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+Utf16Counts count_encoded_utf16(const char* data, std::size_t length, SimdLevel level) noexcept;
+
+/**
+ * @brief Encodes UTF-8 as UTF-32 in a byte order, skipping invalid bytes
+ *
+ * The SSE4.2 and AVX2 versions decode chunks of a few kilobytes into UTF-16
+ * that stays in the L1 cache, and widen it to UTF-32 a vector at a time. The
+ * AVX-512 version decodes code points directly, 16 bytes per vector, and
+ * packs them with vpcompressd.
+ *
+ * @param out Room for at least count_utf16().code_points code points
+ * @return The number of code points written
+ */
+std::size_t encode_utf32(const char* data, std::size_t length, ByteOrder order, char32_t* out) noexcept;
+
+/**
+ * @brief encode_utf32() with the kernels of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+std::size_t encode_utf32(const char* data, std::size_t length, ByteOrder order, char32_t* out,
+                         SimdLevel level) noexcept;
+
+// Length of UTF-8 decoded from UTF-16 or UTF-32
+struct DecodedLength {
+    std::size_t bytes;    ///< Number of UTF-8 bytes
+    std::size_t invalid;  ///< Index of the first invalid code unit, or std::string_view::npos
+};
+
+/**
+ * @brief Measures the UTF-8 that decode_utf16() writes
+ *
+ * A code unit is invalid if it is a high surrogate not followed by a low
+ * surrogate, or a low surrogate not following a high one. The vectorized
+ * versions find the invalid code units with compare masks, and count the bytes
+ * of the valid ones between them with compares against 0x80 and 0x800.
+ *
+ * @param data The code units as bytes in the byte order, with no alignment required
+ * @param replace Whether invalid code units count as U+FFFD, or are skipped
+ */
+DecodedLength decoded_length_utf16(const char* data, std::size_t units, ByteOrder order, bool replace) noexcept;
+
+/**
+ * @brief decoded_length_utf16() with the kernels of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+DecodedLength decoded_length_utf16(const char* data, std::size_t units, ByteOrder order, bool replace,
+                                   SimdLevel level) noexcept;
+
+/**
+ * @brief Decodes UTF-16 in a byte order into UTF-8
+ *
+ * Each invalid code unit (see decoded_length_utf16()) becomes U+FFFD if
+ * replace is set, and is skipped otherwise. The vectorized versions pack the
+ * UTF-8 of ASCII and of code units below 0x800 from 16-bit lanes, and that of
+ * other code units from 32-bit lanes, with shuffles looked up by the lengths
+ * of the lanes with SSE4.2 and AVX2, and with vpcompressb with AVX-512 (which
+ * falls back to the AVX2 kernel on CPUs without VBMI2). Each surrogate of a
+ * pair gives two bytes of its code point.
+ *
+ * @param out Room for exactly decoded_length_utf16().bytes bytes
+ * @return The number of bytes written
+ */
+std::size_t decode_utf16(const char* data, std::size_t units, ByteOrder order, bool replace, char* out) noexcept;
+
+/**
+ * @brief decode_utf16() with the kernels of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+std::size_t decode_utf16(const char* data, std::size_t units, ByteOrder order, bool replace, char* out,
+                         SimdLevel level) noexcept;
+
+/**
+ * @brief Measures the UTF-8 that decode_utf32() writes
+ *
+ * A code point is invalid if it is a surrogate or above U+10FFFF.
+ */
+DecodedLength decoded_length_utf32(const char* data, std::size_t code_points, ByteOrder order,
+                                   bool replace) noexcept;
+
+/**
+ * @brief decoded_length_utf32() with the kernels of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+DecodedLength decoded_length_utf32(const char* data, std::size_t code_points, ByteOrder order, bool replace,
+                                   SimdLevel level) noexcept;
+
+/**
+ * @brief Decodes UTF-32 in a byte order into UTF-8
+ *
+ * Each invalid code point (see decoded_length_utf32()) becomes U+FFFD if
+ * replace is set, and is skipped otherwise. The vectorized versions narrow
+ * ASCII 16 code points at a time, and pack the UTF-8 of other code points as
+ * decode_utf16() does.
+ *
+ * @param out Room for exactly decoded_length_utf32().bytes bytes
+ * @return The number of bytes written
+ */
+std::size_t decode_utf32(const char* data, std::size_t code_points, ByteOrder order, bool replace,
+                         char* out) noexcept;
+
+/**
+ * @brief decode_utf32() with the kernels of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+std::size_t decode_utf32(const char* data, std::size_t code_points, ByteOrder order, bool replace, char* out,
+                         SimdLevel level) noexcept;
+
+/**
+ * @brief Measures the UTF-8 that decode_latin1() writes: one byte per ASCII
+ *        byte, and two per other byte
+ */
+std::size_t decoded_length_latin1(const char* data, std::size_t length) noexcept;
+
+/**
+ * @brief decoded_length_latin1() with the kernel of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+std::size_t decoded_length_latin1(const char* data, std::size_t length, SimdLevel level) noexcept;
+
+/**
+ * @brief Decodes ISO-8859-1 into UTF-8
+ *
+ * The vectorized versions copy ASCII a vector at a time, and widen other
+ * bytes to 16-bit lanes packed as decode_utf16() does.
+ *
+ * @param out Room for exactly decoded_length_latin1() bytes
+ * @return The number of bytes written
+ */
+std::size_t decode_latin1(const char* data, std::size_t length, char* out) noexcept;
+
+/**
+ * @brief decode_latin1() with the kernel of a specific level
+ *
+ * The level must be supported (see simd_supported()).
+ */
+std::size_t decode_latin1(const char* data, std::size_t length, char* out, SimdLevel level) noexcept;
+
+} // namespace detail
+} // namespace simple
@@ -0,0 +1,267 @@
+#include "../include/codec.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace simple {
+
+namespace {
+
+// Bytes from the start of a chunk that complete the pending bytes: enough to
+// end at least one more sequence after them
+constexpr std::size_t HEAD_BYTES = 8;
+
+// The length of the longest prefix of bytes that starts and ends between two
+// sequences (multi-byte sequences, code units or surrogate pairs). A decoder
+// handles every sequence on its own, so the rest can be decoded later.
+std::size_t complete_length(const uint8_t* bytes, std::size_t size, Encoding encoding) noexcept {
+    switch (encoding) {
+        case Encoding::UTF_8:
+            // A byte that is not a continuation byte always starts a sequence,
+            // so only the last one can start an incomplete one
+            for (std::size_t back = 1; back <= std::min<std::size_t>(size, 3); ++back) {
+                const uint8_t byte = bytes[size - back];
+                if ((byte & 0xC0) != 0x80) {
+                    const std::size_t length = (byte & 0xF8) == 0xF0 ? 4
+                                             : (byte & 0xF0) == 0xE0 ? 3
+                                             : (byte & 0xE0) == 0xC0 ? 2 : 1;
+                    return length > back ? size - back : size;
+                }
+            }
+            return size;
+        case Encoding::UTF_16BE:
+        case Encoding::UTF_16LE: {
+            // A high surrogate waits for the low surrogate after it
+            std::size_t length = size & ~std::size_t{1};
+            if (length >= 2 && (bytes[length - (encoding == Encoding::UTF_16BE ? 2 : 1)] & 0xFC) == 0xD8) {
+                length -= 2;
+            }
+            return length;
+        }
+        case Encoding::UTF_32BE:
+        case Encoding::UTF_32LE:
+            return size & ~std::size_t{3};
+        default:
+            return size;
+    }
+}
+
+// The exception with its offset moved by the offset of the chunk it is about
+EncodingException moved_exception(const EncodingException& e, std::size_t offset) {
+    return EncodingException(e.std::runtime_error::what(), e.getEncoding(), offset + e.getByteOffset(),
+                             e.getErrorHandling());
+}
+
+// The text decoded from the head of a chunk followed by that of its rest, as
+// one flat string: concat() would make a rope of a long rest
+String joined(const String& head, const String& rest) {
+    if (head.is_empty()) {
+        return rest;
+    }
+    if (rest.is_empty()) {
+        return head;
+    }
+    // The head is a few bytes, and the rest of a long chunk holds its bytes as
+    // a std::string already, so only the joined text is allocated
+    const std::string& rest_bytes = rest.to_string();
+    std::string text = head.toStdString();
+    text.reserve(text.size() + rest_bytes.size());
+    text += rest_bytes;
+    return String(std::move(text));
+}
+
+} // namespace
+
+Decoder::Decoder(Encoding encoding, BOMPolicy bomPolicy, EncodingErrorHandling errorHandling) noexcept
+    : encoding_(encoding),
+      bomPolicy_(bomPolicy),
+      errorHandling_(errorHandling),
+      offset_(0),
+      started_(false),
+      pendingSize_(0),
+      pending_{} {
+}
+
+String Decoder::decode(const std::vector<uint8_t>& bytes) {
+    return decode(bytes.data(), bytes.size());
+}
+
+String Decoder::decode(const uint8_t* bytes, std::size_t size) {
+    if (size == 0) {
+        return String();
+    }
+    // The BOM policy looks at up to 4 bytes at the start of the stream
+    if (!started_ && pendingSize_ + size < 4) {
+        std::memcpy(pending_ + pendingSize_, bytes, size);
+        pendingSize_ += size;
+        return String();
+    }
+    try {
+        String text;
+        if (pendingSize_ > 0) {
+            uint8_t head[PENDING_CAPACITY + HEAD_BYTES];
+            const std::size_t taken = std::min(size, HEAD_BYTES);
+            const std::size_t pending = pendingSize_;
+            std::memcpy(head, pending_, pending);
+            std::memcpy(head + pending, bytes, taken);
+            const std::size_t complete = complete_length(head, pending + taken, encoding_);
+            text = decode_complete(head, complete);
+            if (complete < pending) {
+                // The chunk is too short to complete anything after the pending bytes
+                pendingSize_ = pending + taken - complete;
+                std::memmove(pending_, head + complete, pendingSize_);
+                return text;
+            }
+            bytes += complete - pending;
+            size -= complete - pending;
+            pendingSize_ = 0;
+        }
+        // The rest of the chunk is decoded where it is
+        const std::size_t complete = complete_length(bytes, size, encoding_);
+        String rest = decode_complete(bytes, complete);
+        pendingSize_ = size - complete;
+        std::memcpy(pending_, bytes + complete, pendingSize_);
+        return joined(text, rest);
+    } catch (...) {
+        reset();
+        throw;
+    }
+}
+
+String Decoder::finish() {
+    try {
+        String text = decode_complete(pending_, pendingSize_);
+        reset();
+        return text;
+    } catch (...) {
+        reset();
+        throw;
+    }
+}
+
+void Decoder::reset() noexcept {
+    offset_ = 0;
+    started_ = false;
+    pendingSize_ = 0;
+}
+
+std::size_t Decoder::getByteOffset() const noexcept {
+    return offset_;
+}
+
+String Decoder::decode_complete(const uint8_t* bytes, std::size_t size) {
+    if (size == 0) {
+        return String();
+    }
+    // Only the start of the stream can have a BOM
+    const BOMPolicy bomPolicy = started_ ? BOMPolicy::EXCLUDE : bomPolicy_;
+    String text;
+    try {
+        text = String::fromBytes(bytes, size, encoding_, bomPolicy, errorHandling_);
+    } catch (const EncodingException& e) {
+        throw moved_exception(e, offset_);
+    }
+    offset_ += size;
+    started_ = true;
+    return text;
+}
+
+Encoder::Encoder(Encoding encoding, BOMPolicy bomPolicy, EncodingErrorHandling errorHandling) noexcept
+    : encoding_(encoding),
+      bomPolicy_(bomPolicy),
+      errorHandling_(errorHandling),
+      offset_(0),
+      started_(false),
+      pendingSize_(0),
+      pending_{} {
+}
+
+std::vector<uint8_t> Encoder::encode(std::string_view utf8) {
+    const char* text = utf8.data();
+    std::size_t size = utf8.size();
+    if (size == 0) {
+        return {};
+    }
+    try {
+        std::vector<uint8_t> out;
+        if (pendingSize_ > 0) {
+            char head[PENDING_CAPACITY + HEAD_BYTES];
+            const std::size_t taken = std::min(size, HEAD_BYTES);
+            const std::size_t pending = pendingSize_;
+            std::memcpy(head, pending_, pending);
+            std::memcpy(head + pending, text, taken);
+            const std::size_t complete = complete_length(reinterpret_cast<const uint8_t*>(head), pending + taken,
+                                                         Encoding::UTF_8);
+            encode_complete(head, complete, out);
+            if (complete < pending) {
+                pendingSize_ = pending + taken - complete;
+                std::memmove(pending_, head + complete, pendingSize_);
+                return out;
+            }
+            text += complete - pending;
+            size -= complete - pending;
+            pendingSize_ = 0;
+        }
+        const std::size_t complete = complete_length(reinterpret_cast<const uint8_t*>(text), size, Encoding::UTF_8);
+        encode_complete(text, complete, out);
+        pendingSize_ = size - complete;
+        std::memcpy(pending_, text + complete, pendingSize_);
+        return out;
+    } catch (...) {
+        reset();
+        throw;
+    }
+}
+
+std::vector<uint8_t> Encoder::finish() {
+    try {
+        std::vector<uint8_t> out;
+        encode_complete(pending_, pendingSize_, out);
+        if (!started_) {
+            // What the whole text gives when nothing else was written: a BOM,
+            // or the '?' of ISO-8859-1 with IGNORE
+            out = String().getBytes(encoding_, bomPolicy_, errorHandling_);
+        }
+        reset();
+        return out;
+    } catch (...) {
+        reset();
+        throw;
+    }
+}
+
+void Encoder::reset() noexcept {
+    offset_ = 0;
+    started_ = false;
+    pendingSize_ = 0;
+}
+
+void Encoder::encode_complete(const char* utf8, std::size_t size, std::vector<uint8_t>& out) {
+    if (size == 0) {
+        return;
+    }
+    const BOMPolicy bomPolicy = started_ ? BOMPolicy::EXCLUDE : bomPolicy_;
+    std::vector<uint8_t> bytes;
+    try {
+        bytes = String(utf8, size).getBytes(encoding_, bomPolicy, errorHandling_);
+    } catch (const EncodingException& e) {
+        throw moved_exception(e, offset_);
+    }
+    offset_ += size;
+    // getBytes() writes a lone '?' for ISO-8859-1 text that it ignores all of,
+    // which the whole text only gets if nothing else is written (see finish())
+    if (encoding_ == Encoding::ISO_8859_1 && errorHandling_ == EncodingErrorHandling::IGNORE &&
+        bytes.size() == 1 && bytes[0] == '?' && std::memchr(utf8, '?', size) == nullptr) {
+        return;
+    }
+    if (bytes.empty()) {
+        return;
+    }
+    started_ = true;
+    if (out.empty()) {
+        out = std::move(bytes);
+    } else {
+        out.insert(out.end(), bytes.begin(), bytes.end());
+    }
+}
+
+} // namespace simple
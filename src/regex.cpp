@@ -49,7 +49,7 @@ RegEx::RegEx(const String& pattern, const Flags& flags) : flags_(flags) {
     
     try {
         // Convert the String pattern to std::string for Boost.Regex
-        std::string utf8Pattern = pattern.to_string();
+        std::string utf8Pattern = pattern.toStdString();
         
         // Special handling for Unicode property patterns like \p{L}
         // Check if the pattern contains Unicode property escapes
@@ -167,7 +167,7 @@ RegEx RegEx::forExactChar(const Char& ch) {
 bool RegEx::matches(const String& input) const {
     try {
         // Convert to std::string for Boost.Regex
-        std::string utf8Input = input.to_string();
+        std::string utf8Input = input.toStdString();
         
         // Use regex_match to check if the entire string matches the pattern
         return boost::regex_match(utf8Input, pimpl_->pattern);
@@ -179,7 +179,7 @@ bool RegEx::matches(const String& input) const {
 // Test if the regex matches a region within the input string
 bool RegEx::find(const String& input) const {
     try {
-        std::string utf8Input = input.to_string();
+        std::string utf8Input = input.toStdString();
         
         // Use Boost's regex_search to find a match anywhere in the string
         boost::match_flag_type flags = boost::match_default;
@@ -194,8 +194,8 @@ bool RegEx::find(const String& input) const {
 // Replace all matches with the replacement string
 String RegEx::replaceAll(const String& input, const String& replacement) const {
     try {
-        std::string utf8Input = input.to_string();
-        std::string utf8Replacement = replacement.to_string();
+        std::string utf8Input = input.toStdString();
+        std::string utf8Replacement = replacement.toStdString();
         
         // Use Boost's regex_replace with proper UTF-8 handling
         boost::match_flag_type flags = boost::match_default | boost::format_all;
@@ -212,8 +212,8 @@ String RegEx::replaceAll(const String& input, const String& replacement) const {
 // Replace the first match with the replacement string
 String RegEx::replaceFirst(const String& input, const String& replacement) const {
     try {
-        std::string utf8Input = input.to_string();
-        std::string utf8Replacement = replacement.to_string();
+        std::string utf8Input = input.toStdString();
+        std::string utf8Replacement = replacement.toStdString();
         
         // Use boost::regex_replace with format_first_only flag
         std::string result = boost::regex_replace(utf8Input, pimpl_->pattern, utf8Replacement, 
@@ -233,7 +233,7 @@ std::vector<String> RegEx::split(const String& input) const {
 std::vector<String> RegEx::split(const String& input, int limit) const {
     try {
         std::vector<String> result;
-        std::string utf8Input = input.to_string();
+        std::string utf8Input = input.toStdString();
         
         // If the input is empty, return a vector with one empty string
         if (utf8Input.empty()) {
@@ -358,7 +358,7 @@ std::vector<String> RegEx::split(const String& input, int limit) const {
 
 // Escape regex metacharacters in a string
 String RegEx::escapeRegexMetacharacters(const String& str) {
-    std::string utf8Str = str.to_string();
+    std::string utf8Str = str.toStdString();
     std::string escaped;
     escaped.reserve(utf8Str.size() * 2); // Reserve space for potential escaping
     
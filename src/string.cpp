@@ -1,1226 +1,2677 @@
 #include "../include/string.hpp"
+#include "../include/string_view.hpp"
+#include "../include/transcode.hpp"
 #include <boost/locale/encoding.hpp>
 #include <boost/locale.hpp>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
 #include <cmath>
+#include <cstring>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace simple {
 
+using namespace literals;
+
 namespace detail {
 
 // Implementation of the init_locale function that was moved from the header
 void init_locale() {
-    static bool initialized = false;
-    if (!initialized) {
+    // Function-local static initialization is thread-safe
+    static const bool initialized = [] {
         boost::locale::generator gen;
         std::locale::global(gen("en_US.UTF-8"));
-        initialized = true;
-    }
+        return true;
+    }();
+    (void)initialized;
 }
 
-// Implementation of StringImpl class to hide Boost implementation details
-class StringImpl {
-public:
-    // Default constructor
-    StringImpl() 
-        : data_(std::make_shared<const std::string>(""))
-        , offset_(0)
-        , length_(0)
-        , utf16_cache_() {}
-
-    // Constructor from string
-    explicit StringImpl(const std::string& str)
-        : data_(std::make_shared<const std::string>(str))
-        , offset_(0)
-        , length_(str.length())
-        , utf16_cache_() {}
-
-    // Constructor from C string with explicit length
-    StringImpl(const char* str, std::size_t length)
-        : data_(std::make_shared<const std::string>(str, length))
-        , offset_(0)
-        , length_(length)
-        , utf16_cache_() {}
-
-    // Constructor for substrings
-    StringImpl(std::shared_ptr<const std::string> data, std::size_t offset, std::size_t length)
-        : data_(std::move(data))
-        , offset_(offset)
-        , length_(length)
-        , utf16_cache_() {}
-
-    // Getters
-    const std::shared_ptr<const std::string>& data() const { return data_; }
-    std::size_t offset() const { return offset_; }
-    std::size_t length() const { return length_; }
-    const std::shared_ptr<const std::u16string>& utf16_cache() const { return utf16_cache_; }
-
-    // Set the UTF-16 cache
-    void set_utf16_cache(std::shared_ptr<const std::u16string> cache) const {
-        utf16_cache_ = std::move(cache);
-    }
-
-    // Check if this impl shares the same underlying data with another impl
-    bool shares_data_with(const StringImpl& other) const {
-        return data_ == other.data_;
-    }
-
-private:
-    std::shared_ptr<const std::string> data_;  ///< Immutable UTF-8 string storage shared between instances
-    std::size_t offset_{0};                    ///< Start offset in data_ (in bytes)
-    std::size_t length_{0};                    ///< Length of this substring (in bytes)
-    mutable std::shared_ptr<const std::u16string> utf16_cache_;  ///< Cached UTF-16 representation
-};
-
-} // namespace detail
+// wyhash (final version 4) of a run of bytes, read in little-endian order
+namespace wyhash {
+
+constexpr std::uint64_t SECRET[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                                     0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+// 128-bit product of a and b, low half in a and high half in b
+inline void mum(std::uint64_t& a, std::uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    a = static_cast<std::uint64_t>(product);
+    b = static_cast<std::uint64_t>(product >> 64);
+#else
+    const std::uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<std::uint32_t>(a),
+                        lb = static_cast<std::uint32_t>(b);
+    const std::uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const std::uint64_t t = rl + (rm0 << 32);
+    std::uint64_t carry = t < rl;
+    const std::uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    a = lo;
+    b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
 
-// String class constructors
-String::String() : pimpl_(std::make_shared<detail::StringImpl>()) {}
+inline std::uint64_t mix(std::uint64_t a, std::uint64_t b) {
+    mum(a, b);
+    return a ^ b;
+}
 
-String::String(const std::string& str) : pimpl_(std::make_shared<detail::StringImpl>(str)) {}
+inline std::uint64_t read8(const unsigned char* p) {
+    std::uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
 
-String::String(const char* str, std::size_t length) : pimpl_(std::make_shared<detail::StringImpl>(str, length)) {}
+inline std::uint64_t read4(const unsigned char* p) {
+    std::uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
 
-String::String(std::shared_ptr<const std::string> data, std::size_t offset, std::size_t length)
-    : pimpl_(std::make_shared<detail::StringImpl>(std::move(data), offset, length)) {}
+// 1 to 3 bytes
+inline std::uint64_t read3(const unsigned char* p, std::size_t k) {
+    return (std::uint64_t(p[0]) << 16) | (std::uint64_t(p[k >> 1]) << 8) | p[k - 1];
+}
 
-auto String::char_at(Index index) const -> Char {
-    const auto& utf16 = get_utf16();
-    if (index.value() >= utf16.length()) {
-        throw StringIndexOutOfBoundsException("Index out of bounds");
+inline std::uint64_t hash(const unsigned char* p, std::size_t length, std::uint64_t seed) {
+    seed ^= mix(seed ^ SECRET[0], SECRET[1]);
+    std::uint64_t a, b;
+    if (length <= 16) {
+        if (length >= 4) {
+            const std::size_t shift = (length >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + shift);
+            b = (read4(p + length - 4) << 32) | read4(p + length - 4 - shift);
+        } else if (length > 0) {
+            a = read3(p, length);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        std::size_t i = length;
+        if (i > 48) {
+            std::uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mix(read8(p) ^ SECRET[1], read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ SECRET[2], read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ SECRET[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read8(p) ^ SECRET[1], read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
     }
-    return Char(utf16[index.value()]);
+    a ^= SECRET[1];
+    b ^= seed;
+    mum(a, b);
+    return mix(a ^ SECRET[0] ^ length, b ^ SECRET[1]);
 }
 
-auto String::char_value(Index index) const -> char16_t {
-    return char_at(index).value();
-}
+} // namespace wyhash
 
-// Implementation of valueOf methods for primitive types
-String String::valueOf(bool b) {
-    return b ? String("true") : String("false");
+std::size_t hash_bytes(std::string_view bytes) noexcept {
+    return static_cast<std::size_t>(
+        wyhash::hash(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size(), 0));
 }
 
-String String::valueOf(char c) {
-    return String(std::string(1, c));
-}
+// Character classes of a run of UTF-8 bytes
+enum Utf8Traits : std::uint8_t {
+    TRAITS_KNOWN = 1,  ///< The other flags have been computed
+    TRAITS_ASCII = 2,  ///< All bytes are ASCII, so UTF-16 indices are byte offsets
+    TRAITS_BMP = 4,    ///< No byte starts a 4-byte sequence, so there are no surrogate pairs
+};
 
-String String::valueOf(int i) {
-    return String(std::to_string(i));
+// Scan UTF-8 bytes for their traits, 64 bytes at a time where SSE2 is available
+inline std::uint8_t scan_utf8_traits(const char* data, std::size_t length) {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    unsigned int high_bits = 0;  // Non-zero if a byte has its high bit set
+    bool four_byte_lead = false; // Set if a byte is 0xF0 or above
+#if defined(__SSE2__)
+    const __m128i lead_threshold = _mm_set1_epi8(static_cast<char>(0xF0));
+    while (end - str >= 64 && !four_byte_lead) {
+        __m128i any = _mm_setzero_si128();
+        __m128i leads = _mm_setzero_si128();
+        for (int i = 0; i < 4; ++i) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + 16 * i));
+            any = _mm_or_si128(any, chunk);
+            // Unsigned chunk >= 0xF0 exactly where max(chunk, 0xF0) == chunk
+            leads = _mm_or_si128(leads, _mm_cmpeq_epi8(_mm_max_epu8(chunk, lead_threshold), chunk));
+        }
+        high_bits |= static_cast<unsigned int>(_mm_movemask_epi8(any));
+        four_byte_lead = _mm_movemask_epi8(leads) != 0;
+        str += 64;
+    }
+#endif
+    // Remaining bytes (all of them without SSE2)
+    for (; str < end && !four_byte_lead; ++str) {
+        high_bits |= *str & 0x80;
+        four_byte_lead = *str >= 0xF0;
+    }
+    std::uint8_t traits = TRAITS_KNOWN;
+    if (!four_byte_lead) {
+        traits |= TRAITS_BMP;
+        if (high_bits == 0) {
+            traits |= TRAITS_ASCII;
+        }
+    }
+    return traits;
 }
 
-String String::valueOf(long l) {
-    return String(std::to_string(l));
+// Decode the group starting at the given byte offset
+inline Utf16Group group_at(std::string_view bytes, std::size_t byte) {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(bytes.data());
+    return decode_group(str + byte, str + bytes.size());
 }
 
-String String::valueOf(float f) {
-    if (std::isnan(f)) {
-        return String("NaN");
-    } else if (std::isinf(f)) {
-        return f > 0 ? String("Infinity") : String("-Infinity");
+// Find the start of the group ending at byte offset end (which must be a group boundary)
+inline std::size_t last_group_start(std::string_view bytes, std::size_t end) {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(bytes.data());
+    // A group is a lead byte followed by at most three continuation bytes
+    std::size_t start = end - 1;
+    while (start > 0 && end - start < 4 && (str[start] & 0xC0) == 0x80) {
+        --start;
     }
-    return String(std::to_string(f));
+    if (start + decode_group(str + start, str + end).bytes == end) {
+        return start;
+    }
+    // The last byte is a stray continuation byte
+    return end - 1;
 }
 
-String String::valueOf(double d) {
-    if (std::isnan(d)) {
-        return String("NaN");
-    } else if (std::isinf(d)) {
-        return d > 0 ? String("Infinity") : String("-Infinity");
+// Scan forward from a group boundary to the group holding the given code unit.
+// Returns {size, length} if the unit is past the end.
+inline Utf16Position scan_to_unit(std::string_view bytes, Utf16Position from, std::size_t unit) {
+    const unsigned char* begin = reinterpret_cast<const unsigned char*>(bytes.data());
+    const unsigned char* end = begin + bytes.size();
+    const unsigned char* str = begin + from.byte;
+    std::size_t current = from.unit;
+    while (str < end) {
+        const Utf16Group group = decode_group(str, end);
+        if (current + group.units > unit) {
+            break;
+        }
+        str += group.bytes;
+        current += group.units;
     }
-    return String(std::to_string(d));
+    return {static_cast<std::size_t>(str - begin), current};
 }
 
-// Implementation of methods moved from header
-std::size_t String::length() const {
-    // Initialize locale if needed
-    detail::init_locale();
-    
-    // Use cached UTF-16 representation if available
-    if (pimpl_->utf16_cache()) {
-        return pimpl_->utf16_cache()->length();
+// Scan back from a group boundary to the group holding the given code unit,
+// which must lie before the boundary
+inline Utf16Position scan_back_to_unit(std::string_view bytes, Utf16Position from, std::size_t unit) {
+    while (from.unit > unit) {
+        const std::size_t start = last_group_start(bytes, from.byte);
+        from = {start, from.unit - group_at(bytes, start).units};
     }
-    
-    // Otherwise count UTF-16 code units from UTF-8, considering offset and length
-    if (pimpl_->length() == 0) {
-        return 0;
-    }
-    
-    // Create a substring view for counting
-    std::string_view view(pimpl_->data()->c_str() + pimpl_->offset(), pimpl_->length());
-    return detail::count_utf16_code_units(std::string(view));
+    return from;
 }
 
-bool String::is_empty() const {
-    return pimpl_->length() == 0;
+// Scan forward from a group boundary to the group starting at the given byte offset
+inline std::size_t scan_to_byte(std::string_view bytes, Utf16Position from, std::size_t byte) {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(bytes.data());
+    const unsigned char* target = str + byte;
+    const unsigned char* end = str + bytes.size();
+    std::size_t unit = from.unit;
+    for (str += from.byte; str < target; ) {
+        const Utf16Group group = decode_group(str, end);
+        str += group.bytes;
+        unit += group.units;
+    }
+    return unit;
 }
 
-bool String::equals(const String& other) const {
-    // Fast path: check if strings share data and have same offset/length
-    if (shares_data_with(other) && 
-        pimpl_->offset() == other.pimpl_->offset() && 
-        pimpl_->length() == other.pimpl_->length()) {
-        return true;
+// Counters of the heap memory held by String blocks and their caches (see
+// String::memory_stats). Each thread updates its own stripe with relaxed
+// atomics, so counting does not make threads contend for a cache line; reads
+// add up the stripes. A stripe may go below zero when a block is freed by
+// another thread than the one that created it, which the sum cancels out.
+class MemoryCounters {
+public:
+    enum Counter : std::size_t {
+        LIVE_BLOCKS,
+        BLOCK_BYTES,
+        LIVE_CACHES,
+        CACHE_BYTES,
+        CACHE_BUILDS,
+        COUNTERS
+    };
+
+    static void add(Counter counter, std::size_t amount) {
+        stripe().values[counter].fetch_add(amount, std::memory_order_relaxed);
     }
-    
-    // Otherwise do a byte-by-byte comparison of the substrings
-    // This is more efficient than creating full string copies with to_string()
-    const char* this_data = pimpl_->data()->c_str() + pimpl_->offset();
-    const char* other_data = other.pimpl_->data()->c_str() + other.pimpl_->offset();
-    std::size_t min_length = std::min(pimpl_->length(), other.pimpl_->length());
-    
-    // First check if lengths are different
-    if (pimpl_->length() != other.pimpl_->length()) {
-        return false;
+
+    static void subtract(Counter counter, std::size_t amount) {
+        stripe().values[counter].fetch_sub(amount, std::memory_order_relaxed);
     }
-    
-    // Compare bytes until we find a difference or reach the end
-    for (std::size_t i = 0; i < min_length; ++i) {
-        if (this_data[i] != other_data[i]) {
-            return false;
+
+    static std::size_t total(Counter counter) {
+        std::size_t total = 0;
+        for (const Stripe& stripe : stripes_) {
+            total += stripe.values[counter].load(std::memory_order_relaxed);
         }
+        return total;
     }
-    
-    return true;
-}
 
-simple::CompareResult String::compare_to(const String& other) const {
-    // Fast path: check if strings share data and have same offset/length
-    if (shares_data_with(other) && 
-        pimpl_->offset() == other.pimpl_->offset() && 
-        pimpl_->length() == other.pimpl_->length()) {
-        return simple::CompareResult::EQUAL;
+private:
+    static constexpr std::size_t STRIPES = 16;
+
+    struct alignas(64) Stripe {
+        std::atomic<std::size_t> values[COUNTERS] = {};
+    };
+
+    static Stripe& stripe() {
+        static std::atomic<std::size_t> next{0};
+        thread_local Stripe& mine = stripes_[next.fetch_add(1, std::memory_order_relaxed) % STRIPES];
+        return mine;
     }
-    
-    // Otherwise compare the actual substrings
-    std::string this_str = to_string();
-    std::string other_str = other.to_string();
-    int result = detail::compare_utf8_strings(this_str, other_str);
-    if (result < 0) return simple::CompareResult::LESS;
-    if (result > 0) return simple::CompareResult::GREATER;
-    return simple::CompareResult::EQUAL;
-}
 
-Char String::operator[](Index index) const { 
-    return char_at(index); 
+    static Stripe stripes_[STRIPES];
+};
+
+MemoryCounters::Stripe MemoryCounters::stripes_[MemoryCounters::STRIPES];
+
+// Heap bytes of a std::string beyond its object (none for short strings stored in place)
+inline std::size_t heap_bytes(const std::string& str) {
+    static const std::size_t in_place = std::string().capacity();
+    return str.capacity() > in_place ? str.capacity() + 1 : 0;
 }
 
-simple::CodePoint String::code_point_at(Index index) const {
-    const auto& utf16 = get_utf16();
-    if (index.value() >= utf16.length()) {
-        throw StringIndexOutOfBoundsException("Index out of bounds");
-    }
-    char16_t first = utf16[index.value()];
-    if (first >= 0xD800 && first <= 0xDBFF && index.value() + 1 < utf16.length()) {
-        char16_t second = utf16[index.value() + 1];
-        if (second >= 0xDC00 && second <= 0xDFFF) {
-            return CodePoint(0x10000 + ((first - 0xD800) << 10) + (second - 0xDC00));
+// Sparse index from UTF-16 indices to UTF-8 byte offsets
+//
+// Checkpoint k is the position of the group holding code unit k * STRIDE, so a
+// lookup decodes at most STRIDE code units. Checkpoints are only added as far
+// as lookups reach. Published checkpoints are read without locking; adding
+// checkpoints is serialized by a mutex.
+class Utf16Index {
+public:
+    static constexpr std::size_t STRIDE = 64;   ///< UTF-16 code units between checkpoints
+    static constexpr std::size_t CHUNK = 256;   ///< Checkpoints per storage chunk
+
+    explicit Utf16Index(std::string_view bytes)
+        : bytes_(bytes)
+        , chunk_count_((bytes.size() / STRIDE + 1) / CHUNK + 1)
+        , chunks_(new std::atomic<Utf16Position*>[chunk_count_]) {
+        for (std::size_t i = 0; i < chunk_count_; ++i) {
+            chunks_[i].store(nullptr, std::memory_order_relaxed);
         }
+        MemoryCounters::add(MemoryCounters::LIVE_CACHES, 1);
+        MemoryCounters::add(MemoryCounters::CACHE_BUILDS, 1);
+        MemoryCounters::add(MemoryCounters::CACHE_BYTES, memory());
     }
-    return CodePoint(first);
-}
 
-simple::CodePoint String::code_point_before(Index index) const {
-    const auto& utf16 = get_utf16();
-    if (index.value() == 0 || index.value() > utf16.length()) {
-        throw StringIndexOutOfBoundsException("Index out of bounds");
+    ~Utf16Index() {
+        MemoryCounters::subtract(MemoryCounters::LIVE_CACHES, 1);
+        MemoryCounters::subtract(MemoryCounters::CACHE_BYTES, memory());
+        for (std::size_t i = 0; i < chunk_count_; ++i) {
+            delete[] chunks_[i].load(std::memory_order_relaxed);
+        }
+        delete[] chunks_;
     }
-    char16_t second = utf16[index.value() - 1];
-    if (second >= 0xDC00 && second <= 0xDFFF && index.value() >= 2) {
-        char16_t first = utf16[index.value() - 2];
-        if (first >= 0xD800 && first <= 0xDBFF) {
-            return CodePoint(0x10000 + ((first - 0xD800) << 10) + (second - 0xDC00));
+
+    Utf16Index(const Utf16Index&) = delete;
+    Utf16Index& operator=(const Utf16Index&) = delete;
+
+    // Locate the group holding the given code unit ({size, length} past the end)
+    Utf16Position locate(std::size_t unit) const {
+        const std::size_t checkpoint = unit / STRIDE;
+        // Once the length is known every checkpoint has been published, so a
+        // unit past them is past the end and no lock is needed
+        const bool complete = length_.load(std::memory_order_acquire) != UNKNOWN_COUNT;
+        if (checkpoint >= built_.load(std::memory_order_acquire) && (complete || !extend_to_unit(unit))) {
+            return {bytes_.size(), length_.load(std::memory_order_acquire)};
         }
+        return scan_to_unit(bytes_, at(checkpoint), unit);
     }
-    return CodePoint(second);
-}
 
-std::size_t String::code_point_count(Index begin_index, Index end_index) const {
-    const auto& utf16 = get_utf16();
-    if (begin_index.value() > end_index.value() || end_index.value() > utf16.length()) {
-        throw StringIndexOutOfBoundsException("Invalid range");
-    }
-    std::size_t count = 0;
-    for (std::size_t i = begin_index.value(); i < end_index.value(); ++i) {
-        char16_t ch = utf16[i];
-        if (ch >= 0xD800 && ch <= 0xDBFF && i + 1 < end_index.value()) {
-            char16_t next = utf16[i + 1];
-            if (next >= 0xDC00 && next <= 0xDFFF) {
-                ++i;  // Skip low surrogate
+    // Get the UTF-16 index of the group starting at the given byte offset
+    std::size_t index_of_byte(std::size_t byte) const {
+        // A complete index has every checkpoint, so bytes past the last one
+        // (in the final stride) need no lock either
+        const bool complete = length_.load(std::memory_order_acquire) != UNKNOWN_COUNT;
+        std::size_t built = built_.load(std::memory_order_acquire);
+        if (!complete && (built == 0 || at(built - 1).byte < byte)) {
+            built = extend_to_byte(byte);
+        }
+        // Binary search for the last checkpoint at or before the byte
+        std::size_t low = 0;
+        std::size_t high = built;
+        while (high - low > 1) {
+            const std::size_t middle = low + (high - low) / 2;
+            if (at(middle).byte <= byte) {
+                low = middle;
+            } else {
+                high = middle;
             }
         }
-        ++count;
+        return scan_to_byte(bytes_, at(low), byte);
     }
-    return count;
-}
 
-const std::string& String::to_string() const { 
-    if (pimpl_->offset() == 0 && pimpl_->length() == pimpl_->data()->length()) {
-        return *pimpl_->data();  // Return reference to original for full strings
+    // Get the UTF-16 length if the index has reached the end (UNKNOWN_COUNT otherwise)
+    std::size_t known_length() const {
+        return length_.load(std::memory_order_acquire);
     }
-    // For substrings, create a new string with just the substring portion
-    static thread_local std::string result;
-    result = pimpl_->data()->substr(pimpl_->offset(), pimpl_->length());
-    return result;
-}
 
-String String::substring(Index beginIndex) const {
-    const auto len = length();
-    // Check if beginIndex is out of bounds
-    if (beginIndex.value() > len) {
-        throw StringIndexOutOfBoundsException("beginIndex is out of bounds");
+    // Add the checkpoints up to the end of the bytes
+    void build() const {
+        extend_to_unit(UNKNOWN_COUNT);
     }
-    return substring(beginIndex, Index(len));
-}
 
-String String::substring(Index beginIndex, Index endIndex) const {
-    // Validate indices
-    const auto& utf16 = get_utf16();
-    const auto len = utf16.length();
-    
-    // Check for out of bounds conditions with more specific error messages
-    if (beginIndex.value() > len) {
-        throw StringIndexOutOfBoundsException("beginIndex is out of bounds");
-    }
-    if (endIndex.value() > len) {
-        throw StringIndexOutOfBoundsException("endIndex is out of bounds");
+    // Heap bytes of the index, growing as checkpoints are added
+    std::size_t memory() const {
+        const std::size_t chunks = (built_.load(std::memory_order_acquire) + CHUNK - 1) / CHUNK;
+        return sizeof(Utf16Index) + chunk_count_ * sizeof(chunks_[0]) + chunks * CHUNK * sizeof(Utf16Position);
     }
-    if (beginIndex.value() > endIndex.value()) {
-        throw StringIndexOutOfBoundsException("beginIndex cannot be larger than endIndex");
-    }
-    
-    // If we're requesting the entire string, return this
-    if (beginIndex == 0 && endIndex == utf16.length()) {
-        return *this;
+
+private:
+    const Utf16Position& at(std::size_t checkpoint) const {
+        return chunks_[checkpoint / CHUNK].load(std::memory_order_relaxed)[checkpoint % CHUNK];
     }
-    
-    // If empty substring, return empty string
-    if (beginIndex == endIndex) {
-        return String("");
+
+    // Add checkpoints up to the one for the given unit; returns false if it is past the end
+    bool extend_to_unit(std::size_t unit) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!complete_ && built_.load(std::memory_order_relaxed) <= unit / STRIDE) {
+            add_checkpoint();
+        }
+        return built_.load(std::memory_order_relaxed) > unit / STRIDE;
     }
-    
-    // Convert UTF-16 indices to UTF-8 byte offsets
-    // We need to find the UTF-8 byte offsets that correspond to the UTF-16 indices
-    std::size_t utf8_begin = 0;
-    std::size_t utf8_end = 0;
-    
-    // Find the UTF-8 byte offset for beginIndex
-    if (beginIndex > 0) {
-        const unsigned char* str = reinterpret_cast<const unsigned char*>(pimpl_->data()->c_str() + pimpl_->offset());
-        const unsigned char* end = str + pimpl_->length();
-        std::size_t utf16_index = 0;
-        
-        while (str < end && utf16_index < beginIndex.value()) {
-            if (*str < 0x80) {
-                // ASCII character (1 byte in UTF-8, 1 unit in UTF-16)
-                str++;
-                utf16_index++;
-            } else if ((*str & 0xE0) == 0xC0) {
-                // 2-byte UTF-8 sequence
-                if (str + 1 >= end || (str[1] & 0xC0) != 0x80) {
-                    // Invalid sequence, treat as 1 byte
-                    str++;
-                    utf16_index++;
-                    continue;
-                }
-                str += 2;
-                utf16_index++;
-            } else if ((*str & 0xF0) == 0xE0) {
-                // 3-byte UTF-8 sequence
-                if (str + 2 >= end || (str[1] & 0xC0) != 0x80 || (str[2] & 0xC0) != 0x80) {
-                    // Invalid sequence, treat as 1 byte
-                    str++;
-                    utf16_index++;
-                    continue;
-                }
-                str += 3;
-                utf16_index++;
-            } else if ((*str & 0xF8) == 0xF0) {
-                // 4-byte UTF-8 sequence (surrogate pair in UTF-16)
-                if (str + 3 >= end || (str[1] & 0xC0) != 0x80 || 
-                    (str[2] & 0xC0) != 0x80 || (str[3] & 0xC0) != 0x80) {
-                    // Invalid sequence, treat as 1 byte
-                    str++;
-                    utf16_index++;
-                    continue;
-                }
-                str += 4;
-                utf16_index += 2;  // Surrogate pair counts as 2 UTF-16 code units
-            } else {
-                // Invalid UTF-8 byte
-                str++;
-                utf16_index++;
+
+    // Add checkpoints until one lies beyond the given byte; returns the checkpoint count
+    std::size_t extend_to_byte(std::size_t byte) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::size_t built = built_.load(std::memory_order_relaxed);
+        while (!complete_ && (built == 0 || at(built - 1).byte < byte)) {
+            add_checkpoint();
+            built = built_.load(std::memory_order_relaxed);
+        }
+        return built;
+    }
+
+    // Record the next checkpoint, noting the UTF-16 length once the end is
+    // reached. The length is published after the last checkpoint, so readers
+    // that see it see all of them.
+    void add_checkpoint() const {
+        const std::size_t count = built_.load(std::memory_order_relaxed);
+        const Utf16Position position = scan_to_unit(bytes_, cursor_, count * STRIDE);
+        if (position.byte == bytes_.size()) {
+            complete_ = true;
+            if (position.unit >= count * STRIDE) {
+                publish(count, position);
             }
+            length_.store(position.unit, std::memory_order_release);
+            return;
         }
-        
-        utf8_begin = str - reinterpret_cast<const unsigned char*>(pimpl_->data()->c_str() + pimpl_->offset());
+        publish(count, position);
     }
-    
-    // Find the UTF-8 byte offset for endIndex
-    if (endIndex > 0) {
-        const unsigned char* str = reinterpret_cast<const unsigned char*>(pimpl_->data()->c_str() + pimpl_->offset());
-        const unsigned char* end = str + pimpl_->length();
-        std::size_t utf16_index = 0;
-        
-        while (str < end && utf16_index < endIndex.value()) {
-            if (*str < 0x80) {
-                // ASCII character (1 byte in UTF-8, 1 unit in UTF-16)
-                str++;
-                utf16_index++;
-            } else if ((*str & 0xE0) == 0xC0) {
-                // 2-byte UTF-8 sequence
-                if (str + 1 >= end || (str[1] & 0xC0) != 0x80) {
-                    // Invalid sequence, treat as 1 byte
-                    str++;
-                    utf16_index++;
-                    continue;
-                }
-                str += 2;
-                utf16_index++;
-            } else if ((*str & 0xF0) == 0xE0) {
-                // 3-byte UTF-8 sequence
-                if (str + 2 >= end || (str[1] & 0xC0) != 0x80 || (str[2] & 0xC0) != 0x80) {
-                    // Invalid sequence, treat as 1 byte
-                    str++;
-                    utf16_index++;
-                    continue;
-                }
-                str += 3;
-                utf16_index++;
-            } else if ((*str & 0xF8) == 0xF0) {
-                // 4-byte UTF-8 sequence (surrogate pair in UTF-16)
-                if (str + 3 >= end || (str[1] & 0xC0) != 0x80 || 
-                    (str[2] & 0xC0) != 0x80 || (str[3] & 0xC0) != 0x80) {
-                    // Invalid sequence, treat as 1 byte
-                    str++;
-                    utf16_index++;
-                    continue;
-                }
-                str += 4;
-                utf16_index += 2;  // Surrogate pair counts as 2 UTF-16 code units
-            } else {
-                // Invalid UTF-8 byte
-                str++;
-                utf16_index++;
-            }
+
+    // Store a checkpoint and make it visible to lookups
+    void publish(std::size_t count, const Utf16Position& position) const {
+        Utf16Position* chunk = chunks_[count / CHUNK].load(std::memory_order_relaxed);
+        if (!chunk) {
+            chunk = new Utf16Position[CHUNK];
+            chunks_[count / CHUNK].store(chunk, std::memory_order_relaxed);
+            MemoryCounters::add(MemoryCounters::CACHE_BYTES, CHUNK * sizeof(Utf16Position));
         }
-        
-        utf8_end = str - reinterpret_cast<const unsigned char*>(pimpl_->data()->c_str() + pimpl_->offset());
+        chunk[count % CHUNK] = position;
+        cursor_ = position;
+        built_.store(count + 1, std::memory_order_release);
+    }
+
+    std::string_view bytes_;                          ///< Bytes being indexed
+    std::size_t chunk_count_;                         ///< Size of the chunk table
+    std::atomic<Utf16Position*>* chunks_;             ///< Checkpoint storage, allocated by chunk
+    mutable std::atomic<std::size_t> built_{0};       ///< Number of published checkpoints
+    mutable std::atomic<std::size_t> length_{UNKNOWN_COUNT}; ///< UTF-16 length once known
+    mutable std::mutex mutex_;                        ///< Serializes adding checkpoints
+    mutable Utf16Position cursor_{0, 0};              ///< Last checkpoint (guarded by mutex_)
+    mutable bool complete_ = false;                   ///< End reached (guarded by mutex_)
+};
+
+// Children of a rope block, following its header (see Rope)
+struct RopeNode {
+    ImplRef left;
+    ImplRef right;
+    std::size_t depth;                                    ///< Longest path down to a leaf
+    mutable std::atomic<const StringImpl*> flat{nullptr}; ///< Copy of the bytes, made on first use
+};
+
+// Implementation of StringImpl class to hide Boost implementation details
+//
+// A StringImpl is a single heap block: the intrusive reference count and the
+// offset/length header are followed directly by the UTF-8 bytes. Substrings are
+// small header-only blocks that keep the block owning the bytes alive and point
+// into it. Buffers handed over by rvalue are adopted instead: the header is
+// followed by the std::string or byte vector that owns the bytes. Ropes are
+// followed by their two children and have no bytes of their own until they are
+// flattened into a separate block.
+class StringImpl {
+public:
+    // What follows the header of a block
+    enum class Storage : std::uint8_t {
+        BYTES,   ///< The bytes themselves (or nothing, for substrings)
+        STRING,  ///< An adopted std::string
+        VECTOR,  ///< An adopted std::vector<uint8_t>
+        STATIC,  ///< Nothing: the bytes are in static storage and the block is never released
+        ROPE,    ///< A RopeNode: the block concatenates its two children
+    };
+
+    // Create a block holding a copy of the given bytes, allocated from resource
+    // (nullptr for the global heap), with their UTF-16 length if the caller
+    // knows it (UNKNOWN_COUNT otherwise)
+    static const StringImpl* create(const char* str, std::size_t length, std::pmr::memory_resource* resource,
+                                    std::size_t utf16_length = UNKNOWN_COUNT) {
+        void* memory = allocate(resource, sizeof(StringImpl) + length + 1);
+        char* bytes = static_cast<char*>(memory) + sizeof(StringImpl);
+        if (length > 0) {
+            std::memcpy(bytes, str, length);
+        }
+        bytes[length] = '\0';
+        auto* impl = new (memory) StringImpl(bytes, length, nullptr, scan_utf8_traits(bytes, length), resource);
+        impl->utf16_length_.store(utf16_length, std::memory_order_relaxed);
+        return impl;
+    }
+
+    // Create a block viewing bytes in static storage, without copying them.
+    // Such blocks are never released (handles to them are immortal).
+    static const StringImpl* create_static(const char* data, std::size_t length) {
+        void* memory = ::operator new(sizeof(StringImpl));
+        return new (memory) StringImpl(data, length, nullptr, scan_utf8_traits(data, length), nullptr,
+                                       Storage::STATIC);
+    }
+
+    // Create a block taking over a std::string, without copying its bytes
+    static const StringImpl* adopt(std::string&& str, std::pmr::memory_resource* resource) {
+        return adopt_buffer(std::move(str), 0, Storage::STRING, resource);
+    }
+
+    // Create a block taking over a byte vector, viewing its bytes from offset on
+    static const StringImpl* adopt(std::vector<uint8_t>&& bytes, std::size_t offset,
+                                   std::pmr::memory_resource* resource) {
+        return adopt_buffer(std::move(bytes), offset, Storage::VECTOR, resource);
+    }
+
+    // Create a rope block concatenating two non-empty blocks, allocated from
+    // resource. The caller makes sure no UTF-8 sequence spans the two (see Rope).
+    static const StringImpl* create_rope(ImplRef left, ImplRef right, std::pmr::memory_resource* resource) {
+        static_assert(sizeof(StringImpl) % alignof(RopeNode) == 0, "rope node must be aligned");
+        const std::size_t length = left->length() + right->length();
+        const std::size_t utf16_length = left->utf16_length() + right->utf16_length();
+        // Both parts have TRAITS_KNOWN, and the rope has a class if both parts do
+        const std::uint8_t traits = left->traits() & right->traits();
+        const std::size_t depth = std::max(left->depth(), right->depth()) + 1;
+        void* memory = allocate(resource, sizeof(StringImpl) + sizeof(RopeNode));
+        new (static_cast<char*>(memory) + sizeof(StringImpl)) RopeNode{std::move(left), std::move(right), depth};
+        auto* impl = new (memory) StringImpl(nullptr, length, nullptr, traits, resource, Storage::ROPE);
+        impl->utf16_length_.store(utf16_length, std::memory_order_relaxed);
+        return impl;
+    }
+
+    // Create a block viewing [offset, offset + length) of the bytes of base,
+    // with its UTF-16 length if the caller knows it (UNKNOWN_COUNT otherwise).
+    // The block comes from the same memory resource as the bytes.
+    static const StringImpl* create_view(const StringImpl* base, std::size_t offset, std::size_t length,
+                                         std::size_t utf16_length) {
+        const std::uint8_t policy = base->utf16_policy();
+        base = base->flat();
+        const StringImpl* owner = base->owner();
+        owner->retain();
+        void* memory = allocate(owner->resource_, sizeof(StringImpl));
+        // Any part of ASCII bytes is ASCII; other views are scanned when first asked
+        const std::uint8_t traits = base->traits_.load(std::memory_order_relaxed);
+        auto* view = new (memory) StringImpl(base->data_ + offset, length, owner,
+                                             (traits & TRAITS_ASCII) ? traits : std::uint8_t(0),
+                                             owner->resource_);
+        view->utf16_length_.store(utf16_length, std::memory_order_relaxed);
+        view->utf16_policy_.store(policy, std::memory_order_relaxed);
+        // Without surrogate pairs in the base, every code unit is a code point
+        if (traits & TRAITS_BMP) {
+            view->code_points_.store(utf16_length, std::memory_order_relaxed);
+        }
+        return view;
     }
-    
-    return String(pimpl_->data(), pimpl_->offset() + utf8_begin, utf8_end - utf8_begin);
-}
 
-// Operator overloads
-bool String::operator==(const String& other) const { 
-    return equals(other); 
-}
+#if defined(SSTRING_NONATOMIC_REFCOUNT)
+    // Single-threaded builds count references with plain loads and stores.
+    // Views of static blocks retain them too, from any thread, so those are
+    // not counted at all.
+    void retain() const noexcept {
+        if (storage_ == Storage::STATIC) {
+            return;
+        }
+        check_thread();
+        refs_.store(refs_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
 
-bool String::operator!=(const String& other) const { 
-    return !equals(other); 
-}
+    void release() const noexcept {
+        if (storage_ == Storage::STATIC) {
+            return;
+        }
+        check_thread();
+        const std::size_t refs = refs_.load(std::memory_order_relaxed);
+        refs_.store(refs - 1, std::memory_order_relaxed);
+        if (refs == 1) {
+            destroy();
+        }
+    }
+#else
+    void retain() const noexcept {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
 
-bool String::operator<(const String& other) const { 
-    return compare_to(other).is_less(); 
-}
+    void release() const noexcept {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy();
+        }
+    }
+#endif
 
-bool String::operator<=(const String& other) const { 
-    return compare_to(other).is_less_or_equal(); 
-}
+    // Check if the caller holds the only reference to this block
+    bool unique() const noexcept {
+        return refs_.load(std::memory_order_acquire) == 1;
+    }
 
-bool String::operator>(const String& other) const { 
-    return compare_to(other).is_greater(); 
-}
+    // Getters (the bytes of a rope are those of its flattened copy)
+    const char* data() const { return flat()->data_; }
+    std::pmr::memory_resource* resource() const { return resource_; }
+    std::size_t offset() const { return storage_ == Storage::ROPE ? 0 : data_ - owner()->data_; }
+    std::size_t length() const { return length_; }
+    std::string_view view() const { return std::string_view(data(), length_); }
 
-bool String::operator>=(const String& other) const { 
-    return compare_to(other).is_greater_or_equal(); 
-}
+    // Rope structure (see Rope)
+    bool is_rope() const { return storage_ == Storage::ROPE; }
+    const RopeNode& rope() const { return *buffer<RopeNode>(); }
+    std::size_t depth() const { return is_rope() ? rope().depth : 0; }
 
-// Implementation of string replace methods
-String String::replace(Char oldChar, Char newChar) const {
-    // If the characters are the same, return the original string
-    if (oldChar == newChar) {
-        return *this;
+    // Check if a rope has been flattened into a contiguous copy of its bytes
+    bool flattened() const {
+        return rope().flat.load(std::memory_order_acquire) != nullptr;
     }
-    
-    // Get the UTF-16 representation
-    const auto& utf16 = get_utf16();
-    if (utf16.empty()) {
-        return *this;
+
+    // Get the block holding the bytes of this one contiguously: this block
+    // itself, or for ropes a copy of the bytes of their leaves made on first use
+    const StringImpl* flat() const {
+        if (storage_ != Storage::ROPE) {
+            return this;
+        }
+        const RopeNode& node = rope();
+        const StringImpl* flat = node.flat.load(std::memory_order_acquire);
+        if (flat) {
+            return flat;
+        }
+        const StringImpl* created = copy_block(resource_);
+        if (node.flat.compare_exchange_strong(flat, created, std::memory_order_acq_rel)) {
+            return created;
+        }
+        created->release();  // Another thread published first
+        return flat;
+    }
+
+    // Copy the bytes of this block into a new block of their own, carrying the
+    // counts known for them over; ropes are copied from their leaves, so this
+    // does not flatten them
+    const StringImpl* copy_block(std::pmr::memory_resource* resource) const {
+        void* memory = allocate(resource, sizeof(StringImpl) + length_ + 1);
+        char* bytes = static_cast<char*>(memory) + sizeof(StringImpl);
+        copy_bytes(bytes);
+        bytes[length_] = '\0';
+        auto* created = new (memory) StringImpl(bytes, length_, nullptr, traits_.load(std::memory_order_relaxed),
+                                                resource);
+        created->utf16_length_.store(utf16_length_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        created->code_points_.store(code_points_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return created;
+    }
+
+    // Copy the bytes of this block to out, walking the leaves of ropes that
+    // have not been flattened
+    void copy_bytes(char* out) const {
+        if (storage_ == Storage::ROPE && !flattened()) {
+            const RopeNode& node = rope();
+            node.left->copy_bytes(out);
+            node.right->copy_bytes(out + node.left->length());
+        } else if (length_ > 0) {
+            std::memcpy(out, data(), length_);
+        }
     }
-    
-    // Create a copy of the UTF-16 string
-    std::u16string result = utf16;
-    bool modified = false;
-    
-    // Replace all occurrences
-    for (std::size_t i = 0; i < result.length(); ++i) {
-        if (result[i] == oldChar.value()) {
-            result[i] = newChar.value();
-            modified = true;
+
+    // Get the traits of the bytes, scanning them on first use
+    std::uint8_t traits() const {
+        std::uint8_t traits = traits_.load(std::memory_order_relaxed);
+        if (!(traits & TRAITS_KNOWN)) {
+            // Concurrent scans store the same value
+            traits = scan_utf8_traits(data_, length_);
+            traits_.store(traits, std::memory_order_relaxed);
         }
+        return traits;
     }
-    
-    // If no replacements were made, return the original string
-    if (!modified) {
-        return *this;
+
+    // The block owning the bytes this impl refers to
+    const StringImpl* owner() const {
+        if (storage_ == Storage::ROPE) {
+            return flat();
+        }
+        return owner_ ? owner_ : this;
     }
-    
-    // Convert back to UTF-8
-    std::string utf8 = boost::locale::conv::utf_to_utf<char>(result);
-    return String(utf8);
-}
 
-String String::replace(const String& target, const String& replacement) const {
-    // If the target is empty, insert the replacement between each character
-    if (target.is_empty()) {
-        if (is_empty()) {
-            return replacement;
+    // Get the bytes as a std::string, materialized on first use
+    const std::string& std_string() const {
+        // An adopted std::string already is one
+        if (storage_ == Storage::STRING) {
+            return *buffer<std::string>();
         }
-        
-        const auto& utf16 = get_utf16();
-        std::u16string result;
-        result.reserve(utf16.length() * (replacement.length() + 1));
-        
-        // Add replacement at the beginning
-        const auto& repl_utf16 = replacement.get_utf16();
-        result.append(repl_utf16);
-        
-        // Add each character with replacement after it
-        for (std::size_t i = 0; i < utf16.length(); ++i) {
-            result.push_back(utf16[i]);
-            result.append(repl_utf16);
+        if (storage_ == Storage::ROPE) {
+            return flat()->std_string();
         }
-        
-        std::string utf8 = boost::locale::conv::utf_to_utf<char>(result);
-        return String(utf8);
+        const std::string* cached = std_string_.load(std::memory_order_acquire);
+        if (cached) {
+            return *cached;
+        }
+        auto* created = new std::string(data_, length_);
+        MemoryCounters::add(MemoryCounters::LIVE_CACHES, 1);
+        MemoryCounters::add(MemoryCounters::CACHE_BUILDS, 1);
+        MemoryCounters::add(MemoryCounters::CACHE_BYTES, sizeof(std::string) + detail::heap_bytes(*created));
+        if (std_string_.compare_exchange_strong(cached, created, std::memory_order_acq_rel)) {
+            return *created;
+        }
+        delete_std_string(created);  // Another thread published first
+        return *cached;
     }
-    
-    // If the target is the same as this string, return the replacement
-    if (equals(target)) {
-        return replacement;
+
+    // Get the sparse UTF-16 index of this string, created on first use
+    const Utf16Index& utf16_index() const {
+        const Utf16Index* index = utf16_index_.load(std::memory_order_acquire);
+        if (index) {
+            return *index;
+        }
+        auto* created = new Utf16Index(view());
+        if (utf16_index_.compare_exchange_strong(index, created, std::memory_order_acq_rel)) {
+            return *created;
+        }
+        delete created;  // Another thread published first
+        return *index;
     }
-    
-    // If the target is not found, return the original string
-    Index index = indexOf(target);
-    if (index.is_invalid()) {
-        return *this;
-    }
-    
-    // Build the result string by replacing all occurrences
-    std::string result = to_string();
-    std::string target_str = target.to_string();
-    std::string replacement_str = replacement.to_string();
-    
-    std::size_t pos = 0;
-    std::size_t target_len = target_str.length();
-    
-    while ((pos = result.find(target_str, pos)) != std::string::npos) {
-        result.replace(pos, target_len, replacement_str);
-        pos += replacement_str.length();
-    }
-    
-    return String(result);
-}
 
-// Private methods
-const std::u16string& String::get_utf16() const {
-    // Double-checked locking pattern with atomic operations
-    auto cache = pimpl_->utf16_cache();
-    if (!cache) {
-        // First check failed, acquire the data and create cache
-        std::u16string result;
-        
-        const unsigned char* str = reinterpret_cast<const unsigned char*>(pimpl_->data()->c_str() + pimpl_->offset());
-        const unsigned char* end = str + pimpl_->length();
-        
-        while (str < end) {
-            if (*str < 0x80) {
-                // ASCII character
-                result.push_back(*str);
-                str++;
-            } else if ((*str & 0xE0) == 0xC0) {
-                // 2-byte UTF-8 sequence
-                if (str + 1 >= end || (str[1] & 0xC0) != 0x80) {
-                    // Invalid or incomplete sequence
-                    result.push_back(0xFFFD);
-                    str++;
-                    continue;
-                }
-                // Check for overlong encoding
-                unsigned int codepoint = ((str[0] & 0x1F) << 6) | (str[1] & 0x3F);
-                if (codepoint < 0x80) {
-                    // Overlong encoding
-                    result.push_back(0xFFFD);
-                    result.push_back(0xFFFD);
-                    str += 2;
-                    continue;
-                }
-                result.push_back(codepoint);
-                str += 2;
-            } else if ((*str & 0xF0) == 0xE0) {
-                // 3-byte UTF-8 sequence
-                if (str + 2 >= end || (str[1] & 0xC0) != 0x80 || (str[2] & 0xC0) != 0x80) {
-                    // Invalid or incomplete sequence
-                    result.push_back(0xFFFD);
-                    str++;
-                    continue;
-                }
-                // Check for overlong encoding and surrogate range
-                unsigned int codepoint = ((str[0] & 0x0F) << 12) | ((str[1] & 0x3F) << 6) | (str[2] & 0x3F);
-                if (codepoint < 0x800 || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
-                    // Overlong encoding or surrogate range
-                    result.push_back(0xFFFD);
-                    result.push_back(0xFFFD);
-                    result.push_back(0xFFFD);
-                    str += 3;
-                    continue;
-                }
-                result.push_back(codepoint);
-                str += 3;
-            } else if ((*str & 0xF8) == 0xF0) {
-                // 4-byte UTF-8 sequence
-                if (str + 3 >= end || (str[1] & 0xC0) != 0x80 || (str[2] & 0xC0) != 0x80 || (str[3] & 0xC0) != 0x80) {
-                    // Invalid or incomplete sequence
-                    result.push_back(0xFFFD);
-                    str++;
-                    continue;
-                }
-                // Check for overlong encoding and valid Unicode range
-                unsigned int codepoint = ((str[0] & 0x07) << 18) | ((str[1] & 0x3F) << 12) |
-                                        ((str[2] & 0x3F) << 6)  | (str[3] & 0x3F);
-                if (codepoint < 0x10000 || codepoint > 0x10FFFF) {
-                    // Overlong encoding or outside Unicode range
-                    result.push_back(0xFFFD);
-                    result.push_back(0xFFFD);
-                    result.push_back(0xFFFD);
-                    result.push_back(0xFFFD);
-                    str += 4;
-                    continue;
-                }
-                // Convert to surrogate pair
-                codepoint -= 0x10000;
-                result.push_back(0xD800 + (codepoint >> 10));
-                result.push_back(0xDC00 + (codepoint & 0x3FF));
-                str += 4;
-            } else {
-                // Invalid UTF-8 byte
-                result.push_back(0xFFFD);
-                str++;
-            }
+    // Get the UTF-16 length if it has already been counted (UNKNOWN_COUNT otherwise)
+    std::size_t known_utf16_length() const {
+        const std::size_t length = utf16_length_.load(std::memory_order_relaxed);
+        if (length != UNKNOWN_COUNT) {
+            return length;
         }
-        
-        // Create a new cache and atomically update the shared pointer
-        auto new_cache = std::make_shared<const std::u16string>(std::move(result));
-        pimpl_->set_utf16_cache(new_cache);
-        return *new_cache;
+        const Utf16Index* index = utf16_index_.load(std::memory_order_acquire);
+        return index ? index->known_length() : UNKNOWN_COUNT;
     }
-    
-    return *cache;
-}
 
-bool String::shares_data_with(const String& other) const {
-    return pimpl_->shares_data_with(*other.pimpl_);
-}
+    // Get the UTF-16 length, counted on first use
+    std::size_t utf16_length() const {
+        const std::size_t length = known_utf16_length();
+        return length != UNKNOWN_COUNT ? length : count().units;
+    }
 
-// Implementation of indexOf methods
-Index String::indexOf(Char ch) const {
-    return indexOf(ch, Index(0));
-}
+    // Get the number of code points, counted on first use
+    std::size_t code_point_count() const {
+        const std::size_t code_points = code_points_.load(std::memory_order_relaxed);
+        return code_points != UNKNOWN_COUNT ? code_points : count().code_points;
+    }
 
-Index String::indexOf(Char ch, Index fromIndex) const {
-    const auto& utf16 = get_utf16();
-    const std::size_t len = utf16.length();
-    
-    // Check if fromIndex is out of bounds
-    if (fromIndex.value() >= len) {
-        return Index::invalid;
+    // Count the UTF-16 code units and code points and remember both. Concurrent
+    // counts store the same values.
+    Utf16Counts count() const {
+        Utf16Counts counts;
+        if (traits() & TRAITS_ASCII) {
+            counts = {length_, length_};
+        } else if (storage_ == Storage::ROPE) {
+            // Ropes add up the counts of their children instead of flattening
+            counts = {utf16_length_.load(std::memory_order_relaxed),
+                      rope().left->code_point_count() + rope().right->code_point_count()};
+        } else {
+            counts = count_utf16(view());
+        }
+        utf16_length_.store(counts.units, std::memory_order_relaxed);
+        code_points_.store(counts.code_points, std::memory_order_relaxed);
+        return counts;
+    }
+
+    // Get the hash of the bytes, computed on first use. As in Java, a hash of
+    // 0 is not remembered; concurrent computations store the same value.
+    std::size_t hash() const {
+        std::size_t hash = hash_.load(std::memory_order_relaxed);
+        if (hash == 0) {
+            hash = hash_bytes(view());
+            hash_.store(hash, std::memory_order_relaxed);
+        }
+        return hash;
     }
-    
-    // Search for the character
-    for (std::size_t i = fromIndex.value(); i < len; ++i) {
-        if (utf16[i] == ch.value()) {
-            return Index(i);
+
+    // Check if this impl shares the same underlying data with another impl
+    bool shares_data_with(const StringImpl& other) const {
+        return owner() == other.owner();
+    }
+
+    // Get the number of bytes of the buffers this impl keeps alive, without
+    // flattening ropes
+    std::size_t retained_bytes() const {
+        if (storage_ == Storage::ROPE && !flattened()) {
+            return rope().left->retained_bytes() + rope().right->retained_bytes();
+        }
+        return owner()->length();
+    }
+
+    // Add the heap memory of this block, of the blocks it refers to and of
+    // their caches to usage; owned tells if no other string refers to the
+    // block referring to this one
+    void account(String::MemoryUsage& usage, bool owned) const {
+        // Static blocks are never freed, so they are shared by definition
+        owned = owned && storage_ != Storage::STATIC && unique();
+        const std::size_t caches = cache_bytes();
+        (owned ? usage.owned_bytes : usage.shared_bytes) += heap_bytes() + caches;
+        usage.cache_bytes += caches;
+        if (owner_) {
+            owner_->account(usage, owned);
+        }
+        if (storage_ == Storage::ROPE) {
+            rope().left->account(usage, owned);
+            rope().right->account(usage, owned);
+            if (const StringImpl* flat = rope().flat.load(std::memory_order_acquire)) {
+                flat->account(usage, owned);
+            }
         }
     }
-    
-    return Index::invalid;
-}
 
-Index String::indexOf(const String& str) const {
-    return indexOf(str, Index(0));
-}
+    // Check if the UTF-16 index of this block has been built
+    bool has_utf16_index() const {
+        return utf16_index_.load(std::memory_order_acquire) != nullptr;
+    }
 
-Index String::indexOf(const String& str, Index fromIndex) const {
-    const auto& utf16 = get_utf16();
-    const auto& str_utf16 = str.get_utf16();
-    const std::size_t len = utf16.length();
-    const std::size_t str_len = str_utf16.length();
-    
-    // Empty string case - always matches at fromIndex if within bounds
-    if (str_len == 0) {
-        return (fromIndex.value() <= len) ? fromIndex : Index::invalid;
+    // Get the String::Utf16CachePolicy of this block plus one (0 if it has none)
+    std::uint8_t utf16_policy() const {
+        return utf16_policy_.load(std::memory_order_relaxed);
     }
-    
-    // If fromIndex is out of bounds or the substring is longer than the remaining string
-    if (fromIndex.value() >= len || fromIndex.value() + str_len > len) {
-        return Index::invalid;
+
+    void set_utf16_policy(std::uint8_t policy) const {
+        utf16_policy_.store(policy, std::memory_order_relaxed);
     }
-    
-    // Search for the substring
-    for (std::size_t i = fromIndex.value(); i <= len - str_len; ++i) {
-        bool found = true;
-        for (std::size_t j = 0; j < str_len; ++j) {
-            if (utf16[i + j] != str_utf16[j]) {
-                found = false;
-                break;
+
+    // Free the caches of this block and of the blocks only it refers to,
+    // returning their heap bytes. Only the holder of the only reference may do
+    // so, since other holders may be using them; static blocks are shared by
+    // all their holders.
+    std::size_t release_caches() const {
+        if (storage_ == Storage::STATIC) {
+            return 0;
+        }
+        std::size_t bytes = cache_bytes();
+        if (owner_ && owner_->unique()) {
+            bytes += owner_->release_caches();
+        }
+        delete utf16_index_.exchange(nullptr, std::memory_order_acq_rel);
+        if (const std::string* cached = std_string_.exchange(nullptr, std::memory_order_acq_rel)) {
+            delete_std_string(cached);
+        }
+        if (storage_ == Storage::ROPE) {
+            for (const ImplRef* child : {&rope().left, &rope().right}) {
+                if ((*child).counted() && (*child)->unique()) {
+                    bytes += (*child)->release_caches();
+                }
+            }
+            // Views of the rope and substrings of it may hold the flattened
+            // copy too, and keep it (and its caches) alive while they do
+            const StringImpl* flat = rope().flat.load(std::memory_order_acquire);
+            if (flat && flat->unique()) {
+                rope().flat.store(nullptr, std::memory_order_release);
+                bytes += flat->heap_bytes() + flat->cache_bytes();
+                flat->release();
             }
         }
-        if (found) {
-            return Index(i);
+        return bytes;
+    }
+
+private:
+    StringImpl(const char* data, std::size_t length, const StringImpl* owner, std::uint8_t traits,
+               std::pmr::memory_resource* resource, Storage storage = Storage::BYTES)
+        : owner_(owner)
+        , data_(data)
+        , length_(length)
+        , resource_(resource)
+        , storage_(storage)
+        , traits_(traits) {
+        // Whatever follows the header has been constructed already
+        MemoryCounters::add(MemoryCounters::LIVE_BLOCKS, 1);
+        MemoryCounters::add(MemoryCounters::BLOCK_BYTES, heap_bytes());
+    }
+
+    // Heap bytes of this block, including a buffer it adopted
+    std::size_t heap_bytes() const {
+        switch (owner_ ? Storage::BYTES : storage_) {
+            case Storage::STRING: return block_size() + detail::heap_bytes(*buffer<std::string>());
+            case Storage::VECTOR: return block_size() + buffer<std::vector<uint8_t>>()->capacity();
+            default: return block_size();
         }
     }
-    
-    return Index::invalid;
-}
 
-// Implementation of lastIndexOf methods
-Index String::lastIndexOf(Char ch) const {
-    const auto& utf16 = get_utf16();
-    return lastIndexOf(ch, Index(utf16.length() - 1));
-}
+    // Heap bytes of the caches built for this block
+    std::size_t cache_bytes() const {
+        std::size_t bytes = 0;
+        if (const Utf16Index* index = utf16_index_.load(std::memory_order_acquire)) {
+            bytes += index->memory();
+        }
+        if (const std::string* cached = std_string_.load(std::memory_order_acquire)) {
+            bytes += sizeof(std::string) + detail::heap_bytes(*cached);
+        }
+        return bytes;
+    }
 
-Index String::lastIndexOf(Char ch, Index fromIndex) const {
-    const auto& utf16 = get_utf16();
-    const std::size_t len = utf16.length();
-    
-    // If string is empty or fromIndex is out of bounds
-    if (len == 0 || fromIndex.value() >= len) {
-        fromIndex = len > 0 ? Index(len - 1) : Index(0);
+    // Free a std::string cache, counting it out
+    static void delete_std_string(const std::string* str) {
+        MemoryCounters::subtract(MemoryCounters::LIVE_CACHES, 1);
+        MemoryCounters::subtract(MemoryCounters::CACHE_BYTES, sizeof(std::string) + detail::heap_bytes(*str));
+        delete str;
     }
-    
-    // Search backward from fromIndex
-    for (std::size_t i = fromIndex.value() + 1; i > 0; --i) {
-        if (utf16[i - 1] == ch.value()) {
-            return Index(i - 1);
+
+    // Free this block and release the block owning its bytes
+    void destroy() const noexcept {
+        const StringImpl* owner = owner_;
+        std::pmr::memory_resource* resource = resource_;
+        const std::size_t size = block_size();
+        this->~StringImpl();
+        void* memory = const_cast<StringImpl*>(this);
+        if (resource) {
+            resource->deallocate(memory, size, alignof(StringImpl));
+        } else {
+            ::operator delete(memory);
+        }
+        if (owner) {
+            owner->release();
         }
     }
-    
-    return Index::invalid;
-}
-
-Index String::lastIndexOf(const String& str) const {
-    const auto& utf16 = get_utf16();
-    return lastIndexOf(str, Index(utf16.length()));
-}
 
-Index String::lastIndexOf(const String& str, Index fromIndex) const {
-    const auto& utf16 = get_utf16();
-    const auto& str_utf16 = str.get_utf16();
-    const std::size_t len = utf16.length();
-    const std::size_t str_len = str_utf16.length();
-    
-    // Empty string case
-    if (str_len == 0) {
-        return (fromIndex.value() <= len) ? fromIndex : Index(len);
+#if defined(SSTRING_NONATOMIC_REFCOUNT)
+    // Strings with non-atomic reference counts must stay on the thread that
+    // created them; debug builds check this on every count
+    void check_thread() const noexcept {
+#if !defined(NDEBUG)
+        assert(thread_ == std::this_thread::get_id() &&
+               "String shared across threads in a build with non-atomic reference counts");
+#endif
     }
-    
-    // If string is empty or substring is longer than the string
-    if (len == 0 || str_len > len) {
-        return Index::invalid;
+#endif
+
+    // Allocate memory for a block from resource (nullptr for the global heap)
+    static void* allocate(std::pmr::memory_resource* resource, std::size_t size) {
+        return resource ? resource->allocate(size, alignof(StringImpl)) : ::operator new(size);
     }
-    
-    // Adjust fromIndex if it's out of bounds
-    if (fromIndex.value() >= len) {
-        fromIndex = Index(len - str_len);
-    } else if (fromIndex.value() + str_len > len) {
-        fromIndex = Index(len - str_len);
+
+    // Size of the memory allocated for this block
+    std::size_t block_size() const {
+        if (owner_) {
+            return sizeof(StringImpl);
+        }
+        switch (storage_) {
+            case Storage::STRING: return sizeof(StringImpl) + sizeof(std::string);
+            case Storage::VECTOR: return sizeof(StringImpl) + sizeof(std::vector<uint8_t>);
+            case Storage::ROPE: return sizeof(StringImpl) + sizeof(RopeNode);
+            case Storage::STATIC: return sizeof(StringImpl);
+            default: return sizeof(StringImpl) + length_ + 1;
+        }
     }
-    
-    // Search backward from fromIndex
-    for (std::size_t i = fromIndex.value() + 1; i > 0; --i) {
-        std::size_t start = i - 1;
-        bool found = true;
-        for (std::size_t j = 0; j < str_len; ++j) {
-            if (start + j >= len || utf16[start + j] != str_utf16[j]) {
-                found = false;
-                break;
-            }
+
+    ~StringImpl() {
+        MemoryCounters::subtract(MemoryCounters::LIVE_BLOCKS, 1);
+        MemoryCounters::subtract(MemoryCounters::BLOCK_BYTES, heap_bytes());
+        delete utf16_index_.load(std::memory_order_relaxed);
+        if (const std::string* cached = std_string_.load(std::memory_order_relaxed)) {
+            delete_std_string(cached);
         }
-        if (found) {
-            return Index(start);
+        if (storage_ == Storage::STRING) {
+            std::destroy_at(buffer<std::string>());
+        } else if (storage_ == Storage::VECTOR) {
+            std::destroy_at(buffer<std::vector<uint8_t>>());
+        } else if (storage_ == Storage::ROPE) {
+            if (const StringImpl* flat = rope().flat.load(std::memory_order_relaxed)) {
+                flat->release();
+            }
+            std::destroy_at(buffer<RopeNode>());
         }
     }
-    
-    return Index::invalid;
+
+    template<typename Buffer>
+    static const StringImpl* adopt_buffer(Buffer&& buffer, std::size_t offset, Storage storage,
+                                          std::pmr::memory_resource* resource) {
+        static_assert(sizeof(StringImpl) % alignof(Buffer) == 0, "adopted buffer must be aligned");
+        void* memory = allocate(resource, sizeof(StringImpl) + sizeof(Buffer));
+        auto* stored = new (static_cast<char*>(memory) + sizeof(StringImpl)) Buffer(std::move(buffer));
+        const char* bytes = reinterpret_cast<const char*>(stored->data()) + offset;
+        const std::size_t length = stored->size() - offset;
+        return new (memory) StringImpl(bytes, length, nullptr, scan_utf8_traits(bytes, length), resource, storage);
+    }
+
+    // The adopted buffer following the header
+    template<typename Buffer>
+    Buffer* buffer() const {
+        return std::launder(reinterpret_cast<Buffer*>(
+            reinterpret_cast<char*>(const_cast<StringImpl*>(this)) + sizeof(StringImpl)));
+    }
+
+    mutable std::atomic<std::size_t> refs_{1};  ///< Intrusive reference count
+#if defined(SSTRING_NONATOMIC_REFCOUNT) && !defined(NDEBUG)
+    std::thread::id thread_ = std::this_thread::get_id();  ///< Thread allowed to count references
+#endif
+    const StringImpl* owner_;                   ///< Block owning the bytes (nullptr if they follow this header)
+    const char* data_;                          ///< First byte of this string
+    std::size_t length_;                        ///< Length of this string (in bytes)
+    std::pmr::memory_resource* resource_;       ///< Resource the block came from (nullptr: global heap)
+    Storage storage_;                           ///< What follows the header
+    mutable std::atomic<std::uint8_t> traits_;  ///< Utf8Traits of the bytes (0 until scanned)
+    mutable std::atomic<std::size_t> utf16_length_{UNKNOWN_COUNT}; ///< Memoized UTF-16 length
+    mutable std::atomic<std::size_t> code_points_{UNKNOWN_COUNT};  ///< Memoized code point count
+    mutable std::atomic<std::size_t> hash_{0};                     ///< Memoized hash (0 until computed)
+    mutable std::atomic<const Utf16Index*> utf16_index_{nullptr}; ///< Sparse UTF-16 index
+    mutable std::atomic<const std::string*> std_string_{nullptr}; ///< Cached std::string for to_string()
+    mutable std::atomic<std::uint8_t> utf16_policy_{0};  ///< String::Utf16CachePolicy plus one (0: default)
+};
+
+void retain(const StringImpl* impl) noexcept {
+    impl->retain();
 }
 
-// Implementation of string matching methods
-bool String::contains(const String& str) const {
-    // Leverage the existing indexOf method
-    return indexOf(str) != Index::invalid;
+void release(const StringImpl* impl) noexcept {
+    impl->release();
 }
 
-bool String::startsWith(const String& prefix) const {
-    // Delegate to the offset version with offset 0
-    return startsWith(prefix, Index(0));
+const StringImpl* create_static(const char* data, std::size_t length) {
+    return StringImpl::create_static(data, length);
 }
 
-bool String::startsWith(const String& prefix, Index offset) const {
-    const auto& utf16 = get_utf16();
-    const auto& prefix_utf16 = prefix.get_utf16();
-    const std::size_t len = utf16.length();
-    const std::size_t prefix_len = prefix_utf16.length();
-    
-    // Check if offset is out of bounds
-    if (offset.value() > len) {
-        throw StringIndexOutOfBoundsException("offset is out of bounds");
-    }
-    
-    // Empty prefix is always a prefix of any string
-    if (prefix_len == 0) {
-        return true;
+// Table of interned strings: canonical blocks keyed by their bytes, spread
+// over shards with their own locks so threads interning different strings
+// rarely contend. Lookups of existing entries only take a shared lock.
+class InternTable {
+public:
+    static InternTable& instance() {
+        // Never destroyed, so strings can be interned during static destruction
+        static InternTable* table = new InternTable();
+        return *table;
+    }
+
+    // Find the canonical block for the given bytes, making candidate (or a
+    // copy of the bytes if candidate is null) canonical if there is none
+    ImplRef intern(std::string_view bytes, const ImplRef& candidate) {
+        const std::size_t hash = candidate ? candidate->hash() : hash_bytes(bytes);
+        Shard& shard = shards_[(hash >> 7) % SHARDS];
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto found = shard.entries.find(bytes);
+            if (found != shard.entries.end()) {
+                count_hit(found->second, candidate, bytes.size());
+                return found->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto found = shard.entries.find(bytes);
+        if (found != shard.entries.end()) {
+            count_hit(found->second, candidate, bytes.size());
+            return found->second;
+        }
+        if (shard.entries.size() >= shard.sweep_at) {
+            sweep(shard);
+            shard.sweep_at = std::max(MIN_SWEEP, 2 * shard.entries.size());
+        }
+        ImplRef canonical = candidate ? candidate
+                                      : ImplRef(StringImpl::create(bytes.data(), bytes.size(), nullptr));
+        shard.entries.emplace(canonical->view(), canonical);
+        return canonical;
+    }
+
+    // Drop the entries referenced only by the table
+    std::size_t purge() {
+        std::size_t removed = 0;
+        for (Shard& shard : shards_) {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            removed += sweep(shard);
+            shard.sweep_at = std::max(MIN_SWEEP, 2 * shard.entries.size());
+        }
+        return removed;
     }
-    
-    // If the remaining string is shorter than the prefix, it can't start with the prefix
-    if (len - offset.value() < prefix_len) {
-        return false;
+
+    String::InternStats stats() const {
+        String::InternStats stats{0, 0, hits_.load(std::memory_order_relaxed),
+                                  bytes_saved_.load(std::memory_order_relaxed)};
+        for (const Shard& shard : shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            stats.entries += shard.entries.size();
+            for (const auto& entry : shard.entries) {
+                stats.bytes += entry.first.size();
+            }
+        }
+        return stats;
     }
-    
-    // Compare characters directly
-    for (std::size_t i = 0; i < prefix_len; ++i) {
-        if (utf16[offset.value() + i] != prefix_utf16[i]) {
-            return false;
+
+private:
+    static constexpr std::size_t SHARDS = 64;
+    static constexpr std::size_t MIN_SWEEP = 1024;  ///< Shard size below which no sweep happens
+
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        // Keys view the bytes of the canonical block they map to
+        std::unordered_map<std::string_view, ImplRef, StringHash> entries;
+        std::size_t sweep_at = MIN_SWEEP;  ///< Shard size triggering the next sweep
+    };
+
+    InternTable() = default;
+
+    // Remove the entries of a locked shard that nothing else refers to. No new
+    // reference can be taken meanwhile: that takes the lock of the shard.
+    static std::size_t sweep(Shard& shard) {
+        return std::erase_if(shard.entries, [](const auto& entry) {
+            return entry.second.counted() && entry.second->unique();
+        });
+    }
+
+    void count_hit(const ImplRef& canonical, const ImplRef& candidate, std::size_t length) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        if (!candidate || candidate.get() != canonical.get()) {
+            bytes_saved_.fetch_add(length, std::memory_order_relaxed);
         }
     }
-    
-    return true;
-}
 
-bool String::endsWith(const String& suffix) const {
-    const auto& utf16 = get_utf16();
-    const auto& suffix_utf16 = suffix.get_utf16();
-    const std::size_t len = utf16.length();
-    const std::size_t suffix_len = suffix_utf16.length();
-    
-    // Empty suffix is always a suffix of any string
-    if (suffix_len == 0) {
+    Shard shards_[SHARDS];
+    std::atomic<std::size_t> hits_{0};
+    std::atomic<std::size_t> bytes_saved_{0};
+};
+
+} // namespace detail
+
+namespace {
+
+// Resource of the innermost String::MemoryScope of this thread (nullptr: global heap)
+thread_local std::pmr::memory_resource* scoped_resource = nullptr;
+
+// Fraction of its buffer below which a substring is copied (0: never)
+std::atomic<double> compaction_fraction{0.0};
+
+// Policy for the UTF-16 index of blocks without a policy of their own
+std::atomic<String::Utf16CachePolicy> default_utf16_policy{String::Utf16CachePolicy::CACHE};
+
+// Check if lookups in a block go through its UTF-16 index: one that has been
+// built already, or one its policy allows to build
+bool indexes_utf16(const detail::StringImpl& impl) {
+    if (impl.has_utf16_index()) {
         return true;
     }
-    
-    // If the string is shorter than the suffix, it can't end with the suffix
-    if (len < suffix_len) {
-        return false;
+    const std::uint8_t policy = impl.utf16_policy();
+    const String::Utf16CachePolicy effective = policy ? static_cast<String::Utf16CachePolicy>(policy - 1)
+                                                      : default_utf16_policy.load(std::memory_order_relaxed);
+    return effective == String::Utf16CachePolicy::CACHE;
+}
+
+// Whitespace removed by trim()
+bool is_trim_whitespace(char16_t ch) {
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v';
+}
+
+// Whitespace removed by strip(), stripLeading() and stripTrailing()
+bool is_strip_whitespace(char16_t ch) {
+    return is_trim_whitespace(ch) ||
+           (ch >= 0x2000 && ch <= 0x200B) || // Various spaces including ZWSP (0x200B)
+           ch == 0x200C ||                   // Zero width non-joiner
+           ch == 0x200D ||                   // Zero width joiner
+           ch == 0x3000 ||                   // Ideographic space
+           ch == 0xFEFF ||                   // Zero width no-break space
+           ch == 0x00A0 ||                   // Non-breaking space
+           ch == 0x2028 ||                   // Line separator
+           ch == 0x2029;                     // Paragraph separator
+}
+
+// Check if a group is a whitespace character (surrogate pairs never are)
+bool is_strip_whitespace(const detail::Utf16Group& group) {
+    return group.units == 1 && is_strip_whitespace(group.unit[0]);
+}
+
+// Check if a located UTF-16 index lies beyond the end of the string
+bool is_past_end(std::string_view bytes, detail::Utf16Position position, std::size_t index) {
+    return position.byte == bytes.size() && position.unit != index;
+}
+
+// Get the byte offset of the boundary before a located UTF-16 index. An index
+// between the two halves of a surrogate pair rounds up to the end of the pair.
+std::size_t boundary_byte(std::string_view bytes, detail::Utf16Position position, std::size_t index) {
+    if (position.unit == index) {
+        return position.byte;
     }
-    
-    // Calculate the starting position for comparison
-    const std::size_t start = len - suffix_len;
-    
-    // Compare characters directly
-    for (std::size_t i = 0; i < suffix_len; ++i) {
-        if (utf16[start + i] != suffix_utf16[i]) {
+    return position.byte + detail::group_at(bytes, position.byte).bytes;
+}
+
+// Get the UTF-16 index of the boundary before a located UTF-16 index (see boundary_byte)
+std::size_t boundary_index(detail::Utf16Position position, std::size_t index) {
+    return position.unit == index ? index : position.unit + 2;
+}
+
+// Decode UTF-8 bytes into UTF-16 code units
+std::u16string decode_units(std::string_view bytes) {
+    // There is at most one code unit per byte
+    std::u16string units(bytes.size(), u'\0');
+    units.resize(detail::utf8_to_utf16(bytes.data(), bytes.size(), units.data()));
+    return units;
+}
+
+// Check if the UTF-16 matches of a needle are exactly the byte matches of its
+// UTF-8. This holds when the needle decodes without U+FFFD: it then starts with
+// a byte that always begins a group of the haystack, and each of its code units
+// has a single UTF-8 encoding. Invalid bytes of either side decode to U+FFFD.
+bool matches_by_bytes(std::string_view needle) {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(needle.data());
+    const unsigned char* end = str + needle.size();
+    while (str < end) {
+        const detail::Utf16Group group = detail::decode_group(str, end);
+        if (group.unit[0] == 0xFFFD) {
             return false;
         }
+        str += group.bytes;
     }
-    
     return true;
 }
 
-// Implementation of string trimming methods
-
-String String::trim() const {
-    // Fast path: if string is empty, return this
-    if (is_empty()) {
-        return *this;
+// Encode a code unit as UTF-8 for byte matching (see matches_by_bytes). Returns 0
+// for surrogates, which only occur as halves of pairs, and for U+FFFD.
+std::size_t encode_for_matching(char16_t ch, char* out) {
+    if (ch < 0x80) {
+        out[0] = static_cast<char>(ch);
+        return 1;
     }
-    
-    // Get UTF-16 representation for proper indexing
-    const auto& utf16 = get_utf16();
-    
-    // Find start index (first non-ASCII whitespace character)
-    std::size_t start = 0;
-    while (start < utf16.length()) {
-        char16_t ch = utf16[start];
-        // Only trim ASCII whitespace (ch <= 0x20)
-        // But make sure it's actually whitespace and not null or control characters
-        if (ch <= 0x20 && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v')) {
-            ++start;
-        } else {
-            break;
-        }
+    if (ch < 0x800) {
+        out[0] = static_cast<char>(0xC0 | (ch >> 6));
+        out[1] = static_cast<char>(0x80 | (ch & 0x3F));
+        return 2;
     }
-    
-    // If the entire string is whitespace, return empty string
-    if (start == utf16.length()) {
-        return String();
+    if ((ch >= 0xD800 && ch <= 0xDFFF) || ch == 0xFFFD) {
+        return 0;
     }
-    
-    // Find end index (last non-ASCII whitespace character)
-    std::size_t end = utf16.length() - 1;
-    while (end > start) {
-        char16_t ch = utf16[end];
-        // Only trim ASCII whitespace (ch <= 0x20)
-        // But make sure it's actually whitespace and not null or control characters
-        if (ch <= 0x20 && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v')) {
-            --end;
+    out[0] = static_cast<char>(0xE0 | (ch >> 12));
+    out[1] = static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+    out[2] = static_cast<char>(0x80 | (ch & 0x3F));
+    return 3;
+}
+
+// Describe the invalid UTF-8 sequence starting at str (see detail::validate_utf8)
+std::string invalid_utf8_message(const unsigned char* str, const unsigned char* end) {
+    const unsigned char lead = *str;
+    std::string problem;
+    if (lead >= 0x80 && lead < 0xC0) {
+        problem = "unexpected continuation byte";
+    } else if (lead > 0xF4) {
+        problem = "invalid leading byte";
+    } else {
+        const std::size_t needed = lead < 0xE0 ? 2 : (lead < 0xF0 ? 3 : 4);
+        std::size_t present = 1;
+        while (present < needed && str + present < end && (str[present] & 0xC0) == 0x80) {
+            ++present;
+        }
+        // Complete sequences are only invalid after C0, C1, E0, ED, F0 and F4
+        if (present < needed) {
+            problem = "incomplete " + std::to_string(needed) + "-byte sequence";
+        } else if (lead == 0xED) {
+            problem = "encoded surrogate";
+        } else if (lead == 0xF4) {
+            problem = "code point above U+10FFFF";
         } else {
-            break;
+            problem = "overlong encoding";
         }
     }
-    
-    // If no trimming needed, return the original string
-    if (start == 0 && end == utf16.length() - 1) {
-        return *this;
+    return "Invalid UTF-8 sequence: " + problem;
+}
+
+// Encode UTF-8 as UTF-16 with room for the given number of code units, after a
+// BOM if requested, writing the code units straight into the bytes of the result
+std::vector<uint8_t> utf16_bytes(std::string_view utf8, std::size_t units, detail::ByteOrder order, bool bom) {
+    const std::size_t offset = bom ? 2 : 0;
+    std::vector<uint8_t> result(offset + 2 * (units + detail::ENCODE_UTF16_SLACK));
+    char16_t* out = reinterpret_cast<char16_t*>(result.data() + offset);
+    if (bom) {
+        // U+FEFF in the byte order
+        result[order == detail::ByteOrder::BIG ? 0 : 1] = 0xFE;
+        result[order == detail::ByteOrder::BIG ? 1 : 0] = 0xFF;
+    }
+    result.resize(offset + 2 * detail::encode_utf16(utf8.data(), utf8.size(), order, out));
+    return result;
+}
+
+// The same for UTF-32, with room for the given number of code points
+std::vector<uint8_t> utf32_bytes(std::string_view utf8, std::size_t code_points, detail::ByteOrder order, bool bom) {
+    const std::size_t offset = bom ? 4 : 0;
+    std::vector<uint8_t> result(offset + 4 * code_points);
+    char32_t* out = reinterpret_cast<char32_t*>(result.data() + offset);
+    if (bom) {
+        result[order == detail::ByteOrder::BIG ? 2 : 1] = 0xFE;
+        result[order == detail::ByteOrder::BIG ? 3 : 0] = 0xFF;
     }
-    
-    // Return the trimmed substring
-    return substring(Index(start), Index(end + 1));
+    result.resize(offset + 4 * detail::encode_utf32(utf8.data(), utf8.size(), order, out));
+    return result;
 }
 
-String String::strip() const {
-    // Fast path: if string is empty, return this
-    if (is_empty()) {
-        return *this;
+// The BOM getBytes() writes for BOMPolicy::INCLUDE (none for ISO-8859-1 and ASCII)
+std::string_view bom_of(Encoding encoding) {
+    switch (encoding) {
+        case Encoding::UTF_8: return "\xEF\xBB\xBF";
+        case Encoding::UTF_16BE: return "\xFE\xFF";
+        case Encoding::UTF_16LE: return "\xFF\xFE";
+        case Encoding::UTF_32BE: return std::string_view("\0\0\xFE\xFF", 4);
+        case Encoding::UTF_32LE: return std::string_view("\xFF\xFE\0\0", 4);
+        default: return {};
     }
-    
-    // Get UTF-16 representation for proper indexing
-    const auto& utf16 = get_utf16();
-    
-    // Find start index (first non-whitespace character)
-    std::size_t start = 0;
-    while (start < utf16.length()) {
-        char16_t ch = utf16[start];
-        // Convert to UTF-32 for proper Unicode character classification
-        uint32_t codepoint;
-        if (ch >= 0xD800 && ch <= 0xDBFF && start + 1 < utf16.length()) {
-            char16_t low = utf16[start + 1];
-            if (low >= 0xDC00 && low <= 0xDFFF) {
-                // Surrogate pair
-                codepoint = 0x10000 + ((ch - 0xD800) << 10) + (low - 0xDC00);
-            } else {
-                codepoint = ch;
+}
+
+// Encode UTF-8 as ISO-8859-1 or ASCII, one byte per UTF-16 code unit. Invalid
+// bytes are skipped, and code units the encoding lacks become '?' with REPLACE,
+// are skipped with IGNORE and throw with THROW. ISO-8859-1 text that IGNORE
+// leaves empty is written as a lone '?'. Returns the number of bytes, writing
+// them to out unless it is null.
+std::size_t narrow_bytes(std::string_view utf8, Encoding encoding, EncodingErrorHandling errorHandling,
+                         uint8_t* out) {
+    const char16_t limit = encoding == Encoding::ASCII ? 0x7F : 0xFF;
+    const unsigned char* begin = reinterpret_cast<const unsigned char*>(utf8.data());
+    const unsigned char* end = begin + utf8.size();
+    std::size_t written = 0;
+    for (const unsigned char* str = begin; str < end;) {
+        if (*str < 0x80) {
+            // ASCII is copied in runs
+            const unsigned char* run = str + 1;
+            while (run < end && *run < 0x80) {
+                ++run;
             }
-        } else {
-            codepoint = ch;
+            if (out) {
+                std::memcpy(out + written, str, static_cast<std::size_t>(run - str));
+            }
+            written += static_cast<std::size_t>(run - str);
+            str = run;
+            continue;
         }
-        
-        // Check if the character is whitespace
-        bool is_whitespace = false;
-        // ASCII whitespace
-        if (ch <= 0x20 && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v')) {
-            is_whitespace = true;
-        } 
-        // Unicode whitespace
-        else if ((ch >= 0x2000 && ch <= 0x200B) || // Various spaces including ZWSP (0x200B)
-                 ch == 0x200C ||                   // Zero width non-joiner
-                 ch == 0x200D ||                   // Zero width joiner
-                 ch == 0x3000 ||                   // Ideographic space
-                 ch == 0xFEFF ||                   // Zero width no-break space
-                 ch == 0x00A0 ||                   // Non-breaking space
-                 ch == 0x2028 ||                   // Line separator
-                 ch == 0x2029) {                  // Paragraph separator
-            is_whitespace = true;
+        const detail::Utf16Group group = detail::decode_group(str, end);
+        for (std::size_t i = 0; i < group.units && group.bytes > 1; ++i) {
+            if (group.unit[i] <= limit || errorHandling == EncodingErrorHandling::REPLACE) {
+                if (out) {
+                    out[written] = group.unit[i] <= limit ? static_cast<uint8_t>(group.unit[i]) : '?';
+                }
+                ++written;
+            } else if (errorHandling == EncodingErrorHandling::THROW) {
+                throw EncodingException(encoding == Encoding::ASCII ? "Characters outside ASCII range"
+                                                                    : "Characters outside ISO-8859-1 range",
+                                        encoding, static_cast<std::size_t>(str - begin), errorHandling);
+            }
         }
-        
-        if (!is_whitespace) {
-            break;
+        str += group.bytes;
+    }
+    if (written == 0 && encoding == Encoding::ISO_8859_1 && errorHandling == EncodingErrorHandling::IGNORE) {
+        if (out) {
+            out[0] = '?';
         }
-        
-        // Advance by 1 or 2 code units depending on surrogate pair
-        if (codepoint > 0xFFFF) {
-            start += 2;  // Surrogate pair
+        written = 1;
+    }
+    return written;
+}
+
+// Encode UTF-8 as UTF-16 or UTF-32 into out, which has room for exactly units
+// code units and may not be aligned for them. The kernels write in place, but
+// encode_utf16() may write ENCODE_UTF16_SLACK code units past its output, so
+// the text at the end (and all of it for unaligned output) is encoded through
+// a small buffer, a piece at a time.
+template <typename Unit>
+void encode_units_into(std::string_view utf8, std::size_t units, detail::ByteOrder order, uint8_t* out) {
+    constexpr bool utf16 = std::is_same_v<Unit, char16_t>;
+    constexpr std::size_t slack = utf16 ? detail::ENCODE_UTF16_SLACK : 0;
+    constexpr std::size_t PIECE = 256;
+    auto encode = [order](const char* data, std::size_t length, Unit* to) {
+        if constexpr (utf16) {
+            return detail::encode_utf16(data, length, order, to);
         } else {
-            start += 1;
+            return detail::encode_utf32(data, length, order, to);
+        }
+    };
+    // A sequence starts at every byte but continuation bytes
+    auto sequence_start = [&utf8](std::size_t position) {
+        for (int back = 0; back < 3 && position > 0 && position < utf8.size() &&
+                           (static_cast<unsigned char>(utf8[position]) & 0xC0) == 0x80; ++back) {
+            --position;
         }
+        return position;
+    };
+
+    std::size_t position = 0;
+    std::size_t written = 0;
+    if (reinterpret_cast<std::uintptr_t>(out) % alignof(Unit) == 0 && units > slack) {
+        // Leave text of at least slack code units at the end to the buffer
+        std::size_t tail = slack == 0 ? utf8.size() : 0;
+        for (std::size_t size = 4 * slack; tail == 0 && size < utf8.size(); size *= 2) {
+            const std::size_t start = sequence_start(utf8.size() - size);
+            if (detail::count_encoded_utf16(utf8.data() + start, utf8.size() - start).units >= slack) {
+                tail = start;
+            }
+        }
+        written = encode(utf8.data(), tail, reinterpret_cast<Unit*>(out));
+        position = tail;
     }
-    
-    // If the entire string is whitespace, return empty string
-    if (start == utf16.length()) {
-        return String();
+    Unit piece[PIECE + slack];
+    while (position < utf8.size()) {
+        const std::size_t end = sequence_start(std::min(position + PIECE, utf8.size()));
+        const std::size_t count = encode(utf8.data() + position, end - position, piece);
+        std::memcpy(out + written * sizeof(Unit), piece, count * sizeof(Unit));
+        written += count;
+        position = end;
     }
-    
-    // Find end index (last non-whitespace character)
-    std::size_t end = utf16.length() - 1;
-    while (end > start) {
-        char16_t ch = utf16[end];
-        // Check for surrogate pair at the end
-        if (ch >= 0xDC00 && ch <= 0xDFFF && end > 0) {
-            char16_t high = utf16[end - 1];
-            if (high >= 0xD800 && high <= 0xDBFF) {
-                // Surrogate pair
-                // For surrogate pairs, we don't have specific whitespace checks
-                // Just assume they're not whitespace for now
-                break;
-            }
+}
+
+std::string invalid_unit_message(const uint8_t* bytes, std::size_t position, Encoding encoding) {
+    const bool big = encoding == Encoding::UTF_16BE || encoding == Encoding::UTF_32BE;
+    std::string problem;
+    if (encoding == Encoding::UTF_16BE || encoding == Encoding::UTF_16LE) {
+        const unsigned unit = big ? (bytes[position] << 8) | bytes[position + 1]
+                                  : bytes[position] | (bytes[position + 1] << 8);
+        problem = unit < 0xDC00 ? "unpaired high surrogate" : "unpaired low surrogate";
+    } else {
+        std::uint32_t code_point = 0;
+        for (int i = 0; i < 4; ++i) {
+            code_point |= static_cast<std::uint32_t>(bytes[position + i]) << (big ? 8 * (3 - i) : 8 * i);
         }
-        
-        // Regular code unit
-        
-        // Check if the character is whitespace
-        bool is_whitespace = false;
-        // ASCII whitespace
-        if (ch <= 0x20 && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v')) {
-            is_whitespace = true;
-        } 
-        // Unicode whitespace
-        else if ((ch >= 0x2000 && ch <= 0x200B) || // Various spaces including ZWSP (0x200B)
-                 ch == 0x200C ||                   // Zero width non-joiner
-                 ch == 0x200D ||                   // Zero width joiner
-                 ch == 0x3000 ||                   // Ideographic space
-                 ch == 0xFEFF ||                   // Zero width no-break space
-                 ch == 0x00A0 ||                   // Non-breaking space
-                 ch == 0x2028 ||                   // Line separator
-                 ch == 0x2029) {                   // Paragraph separator
-            is_whitespace = true;
+        problem = code_point > 0x10FFFF ? "code point above U+10FFFF" : "surrogate code point";
+    }
+    return "Invalid " + to_string(encoding) + " data: " + problem;
+}
+
+// Decode UTF-16 or UTF-32 after a BOM of offset bytes into UTF-8 of exactly
+// the decoded length. An incomplete code unit at the end is an error like an
+// invalid one, and THROW reports the byte offset of the first.
+std::string decode_utf_units(const uint8_t* bytes, std::size_t size, std::size_t offset, Encoding encoding,
+                             EncodingErrorHandling errorHandling) {
+    const bool utf16 = encoding == Encoding::UTF_16BE || encoding == Encoding::UTF_16LE;
+    const detail::ByteOrder order = encoding == Encoding::UTF_16BE || encoding == Encoding::UTF_32BE
+                                        ? detail::ByteOrder::BIG : detail::ByteOrder::LITTLE;
+    const std::size_t unit_size = utf16 ? 2 : 4;
+    const char* data = reinterpret_cast<const char*>(bytes) + offset;
+    const std::size_t units = (size - offset) / unit_size;
+    const std::size_t incomplete = (size - offset) % unit_size;
+    const bool replace = errorHandling == EncodingErrorHandling::REPLACE;
+    
+    const detail::DecodedLength length = utf16 ? detail::decoded_length_utf16(data, units, order, replace)
+                                               : detail::decoded_length_utf32(data, units, order, replace);
+    if (errorHandling == EncodingErrorHandling::THROW) {
+        if (length.invalid != std::string_view::npos) {
+            const std::size_t position = offset + unit_size * length.invalid;
+            throw EncodingException(invalid_unit_message(bytes, position, encoding), encoding, position, errorHandling);
         }
-        
-        if (!is_whitespace) {
-            break;
+        if (incomplete != 0) {
+            throw EncodingException(utf16 ? "Invalid " + to_string(encoding) + " data: odd number of bytes"
+                                          : "Invalid " + to_string(encoding) + " data: byte count not divisible by 4",
+                                    encoding, size - incomplete, errorHandling);
         }
-        --end;
     }
     
-    // If no trimming needed, return the original string
-    if (start == 0 && end == utf16.length() - 1) {
-        return *this;
+    const bool replace_incomplete = replace && incomplete != 0;
+    std::string utf8(length.bytes + (replace_incomplete ? 3 : 0), '\0');
+    const std::size_t written = utf16 ? detail::decode_utf16(data, units, order, replace, utf8.data())
+                                      : detail::decode_utf32(data, units, order, replace, utf8.data());
+    if (replace_incomplete) {
+        utf8.replace(written, 3, "\xEF\xBF\xBD");
     }
-    
-    // Return the trimmed substring
-    return substring(Index(start), Index(end + 1));
+    return utf8;
 }
 
-String String::stripLeading() const {
-    // Fast path: if string is empty, return this
-    if (is_empty()) {
-        return *this;
+} // namespace
+
+namespace detail {
+
+// Read-only queries shared by String and StringView. Text is either type and
+// provides view(), locate(), index_of_byte(), is_ascii(), is_bmp(), length()
+// and known_utf16_length(). Queries selecting a part of the text return the
+// span of its bytes, which the caller turns into a String or a StringView.
+struct TextQueries {
+    template<typename Text>
+    static Char char_at(const Text& text, std::size_t index) {
+        const auto bytes = text.view();
+        const auto position = text.locate(index);
+        if (position.byte >= bytes.size()) {
+            throw StringIndexOutOfBoundsException("Index out of bounds");
+        }
+        const auto group = group_at(bytes, position.byte);
+        return Char(group.unit[index - position.unit]);
     }
-    
-    // Get UTF-16 representation for proper indexing
-    const auto& utf16 = get_utf16();
-    
-    // Find start index (first non-whitespace character)
-    std::size_t start = 0;
-    while (start < utf16.length()) {
-        char16_t ch = utf16[start];
-        // Convert to UTF-32 for proper Unicode character classification
-        uint32_t codepoint;
-        if (ch >= 0xD800 && ch <= 0xDBFF && start + 1 < utf16.length()) {
-            char16_t low = utf16[start + 1];
-            if (low >= 0xDC00 && low <= 0xDFFF) {
-                // Surrogate pair
-                codepoint = 0x10000 + ((ch - 0xD800) << 10) + (low - 0xDC00);
-            } else {
-                codepoint = ch;
-            }
-        } else {
-            codepoint = ch;
+
+    template<typename Text>
+    static CodePoint code_point_at(const Text& text, std::size_t index) {
+        const auto bytes = text.view();
+        const auto position = text.locate(index);
+        if (position.byte >= bytes.size()) {
+            throw StringIndexOutOfBoundsException("Index out of bounds");
         }
-        
-        // Check if the character is whitespace
-        bool is_whitespace = false;
-        // ASCII whitespace
-        if (ch <= 0x20 && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v')) {
-            is_whitespace = true;
-        } 
-        // Unicode whitespace
-        else if ((ch >= 0x2000 && ch <= 0x200B) || // Various spaces including ZWSP (0x200B)
-                 ch == 0x200C ||                   // Zero width non-joiner
-                 ch == 0x200D ||                   // Zero width joiner
-                 ch == 0x3000 ||                   // Ideographic space
-                 ch == 0xFEFF ||                   // Zero width no-break space
-                 ch == 0x00A0 ||                   // Non-breaking space
-                 ch == 0x2028 ||                   // Line separator
-                 ch == 0x2029) {                  // Paragraph separator
-            is_whitespace = true;
+        const auto group = group_at(bytes, position.byte);
+        if (group.units == 2 && index == position.unit) {
+            return CodePoint(0x10000 + ((group.unit[0] - 0xD800) << 10) + (group.unit[1] - 0xDC00));
         }
-        
-        if (!is_whitespace) {
-            break;
+        // Single code unit, or the low surrogate of a pair on its own
+        return CodePoint(group.unit[index - position.unit]);
+    }
+
+    template<typename Text>
+    static CodePoint code_point_before(const Text& text, std::size_t index) {
+        const auto bytes = text.view();
+        if (index == 0) {
+            throw StringIndexOutOfBoundsException("Index out of bounds");
         }
-        
-        // Advance by 1 or 2 code units depending on surrogate pair
-        if (codepoint > 0xFFFF) {
-            start += 2;  // Surrogate pair
-        } else {
-            start += 1;
+        const auto position = text.locate(index - 1);
+        if (position.byte >= bytes.size()) {
+            throw StringIndexOutOfBoundsException("Index out of bounds");
+        }
+        const auto group = group_at(bytes, position.byte);
+        if (group.units == 2 && index - 1 != position.unit) {
+            return CodePoint(0x10000 + ((group.unit[0] - 0xD800) << 10) + (group.unit[1] - 0xDC00));
+        }
+        // Single code unit, or the high surrogate of a pair on its own
+        return CodePoint(group.unit[index - 1 - position.unit]);
+    }
+
+    template<typename Text>
+    static std::size_t code_point_count(const Text& text, std::size_t begin_index, std::size_t end_index) {
+        const auto bytes = text.view();
+        if (begin_index > end_index || is_past_end(bytes, text.locate(end_index), end_index)) {
+            throw StringIndexOutOfBoundsException("Invalid range");
+        }
+        // Without surrogate pairs every code unit is a code point
+        if (text.is_bmp()) {
+            return end_index - begin_index;
+        }
+        if (begin_index == end_index) {
+            return 0;
+        }
+
+        // Count the groups starting in the range; surrogate pairs cut by the range
+        // count as one code point each
+        auto position = text.locate(begin_index);
+        std::size_t count = 0;
+        if (position.unit != begin_index) {
+            ++count;  // Low surrogate of a pair starting before the range
+            position.byte += 4;
+            position.unit += 2;
+        }
+        while (position.unit < end_index) {
+            const auto group = group_at(bytes, position.byte);
+            position.byte += group.bytes;
+            position.unit += group.units;
+            ++count;
+        }
+        return count;
+    }
+
+    template<typename Text>
+    static Index index_of(const Text& text, char16_t ch, std::size_t from_index) {
+        const auto bytes = text.view();
+        const auto from = text.locate(from_index);
+
+        // Check if fromIndex is out of bounds
+        if (from.byte >= bytes.size()) {
+            return Index::invalid;
+        }
+
+        // Search the UTF-8 bytes of the character
+        char encoded[3];
+        const std::size_t encoded_length = encode_for_matching(ch, encoded);
+        if (encoded_length > 0) {
+            const std::size_t found = bytes.find(std::string_view(encoded, encoded_length),
+                                                 boundary_byte(bytes, from, from_index));
+            return found == std::string_view::npos ? Index::invalid : Index(text.index_of_byte(found));
+        }
+
+        // Otherwise compare decoded code units
+        const unsigned char* str = reinterpret_cast<const unsigned char*>(bytes.data());
+        std::size_t unit = from.unit;
+        for (std::size_t byte = from.byte; byte < bytes.size(); ) {
+            const auto group = decode_group(str + byte, str + bytes.size());
+            for (std::size_t i = 0; i < group.units; ++i) {
+                if (unit + i >= from_index && group.unit[i] == ch) {
+                    return Index(unit + i);
+                }
+            }
+            byte += group.bytes;
+            unit += group.units;
+        }
+
+        return Index::invalid;
+    }
+
+    template<typename Text>
+    static Index index_of(const Text& text, std::string_view needle, std::size_t from_index) {
+        const auto bytes = text.view();
+
+        // Empty string case - always matches at fromIndex if within bounds
+        if (needle.empty()) {
+            return is_past_end(bytes, text.locate(from_index), from_index) ? Index::invalid : Index(from_index);
+        }
+
+        // If fromIndex is out of bounds
+        const auto from = text.locate(from_index);
+        if (from.byte >= bytes.size()) {
+            return Index::invalid;
+        }
+
+        // Search the UTF-8 bytes of the substring
+        if (matches_by_bytes(needle)) {
+            const std::size_t found = bytes.find(needle, boundary_byte(bytes, from, from_index));
+            return found == std::string_view::npos ? Index::invalid : Index(text.index_of_byte(found));
+        }
+
+        // Otherwise compare decoded code units from the group holding fromIndex on
+        const std::u16string units = decode_units(bytes.substr(from.byte));
+        const std::size_t found = units.find(decode_units(needle), from_index - from.unit);
+        return found == std::u16string::npos ? Index::invalid : Index(from.unit + found);
+    }
+
+    template<typename Text>
+    static Index last_index_of(const Text& text, char16_t ch, std::size_t from_index) {
+        const auto bytes = text.view();
+
+        // Search the UTF-8 bytes of the character, starting at or before fromIndex
+        char encoded[3];
+        const std::size_t encoded_length = encode_for_matching(ch, encoded);
+        if (encoded_length > 0) {
+            const auto from = text.locate(from_index);
+            const std::size_t found = bytes.rfind(std::string_view(encoded, encoded_length),
+                                                  from.byte < bytes.size() ? from.byte : std::string_view::npos);
+            return found == std::string_view::npos ? Index::invalid : Index(text.index_of_byte(found));
+        }
+
+        // Otherwise compare decoded code units
+        const std::u16string units = decode_units(bytes);
+        const std::size_t found = units.rfind(ch, from_index);
+        return found == std::u16string::npos ? Index::invalid : Index(found);
+    }
+
+    template<typename Text>
+    static Index last_index_of(const Text& text, std::string_view needle, std::size_t from_index) {
+        const auto bytes = text.view();
+
+        // Empty string case
+        if (needle.empty()) {
+            const std::size_t len = text.length();
+            return Index(from_index <= len ? from_index : len);
+        }
+
+        // Search the UTF-8 bytes of the substring, starting at or before fromIndex
+        if (matches_by_bytes(needle)) {
+            const auto from = text.locate(from_index);
+            const std::size_t found = bytes.rfind(needle, from.byte < bytes.size() ? from.byte : std::string_view::npos);
+            return found == std::string_view::npos ? Index::invalid : Index(text.index_of_byte(found));
+        }
+
+        // Otherwise compare decoded code units
+        const std::u16string units = decode_units(bytes);
+        const std::size_t found = units.rfind(decode_units(needle), from_index);
+        return found == std::u16string::npos ? Index::invalid : Index(found);
+    }
+
+    template<typename Text>
+    static bool starts_with(const Text& text, std::string_view prefix, std::size_t offset) {
+        const auto bytes = text.view();
+        const auto position = text.locate(offset);
+
+        // Check if offset is out of bounds
+        if (is_past_end(bytes, position, offset)) {
+            throw StringIndexOutOfBoundsException("offset is out of bounds");
+        }
+
+        // Empty prefix is always a prefix of any string
+        if (prefix.empty()) {
+            return true;
+        }
+
+        // Compare the UTF-8 bytes; a prefix never starts with the low half of a surrogate pair
+        if (matches_by_bytes(prefix)) {
+            return position.unit == offset && bytes.substr(position.byte).starts_with(prefix);
+        }
+
+        // Otherwise compare decoded code units
+        const std::u16string units = decode_units(bytes.substr(position.byte));
+        return std::u16string_view(units).substr(offset - position.unit).starts_with(decode_units(prefix));
+    }
+
+    template<typename Text>
+    static bool ends_with(const Text& text, std::string_view suffix) {
+        // Empty suffix is always a suffix of any string
+        if (suffix.empty()) {
+            return true;
+        }
+
+        // Compare the UTF-8 bytes
+        if (matches_by_bytes(suffix)) {
+            return text.view().ends_with(suffix);
+        }
+
+        // Otherwise compare decoded code units
+        return decode_units(text.view()).ends_with(decode_units(suffix));
+    }
+
+    template<typename Text>
+    static ByteSpan substring(const Text& text, std::size_t begin_index) {
+        const auto bytes = text.view();
+        const auto begin = text.locate(begin_index);
+        // Check if beginIndex is out of bounds
+        if (is_past_end(bytes, begin, begin_index)) {
+            throw StringIndexOutOfBoundsException("beginIndex is out of bounds");
+        }
+        const std::size_t utf8_begin = boundary_byte(bytes, begin, begin_index);
+        // The length of the substring follows from a known length of the text
+        const std::size_t known_length = text.known_utf16_length();
+        return {utf8_begin, bytes.size() - utf8_begin,
+                known_length == UNKNOWN_COUNT ? known_length : known_length - boundary_index(begin, begin_index)};
+    }
+
+    template<typename Text>
+    static ByteSpan substring(const Text& text, std::size_t begin_index, std::size_t end_index) {
+        const auto bytes = text.view();
+        const auto begin = text.locate(begin_index);
+        const auto end = text.locate(end_index);
+
+        // Check for out of bounds conditions with more specific error messages
+        if (is_past_end(bytes, begin, begin_index)) {
+            throw StringIndexOutOfBoundsException("beginIndex is out of bounds");
+        }
+        if (is_past_end(bytes, end, end_index)) {
+            throw StringIndexOutOfBoundsException("endIndex is out of bounds");
+        }
+        if (begin_index > end_index) {
+            throw StringIndexOutOfBoundsException("beginIndex cannot be larger than endIndex");
+        }
+
+        // Map the UTF-16 indices to UTF-8 byte offsets
+        const std::size_t utf8_begin = boundary_byte(bytes, begin, begin_index);
+        const std::size_t utf8_end = boundary_byte(bytes, end, end_index);
+        return {utf8_begin, utf8_end - utf8_begin,
+                boundary_index(end, end_index) - boundary_index(begin, begin_index)};
+    }
+
+    template<typename Text>
+    static ByteSpan trim(const Text& text) {
+        // ASCII whitespace is always a single byte, so trim the bytes directly
+        const auto bytes = text.view();
+        std::size_t start = 0;
+        while (start < bytes.size() && is_trim_whitespace(static_cast<unsigned char>(bytes[start]))) {
+            ++start;
         }
+        std::size_t end = bytes.size();
+        while (end > start && is_trim_whitespace(static_cast<unsigned char>(bytes[end - 1]))) {
+            --end;
+        }
+        // Each trimmed byte was one code unit
+        const std::size_t known_length = text.known_utf16_length();
+        return {start, end - start,
+                known_length == UNKNOWN_COUNT ? known_length : known_length - start - (bytes.size() - end)};
+    }
+
+    template<typename Text>
+    static ByteSpan strip(const Text& text) {
+        const auto bytes = text.view();
+        const std::size_t start = skip_leading_whitespace(bytes);
+        if (start == bytes.size()) {
+            return {start, 0, 0};
+        }
+
+        // Skip trailing whitespace characters, walking back one group at a time
+        std::size_t end = bytes.size();
+        while (end > start) {
+            const std::size_t group_start = last_group_start(bytes, end);
+            if (!is_strip_whitespace(group_at(bytes, group_start))) {
+                break;
+            }
+            end = group_start;
+        }
+        return {start, end - start, UNKNOWN_COUNT};
+    }
+
+    template<typename Text>
+    static ByteSpan strip_leading(const Text& text) {
+        const auto bytes = text.view();
+        const std::size_t start = skip_leading_whitespace(bytes);
+        return {start, bytes.size() - start, UNKNOWN_COUNT};
+    }
+
+    template<typename Text>
+    static ByteSpan strip_trailing(const Text& text) {
+        const auto bytes = text.view();
+        if (bytes.empty()) {
+            return {0, 0, 0};
+        }
+
+        // Skip trailing whitespace characters, walking back one group at a time
+        std::size_t end = bytes.size();
+        std::size_t group_start = end;
+        Utf16Group group{};
+        while (true) {
+            group_start = last_group_start(bytes, end);
+            group = group_at(bytes, group_start);
+            if (!is_strip_whitespace(group) || group_start == 0) {
+                break;
+            }
+            end = group_start;
+        }
+
+        // The entire string is whitespace (a leading zero width joiner or non-joiner is kept)
+        if (group_start == 0 && is_strip_whitespace(group) &&
+            group.unit[0] != 0x200C && group.unit[0] != 0x200D) {
+            return {0, 0, 0};
+        }
+        return {0, end, UNKNOWN_COUNT};
+    }
+
+    template<typename Text>
+    static bool is_stripped(const Text& text) {
+        const auto bytes = text.view();
+        if (bytes.empty()) {
+            return true;
+        }
+
+        // Check the first code unit (the high surrogate of a pair is not whitespace)
+        if (is_strip_whitespace(group_at(bytes, 0).unit[0])) {
+            return false;
+        }
+
+        // Check the last code unit (the low surrogate of a pair is not whitespace)
+        const auto last = group_at(bytes, last_group_start(bytes, bytes.size()));
+        return !is_strip_whitespace(last.unit[last.units - 1]);
+    }
+
+private:
+    // Get the byte offset of the first character that is not whitespace
+    static std::size_t skip_leading_whitespace(std::string_view bytes) {
+        std::size_t start = 0;
+        while (start < bytes.size()) {
+            const auto group = group_at(bytes, start);
+            if (!is_strip_whitespace(group)) {
+                break;
+            }
+            start += group.bytes;
+        }
+        return start;
+    }
+};
+
+// Operations on ropes. A rope is a block concatenating two blocks, its
+// children, which are ropes themselves or flat blocks: the leaves. Ropes are
+// balanced like AVL trees, the depths of the children of a node differing by
+// at most one, so the depth of a rope is logarithmic in its number of leaves.
+// Short leaves are merged as they are joined, so appending small pieces one by
+// one does not grow a leaf per piece.
+//
+// Leaves are only joined where no UTF-8 sequence spans the boundary. The
+// groups of a rope are then those of its leaves, and its UTF-16 length is the
+// sum of theirs, so UTF-16 indices are resolved by descending the tree.
+struct Rope {
+    // Concatenations shorter than this (in bytes) are copied into a single block
+    static constexpr std::size_t MIN_BYTES = 512;
+
+    static String concat(const String& left, const String& right) {
+        const std::size_t length = byte_length(left) + byte_length(right);
+        // A continuation byte may complete a sequence at the end of left, so
+        // such parts are copied and decoded together
+        if (length < MIN_BYTES || !starts_group(right)) {
+            std::string bytes;
+            bytes.reserve(length);
+            bytes.append(left.view());
+            bytes.append(right.view());
+            return String(std::move(bytes));
+        }
+        return String(join(left.to_block(), right.to_block(), String::memory_resource()));
+    }
+
+    // Get the part of a rope string between two UTF-16 indices, with the
+    // checks and rounding of String::substring
+    static String substring(const String& text, std::size_t begin_index, std::size_t end_index) {
+        const std::size_t length = text.length();
+        if (begin_index > length) {
+            throw StringIndexOutOfBoundsException("beginIndex is out of bounds");
+        }
+        if (end_index > length) {
+            throw StringIndexOutOfBoundsException("endIndex is out of bounds");
+        }
+        if (begin_index > end_index) {
+            throw StringIndexOutOfBoundsException("beginIndex cannot be larger than endIndex");
+        }
+        const ImplRef part = slice(text.pimpl(), begin_index, end_index, text.pimpl()->resource());
+        if (!part) {
+            return String::EMPTY;
+        }
+        // Short parts are copied rather than kept as small ropes or blocks
+        if (part->is_rope() ? part->length() < MIN_BYTES : String::fits_inline(part->length())) {
+            char bytes[MIN_BYTES];
+            part->copy_bytes(bytes);
+            return String(bytes, part->length());
+        }
+        return String(part);
+    }
+
+    static Char char_at(const String& text, std::size_t index) {
+        if (index >= text.length()) {
+            throw StringIndexOutOfBoundsException("Index out of bounds");
+        }
+        const String leaf(find_leaf(text.pimpl(), index));
+        return leaf.char_at(index);
+    }
+
+    static CodePoint code_point_at(const String& text, std::size_t index) {
+        if (index >= text.length()) {
+            throw StringIndexOutOfBoundsException("Index out of bounds");
+        }
+        // Surrogate pairs never span leaves
+        const String leaf(find_leaf(text.pimpl(), index));
+        return leaf.code_point_at(index);
+    }
+
+private:
+    static std::size_t byte_length(const String& str) {
+        return str.is_inline() ? str.inline_bytes().size() : str.pimpl()->length();
+    }
+
+    // Check if a non-empty string starts with a byte that always begins a group,
+    // whatever precedes it: any byte but a continuation byte
+    static bool starts_group(const String& str) {
+        if (str.is_inline()) {
+            return (static_cast<unsigned char>(str.inline_bytes()[0]) & 0xC0) != 0x80;
+        }
+        const StringImpl* leaf = str.pimpl().get();
+        while (leaf->is_rope()) {
+            leaf = leaf->rope().left.get();
+        }
+        return (static_cast<unsigned char>(leaf->data()[0]) & 0xC0) != 0x80;
+    }
+
+    // Descend to the leaf holding a UTF-16 code unit, making index relative to it
+    static const ImplRef& find_leaf(const ImplRef& root, std::size_t& index) {
+        const ImplRef* node = &root;
+        while ((*node)->is_rope()) {
+            const RopeNode& children = (*node)->rope();
+            const std::size_t middle = children.left->utf16_length();
+            if (index < middle) {
+                node = &children.left;
+            } else {
+                index -= middle;
+                node = &children.right;
+            }
+        }
+        return *node;
+    }
+
+    // Concatenate two blocks (either may be null for an empty part), descending
+    // the deeper one until the depths match
+    static ImplRef join(const ImplRef& left, const ImplRef& right, std::pmr::memory_resource* resource) {
+        if (!left || !right) {
+            return left ? left : right;
+        }
+        const std::size_t left_depth = left->depth();
+        const std::size_t right_depth = right->depth();
+        if (left_depth > right_depth + 1) {
+            const RopeNode& children = left->rope();
+            return balance(children.left, join(children.right, right, resource), resource);
+        }
+        if (right_depth > left_depth + 1) {
+            const RopeNode& children = right->rope();
+            return balance(join(left, children.left, resource), children.right, resource);
+        }
+        return node(left, right, resource);
+    }
+
+    // Create a node from two subtrees whose depths differ by at most two,
+    // rotating if they differ by two
+    static ImplRef balance(const ImplRef& left, const ImplRef& right, std::pmr::memory_resource* resource) {
+        if (left->depth() > right->depth() + 1) {
+            const RopeNode& outer = left->rope();
+            if (outer.left->depth() >= outer.right->depth()) {
+                return node(outer.left, node(outer.right, right, resource), resource);
+            }
+            const RopeNode& inner = outer.right->rope();
+            return node(node(outer.left, inner.left, resource), node(inner.right, right, resource), resource);
+        }
+        if (right->depth() > left->depth() + 1) {
+            const RopeNode& outer = right->rope();
+            if (outer.right->depth() >= outer.left->depth()) {
+                return node(node(left, outer.left, resource), outer.right, resource);
+            }
+            const RopeNode& inner = outer.left->rope();
+            return node(node(left, inner.left, resource), node(inner.right, outer.right, resource), resource);
+        }
+        return node(left, right, resource);
+    }
+
+    // Create a node from two subtrees, merging them if they are short leaves
+    static ImplRef node(const ImplRef& left, const ImplRef& right, std::pmr::memory_resource* resource) {
+        const std::size_t length = left->length() + right->length();
+        if (!left->is_rope() && !right->is_rope() && length < MIN_BYTES) {
+            char bytes[MIN_BYTES];
+            std::memcpy(bytes, left->data(), left->length());
+            std::memcpy(bytes + left->length(), right->data(), right->length());
+            return ImplRef(StringImpl::create(bytes, length, resource,
+                                              left->utf16_length() + right->utf16_length()));
+        }
+        return ImplRef(StringImpl::create_rope(left, right, resource));
+    }
+
+    // Get the part of a block between two UTF-16 indices (null if it is empty)
+    static ImplRef slice(const ImplRef& block, std::size_t begin_index, std::size_t end_index,
+                         std::pmr::memory_resource* resource) {
+        if (begin_index >= end_index) {
+            return ImplRef();
+        }
+        if (begin_index == 0 && end_index == block->utf16_length()) {
+            return block;
+        }
+        if (!block->is_rope()) {
+            const String part = String(block).substring(begin_index, end_index);
+            return part.is_empty() ? ImplRef() : part.to_block();
+        }
+        const RopeNode& children = block->rope();
+        const std::size_t middle = children.left->utf16_length();
+        if (end_index <= middle) {
+            return slice(children.left, begin_index, end_index, resource);
+        }
+        if (begin_index >= middle) {
+            return slice(children.right, begin_index - middle, end_index - middle, resource);
+        }
+        return join(slice(children.left, begin_index, middle, resource),
+                    slice(children.right, 0, end_index - middle, resource), resource);
+    }
+};
+
+} // namespace detail
+
+namespace {
+
+// The block of inline strings
+constinit const detail::ImplRef no_block;
+
+} // namespace
+
+// String class constructors
+String::String() {}
+
+const String String::EMPTY;
+
+String::String(const std::string& str) : String(str.data(), str.length(), memory_resource()) {}
+
+String::String(std::string&& str) {
+    if (fits_inline(str.size())) {
+        store_inline(str.data(), str.size());
+    } else {
+        store_block(detail::ImplRef(detail::StringImpl::adopt(std::move(str), memory_resource())));
+    }
+}
+
+String::String(const char* str, std::size_t length) : String(str, length, memory_resource()) {}
+
+String::String(const std::string& str, std::pmr::memory_resource* resource)
+    : String(str.data(), str.length(), resource) {}
+
+String::String(const char* str, std::size_t length, std::pmr::memory_resource* resource) {
+    if (fits_inline(length)) {
+        store_inline(str, length);
+    } else {
+        store_block(detail::ImplRef(detail::StringImpl::create(str, length, resource)));
+    }
+}
+
+String::String(const String& other) {
+    if (other.is_inline()) {
+        std::memcpy(storage_, other.storage_, sizeof(storage_));
+    } else {
+        store_block(other.pimpl());
+    }
+}
+
+String::String(String&& other) noexcept {
+    // A block reference is moved by its bits, leaving other empty
+    std::memcpy(storage_, other.storage_, sizeof(storage_));
+    if (!is_inline()) {
+        other.storage_[INLINE_CAPACITY] = 0;
+    }
+}
+
+String& String::operator=(const String& other) {
+    if (this != &other) {
+        *this = String(other);
+    }
+    return *this;
+}
+
+String& String::operator=(String&& other) noexcept {
+    if (this != &other) {
+        release_storage();
+        std::memcpy(storage_, other.storage_, sizeof(storage_));
+        if (!is_inline()) {
+            other.storage_[INLINE_CAPACITY] = 0;
+        }
+    }
+    return *this;
+}
+
+String::~String() {
+    release_storage();
+}
+
+const detail::ImplRef& String::pimpl() const {
+    if (is_inline()) {
+        return no_block;
+    }
+    return *std::launder(reinterpret_cast<const detail::ImplRef*>(storage_));
+}
+
+void String::store_inline(const char* bytes, std::size_t length) {
+    release_storage();
+    std::memcpy(storage_, bytes, length);
+    storage_[INLINE_CAPACITY] = static_cast<char>(length);
+}
+
+void String::store_block(detail::ImplRef impl) {
+    release_storage();
+    if (impl) {
+        ::new (static_cast<void*>(storage_)) detail::ImplRef(std::move(impl));
+        storage_[INLINE_CAPACITY] = static_cast<char>(HEAP);
+    } else {
+        storage_[INLINE_CAPACITY] = 0;
+    }
+}
+
+void String::release_storage() noexcept {
+    if (!is_inline()) {
+        std::destroy_at(std::launder(reinterpret_cast<detail::ImplRef*>(storage_)));
+    }
+    storage_[INLINE_CAPACITY] = 0;
+}
+
+String::MemoryScope::MemoryScope(std::pmr::memory_resource* resource) : previous_(scoped_resource) {
+    scoped_resource = resource;
+}
+
+String::MemoryScope::~MemoryScope() {
+    scoped_resource = previous_;
+}
+
+std::pmr::memory_resource* String::memory_resource() {
+    return scoped_resource;
+}
+
+String::String(detail::ImplRef impl) {
+    store_block(std::move(impl));
+}
+
+String String::slice(std::size_t offset, std::size_t length) const {
+    return slice(offset, length, detail::UNKNOWN_COUNT);
+}
+
+String String::slice(std::size_t offset, std::size_t length, std::size_t utf16_length) const {
+    if (fits_inline(length)) {
+        return String(view().data() + offset, length);
+    }
+    // Copy slices too small to justify keeping the whole buffer alive
+    const double threshold = compaction_fraction.load(std::memory_order_relaxed);
+    if (length < threshold * static_cast<double>(pimpl()->owner()->length())) {
+        return String(detail::ImplRef(detail::StringImpl::create(view().data() + offset, length,
+                                                                 pimpl()->owner()->resource(), utf16_length)));
+    }
+    return String(detail::ImplRef(detail::StringImpl::create_view(pimpl().get(), offset, length, utf16_length)));
+}
+
+String String::subspan(const detail::ByteSpan& span) const {
+    if (span.length == view().size()) {
+        return *this;
+    }
+    if (span.length == 0) {
+        return EMPTY;
+    }
+    return slice(span.offset, span.length, span.utf16_length);
+}
+
+std::size_t String::known_utf16_length() const {
+    return pimpl() ? pimpl()->known_utf16_length() : detail::UNKNOWN_COUNT;
+}
+
+detail::ImplRef String::to_block() const {
+    if (pimpl()) {
+        return pimpl();
+    }
+    return detail::ImplRef(detail::StringImpl::create(inline_bytes().data(), inline_bytes().size(),
+                                                      memory_resource()));
+}
+
+bool String::is_unflattened_rope() const {
+    return pimpl() && pimpl()->is_rope() && !pimpl()->flattened();
+}
+
+std::size_t String::rope_depth() const {
+    return pimpl() ? pimpl()->depth() : 0;
+}
+
+std::string_view String::view() const {
+    return is_inline() ? inline_bytes() : pimpl()->view();
+}
+
+bool String::is_ascii() const {
+    const std::uint8_t traits = pimpl() ? pimpl()->traits() : detail::scan_utf8_traits(inline_bytes().data(), inline_bytes().size());
+    return traits & detail::TRAITS_ASCII;
+}
+
+bool String::is_bmp() const {
+    const std::uint8_t traits = pimpl() ? pimpl()->traits() : detail::scan_utf8_traits(inline_bytes().data(), inline_bytes().size());
+    return traits & detail::TRAITS_BMP;
+}
+
+detail::Utf16Counts String::encoded_counts() const {
+    if (is_ascii()) {
+        return {view().size(), view().size()};
+    }
+    return detail::count_encoded_utf16(view().data(), view().size());
+}
+
+detail::Utf16Position String::locate(std::size_t index) const {
+    // In ASCII strings each byte is one code unit
+    if (is_ascii()) {
+        const std::size_t position = std::min(index, view().size());
+        return {position, position};
+    }
+    // Inline strings are short enough to be scanned from the start, and
+    // strings whose policy forbids an index are scanned on every lookup
+    if (is_inline() || !indexes_utf16(*pimpl())) {
+        return detail::scan_to_unit(view(), {0, 0}, index);
+    }
+    return pimpl()->utf16_index().locate(index);
+}
+
+std::size_t String::index_of_byte(std::size_t byte) const {
+    if (is_ascii()) {
+        return byte;
+    }
+    if (is_inline() || !indexes_utf16(*pimpl())) {
+        return detail::scan_to_byte(view(), {0, 0}, byte);
+    }
+    return pimpl()->utf16_index().index_of_byte(byte);
+}
+
+auto String::char_at(Index index) const -> Char {
+    // Ropes are indexed through their tree until they are flattened
+    if (is_unflattened_rope()) {
+        return detail::Rope::char_at(*this, index.value());
+    }
+    return detail::TextQueries::char_at(*this, index.value());
+}
+
+auto String::char_value(Index index) const -> char16_t {
+    return char_at(index).value();
+}
+
+// Implementation of valueOf methods for primitive types
+String String::valueOf(bool b) {
+    return b ? "true"_s : "false"_s;
+}
+
+String String::valueOf(char c) {
+    return String(std::string(1, c));
+}
+
+String String::valueOf(int i) {
+    return String(std::to_string(i));
+}
+
+String String::valueOf(long l) {
+    return String(std::to_string(l));
+}
+
+String String::valueOf(float f) {
+    if (std::isnan(f)) {
+        return "NaN"_s;
+    } else if (std::isinf(f)) {
+        return f > 0 ? "Infinity"_s : "-Infinity"_s;
+    }
+    return String(std::to_string(f));
+}
+
+String String::valueOf(double d) {
+    if (std::isnan(d)) {
+        return "NaN"_s;
+    } else if (std::isinf(d)) {
+        return d > 0 ? "Infinity"_s : "-Infinity"_s;
+    }
+    return String(std::to_string(d));
+}
+
+// Implementation of methods moved from header
+std::size_t String::length() const {
+    // Heap-backed strings memoize their UTF-16 length
+    if (pimpl()) {
+        return pimpl()->utf16_length();
+    }
+    // Inline strings are short enough to be counted on every use
+    return detail::count_utf16(inline_bytes()).units;
+}
+
+bool String::is_empty() const {
+    // Does not flatten ropes
+    return pimpl() ? pimpl()->length() == 0 : inline_bytes().empty();
+}
+
+bool String::equals(const String& other) const {
+    // Fast path: check if strings share data and have same offset/length
+    if (pimpl() && other.pimpl() && shares_data_with(other) && 
+        pimpl()->offset() == other.pimpl()->offset() && 
+        pimpl()->length() == other.pimpl()->length()) {
+        return true;
     }
     
-    // If the entire string is whitespace, return empty string
-    if (start == utf16.length()) {
-        return String();
+    // Otherwise do a byte-by-byte comparison of the substrings
+    // This is more efficient than creating full string copies with to_string()
+    return view() == other.view();
+}
+
+simple::CompareResult String::compare_to(const String& other) const {
+    // Fast path: check if strings share data and have same offset/length
+    if (pimpl() && other.pimpl() && shares_data_with(other) && 
+        pimpl()->offset() == other.pimpl()->offset() && 
+        pimpl()->length() == other.pimpl()->length()) {
+        return simple::CompareResult::EQUAL;
     }
     
-    // If no trimming needed, return the original string
-    if (start == 0) {
-        return *this;
+    // Otherwise compare the actual substrings
+    int result = view().compare(other.view());
+    if (result < 0) return simple::CompareResult::LESS;
+    if (result > 0) return simple::CompareResult::GREATER;
+    return simple::CompareResult::EQUAL;
+}
+
+Char String::operator[](Index index) const { 
+    return char_at(index); 
+}
+
+simple::CodePoint String::code_point_at(Index index) const {
+    if (is_unflattened_rope()) {
+        return detail::Rope::code_point_at(*this, index.value());
     }
-    
-    // Return the trimmed substring
-    return substring(Index(start));
+    return detail::TextQueries::code_point_at(*this, index.value());
 }
 
-String String::stripTrailing() const {
-    // Fast path: if string is empty, return this
+simple::CodePoint String::code_point_before(Index index) const {
+    return detail::TextQueries::code_point_before(*this, index.value());
+}
+
+std::size_t String::code_point_count(Index begin_index, Index end_index) const {
+    // Heap-backed strings memoize the count for the whole string
+    if (pimpl() && begin_index == 0 && end_index.value() == length()) {
+        return pimpl()->code_point_count();
+    }
+    return detail::TextQueries::code_point_count(*this, begin_index.value(), end_index.value());
+}
+
+const std::string& String::to_string() const { 
+    // Inline strings have no room for a std::string, so theirs is a copy in a
+    // buffer of the thread, reused by its next call for an inline string
+    if (is_inline()) {
+        static thread_local std::string inline_string;
+        inline_string.assign(inline_bytes());
+        return inline_string;
+    }
+    // The bytes are not stored as a std::string, so one is materialized on first use
+    return pimpl()->std_string();
+}
+
+String String::substring(Index beginIndex) const {
+    if (is_unflattened_rope()) {
+        return detail::Rope::substring(*this, beginIndex.value(), length());
+    }
+    return subspan(detail::TextQueries::substring(*this, beginIndex.value()));
+}
+
+String String::substring(Index beginIndex, Index endIndex) const {
+    if (is_unflattened_rope()) {
+        return detail::Rope::substring(*this, beginIndex.value(), endIndex.value());
+    }
+    return subspan(detail::TextQueries::substring(*this, beginIndex.value(), endIndex.value()));
+}
+
+String String::concat(const String& str) const {
+    if (str.is_empty()) {
+        return *this;
+    }
     if (is_empty()) {
+        return str;
+    }
+    return detail::Rope::concat(*this, str);
+}
+
+String String::insert(Index offset, const String& str) const {
+    if (offset.value() > length()) {
+        throw StringIndexOutOfBoundsException("offset is out of bounds");
+    }
+    return substring(0, offset).concat(str).concat(substring(offset));
+}
+
+// Operator overloads
+bool String::operator==(const String& other) const { 
+    return equals(other); 
+}
+
+bool String::operator!=(const String& other) const { 
+    return !equals(other); 
+}
+
+bool String::operator<(const String& other) const { 
+    return compare_to(other).is_less(); 
+}
+
+bool String::operator<=(const String& other) const { 
+    return compare_to(other).is_less_or_equal(); 
+}
+
+bool String::operator>(const String& other) const { 
+    return compare_to(other).is_greater(); 
+}
+
+bool String::operator>=(const String& other) const { 
+    return compare_to(other).is_greater_or_equal(); 
+}
+
+// Implementation of string replace methods
+String String::replace(Char oldChar, Char newChar) const {
+    // If the characters are the same, return the original string
+    if (oldChar == newChar) {
+        return *this;
+    }
+    
+    // Get the UTF-16 representation
+    std::u16string result = get_utf16();
+    if (result.empty()) {
         return *this;
     }
     
-    // Get UTF-16 representation for proper indexing
-    const auto& utf16 = get_utf16();
+    bool modified = false;
     
-    // Find end index (last non-whitespace character)
-    std::size_t end = utf16.length() - 1;
-    while (end < utf16.length()) {  // Using < to handle potential underflow when end is 0
-        char16_t ch = utf16[end];
-        // Check for surrogate pair at the end
-        if (ch >= 0xDC00 && ch <= 0xDFFF && end > 0) {
-            char16_t high = utf16[end - 1];
-            if (high >= 0xD800 && high <= 0xDBFF) {
-                // Surrogate pair
-                // For surrogate pairs, we don't have specific whitespace checks
-                // Just assume they're not whitespace for now
-                break;
-            }
+    // Replace all occurrences
+    for (std::size_t i = 0; i < result.length(); ++i) {
+        if (result[i] == oldChar.value()) {
+            result[i] = newChar.value();
+            modified = true;
+        }
+    }
+    
+    // If no replacements were made, return the original string
+    if (!modified) {
+        return *this;
+    }
+    
+    // Convert back to UTF-8
+    std::string utf8 = boost::locale::conv::utf_to_utf<char>(result);
+    return String(utf8);
+}
+
+String String::replace(const String& target, const String& replacement) const {
+    // If the target is empty, insert the replacement between each character
+    if (target.is_empty()) {
+        if (is_empty()) {
+            return replacement;
         }
         
-        // Regular code unit
+        const std::u16string utf16 = get_utf16();
+        const std::u16string repl_utf16 = replacement.get_utf16();
+        std::u16string result;
+        result.reserve(utf16.length() * (repl_utf16.length() + 1));
         
-        // Check if the character is whitespace
-        bool is_whitespace = false;
-        // ASCII whitespace
-        if (ch <= 0x20 && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v')) {
-            is_whitespace = true;
-        } 
-        // Unicode whitespace
-        else if ((ch >= 0x2000 && ch <= 0x200B) || // Various spaces including ZWSP (0x200B)
-                 ch == 0x200C ||                   // Zero width non-joiner
-                 ch == 0x200D ||                   // Zero width joiner
-                 ch == 0x3000 ||                   // Ideographic space
-                 ch == 0xFEFF ||                   // Zero width no-break space
-                 ch == 0x00A0 ||                   // Non-breaking space
-                 ch == 0x2028 ||                   // Line separator
-                 ch == 0x2029) {                  // Paragraph separator
-            is_whitespace = true;
-        }
+        // Add replacement at the beginning
+        result.append(repl_utf16);
         
-        if (!is_whitespace) {
-            break;
+        // Add each character with replacement after it
+        for (std::size_t i = 0; i < utf16.length(); ++i) {
+            result.push_back(utf16[i]);
+            result.append(repl_utf16);
         }
         
-        if (end == 0) {  // Prevent underflow
-            break;
-        }
-        --end;
+        std::string utf8 = boost::locale::conv::utf_to_utf<char>(result);
+        return String(utf8);
     }
     
-    // If the entire string is whitespace, return empty string
-    if (end == 0) {
-        char16_t ch = utf16[0];
-        bool is_whitespace = false;
-        // ASCII whitespace
-        if (ch <= 0x20 && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v')) {
-            is_whitespace = true;
-        } 
-        // Unicode whitespace
-        else if ((ch >= 0x2000 && ch <= 0x200B) || // Various spaces
-                 ch == 0x3000 ||                   // Ideographic space
-                 ch == 0xFEFF ||                   // Zero width no-break space
-                 ch == 0x00A0 ||                   // Non-breaking space
-                 ch == 0x2028 ||                   // Line separator
-                 ch == 0x2029) {                  // Paragraph separator
-            is_whitespace = true;
-        }
-        
-        if (is_whitespace) {
-            return String();
-        }
+    // If the target is the same as this string, return the replacement
+    if (equals(target)) {
+        return replacement;
     }
     
-    // If no trimming needed, return the original string
-    if (end == utf16.length() - 1) {
+    // If the target is not found, return the original string
+    Index index = indexOf(target);
+    if (index.is_invalid()) {
         return *this;
     }
     
-    // Return the trimmed substring
-    return substring(Index(0), Index(end + 1));
+    // Build the result string by replacing all occurrences
+    std::string result(view());
+    std::string_view target_str = target.view();
+    std::string_view replacement_str = replacement.view();
+    
+    std::size_t pos = 0;
+    std::size_t target_len = target_str.length();
+    
+    while ((pos = result.find(target_str, pos)) != std::string::npos) {
+        result.replace(pos, target_len, replacement_str);
+        pos += replacement_str.length();
+    }
+    
+    return String(result);
 }
 
-bool String::isStripped() const {
-    // Fast path: if string is empty, it's already stripped
-    if (is_empty()) {
-        return true;
+String String::intern() const {
+    // A block holding exactly this string can become canonical as is; parts of
+    // larger buffers are copied so the table does not keep the buffers alive,
+    // as are blocks from memory resources that may not outlive the table
+    const detail::ImplRef candidate =
+        (pimpl() && pimpl()->owner() == pimpl().get() && !pimpl()->resource()) ? pimpl() : detail::ImplRef();
+    return String(detail::InternTable::instance().intern(view(), candidate));
+}
+
+String String::compact() const {
+    if (is_inline() || visible_bytes() == retained_bytes()) {
+        return *this;
     }
-    
-    // Get UTF-16 representation for proper indexing
-    const auto& utf16 = get_utf16();
-    
-    // Check first character
-    char16_t first = utf16[0];
-    if (first >= 0xD800 && first <= 0xDBFF && utf16.length() > 1) {
-        char16_t low = utf16[1];
-        if (low >= 0xDC00 && low <= 0xDFFF) {
-            // Surrogate pair
-        }
-    } else {
+    // The owner of a rope is its flattened copy, which compacting must not make
+    const detail::StringImpl& impl = *pimpl();
+    return String(detail::ImplRef(impl.copy_block(impl.is_rope() ? impl.resource() : impl.owner()->resource())));
+}
+
+std::size_t String::retained_bytes() const {
+    return pimpl() ? pimpl()->retained_bytes() : inline_bytes().size();
+}
+
+std::size_t String::visible_bytes() const {
+    // The length of a rope is known without flattening it
+    return pimpl() ? pimpl()->length() : inline_bytes().size();
+}
 
+void String::set_compaction_threshold(double fraction) {
+    if (!(fraction >= 0.0 && fraction <= 1.0)) {
+        throw std::invalid_argument("Compaction threshold must be between 0 and 1");
     }
-    
-    // Check if the first character is whitespace
-    bool is_first_whitespace = false;
-    // ASCII whitespace
-    if (first <= 0x20 && (first == ' ' || first == '\t' || first == '\n' || first == '\r' || first == '\f' || first == '\v')) {
-        is_first_whitespace = true;
-    } 
-    // Unicode whitespace
-    else if ((first >= 0x2000 && first <= 0x200B) || // Various spaces including ZWSP (0x200B)
-             first == 0x200C ||                   // Zero width non-joiner
-             first == 0x200D ||                   // Zero width joiner
-             first == 0x3000 ||                   // Ideographic space
-             first == 0xFEFF ||                   // Zero width no-break space
-             first == 0x00A0 ||                   // Non-breaking space
-             first == 0x2028 ||                   // Line separator
-             first == 0x2029) {                  // Paragraph separator
-        is_first_whitespace = true;
+    compaction_fraction.store(fraction, std::memory_order_relaxed);
+}
+
+double String::compaction_threshold() {
+    return compaction_fraction.load(std::memory_order_relaxed);
+}
+
+std::size_t String::hash_code() const {
+    // Inline strings are short enough to be hashed every time
+    return pimpl() ? pimpl()->hash() : detail::hash_bytes(inline_bytes());
+}
+
+String::MemoryUsage String::memory_usage() const {
+    MemoryUsage usage{0, 0, 0, false};
+    if (pimpl()) {
+        pimpl()->account(usage, true);
+        usage.utf16_index = pimpl()->has_utf16_index();
     }
-    
-    if (is_first_whitespace) {
-        return false;  // Leading whitespace found
+    return usage;
+}
+
+String::MemoryStats String::memory_stats() {
+    using detail::MemoryCounters;
+    return {MemoryCounters::total(MemoryCounters::LIVE_BLOCKS), MemoryCounters::total(MemoryCounters::BLOCK_BYTES),
+            MemoryCounters::total(MemoryCounters::LIVE_CACHES), MemoryCounters::total(MemoryCounters::CACHE_BYTES),
+            MemoryCounters::total(MemoryCounters::CACHE_BUILDS)};
+}
+
+void String::prewarm_utf16() const {
+    if (is_inline() || is_ascii() || !indexes_utf16(*pimpl())) {
+        return;
     }
-    
-    // Check last character
-    char16_t last = utf16[utf16.length() - 1];
-    if (last >= 0xDC00 && last <= 0xDFFF && utf16.length() > 1) {
-        char16_t high = utf16[utf16.length() - 2];
-        if (high >= 0xD800 && high <= 0xDBFF) {
-            // Surrogate pair
-        }
-    } else {
+    pimpl()->utf16_index().build();
+}
 
+std::size_t String::release_caches() {
+    if (is_inline()) {
+        return 0;
     }
-    
-    // Check if the last character is whitespace
-    bool is_last_whitespace = false;
-    // ASCII whitespace
-    if (last <= 0x20 && (last == ' ' || last == '\t' || last == '\n' || last == '\r' || last == '\f' || last == '\v')) {
-        is_last_whitespace = true;
-    } 
-    // Unicode whitespace
-    else if ((last >= 0x2000 && last <= 0x200B) || // Various spaces including ZWSP (0x200B)
-             last == 0x200C ||                   // Zero width non-joiner
-             last == 0x200D ||                   // Zero width joiner
-             last == 0x3000 ||                   // Ideographic space
-             last == 0xFEFF ||                   // Zero width no-break space
-             last == 0x00A0 ||                   // Non-breaking space
-             last == 0x2028 ||                   // Line separator
-             last == 0x2029) {                  // Paragraph separator
-        is_last_whitespace = true;
+    // Other holders of the block may be using its caches
+    if (!pimpl().counted() || !pimpl()->unique()) {
+        return 0;
     }
-    
-    if (is_last_whitespace) {
-        return false;  // Trailing whitespace found
+    return pimpl()->release_caches();
+}
+
+void String::set_utf16_cache_policy(Utf16CachePolicy policy) {
+    // Inline strings never have an index
+    if (is_inline()) {
+        return;
+    }
+    // Move to a block of our own, sharing the bytes, so the strings sharing
+    // the current block keep their policy
+    if (!pimpl().counted() || !pimpl()->unique()) {
+        if (pimpl()->is_rope()) {
+            const detail::RopeNode& children = pimpl()->rope();
+            store_block(detail::ImplRef(detail::StringImpl::create_rope(children.left, children.right,
+                                                                        pimpl()->resource())));
+        } else {
+            store_block(detail::ImplRef(detail::StringImpl::create_view(pimpl().get(), 0, pimpl()->length(),
+                                                                        pimpl()->known_utf16_length())));
+        }
     }
-    
-    return true;  // No leading or trailing whitespace
+    pimpl()->set_utf16_policy(static_cast<std::uint8_t>(policy) + 1);
+}
+
+void String::set_default_utf16_cache_policy(Utf16CachePolicy policy) {
+    default_utf16_policy.store(policy, std::memory_order_relaxed);
+}
+
+String::Utf16CachePolicy String::default_utf16_cache_policy() {
+    return default_utf16_policy.load(std::memory_order_relaxed);
+}
+
+std::size_t String::purge_interned() {
+    return detail::InternTable::instance().purge();
+}
+
+String::InternStats String::intern_stats() {
+    return detail::InternTable::instance().stats();
+}
+
+// Private methods
+std::u16string String::get_utf16() const {
+    return decode_units(view());
+}
+
+bool String::shares_data_with(const String& other) const {
+    // Inline strings have no shared data (empty strings trivially share theirs)
+    if (is_inline() || other.is_inline()) {
+        return is_empty() && other.is_empty();
+    }
+    return pimpl()->shares_data_with(*other.pimpl());
+}
+
+// Implementation of indexOf methods
+Index String::indexOf(Char ch) const {
+    return indexOf(ch, Index(0));
+}
+
+Index String::indexOf(Char ch, Index fromIndex) const {
+    return detail::TextQueries::index_of(*this, ch.value(), fromIndex.value());
+}
+
+Index String::indexOf(const String& str) const {
+    return indexOf(str, Index(0));
+}
+
+Index String::indexOf(const String& str, Index fromIndex) const {
+    return detail::TextQueries::index_of(*this, str.view(), fromIndex.value());
+}
+
+// Implementation of lastIndexOf methods
+Index String::lastIndexOf(Char ch) const {
+    // A byte length is never less than the UTF-16 length, so this searches the whole string
+    return lastIndexOf(ch, Index(view().size()));
+}
+
+Index String::lastIndexOf(Char ch, Index fromIndex) const {
+    return detail::TextQueries::last_index_of(*this, ch.value(), fromIndex.value());
+}
+
+Index String::lastIndexOf(const String& str) const {
+    // A byte length is never less than the UTF-16 length, so this searches the whole string
+    return lastIndexOf(str, Index(view().size()));
+}
+
+Index String::lastIndexOf(const String& str, Index fromIndex) const {
+    return detail::TextQueries::last_index_of(*this, str.view(), fromIndex.value());
+}
+
+// Implementation of string matching methods
+bool String::contains(const String& str) const {
+    // Leverage the existing indexOf method
+    return indexOf(str) != Index::invalid;
+}
+
+bool String::startsWith(const String& prefix) const {
+    // Delegate to the offset version with offset 0
+    return startsWith(prefix, Index(0));
+}
+
+bool String::startsWith(const String& prefix, Index offset) const {
+    return detail::TextQueries::starts_with(*this, prefix.view(), offset.value());
+}
+
+bool String::endsWith(const String& suffix) const {
+    return detail::TextQueries::ends_with(*this, suffix.view());
+}
+
+// Implementation of string trimming methods
+
+String String::trim() const {
+    return subspan(detail::TextQueries::trim(*this));
+}
+
+String String::strip() const {
+    return subspan(detail::TextQueries::strip(*this));
+}
+
+String String::stripLeading() const {
+    return subspan(detail::TextQueries::strip_leading(*this));
+}
+
+String String::stripTrailing() const {
+    return subspan(detail::TextQueries::strip_trailing(*this));
+}
+
+bool String::isStripped() const {
+    return detail::TextQueries::is_stripped(*this);
 }
 
 // Implementation of encoding methods
@@ -1229,279 +2680,102 @@ std::vector<uint8_t> String::getBytes(Encoding encoding, EncodingErrorHandling e
 }
 
 std::vector<uint8_t> String::getBytes(Encoding encoding, BOMPolicy bomPolicy, EncodingErrorHandling errorHandling) const {
-    std::vector<uint8_t> result;
-    std::string utf8_str = to_string();
-    
-    try {
-        switch (encoding) {
-            case Encoding::UTF_8: {
-                // Convert to UTF-8 (no conversion needed, just copy bytes)
-                result.reserve(utf8_str.size() + (bomPolicy == BOMPolicy::INCLUDE ? 3 : 0));
-                
-                // Add BOM if requested
-                if (bomPolicy == BOMPolicy::INCLUDE) {
-                    result.push_back(0xEF);
-                    result.push_back(0xBB);
-                    result.push_back(0xBF);
-                }
-                
-                // Copy UTF-8 bytes
-                for (char c : utf8_str) {
-                    result.push_back(static_cast<uint8_t>(c));
-                }
-                break;
-            }
-            case Encoding::UTF_16BE: {
-                // Convert to UTF-16BE
-                std::u16string utf16 = boost::locale::conv::utf_to_utf<char16_t>(utf8_str);
-                result.reserve(utf16.size() * 2 + (bomPolicy == BOMPolicy::INCLUDE ? 2 : 0));
-                
-                // Add BOM if requested
-                if (bomPolicy == BOMPolicy::INCLUDE) {
-                    result.push_back(0xFE);
-                    result.push_back(0xFF);
-                }
-                
-                // Convert to big-endian byte order
-                for (char16_t ch : utf16) {
-                    // For UTF-16BE, the most significant byte comes first
-                    result.push_back(static_cast<uint8_t>(ch >> 8));
-                    result.push_back(static_cast<uint8_t>(ch & 0xFF));
-                }
-                break;
-            }
-            case Encoding::UTF_16LE: {
-                // Convert to UTF-16LE
-                std::u16string utf16 = boost::locale::conv::utf_to_utf<char16_t>(utf8_str);
-                result.reserve(utf16.size() * 2 + (bomPolicy == BOMPolicy::INCLUDE ? 2 : 0));
-                
-                // Add BOM if requested
-                if (bomPolicy == BOMPolicy::INCLUDE) {
-                    result.push_back(0xFF);
-                    result.push_back(0xFE);
-                }
-                
-                // Convert to little-endian byte order
-                for (char16_t ch : utf16) {
-                    // For UTF-16LE, the least significant byte comes first
-                    result.push_back(static_cast<uint8_t>(ch & 0xFF));
-                    result.push_back(static_cast<uint8_t>(ch >> 8));
-                }
-                break;
-            }
-            case Encoding::UTF_32BE: {
-                // Convert to UTF-32BE
-                std::u32string utf32 = boost::locale::conv::utf_to_utf<char32_t>(utf8_str);
-                result.reserve(utf32.size() * 4 + (bomPolicy == BOMPolicy::INCLUDE ? 4 : 0));
-                
-                // Add BOM if requested
-                if (bomPolicy == BOMPolicy::INCLUDE) {
-                    result.push_back(0x00);
-                    result.push_back(0x00);
-                    result.push_back(0xFE);
-                    result.push_back(0xFF);
-                }
-                
-                // Convert to big-endian byte order
-                for (char32_t ch : utf32) {
-                    // For UTF-32BE, the most significant byte comes first
-                    result.push_back(static_cast<uint8_t>(ch >> 24));
-                    result.push_back(static_cast<uint8_t>((ch >> 16) & 0xFF));
-                    result.push_back(static_cast<uint8_t>((ch >> 8) & 0xFF));
-                    result.push_back(static_cast<uint8_t>(ch & 0xFF));
-                }
-                break;
-            }
-            case Encoding::UTF_32LE: {
-                // Convert to UTF-32LE
-                std::u32string utf32 = boost::locale::conv::utf_to_utf<char32_t>(utf8_str);
-                result.reserve(utf32.size() * 4 + (bomPolicy == BOMPolicy::INCLUDE ? 4 : 0));
-                
-                // Add BOM if requested
-                if (bomPolicy == BOMPolicy::INCLUDE) {
-                    result.push_back(0xFF);
-                    result.push_back(0xFE);
-                    result.push_back(0x00);
-                    result.push_back(0x00);
-                }
-                
-                // Convert to little-endian byte order
-                for (char32_t ch : utf32) {
-                    // For UTF-32LE, the least significant byte comes first
-                    result.push_back(static_cast<uint8_t>(ch & 0xFF));
-                    result.push_back(static_cast<uint8_t>((ch >> 8) & 0xFF));
-                    result.push_back(static_cast<uint8_t>((ch >> 16) & 0xFF));
-                    result.push_back(static_cast<uint8_t>(ch >> 24));
-                }
-                break;
-            }
-            case Encoding::ISO_8859_1: {
-                // Convert to ISO-8859-1 (Latin-1)
-                std::string latin1_str;
-                
-                try {
-                    if (errorHandling == EncodingErrorHandling::THROW) {
-                        // This will throw if any character is outside Latin-1 range
-                        latin1_str = boost::locale::conv::from_utf(utf8_str, "ISO-8859-1", boost::locale::conv::stop);
-                    } else if (errorHandling == EncodingErrorHandling::REPLACE) {
-                        // Use a custom approach for REPLACE since Boost doesn't have a direct replacement mode
-                        std::u16string utf16 = boost::locale::conv::utf_to_utf<char16_t>(utf8_str);
-                        latin1_str.reserve(utf16.size());
-                        bool replacements_made = false;
-                        for (char16_t ch : utf16) {
-                            if (ch <= 0xFF) {
-                                latin1_str.push_back(static_cast<char>(ch));
-                            } else {
-                                latin1_str.push_back('?'); // Replacement character
-                                replacements_made = true;
-                            }
-                        }
-                        
-                        // If we made replacements, we should throw an exception if THROW is specified
-                        if (replacements_made && errorHandling == EncodingErrorHandling::THROW) {
-                            throw EncodingException("Characters outside ISO-8859-1 range",
-                                                 encoding, 0, errorHandling);
-                        }
-                    } else { // IGNORE
-                        // Custom implementation that skips characters outside Latin-1 range
-                        std::u16string utf16 = boost::locale::conv::utf_to_utf<char16_t>(utf8_str);
-                        latin1_str.reserve(utf16.size());
-                        bool chars_ignored = false;
-                        
-                        // Process each character, skipping those outside Latin-1 range
-                        
-                        // Process each character, skipping those outside Latin-1 range
-                        for (char16_t ch : utf16) {
-                            if (ch <= 0xFF) {
-                                latin1_str.push_back(static_cast<char>(ch));
-                            } else {
-                                chars_ignored = true;
-                            }
-                        }
-                        
-                        // Ensure we always have at least one character in the output
-                        if (latin1_str.empty()) {
-                            // If all characters were skipped or input was empty,
-                            // add a placeholder character to ensure test passes
-                            latin1_str.push_back('?');
-                        }
-                        
-                        // If we ignored characters and THROW is specified, throw an exception
-                        if (chars_ignored && errorHandling == EncodingErrorHandling::THROW) {
-                            throw EncodingException("Characters outside ISO-8859-1 range",
-                                                 encoding, 0, errorHandling);
-                        }
-                    }
-                    
-                    // Copy Latin-1 bytes to result
-                    result.reserve(latin1_str.size());
-                    for (char c : latin1_str) {
-                        result.push_back(static_cast<uint8_t>(c));
-                    }
-                } catch (const boost::locale::conv::conversion_error& e) {
-                    throw EncodingException("Failed to convert to ISO-8859-1: " + std::string(e.what()),
-                                         encoding, 0, errorHandling);
-                }
-                break;
-            }
-            case Encoding::ASCII: {
-                // Convert to ASCII
-                std::string ascii_str;
-                ascii_str.reserve(utf8_str.size());
-                bool chars_outside_ascii = false;
-                
-                // Process each character
-                std::u16string utf16 = boost::locale::conv::utf_to_utf<char16_t>(utf8_str);
-                for (char16_t ch : utf16) {
-                    if (ch <= 0x7F) {
-                        ascii_str.push_back(static_cast<char>(ch));
-                    } else {
-                        chars_outside_ascii = true;
-                        if (errorHandling == EncodingErrorHandling::REPLACE) {
-                            ascii_str.push_back('?'); // Replacement character
-                        } else if (errorHandling == EncodingErrorHandling::THROW) {
-                            throw EncodingException("Characters outside ASCII range",
-                                                 encoding, 0, errorHandling);
-                        }
-                        // For IGNORE, we simply skip the character
-                    }
-                }
-                
-                // If we encountered characters outside ASCII range and the error handling is THROW, throw an exception
-                if (chars_outside_ascii && errorHandling == EncodingErrorHandling::THROW) {
-                    throw EncodingException("Characters outside ASCII range",
-                                         encoding, 0, errorHandling);
-                }
-                
-                // Copy ASCII bytes to result
-                result.reserve(ascii_str.size());
-                for (char c : ascii_str) {
-                    result.push_back(static_cast<uint8_t>(c));
-                }
-                break;
+    const bool bom = bomPolicy == BOMPolicy::INCLUDE;
+    // UTF output is encoded straight from the bytes; invalid UTF-8 is skipped
+    switch (encoding) {
+        case Encoding::UTF_8: {
+            const std::string_view bytes = view();
+            std::vector<uint8_t> result;
+            result.reserve(bytes.size() + (bom ? 3 : 0));
+            if (bom) {
+                result.insert(result.end(), {0xEF, 0xBB, 0xBF});
             }
-            default:
-                throw EncodingException("Unsupported encoding", encoding, 0, errorHandling);
+            result.insert(result.end(), bytes.begin(), bytes.end());
+            return result;
         }
-    } catch (const EncodingException& e) {
-        throw;  // Re-throw encoding exceptions
-    } catch (const std::exception& e) {
-        throw EncodingException("Encoding error: " + std::string(e.what()),
-                             encoding, 0, errorHandling);
+        case Encoding::UTF_16BE:
+            return utf16_bytes(view(), length(), detail::ByteOrder::BIG, bom);
+        case Encoding::UTF_16LE:
+            return utf16_bytes(view(), length(), detail::ByteOrder::LITTLE, bom);
+        case Encoding::UTF_32BE:
+            return utf32_bytes(view(), code_point_count(0, length()), detail::ByteOrder::BIG, bom);
+        case Encoding::UTF_32LE:
+            return utf32_bytes(view(), code_point_count(0, length()), detail::ByteOrder::LITTLE, bom);
+        default:
+            break;
     }
-    
+
+    if (encoding != Encoding::ISO_8859_1 && encoding != Encoding::ASCII) {
+        throw EncodingException("Unsupported encoding", encoding, 0, errorHandling);
+    }
+    std::vector<uint8_t> result(narrow_bytes(view(), encoding, errorHandling, nullptr));
+    narrow_bytes(view(), encoding, errorHandling, result.data());
     return result;
 }
 
+std::size_t String::encoded_size(Encoding encoding, BOMPolicy bomPolicy, EncodingErrorHandling errorHandling) const {
+    const std::size_t bom = bomPolicy == BOMPolicy::INCLUDE ? bom_of(encoding).size() : 0;
+    switch (encoding) {
+        case Encoding::UTF_8:
+            return bom + view().size();
+        case Encoding::UTF_16BE:
+        case Encoding::UTF_16LE:
+            return bom + 2 * encoded_counts().units;
+        case Encoding::UTF_32BE:
+        case Encoding::UTF_32LE:
+            return bom + 4 * encoded_counts().code_points;
+        case Encoding::ISO_8859_1:
+        case Encoding::ASCII:
+            return narrow_bytes(view(), encoding, errorHandling, nullptr);
+        default:
+            throw EncodingException("Unsupported encoding", encoding, 0, errorHandling);
+    }
+}
+
+std::size_t String::encode_into(std::span<uint8_t> buffer, Encoding encoding, BOMPolicy bomPolicy,
+                                EncodingErrorHandling errorHandling) const {
+    const std::size_t size = encoded_size(encoding, bomPolicy, errorHandling);
+    if (buffer.size() < size) {
+        throw std::length_error("Buffer too small for the encoded string");
+    }
+    const std::string_view bom = bomPolicy == BOMPolicy::INCLUDE ? bom_of(encoding) : std::string_view();
+    // memcpy() takes no null pointers, even to copy nothing
+    if (!bom.empty()) {
+        std::memcpy(buffer.data(), bom.data(), bom.size());
+    }
+    uint8_t* out = buffer.data() + bom.size();
+    switch (encoding) {
+        case Encoding::UTF_8:
+            if (size != 0) {
+                std::memcpy(out, view().data(), view().size());
+            }
+            break;
+        case Encoding::UTF_16BE:
+        case Encoding::UTF_16LE:
+            encode_units_into<char16_t>(view(), (size - bom.size()) / 2,
+                                        encoding == Encoding::UTF_16BE ? detail::ByteOrder::BIG
+                                                                       : detail::ByteOrder::LITTLE, out);
+            break;
+        case Encoding::UTF_32BE:
+        case Encoding::UTF_32LE:
+            encode_units_into<char32_t>(view(), (size - bom.size()) / 4,
+                                        encoding == Encoding::UTF_32BE ? detail::ByteOrder::BIG
+                                                                       : detail::ByteOrder::LITTLE, out);
+            break;
+        default:
+            narrow_bytes(view(), encoding, errorHandling, out);
+            break;
+    }
+    return size;
+}
+
 std::string String::toStdString() const {
-    return to_string();
+    return std::string(view());
 }
 
 String String::fromBytes(const std::vector<uint8_t>& bytes,
                          Encoding encoding,
                          EncodingErrorHandling errorHandling) {
-    // For UTF-8 with THROW error handling, validate the UTF-8 sequence first
-    if (encoding == Encoding::UTF_8 && errorHandling == EncodingErrorHandling::THROW) {
-        // Check for invalid UTF-8 sequences
-        std::string utf8_str(reinterpret_cast<const char*>(bytes.data()), bytes.size());
-        
-        // Validate UTF-8 by checking byte patterns
-        for (size_t i = 0; i < utf8_str.size(); ++i) {
-            uint8_t byte = static_cast<uint8_t>(utf8_str[i]);
-            
-            if ((byte & 0x80) == 0) {
-                // ASCII character (0xxxxxxx) - valid
-                continue;
-            } else if ((byte & 0xE0) == 0xC0) {
-                // 2-byte sequence (110xxxxx 10xxxxxx)
-                if (i + 1 >= utf8_str.size() || (utf8_str[i+1] & 0xC0) != 0x80) {
-                    throw EncodingException("Invalid UTF-8 sequence: incomplete 2-byte sequence",
-                                         encoding, i, errorHandling);
-                }
-                i++; // Skip the continuation byte
-            } else if ((byte & 0xF0) == 0xE0) {
-                // 3-byte sequence (1110xxxx 10xxxxxx 10xxxxxx)
-                if (i + 2 >= utf8_str.size() || (utf8_str[i+1] & 0xC0) != 0x80 || (utf8_str[i+2] & 0xC0) != 0x80) {
-                    throw EncodingException("Invalid UTF-8 sequence: incomplete 3-byte sequence",
-                                         encoding, i, errorHandling);
-                }
-                i += 2; // Skip the continuation bytes
-            } else if ((byte & 0xF8) == 0xF0) {
-                // 4-byte sequence (11110xxx 10xxxxxx 10xxxxxx 10xxxxxx)
-                if (i + 3 >= utf8_str.size() || (utf8_str[i+1] & 0xC0) != 0x80 || 
-                    (utf8_str[i+2] & 0xC0) != 0x80 || (utf8_str[i+3] & 0xC0) != 0x80) {
-                    throw EncodingException("Invalid UTF-8 sequence: incomplete 4-byte sequence",
-                                         encoding, i, errorHandling);
-                }
-                i += 3; // Skip the continuation bytes
-            } else {
-                // Invalid UTF-8 byte
-                throw EncodingException("Invalid UTF-8 sequence: invalid leading byte",
-                                     encoding, i, errorHandling);
-            }
-        }
-    }
-    
     return fromBytes(bytes, encoding, BOMPolicy::AUTO, errorHandling);
 }
 
@@ -1509,8 +2783,16 @@ String String::fromBytes(const std::vector<uint8_t>& bytes,
                          Encoding encoding,
                          BOMPolicy bomPolicy,
                          EncodingErrorHandling errorHandling) {
-    if (bytes.empty()) {
-        return String("");
+    return fromBytes(bytes.data(), bytes.size(), encoding, bomPolicy, errorHandling);
+}
+
+String String::fromBytes(const uint8_t* bytes,
+                         std::size_t size,
+                         Encoding encoding,
+                         BOMPolicy bomPolicy,
+                         EncodingErrorHandling errorHandling) {
+    if (size == 0) {
+        return EMPTY;
     }
     
     std::string utf8_result;
@@ -1520,7 +2802,7 @@ String String::fromBytes(const std::vector<uint8_t>& bytes,
         // Handle BOM if needed
         if (bomPolicy == BOMPolicy::AUTO || bomPolicy == BOMPolicy::INCLUDE) {
             // Check for UTF-8 BOM (EF BB BF)
-            if (bytes.size() >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF) {
+            if (size >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF) {
                 if (encoding == Encoding::UTF_8) {
                     offset = 3;  // Skip BOM for UTF-8
                 }
@@ -1533,24 +2815,24 @@ String String::fromBytes(const std::vector<uint8_t>& bytes,
                 switch (encoding) {
                     case Encoding::UTF_8:
                         // UTF-8 BOM is EF BB BF
-                        hasBom = (bytes.size() >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF);
+                        hasBom = (size >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF);
                         break;
                     case Encoding::UTF_16BE:
                         // UTF-16BE BOM is FE FF
-                        hasBom = (bytes.size() >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF);
+                        hasBom = (size >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF);
                         break;
                     case Encoding::UTF_16LE:
                         // UTF-16LE BOM is FF FE
-                        hasBom = (bytes.size() >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE);
+                        hasBom = (size >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE);
                         break;
                     case Encoding::UTF_32BE:
                         // UTF-32BE BOM is 00 00 FE FF
-                        hasBom = (bytes.size() >= 4 && bytes[0] == 0x00 && bytes[1] == 0x00 && 
+                        hasBom = (size >= 4 && bytes[0] == 0x00 && bytes[1] == 0x00 && 
                                 bytes[2] == 0xFE && bytes[3] == 0xFF);
                         break;
                     case Encoding::UTF_32LE:
                         // UTF-32LE BOM is FF FE 00 00
-                        hasBom = (bytes.size() >= 4 && bytes[0] == 0xFF && bytes[1] == 0xFE && 
+                        hasBom = (size >= 4 && bytes[0] == 0xFF && bytes[1] == 0xFE && 
                                 bytes[2] == 0x00 && bytes[3] == 0x00);
                         break;
                     default:
@@ -1564,15 +2846,15 @@ String String::fromBytes(const std::vector<uint8_t>& bytes,
                 }
             }
             // Check for UTF-16BE BOM (FE FF)
-            else if (bytes.size() >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) {
+            else if (size >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) {
                 if (encoding == Encoding::UTF_16BE) {
                     offset = 2;  // Skip BOM for UTF-16BE
                 }
             }
             // Check for UTF-16LE BOM (FF FE)
-            else if (bytes.size() >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
+            else if (size >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
                 // Check if it's UTF-32LE (FF FE 00 00)
-                if (bytes.size() >= 4 && bytes[2] == 0x00 && bytes[3] == 0x00) {
+                if (size >= 4 && bytes[2] == 0x00 && bytes[3] == 0x00) {
                     if (encoding == Encoding::UTF_32LE) {
                         offset = 4;  // Skip BOM for UTF-32LE
                     }
@@ -1581,7 +2863,7 @@ String String::fromBytes(const std::vector<uint8_t>& bytes,
                 }
             }
             // Check for UTF-32BE BOM (00 00 FE FF)
-            else if (bytes.size() >= 4 && bytes[0] == 0x00 && bytes[1] == 0x00 && 
+            else if (size >= 4 && bytes[0] == 0x00 && bytes[1] == 0x00 && 
                     bytes[2] == 0xFE && bytes[3] == 0xFF) {
                 if (encoding == Encoding::UTF_32BE) {
                     offset = 4;  // Skip BOM for UTF-32BE
@@ -1592,275 +2874,62 @@ String String::fromBytes(const std::vector<uint8_t>& bytes,
         // Decode based on encoding
         switch (encoding) {
             case Encoding::UTF_8: {
-                // Process UTF-8 with proper error handling
-                if (errorHandling == EncodingErrorHandling::THROW) {
-                    // For THROW, we validate the UTF-8 sequence
-                    try {
-                        // Copy bytes first
-                        utf8_result.reserve(bytes.size() - offset);
-                        for (size_t i = offset; i < bytes.size(); ++i) {
-                            utf8_result.push_back(static_cast<char>(bytes[i]));
+                // Valid UTF-8 is copied as it is with every error handling strategy
+                const char* data = reinterpret_cast<const char*>(bytes) + offset;
+                const std::size_t invalid = detail::validate_utf8(data, size - offset);
+                if (invalid == std::string_view::npos) {
+                    utf8_result.assign(data, size - offset);
+                } else if (errorHandling == EncodingErrorHandling::THROW) {
+                    throw EncodingException(invalid_utf8_message(bytes + offset + invalid, bytes + size),
+                                            encoding, offset + invalid, errorHandling);
+                } else {
+                    // Valid runs are copied as they are, straight from the input.
+                    // Every invalid byte becomes one U+FFFD or is skipped, as
+                    // decode_group() counts invalid bytes everywhere else.
+                    const unsigned char* end = bytes + size;
+                    std::size_t position = offset;
+                    std::size_t valid = invalid;
+                    utf8_result.reserve(size - offset);
+                    while (true) {
+                        utf8_result.append(reinterpret_cast<const char*>(bytes) + position, valid);
+                        position += valid;
+                        if (position == size) {
+                            break;
                         }
-                        
-                        // This will throw if UTF-8 is invalid
-                        std::u16string test = boost::locale::conv::utf_to_utf<char16_t>(utf8_result);
-                    } catch (const boost::locale::conv::conversion_error& e) {
-                        throw EncodingException("Invalid UTF-8 sequence: " + std::string(e.what()),
-                                             encoding, 0, errorHandling);
-                    }
-                } else if (errorHandling == EncodingErrorHandling::REPLACE) {
-                    // For REPLACE, we replace invalid sequences with the replacement character U+FFFD
-                    std::string temp;
-                    temp.reserve(bytes.size() - offset);
-                    for (size_t i = offset; i < bytes.size(); ++i) {
-                        temp.push_back(static_cast<char>(bytes[i]));
-                    }
-                    
-                    // Try to convert to UTF-16 and back to handle replacements
-                    try {
-                        std::u16string utf16 = boost::locale::conv::utf_to_utf<char16_t>(temp, boost::locale::conv::stop);
-                        utf8_result = boost::locale::conv::utf_to_utf<char>(utf16);
-                    } catch (const boost::locale::conv::conversion_error& e) {
-                        // If conversion fails, use a custom approach to replace invalid sequences
-                        utf8_result.clear();
-                        for (size_t i = 0; i < temp.size(); ++i) {
-                            if ((temp[i] & 0x80) == 0) {
-                                // ASCII character (0xxxxxxx)
-                                utf8_result.push_back(temp[i]);
-                            } else if ((temp[i] & 0xE0) == 0xC0) {
-                                // 2-byte sequence (110xxxxx 10xxxxxx)
-                                if (i + 1 < temp.size() && (temp[i+1] & 0xC0) == 0x80) {
-                                    utf8_result.push_back(temp[i]);
-                                    utf8_result.push_back(temp[i+1]);
-                                    i++;
-                                } else {
-                                    // Invalid sequence, replace with U+FFFD (in UTF-8: EF BF BD)
-                                    utf8_result.push_back(static_cast<char>(0xEF));
-                                    utf8_result.push_back(static_cast<char>(0xBF));
-                                    utf8_result.push_back(static_cast<char>(0xBD));
-                                }
-                            } else if ((temp[i] & 0xF0) == 0xE0) {
-                                // 3-byte sequence (1110xxxx 10xxxxxx 10xxxxxx)
-                                if (i + 2 < temp.size() && (temp[i+1] & 0xC0) == 0x80 && (temp[i+2] & 0xC0) == 0x80) {
-                                    utf8_result.push_back(temp[i]);
-                                    utf8_result.push_back(temp[i+1]);
-                                    utf8_result.push_back(temp[i+2]);
-                                    i += 2;
-                                } else {
-                                    // Invalid sequence, replace with U+FFFD (in UTF-8: EF BF BD)
-                                    utf8_result.push_back(static_cast<char>(0xEF));
-                                    utf8_result.push_back(static_cast<char>(0xBF));
-                                    utf8_result.push_back(static_cast<char>(0xBD));
-                                }
-                            } else if ((temp[i] & 0xF8) == 0xF0) {
-                                // 4-byte sequence (11110xxx 10xxxxxx 10xxxxxx 10xxxxxx)
-                                if (i + 3 < temp.size() && (temp[i+1] & 0xC0) == 0x80 && 
-                                    (temp[i+2] & 0xC0) == 0x80 && (temp[i+3] & 0xC0) == 0x80) {
-                                    utf8_result.push_back(temp[i]);
-                                    utf8_result.push_back(temp[i+1]);
-                                    utf8_result.push_back(temp[i+2]);
-                                    utf8_result.push_back(temp[i+3]);
-                                    i += 3;
-                                } else {
-                                    // Invalid sequence, replace with U+FFFD (in UTF-8: EF BF BD)
-                                    utf8_result.push_back(static_cast<char>(0xEF));
-                                    utf8_result.push_back(static_cast<char>(0xBF));
-                                    utf8_result.push_back(static_cast<char>(0xBD));
-                                }
-                            } else {
-                                // Invalid byte, replace with U+FFFD (in UTF-8: EF BF BD)
-                                utf8_result.push_back(static_cast<char>(0xEF));
-                                utf8_result.push_back(static_cast<char>(0xBF));
-                                utf8_result.push_back(static_cast<char>(0xBD));
-                            }
+                        const detail::Utf16Group group = detail::decode_group(bytes + position, end);
+                        if (group.bytes > 1 || bytes[position] < 0x80) {
+                            utf8_result.append(reinterpret_cast<const char*>(bytes) + position, group.bytes);
+                        } else if (errorHandling == EncodingErrorHandling::REPLACE) {
+                            utf8_result.append("\xEF\xBF\xBD");
                         }
-                    }
-                } else { // IGNORE
-                    // For IGNORE, we skip invalid sequences
-                    std::string temp;
-                    temp.reserve(bytes.size() - offset);
-                    for (size_t i = offset; i < bytes.size(); ++i) {
-                        temp.push_back(static_cast<char>(bytes[i]));
-                    }
-                    
-                    // Process byte by byte to identify and skip invalid sequences
-                    for (size_t i = 0; i < temp.size(); ++i) {
-                        if ((temp[i] & 0x80) == 0) {
-                            // ASCII character (0xxxxxxx)
-                            utf8_result.push_back(temp[i]);
-                        } else if ((temp[i] & 0xE0) == 0xC0) {
-                            // 2-byte sequence (110xxxxx 10xxxxxx)
-                            if (i + 1 < temp.size() && (temp[i+1] & 0xC0) == 0x80) {
-                                utf8_result.push_back(temp[i]);
-                                utf8_result.push_back(temp[i+1]);
-                                i++;
-                            }
-                            // Invalid sequence is ignored
-                        } else if ((temp[i] & 0xF0) == 0xE0) {
-                            // 3-byte sequence (1110xxxx 10xxxxxx 10xxxxxx)
-                            if (i + 2 < temp.size() && (temp[i+1] & 0xC0) == 0x80 && (temp[i+2] & 0xC0) == 0x80) {
-                                utf8_result.push_back(temp[i]);
-                                utf8_result.push_back(temp[i+1]);
-                                utf8_result.push_back(temp[i+2]);
-                                i += 2;
-                            }
-                            // Invalid sequence is ignored
-                        } else if ((temp[i] & 0xF8) == 0xF0) {
-                            // 4-byte sequence (11110xxx 10xxxxxx 10xxxxxx 10xxxxxx)
-                            if (i + 3 < temp.size() && (temp[i+1] & 0xC0) == 0x80 && 
-                                (temp[i+2] & 0xC0) == 0x80 && (temp[i+3] & 0xC0) == 0x80) {
-                                utf8_result.push_back(temp[i]);
-                                utf8_result.push_back(temp[i+1]);
-                                utf8_result.push_back(temp[i+2]);
-                                utf8_result.push_back(temp[i+3]);
-                                i += 3;
-                            }
-                            // Invalid sequence is ignored
+                        position += group.bytes;
+                        valid = detail::validate_utf8(reinterpret_cast<const char*>(bytes) + position, size - position);
+                        if (valid == std::string_view::npos) {
+                            valid = size - position;
                         }
-                        // Invalid byte is ignored
-                    }
-                }
-                break;
-            }
-            case Encoding::UTF_16BE: {
-                // Convert from UTF-16BE to UTF-8
-                if ((bytes.size() - offset) % 2 != 0) {
-                    throw EncodingException("Invalid UTF-16BE data: odd number of bytes",
-                                          encoding, bytes.size() - 1, errorHandling);
-                }
-                
-                std::u16string utf16_str;
-                utf16_str.reserve((bytes.size() - offset) / 2);
-                
-                for (size_t i = offset; i < bytes.size(); i += 2) {
-                    // For UTF-16BE, the most significant byte comes first
-                    if (bytes[i] == 0x00 && bytes[i+1] <= 0x7F) {
-                        // Special handling for ASCII characters to match test expectations
-                        char16_t ch = static_cast<char16_t>(bytes[i+1]);
-                        utf16_str.push_back(ch);
-                    } else {
-                        char16_t ch = (static_cast<char16_t>(bytes[i]) << 8) | 
-                                      static_cast<char16_t>(bytes[i + 1]);
-                        utf16_str.push_back(ch);
-                    }
-                }
-                
-                try {
-                    utf8_result = boost::locale::conv::utf_to_utf<char>(utf16_str);
-                } catch (const boost::locale::conv::conversion_error& e) {
-                    throw EncodingException("Failed to convert from UTF-16BE: " + std::string(e.what()),
-                                          encoding, 0, errorHandling);
-                }
-                break;
-            }
-            case Encoding::UTF_16LE: {
-                // Convert from UTF-16LE to UTF-8
-                if ((bytes.size() - offset) % 2 != 0) {
-                    throw EncodingException("Invalid UTF-16LE data: odd number of bytes",
-                                          encoding, bytes.size() - 1, errorHandling);
-                }
-                
-                std::u16string utf16_str;
-                utf16_str.reserve((bytes.size() - offset) / 2);
-                
-                for (size_t i = offset; i < bytes.size(); i += 2) {
-                    // For UTF-16LE, the least significant byte comes first
-                    char16_t ch = static_cast<char16_t>(bytes[i]) | 
-                                 (static_cast<char16_t>(bytes[i + 1]) << 8);
-                    utf16_str.push_back(ch);
-                }
-                
-                try {
-                    utf8_result = boost::locale::conv::utf_to_utf<char>(utf16_str);
-                } catch (const boost::locale::conv::conversion_error& e) {
-                    throw EncodingException("Failed to convert from UTF-16LE: " + std::string(e.what()),
-                                          encoding, 0, errorHandling);
-                }
-                break;
-            }
-            case Encoding::UTF_32BE: {
-                // Convert from UTF-32BE to UTF-8
-                if ((bytes.size() - offset) % 4 != 0) {
-                    throw EncodingException("Invalid UTF-32BE data: byte count not divisible by 4",
-                                          encoding, bytes.size() - 1, errorHandling);
-                }
-                
-                std::u32string utf32_str;
-                utf32_str.reserve((bytes.size() - offset) / 4);
-                
-                for (size_t i = offset; i < bytes.size(); i += 4) {
-                    // For UTF-32BE, bytes are in big-endian order (most significant byte first)
-                    if (bytes[i] == 0 && bytes[i+1] == 0 && bytes[i+2] == 0 && bytes[i+3] <= 0x7F) {
-                        // Special handling for ASCII characters to match test expectations
-                        char32_t ch = static_cast<char32_t>(bytes[i+3]);
-                        utf32_str.push_back(ch);
-                    } else {
-                        char32_t ch = (static_cast<char32_t>(bytes[i]) << 24) | 
-                                     (static_cast<char32_t>(bytes[i + 1]) << 16) | 
-                                     (static_cast<char32_t>(bytes[i + 2]) << 8) | 
-                                      static_cast<char32_t>(bytes[i + 3]);
-                        utf32_str.push_back(ch);
                     }
                 }
-                
-                try {
-                    utf8_result = boost::locale::conv::utf_to_utf<char>(utf32_str);
-                } catch (const boost::locale::conv::conversion_error& e) {
-                    throw EncodingException("Failed to convert from UTF-32BE: " + std::string(e.what()),
-                                          encoding, 0, errorHandling);
-                }
                 break;
             }
-            case Encoding::UTF_32LE: {
-                // Convert from UTF-32LE to UTF-8
-                if ((bytes.size() - offset) % 4 != 0) {
-                    throw EncodingException("Invalid UTF-32LE data: byte count not divisible by 4",
-                                          encoding, bytes.size() - 1, errorHandling);
-                }
-                
-                std::u32string utf32_str;
-                utf32_str.reserve((bytes.size() - offset) / 4);
-                
-                for (size_t i = offset; i < bytes.size(); i += 4) {
-                    // For UTF-32LE, bytes are in little-endian order (least significant byte first)
-                    char32_t ch = static_cast<char32_t>(bytes[i]) | 
-                                 (static_cast<char32_t>(bytes[i + 1]) << 8) | 
-                                 (static_cast<char32_t>(bytes[i + 2]) << 16) | 
-                                 (static_cast<char32_t>(bytes[i + 3]) << 24);
-                    utf32_str.push_back(ch);
-                }
-                
-                try {
-                    utf8_result = boost::locale::conv::utf_to_utf<char>(utf32_str);
-                } catch (const boost::locale::conv::conversion_error& e) {
-                    throw EncodingException("Failed to convert from UTF-32LE: " + std::string(e.what()),
-                                          encoding, 0, errorHandling);
-                }
+            case Encoding::UTF_16BE:
+            case Encoding::UTF_16LE:
+            case Encoding::UTF_32BE:
+            case Encoding::UTF_32LE:
+                utf8_result = decode_utf_units(bytes, size, offset, encoding, errorHandling);
                 break;
-            }
             case Encoding::ISO_8859_1: {
-                // Convert from ISO-8859-1 (Latin-1) to UTF-8
-                utf8_result.reserve(bytes.size() * 2);  // Worst case scenario
-                
-                for (size_t i = offset; i < bytes.size(); ++i) {
-                    uint8_t byte = bytes[i];
-                    if (byte <= 0x7F) {
-                        // ASCII range, direct mapping
-                        utf8_result.push_back(static_cast<char>(byte));
-                    } else {
-                        // Latin-1 extended range (0x80-0xFF)
-                        // Convert to 2-byte UTF-8 sequence
-                        utf8_result.push_back(static_cast<char>(0xC0 | (byte >> 6)));
-                        utf8_result.push_back(static_cast<char>(0x80 | (byte & 0x3F)));
-                    }
-                }
+                // Every byte is a code point, so there are no errors to handle
+                const char* data = reinterpret_cast<const char*>(bytes) + offset;
+                const std::size_t length = size - offset;
+                utf8_result.resize(detail::decoded_length_latin1(data, length));
+                detail::decode_latin1(data, length, utf8_result.data());
                 break;
             }
             case Encoding::ASCII: {
                 // Convert from ASCII to UTF-8 (direct mapping for valid ASCII)
-                utf8_result.reserve(bytes.size());
+                utf8_result.reserve(size);
                 
-                for (size_t i = offset; i < bytes.size(); ++i) {
+                for (size_t i = offset; i < size; ++i) {
                     uint8_t byte = bytes[i];
                     if (byte > 0x7F) {
                         if (errorHandling == EncodingErrorHandling::THROW) {
@@ -1886,11 +2955,278 @@ String String::fromBytes(const std::vector<uint8_t>& bytes,
                              encoding, 0, errorHandling);
     }
     
-    return String(utf8_result);
+    return String(std::move(utf8_result));
+}
+
+String String::fromBytes(std::vector<uint8_t>&& bytes,
+                         Encoding encoding,
+                         EncodingErrorHandling errorHandling) {
+    String result;
+    if (encoding == Encoding::UTF_8 && adopt_utf8(bytes, BOMPolicy::AUTO, result)) {
+        return result;
+    }
+    return fromBytes(static_cast<const std::vector<uint8_t>&>(bytes), encoding, errorHandling);
+}
+
+String String::fromBytes(std::vector<uint8_t>&& bytes,
+                         Encoding encoding,
+                         BOMPolicy bomPolicy,
+                         EncodingErrorHandling errorHandling) {
+    String result;
+    if (encoding == Encoding::UTF_8 && adopt_utf8(bytes, bomPolicy, result)) {
+        return result;
+    }
+    return fromBytes(static_cast<const std::vector<uint8_t>&>(bytes), encoding, bomPolicy, errorHandling);
 }
 
 String String::fromStdString(const std::string& str) {
     return String(str);
 }
 
+String String::fromStdString(std::string&& str) {
+    return String(std::move(str));
+}
+
+String String::fromStringView(const StringView& view) {
+    return String(view.view().data(), view.view().size());
+}
+
+bool String::adopt_utf8(std::vector<uint8_t>& bytes, BOMPolicy bomPolicy, String& result) {
+    // A required BOM that is missing is reported by the copying path
+    const bool has_bom = bytes.size() >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF;
+    if (bomPolicy == BOMPolicy::INCLUDE && !has_bom) {
+        return false;
+    }
+    const std::size_t offset = (has_bom && bomPolicy != BOMPolicy::EXCLUDE) ? 3 : 0;
+    
+    // Valid UTF-8 passes every error handling strategy unchanged; anything else
+    // is left to the copying path
+    const char* data = reinterpret_cast<const char*>(bytes.data()) + offset;
+    const std::size_t length = bytes.size() - offset;
+    if (detail::validate_utf8(data, length) != std::string_view::npos) {
+        return false;
+    }
+    
+    if (fits_inline(length)) {
+        result = String(data, length);
+    } else {
+        result = String(detail::ImplRef(detail::StringImpl::adopt(std::move(bytes), offset, memory_resource())));
+    }
+    return true;
+}
+
+// Implementation of StringView
+
+StringView::StringView(const String& str)
+    : StringView(str.view().data(), str.view().size(), str.known_utf16_length(),
+                 str.pimpl() ? str.pimpl()->traits() : std::uint8_t(0)) {
+    // A rope is viewed in its flattened copy, which the view holds on to
+    if (str.pimpl() && str.pimpl()->is_rope()) {
+        const detail::StringImpl* flat = str.pimpl()->flat();
+        detail::retain(flat);
+        flat_ = detail::ImplRef(flat);
+    }
+}
+
+StringView::StringView(const char* str, std::size_t length) noexcept
+    : StringView(str, length, detail::UNKNOWN_COUNT, 0) {}
+
+StringView::StringView(const char* str, std::size_t length, std::size_t utf16_length, std::uint8_t traits) noexcept
+    : data_(str), size_(length), utf16_length_(utf16_length), traits_(traits) {
+    static_assert(EMPTY_TRAITS == (detail::TRAITS_KNOWN | detail::TRAITS_ASCII | detail::TRAITS_BMP));
+}
+
+StringView::StringView(const StringView& other) noexcept
+    : data_(other.data_), size_(other.size_), utf16_length_(other.known_utf16_length()),
+      traits_(other.traits_.load(std::memory_order_relaxed)), cursor_(other.cursor_.load(std::memory_order_relaxed)),
+      flat_(other.flat_) {}
+
+StringView& StringView::operator=(const StringView& other) noexcept {
+    data_ = other.data_;
+    size_ = other.size_;
+    utf16_length_.store(other.known_utf16_length(), std::memory_order_relaxed);
+    traits_.store(other.traits_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    cursor_.store(other.cursor_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    flat_ = other.flat_;
+    return *this;
+}
+
+std::uint8_t StringView::traits() const {
+    std::uint8_t traits = traits_.load(std::memory_order_relaxed);
+    if (!traits) {
+        traits = detail::scan_utf8_traits(data_, size_);
+        traits_.store(traits, std::memory_order_relaxed);
+    }
+    return traits;
+}
+
+bool StringView::is_ascii() const {
+    return traits() & detail::TRAITS_ASCII;
+}
+
+bool StringView::is_bmp() const {
+    return traits() & detail::TRAITS_BMP;
+}
+
+detail::Utf16Position StringView::locate(std::size_t index) const {
+    // In ASCII text each byte is one code unit
+    if (is_ascii()) {
+        const std::size_t position = std::min(index, size_);
+        return {position, position};
+    }
+    // Scan from the position of the previous lookup, or from the start if it
+    // is nearer, so walking the text either way is linear
+    detail::Utf16Position position = cursor();
+    if (index >= position.unit) {
+        position = detail::scan_to_unit(view(), position, index);
+    } else if (position.unit - index < index) {
+        position = detail::scan_back_to_unit(view(), position, index);
+    } else {
+        position = detail::scan_to_unit(view(), {0, 0}, index);
+    }
+    set_cursor(position);
+    return position;
+}
+
+std::size_t StringView::index_of_byte(std::size_t byte) const {
+    if (is_ascii()) {
+        return byte;
+    }
+    const detail::Utf16Position from = cursor();
+    return detail::scan_to_byte(view(), from.byte <= byte ? from : detail::Utf16Position{0, 0}, byte);
+}
+
+detail::Utf16Position StringView::cursor() const {
+    const std::uint64_t cursor = cursor_.load(std::memory_order_relaxed);
+    return {static_cast<std::size_t>(cursor >> 32), static_cast<std::size_t>(cursor & 0xFFFFFFFF)};
+}
+
+void StringView::set_cursor(const detail::Utf16Position& position) const {
+    // Positions in views of 4 GiB or more do not fit, so those scan from the start
+    if (size_ <= 0xFFFFFFFF) {
+        cursor_.store(static_cast<std::uint64_t>(position.byte) << 32 | position.unit, std::memory_order_relaxed);
+    }
+}
+
+StringView StringView::subspan(const detail::ByteSpan& span) const {
+    if (span.length == size_) {
+        return *this;
+    }
+    // Any part of ASCII bytes is ASCII
+    const std::uint8_t known = traits_.load(std::memory_order_relaxed);
+    const std::uint8_t traits = (known & detail::TRAITS_ASCII) ? known : std::uint8_t(0);
+    StringView part(data_ + span.offset, span.length, span.utf16_length, traits);
+    part.flat_ = flat_;
+    return part;
+}
+
+std::size_t StringView::length() const {
+    std::size_t length = known_utf16_length();
+    if (length == detail::UNKNOWN_COUNT) {
+        length = is_ascii() ? size_ : detail::count_utf16(view()).units;
+        utf16_length_.store(length, std::memory_order_relaxed);
+    }
+    return length;
+}
+
+Char StringView::char_at(Index index) const {
+    return detail::TextQueries::char_at(*this, index.value());
+}
+
+CodePoint StringView::code_point_at(Index index) const {
+    return detail::TextQueries::code_point_at(*this, index.value());
+}
+
+CodePoint StringView::code_point_before(Index index) const {
+    return detail::TextQueries::code_point_before(*this, index.value());
+}
+
+std::size_t StringView::code_point_count(Index begin_index, Index end_index) const {
+    return detail::TextQueries::code_point_count(*this, begin_index.value(), end_index.value());
+}
+
+CompareResult StringView::compare_to(StringView other) const {
+    const int result = view().compare(other.view());
+    if (result < 0) return CompareResult::LESS;
+    if (result > 0) return CompareResult::GREATER;
+    return CompareResult::EQUAL;
+}
+
+Index StringView::indexOf(Char ch) const {
+    return indexOf(ch, Index(0));
+}
+
+Index StringView::indexOf(Char ch, Index fromIndex) const {
+    return detail::TextQueries::index_of(*this, ch.value(), fromIndex.value());
+}
+
+Index StringView::indexOf(StringView str) const {
+    return indexOf(str, Index(0));
+}
+
+Index StringView::indexOf(StringView str, Index fromIndex) const {
+    return detail::TextQueries::index_of(*this, str.view(), fromIndex.value());
+}
+
+Index StringView::lastIndexOf(Char ch) const {
+    // A byte length is never less than the UTF-16 length, so this searches the whole text
+    return lastIndexOf(ch, Index(size_));
+}
+
+Index StringView::lastIndexOf(Char ch, Index fromIndex) const {
+    return detail::TextQueries::last_index_of(*this, ch.value(), fromIndex.value());
+}
+
+Index StringView::lastIndexOf(StringView str) const {
+    return lastIndexOf(str, Index(size_));
+}
+
+Index StringView::lastIndexOf(StringView str, Index fromIndex) const {
+    return detail::TextQueries::last_index_of(*this, str.view(), fromIndex.value());
+}
+
+bool StringView::contains(StringView str) const {
+    return indexOf(str) != Index::invalid;
+}
+
+bool StringView::startsWith(StringView prefix) const {
+    return startsWith(prefix, Index(0));
+}
+
+bool StringView::startsWith(StringView prefix, Index offset) const {
+    return detail::TextQueries::starts_with(*this, prefix.view(), offset.value());
+}
+
+bool StringView::endsWith(StringView suffix) const {
+    return detail::TextQueries::ends_with(*this, suffix.view());
+}
+
+StringView StringView::substring(Index beginIndex) const {
+    return subspan(detail::TextQueries::substring(*this, beginIndex.value()));
+}
+
+StringView StringView::substring(Index beginIndex, Index endIndex) const {
+    return subspan(detail::TextQueries::substring(*this, beginIndex.value(), endIndex.value()));
+}
+
+StringView StringView::trim() const {
+    return subspan(detail::TextQueries::trim(*this));
+}
+
+StringView StringView::strip() const {
+    return subspan(detail::TextQueries::strip(*this));
+}
+
+StringView StringView::stripLeading() const {
+    return subspan(detail::TextQueries::strip_leading(*this));
+}
+
+StringView StringView::stripTrailing() const {
+    return subspan(detail::TextQueries::strip_trailing(*this));
+}
+
+bool StringView::isStripped() const {
+    return detail::TextQueries::is_stripped(*this);
+}
+
 } // namespace simple
@@ -0,0 +1,2655 @@
+#include "../include/transcode.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+
+// The vectorized kernels are compiled for x86 with GCC and Clang, which can
+// target instruction sets per function, so the library still runs on CPUs
+// without them
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SSTRING_X86_KERNELS 1
+#define SSTRING_TARGET(isa) __attribute__((target(isa)))
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace simple {
+namespace detail {
+
+namespace {
+
+constexpr std::size_t npos = std::string_view::npos;
+
+// Find the first invalid byte one group at a time, skipping ASCII eight bytes at a time
+std::size_t validate_utf8_scalar(const char* data, std::size_t length) noexcept {
+    const unsigned char* begin = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = begin + length;
+    const unsigned char* str = begin;
+    while (str < end) {
+        if (end - str >= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, str, 8);
+            if ((word & 0x8080808080808080ULL) == 0) {
+                str += 8;
+                continue;
+            }
+        }
+        if (*str < 0x80) {
+            ++str;
+            continue;
+        }
+        // Only invalid bytes decode on their own
+        const std::size_t bytes = decode_group(str, end).bytes;
+        if (bytes == 1) {
+            return static_cast<std::size_t>(str - begin);
+        }
+        str += bytes;
+    }
+    return npos;
+}
+
+// A code unit or code point in the other byte order
+inline char16_t swap_bytes(char16_t unit) noexcept {
+    return static_cast<char16_t>((unit << 8) | (unit >> 8));
+}
+
+inline char32_t swap_bytes(char32_t value) noexcept {
+    return (value << 24) | ((value & 0xFF00) << 8) | ((value >> 8) & 0xFF00) | (value >> 24);
+}
+
+// Decode the groups starting before until (but reading up to end), returning
+// the end of the last one. Swap gives the code units in the other byte order.
+template <bool Swap>
+inline const unsigned char* decode_groups(const unsigned char* str, const unsigned char* until,
+                                          const unsigned char* end, char16_t*& out) noexcept {
+    while (str < until) {
+        const Utf16Group group = decode_group(str, end);
+        out[0] = Swap ? swap_bytes(group.unit[0]) : group.unit[0];
+        if (group.units == 2) {
+            out[1] = Swap ? swap_bytes(group.unit[1]) : group.unit[1];
+        }
+        out += group.units;
+        str += group.bytes;
+    }
+    return str;
+}
+
+// Decode one group at a time, widening ASCII eight bytes at a time
+template <bool Swap>
+std::size_t utf8_to_utf16_scalar(const char* data, std::size_t length, char16_t* out) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    char16_t* const start = out;
+    while (str < end) {
+        if (end - str >= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, str, 8);
+            if ((word & 0x8080808080808080ULL) == 0) {
+                for (int i = 0; i < 8; ++i) {
+                    out[i] = static_cast<char16_t>(Swap ? str[i] << 8 : str[i]);
+                }
+                str += 8;
+                out += 8;
+                continue;
+            }
+        }
+        str = decode_groups<Swap>(str, str + 1, end, out);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+// Widen valid UTF-16 to UTF-32 one code unit or surrogate pair at a time
+template <bool Swap>
+inline char32_t* widen_units(const char16_t* units, const char16_t* end, char32_t* out) noexcept {
+    while (units < end) {
+        char32_t value = *units++;
+        if (value >= 0xD800 && value <= 0xDBFF && units < end) {
+            value = 0x10000 + ((value - 0xD800) << 10) + (*units++ - 0xDC00);
+        }
+        *out++ = Swap ? swap_bytes(value) : value;
+    }
+    return out;
+}
+
+// Decode one group at a time
+template <bool Swap>
+std::size_t utf8_to_utf32_scalar(const char* data, std::size_t length, char32_t* out) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    char32_t* const start = out;
+    while (str < end) {
+        const Utf16Group group = decode_group(str, end);
+        out = widen_units<Swap>(group.unit, group.unit + group.units, out);
+        str += group.bytes;
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+// Count one group at a time, skipping ASCII eight bytes at a time
+Utf16Counts count_utf16_scalar(const char* data, std::size_t length) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    Utf16Counts counts{0, 0};
+    while (str < end) {
+        if (end - str >= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, str, 8);
+            if ((word & 0x8080808080808080ULL) == 0) {
+                str += 8;
+                counts.units += 8;
+                counts.code_points += 8;
+                continue;
+            }
+        }
+        if (*str < 0x80) {
+            ++str;
+            ++counts.units;
+        } else {
+            const Utf16Group group = decode_group(str, end);
+            str += group.bytes;
+            counts.units += group.units;
+        }
+        ++counts.code_points;
+    }
+    return counts;
+}
+
+// Count valid UTF-8: one code point per byte that is not a continuation byte,
+// and one more code unit per 4-byte lead for its low surrogate
+inline Utf16Counts count_valid_utf16(const unsigned char* str, const unsigned char* end) noexcept {
+    Utf16Counts counts{0, 0};
+    for (; str < end; ++str) {
+        counts.code_points += (*str & 0xC0) != 0x80;
+        counts.units += *str >= 0xF0;
+    }
+    counts.units += counts.code_points;
+    return counts;
+}
+
+// Count UTF-8 that may have invalid bytes: the valid text between them with a
+// vectorized kernel that only counts, and each invalid byte as one code unit
+// and one code point, as it decodes to one U+FFFD
+Utf16Counts count_utf16_runs(const char* data, std::size_t length,
+                             std::size_t (*validate)(const char*, std::size_t) noexcept,
+                             Utf16Counts (*count_valid)(const char*, std::size_t) noexcept) noexcept {
+    Utf16Counts counts{0, 0};
+    while (true) {
+        const std::size_t invalid = validate(data, length);
+        const Utf16Counts valid = count_valid(data, invalid == npos ? length : invalid);
+        counts.units += valid.units;
+        counts.code_points += valid.code_points;
+        if (invalid == npos) {
+            return counts;
+        }
+        ++counts.units;
+        ++counts.code_points;
+        data += invalid + 1;
+        length -= invalid + 1;
+    }
+}
+
+// UTF-16, UTF-32 and ISO-8859-1 to UTF-8. Code units are read from bytes
+// without alignment, with Swap set if their byte order is not that of this CPU.
+// The kernels decode valid input only; the runs wrappers below handle the
+// invalid code units between valid runs.
+
+template <typename Unit, bool Swap>
+inline Unit load_unit(const char* data) noexcept {
+    Unit unit;
+    std::memcpy(&unit, data, sizeof(Unit));
+    return Swap ? swap_bytes(unit) : unit;
+}
+
+// Write a code point as UTF-8
+inline char* put_utf8(char32_t code_point, char* out) noexcept {
+    if (code_point < 0x80) {
+        *out++ = static_cast<char>(code_point);
+    } else if (code_point < 0x800) {
+        *out++ = static_cast<char>(0xC0 | (code_point >> 6));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        *out++ = static_cast<char>(0xE0 | (code_point >> 12));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+    } else {
+        *out++ = static_cast<char>(0xF0 | (code_point >> 18));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+    return out;
+}
+
+// Find the first code unit that is an unpaired surrogate
+template <bool Swap>
+std::size_t validate_utf16_scalar(const char* data, std::size_t units) noexcept {
+    for (std::size_t i = 0; i < units; ++i) {
+        const char16_t unit = load_unit<char16_t, Swap>(data + 2 * i);
+        if ((unit & 0xF800) != 0xD800) {
+            continue;
+        }
+        if (unit >= 0xDC00 || i + 1 == units || (load_unit<char16_t, Swap>(data + 2 * i + 2) & 0xFC00) != 0xDC00) {
+            return i;
+        }
+        ++i;
+    }
+    return npos;
+}
+
+// Each surrogate of a pair counts half of its 4 bytes
+template <bool Swap>
+std::size_t utf16_length_scalar(const char* data, std::size_t units) noexcept {
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < units; ++i) {
+        const char16_t unit = load_unit<char16_t, Swap>(data + 2 * i);
+        bytes += unit < 0x80 ? 1 : (unit < 0x800 || (unit & 0xF800) == 0xD800 ? 2 : 3);
+    }
+    return bytes;
+}
+
+template <bool Swap>
+std::size_t utf16_to_utf8_scalar(const char* data, std::size_t units, char* out) noexcept {
+    char* const start = out;
+    for (std::size_t i = 0; i < units; ++i) {
+        char32_t code_point = load_unit<char16_t, Swap>(data + 2 * i);
+        if ((code_point & 0xFC00) == 0xD800) {
+            code_point = 0x10000 + ((code_point - 0xD800) << 10) + (load_unit<char16_t, Swap>(data + 2 * i + 2) - 0xDC00);
+            ++i;
+        }
+        out = put_utf8(code_point, out);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+inline bool valid_code_point(char32_t code_point) noexcept {
+    return code_point <= 0x10FFFF && (code_point & 0xFFFFF800) != 0xD800;
+}
+
+template <bool Swap>
+std::size_t validate_utf32_scalar(const char* data, std::size_t code_points) noexcept {
+    for (std::size_t i = 0; i < code_points; ++i) {
+        if (!valid_code_point(load_unit<char32_t, Swap>(data + 4 * i))) {
+            return i;
+        }
+    }
+    return npos;
+}
+
+template <bool Swap>
+std::size_t utf32_length_scalar(const char* data, std::size_t code_points) noexcept {
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < code_points; ++i) {
+        const char32_t code_point = load_unit<char32_t, Swap>(data + 4 * i);
+        bytes += 1 + (code_point >= 0x80) + (code_point >= 0x800) + (code_point >= 0x10000);
+    }
+    return bytes;
+}
+
+template <bool Swap>
+std::size_t utf32_to_utf8_scalar(const char* data, std::size_t code_points, char* out) noexcept {
+    char* const start = out;
+    for (std::size_t i = 0; i < code_points; ++i) {
+        out = put_utf8(load_unit<char32_t, Swap>(data + 4 * i), out);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+std::size_t latin1_length_scalar(const char* data, std::size_t length) noexcept {
+    std::size_t bytes = length;
+    for (std::size_t i = 0; i < length; ++i) {
+        bytes += static_cast<unsigned char>(data[i]) >> 7;
+    }
+    return bytes;
+}
+
+std::size_t latin1_to_utf8_scalar(const char* data, std::size_t length, char* out) noexcept {
+    char* const start = out;
+    for (std::size_t i = 0; i < length; ++i) {
+        out = put_utf8(static_cast<unsigned char>(data[i]), out);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+// The kernels for code units of one size and byte order
+struct UnitDecoder {
+    std::size_t unit_size;
+    std::size_t (*validate)(const char*, std::size_t) noexcept;
+    std::size_t (*length)(const char*, std::size_t) noexcept;
+    std::size_t (*decode)(const char*, std::size_t, char*) noexcept;
+};
+
+constexpr char REPLACEMENT_UTF8[3] = {'\xEF', '\xBF', '\xBD'};
+
+// Measure code units that may be invalid: the valid runs between them with a
+// vectorized kernel, and each invalid code unit as U+FFFD or nothing
+DecodedLength decoded_length_runs(const char* data, std::size_t units, const UnitDecoder& decoder,
+                                  bool replace) noexcept {
+    DecodedLength length{0, npos};
+    std::size_t done = 0;
+    while (true) {
+        const std::size_t invalid = decoder.validate(data, units);
+        length.bytes += decoder.length(data, invalid == npos ? units : invalid);
+        if (invalid == npos) {
+            return length;
+        }
+        if (length.invalid == npos) {
+            length.invalid = done + invalid;
+        }
+        length.bytes += replace ? sizeof(REPLACEMENT_UTF8) : 0;
+        data += decoder.unit_size * (invalid + 1);
+        units -= invalid + 1;
+        done += invalid + 1;
+    }
+}
+
+// Decode code units that may be invalid in the same runs
+std::size_t decode_runs(const char* data, std::size_t units, char* out, const UnitDecoder& decoder,
+                        bool replace) noexcept {
+    char* const start = out;
+    while (true) {
+        const std::size_t invalid = decoder.validate(data, units);
+        out += decoder.decode(data, invalid == npos ? units : invalid, out);
+        if (invalid == npos) {
+            return static_cast<std::size_t>(out - start);
+        }
+        if (replace) {
+            std::memcpy(out, REPLACEMENT_UTF8, sizeof(REPLACEMENT_UTF8));
+            out += sizeof(REPLACEMENT_UTF8);
+        }
+        data += decoder.unit_size * (invalid + 1);
+        units -= invalid + 1;
+    }
+}
+
+#if defined(SSTRING_X86_KERNELS)
+
+// Find the exact offset of the first invalid byte, given that a vectorized
+// kernel found the bytes before offset block to be valid except for a
+// sequence that may start in the last three of them
+std::size_t locate_invalid_utf8(const char* data, std::size_t length, std::size_t block) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    std::size_t start = block;
+    for (std::size_t back = 1; back <= 3 && back <= block; ++back) {
+        const unsigned char byte = str[block - back];
+        if (byte >= 0xC0) {
+            start = block - back;
+            break;
+        }
+        if (byte < 0x80) {
+            break;
+        }
+    }
+    const std::size_t invalid = validate_utf8_scalar(data + start, length - start);
+    return invalid == npos ? npos : start + invalid;
+}
+
+// Error classes of the lookup algorithm. Each byte is checked against the one
+// before it by looking up three nibbles (the high and low nibbles of the
+// previous byte, the high nibble of this one) and ANDing the results, so a bit
+// survives only if all three nibbles allow the error.
+constexpr unsigned char TOO_SHORT = 1 << 0;       // Lead byte not followed by a continuation byte
+constexpr unsigned char TOO_LONG = 1 << 1;        // Continuation byte after an ASCII byte
+constexpr unsigned char OVERLONG_3 = 1 << 2;      // E0 80..9F
+constexpr unsigned char TOO_LARGE = 1 << 3;       // F4 90..BF, or F5..FF
+constexpr unsigned char SURROGATE = 1 << 4;       // ED A0..BF
+constexpr unsigned char OVERLONG_2 = 1 << 5;      // C0 or C1
+constexpr unsigned char TOO_LARGE_1000 = 1 << 6;  // F5..FF 80..8F
+constexpr unsigned char OVERLONG_4 = 1 << 6;      // F0 80..8F
+constexpr unsigned char TWO_CONTS = 1 << 7;       // Continuation byte after a continuation byte
+constexpr unsigned char CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+// Indexed by the high nibble of the previous byte
+alignas(16) constexpr unsigned char BYTE_1_HIGH[16] = {
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+// Indexed by the low nibble of the previous byte
+alignas(16) constexpr unsigned char BYTE_1_LOW[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+// Indexed by the high nibble of the byte itself
+alignas(16) constexpr unsigned char BYTE_2_HIGH[16] = {
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+
+// Subtracted with saturation from the last bytes of a block: the result is
+// non-zero if a sequence starting there needs bytes of the next block
+alignas(64) constexpr unsigned char INCOMPLETE_MAX[64] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+};
+
+// Every kernel checks 64 bytes at a time. A tail shorter than that is copied
+// into a block padded with spaces, which also completes the check of a
+// sequence cut off at the end.
+constexpr std::size_t BLOCK = 64;
+
+inline void pad_tail(unsigned char* block, const char* data, std::size_t length) {
+    std::memset(block, 0x20, BLOCK);
+    std::memcpy(block, data, length);
+}
+
+// SSE4.2: four 16-byte vectors per block
+
+SSTRING_TARGET("sse4.2")
+inline __m128i utf8_errors_sse42(__m128i input, __m128i prev_input) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+    const __m128i byte_1_high = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(BYTE_1_HIGH)),
+                                                 _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    const __m128i byte_1_low = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(BYTE_1_LOW)),
+                                                _mm_and_si128(prev1, nibble));
+    const __m128i byte_2_high = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(BYTE_2_HIGH)),
+                                                 _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    const __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+    // The second and third bytes after a 3- or 4-byte lead must be continuation bytes
+    const __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+    const __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+    const __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+                                        _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+    const __m128i must23_80 = _mm_and_si128(must23, _mm_set1_epi8(static_cast<char>(0x80)));
+    return _mm_xor_si128(must23_80, special);
+}
+
+struct Sse42State {
+    __m128i prev_input;
+    __m128i prev_incomplete;
+};
+
+// Check a block, returning true if it has an error
+SSTRING_TARGET("sse4.2")
+inline bool utf8_block_sse42(const unsigned char* block, Sse42State& state) {
+    const __m128i in0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+    const __m128i in1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16));
+    const __m128i in2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 32));
+    const __m128i in3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 48));
+    __m128i error;
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(in0, in1), _mm_or_si128(in2, in3))) == 0) {
+        // ASCII: only a sequence left open by the previous block is an error
+        error = state.prev_incomplete;
+        state.prev_incomplete = _mm_setzero_si128();
+    } else {
+        error = utf8_errors_sse42(in0, state.prev_input);
+        error = _mm_or_si128(error, utf8_errors_sse42(in1, in0));
+        error = _mm_or_si128(error, utf8_errors_sse42(in2, in1));
+        error = _mm_or_si128(error, utf8_errors_sse42(in3, in2));
+        state.prev_incomplete = _mm_subs_epu8(in3, _mm_load_si128(reinterpret_cast<const __m128i*>(INCOMPLETE_MAX + 48)));
+    }
+    state.prev_input = in3;
+    return !_mm_testz_si128(error, error);
+}
+
+SSTRING_TARGET("sse4.2")
+std::size_t validate_utf8_sse42(const char* data, std::size_t length) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    Sse42State state{_mm_setzero_si128(), _mm_setzero_si128()};
+    std::size_t pos = 0;
+    for (; pos + BLOCK <= length; pos += BLOCK) {
+        if (utf8_block_sse42(str + pos, state)) {
+            return locate_invalid_utf8(data, length, pos);
+        }
+    }
+    if (pos < length) {
+        alignas(64) unsigned char tail[BLOCK];
+        pad_tail(tail, data + pos, length - pos);
+        if (utf8_block_sse42(tail, state)) {
+            return locate_invalid_utf8(data, length, pos);
+        }
+    } else if (!_mm_testz_si128(state.prev_incomplete, state.prev_incomplete)) {
+        return locate_invalid_utf8(data, length, pos);
+    }
+    return npos;
+}
+
+// AVX2: two 32-byte vectors per block. Bytes are shifted in across the two
+// 128-bit lanes by first assembling the previous lane of each lane.
+
+SSTRING_TARGET("avx2")
+inline __m256i lookup_avx2(const unsigned char* table, __m256i index) {
+    const __m256i lanes = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(table)));
+    return _mm256_shuffle_epi8(lanes, index);
+}
+
+SSTRING_TARGET("avx2")
+inline __m256i utf8_errors_avx2(__m256i input, __m256i prev_input) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    const __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+    const __m256i byte_1_high = lookup_avx2(BYTE_1_HIGH, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    const __m256i byte_1_low = lookup_avx2(BYTE_1_LOW, _mm256_and_si256(prev1, nibble));
+    const __m256i byte_2_high = lookup_avx2(BYTE_2_HIGH, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    const __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+    const __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+    const __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+    const __m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+                                           _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+    const __m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8(static_cast<char>(0x80)));
+    return _mm256_xor_si256(must23_80, special);
+}
+
+struct Avx2State {
+    __m256i prev_input;
+    __m256i prev_incomplete;
+};
+
+SSTRING_TARGET("avx2")
+inline bool utf8_block_avx2(const unsigned char* block, Avx2State& state) {
+    const __m256i in0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    const __m256i in1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+    __m256i error;
+    if (_mm256_movemask_epi8(_mm256_or_si256(in0, in1)) == 0) {
+        error = state.prev_incomplete;
+        state.prev_incomplete = _mm256_setzero_si256();
+    } else {
+        error = _mm256_or_si256(utf8_errors_avx2(in0, state.prev_input), utf8_errors_avx2(in1, in0));
+        state.prev_incomplete = _mm256_subs_epu8(in1, _mm256_load_si256(reinterpret_cast<const __m256i*>(INCOMPLETE_MAX + 32)));
+    }
+    state.prev_input = in1;
+    return !_mm256_testz_si256(error, error);
+}
+
+SSTRING_TARGET("avx2")
+std::size_t validate_utf8_avx2(const char* data, std::size_t length) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    Avx2State state{_mm256_setzero_si256(), _mm256_setzero_si256()};
+    std::size_t pos = 0;
+    for (; pos + BLOCK <= length; pos += BLOCK) {
+        if (utf8_block_avx2(str + pos, state)) {
+            return locate_invalid_utf8(data, length, pos);
+        }
+    }
+    if (pos < length) {
+        alignas(64) unsigned char tail[BLOCK];
+        pad_tail(tail, data + pos, length - pos);
+        if (utf8_block_avx2(tail, state)) {
+            return locate_invalid_utf8(data, length, pos);
+        }
+    } else if (!_mm256_testz_si256(state.prev_incomplete, state.prev_incomplete)) {
+        return locate_invalid_utf8(data, length, pos);
+    }
+    return npos;
+}
+
+// AVX-512: one 64-byte vector per block
+
+SSTRING_TARGET("avx512f,avx512bw")
+inline __m512i lookup_avx512(const unsigned char* table, __m512i index) {
+    const __m512i lanes = _mm512_broadcast_i32x4(_mm_load_si128(reinterpret_cast<const __m128i*>(table)));
+    return _mm512_shuffle_epi8(lanes, index);
+}
+
+SSTRING_TARGET("avx512f,avx512bw")
+inline __m512i utf8_errors_avx512(__m512i input, __m512i prev_input) {
+    const __m512i nibble = _mm512_set1_epi8(0x0F);
+    // Lane i of shifted is lane i - 1 of the input, and lane 0 the last lane of the previous input
+    const __m512i shifted = _mm512_permutex2var_epi64(input, _mm512_set_epi64(5, 4, 3, 2, 1, 0, 15, 14), prev_input);
+    const __m512i prev1 = _mm512_alignr_epi8(input, shifted, 15);
+    const __m512i byte_1_high = lookup_avx512(BYTE_1_HIGH, _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nibble));
+    const __m512i byte_1_low = lookup_avx512(BYTE_1_LOW, _mm512_and_si512(prev1, nibble));
+    const __m512i byte_2_high = lookup_avx512(BYTE_2_HIGH, _mm512_and_si512(_mm512_srli_epi16(input, 4), nibble));
+    const __m512i special = _mm512_and_si512(_mm512_and_si512(byte_1_high, byte_1_low), byte_2_high);
+    const __m512i prev2 = _mm512_alignr_epi8(input, shifted, 14);
+    const __m512i prev3 = _mm512_alignr_epi8(input, shifted, 13);
+    const __m512i must23 = _mm512_or_si512(_mm512_subs_epu8(prev2, _mm512_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+                                           _mm512_subs_epu8(prev3, _mm512_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+    const __m512i must23_80 = _mm512_and_si512(must23, _mm512_set1_epi8(static_cast<char>(0x80)));
+    return _mm512_xor_si512(must23_80, special);
+}
+
+struct Avx512State {
+    __m512i prev_input;
+    __m512i prev_incomplete;
+};
+
+SSTRING_TARGET("avx512f,avx512bw")
+inline bool utf8_block_avx512(const unsigned char* block, Avx512State& state) {
+    const __m512i input = _mm512_loadu_si512(block);
+    __m512i error;
+    if (_mm512_movepi8_mask(input) == 0) {
+        error = state.prev_incomplete;
+        state.prev_incomplete = _mm512_setzero_si512();
+    } else {
+        error = utf8_errors_avx512(input, state.prev_input);
+        state.prev_incomplete = _mm512_subs_epu8(input, _mm512_load_si512(INCOMPLETE_MAX));
+    }
+    state.prev_input = input;
+    return _mm512_test_epi8_mask(error, error) != 0;
+}
+
+SSTRING_TARGET("avx512f,avx512bw")
+std::size_t validate_utf8_avx512(const char* data, std::size_t length) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    Avx512State state{_mm512_setzero_si512(), _mm512_setzero_si512()};
+    std::size_t pos = 0;
+    for (; pos + BLOCK <= length; pos += BLOCK) {
+        if (utf8_block_avx512(str + pos, state)) {
+            return locate_invalid_utf8(data, length, pos);
+        }
+    }
+    if (pos < length) {
+        alignas(64) unsigned char tail[BLOCK];
+        pad_tail(tail, data + pos, length - pos);
+        if (utf8_block_avx512(tail, state)) {
+            return locate_invalid_utf8(data, length, pos);
+        }
+    } else if (_mm512_test_epi8_mask(state.prev_incomplete, state.prev_incomplete) != 0) {
+        return locate_invalid_utf8(data, length, pos);
+    }
+    return npos;
+}
+
+// UTF-8 to UTF-16. Text that is not ASCII is decoded in blocks of 64 bytes
+// that the lookup tables find valid, in windows of 16 bytes starting 13 bytes
+// apart, so that every sequence starting in the first 13 bytes of a window
+// ends inside it. Every byte of a window is decoded both as if it started a
+// sequence of the length its high bits give and, if it is a continuation
+// byte, as if it were the second byte of a 4-byte sequence, which then gives
+// the low surrogate. The code units of the lead bytes and of the bytes after
+// 4-byte leads are then packed together with shuffles looked up by position.
+
+// Shuffles moving the 16-bit lanes selected by each 8-bit mask to the front,
+// in the same or the other byte order
+struct PackTable {
+    unsigned char shuffle[256][16];
+    unsigned char count[256];
+};
+
+constexpr PackTable make_pack_table(bool swap) {
+    PackTable table{};
+    for (unsigned mask = 0; mask < 256; ++mask) {
+        unsigned count = 0;
+        for (unsigned lane = 0; lane < 8; ++lane) {
+            if (mask & (1u << lane)) {
+                table.shuffle[mask][2 * count] = static_cast<unsigned char>(2 * lane + swap);
+                table.shuffle[mask][2 * count + 1] = static_cast<unsigned char>(2 * lane + !swap);
+                ++count;
+            }
+        }
+        for (unsigned byte = 2 * count; byte < 16; ++byte) {
+            table.shuffle[mask][byte] = 0x80;
+        }
+        table.count[mask] = static_cast<unsigned char>(count);
+    }
+    return table;
+}
+
+alignas(16) constexpr PackTable PACK_UNITS[2] = {make_pack_table(false), make_pack_table(true)};
+
+constexpr std::size_t WINDOW_STEP = 13;
+
+// Select the code units of the window starting at byte window of a block: those
+// of the lead bytes in its first 13 bytes, and the low surrogates after the
+// leads of 4-byte sequences
+inline unsigned window_units(std::uint64_t leads, std::uint64_t four_byte, std::size_t window) {
+    const unsigned step = (1u << WINDOW_STEP) - 1;
+    return (static_cast<unsigned>(leads >> window) & step) | ((static_cast<unsigned>(four_byte >> window) & step) << 1);
+}
+
+// Length of a valid block of n bytes without a sequence cut off at its end
+inline std::size_t complete_length(const unsigned char* str, std::size_t n) {
+    if (str[n - 1] >= 0xC0) {
+        return n - 1;
+    }
+    if (str[n - 2] >= 0xE0) {
+        return n - 2;
+    }
+    if (str[n - 3] >= 0xF0) {
+        return n - 3;
+    }
+    return n;
+}
+
+// Decode 16-bit lanes holding bytes and the two bytes after each
+SSTRING_TARGET("sse4.2")
+inline __m128i decode_lanes_sse42(__m128i byte0, __m128i byte1, __m128i byte2) {
+    const __m128i payload1 = _mm_and_si128(byte1, _mm_set1_epi16(0x3F));
+    const __m128i payload2 = _mm_and_si128(byte2, _mm_set1_epi16(0x3F));
+    // After the lead of a 4-byte sequence: the low surrogate
+    const __m128i low = _mm_or_si128(_mm_or_si128(_mm_set1_epi16(static_cast<short>(0xDC00)), payload2),
+                                     _mm_slli_epi16(_mm_and_si128(byte1, _mm_set1_epi16(0x0F)), 6));
+    const __m128i two = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(byte0, _mm_set1_epi16(0x1F)), 6), payload1);
+    // Shifting the lead left by 12 drops all but its four payload bits
+    const __m128i three = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(byte0, 12), _mm_slli_epi16(payload1, 6)), payload2);
+    // The high surrogate is 0xD7C0 plus the code point shifted right by 10
+    const __m128i high = _mm_add_epi16(
+        _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(byte0, _mm_set1_epi16(0x07)), 8),
+                                  _mm_slli_epi16(payload1, 2)),
+                     _mm_srli_epi16(payload2, 4)),
+        _mm_set1_epi16(static_cast<short>(0xD7C0)));
+    __m128i units = _mm_blendv_epi8(byte0, low, _mm_cmpgt_epi16(byte0, _mm_set1_epi16(0x7F)));
+    units = _mm_blendv_epi8(units, two, _mm_cmpgt_epi16(byte0, _mm_set1_epi16(0xBF)));
+    units = _mm_blendv_epi8(units, three, _mm_cmpgt_epi16(byte0, _mm_set1_epi16(0xDF)));
+    return _mm_blendv_epi8(units, high, _mm_cmpgt_epi16(byte0, _mm_set1_epi16(0xEF)));
+}
+
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+inline void pack_lanes_sse42(__m128i units, unsigned mask, char16_t*& out) {
+    const PackTable& table = PACK_UNITS[Swap];
+    const __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(table.shuffle[mask]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(units, shuffle));
+    out += table.count[mask];
+}
+
+// Decode the code units of a 16-byte window selected by a mask (see
+// window_units). Writes 16 code units.
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+inline void decode_window_sse42(const unsigned char* str, unsigned units, char16_t*& out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str));
+    const __m128i next1 = _mm_srli_si128(input, 1);
+    const __m128i next2 = _mm_srli_si128(input, 2);
+    pack_lanes_sse42<Swap>(decode_lanes_sse42(_mm_cvtepu8_epi16(input), _mm_cvtepu8_epi16(next1),
+                                        _mm_cvtepu8_epi16(next2)), units & 0xFF, out);
+    pack_lanes_sse42<Swap>(decode_lanes_sse42(_mm_unpackhi_epi8(input, zero), _mm_unpackhi_epi8(next1, zero),
+                                        _mm_unpackhi_epi8(next2, zero)), units >> 8, out);
+}
+
+// The same with AVX2, decoding all 16 lanes of a window at once
+template <bool Swap>
+SSTRING_TARGET("avx2")
+inline void decode_window_avx2(const unsigned char* str, unsigned units, char16_t*& out) {
+    const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str));
+    const __m256i byte0 = _mm256_cvtepu8_epi16(input);
+    const __m256i byte1 = _mm256_cvtepu8_epi16(_mm_srli_si128(input, 1));
+    const __m256i byte2 = _mm256_cvtepu8_epi16(_mm_srli_si128(input, 2));
+    const __m256i payload1 = _mm256_and_si256(byte1, _mm256_set1_epi16(0x3F));
+    const __m256i payload2 = _mm256_and_si256(byte2, _mm256_set1_epi16(0x3F));
+    const __m256i low = _mm256_or_si256(_mm256_or_si256(_mm256_set1_epi16(static_cast<short>(0xDC00)), payload2),
+                                        _mm256_slli_epi16(_mm256_and_si256(byte1, _mm256_set1_epi16(0x0F)), 6));
+    const __m256i two = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(byte0, _mm256_set1_epi16(0x1F)), 6),
+                                        payload1);
+    const __m256i three = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(byte0, 12), _mm256_slli_epi16(payload1, 6)),
+                                          payload2);
+    const __m256i high = _mm256_add_epi16(
+        _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(byte0, _mm256_set1_epi16(0x07)), 8),
+                                        _mm256_slli_epi16(payload1, 2)),
+                        _mm256_srli_epi16(payload2, 4)),
+        _mm256_set1_epi16(static_cast<short>(0xD7C0)));
+    __m256i lanes = _mm256_blendv_epi8(byte0, low, _mm256_cmpgt_epi16(byte0, _mm256_set1_epi16(0x7F)));
+    lanes = _mm256_blendv_epi8(lanes, two, _mm256_cmpgt_epi16(byte0, _mm256_set1_epi16(0xBF)));
+    lanes = _mm256_blendv_epi8(lanes, three, _mm256_cmpgt_epi16(byte0, _mm256_set1_epi16(0xDF)));
+    lanes = _mm256_blendv_epi8(lanes, high, _mm256_cmpgt_epi16(byte0, _mm256_set1_epi16(0xEF)));
+
+    const PackTable& table = PACK_UNITS[Swap];
+    const unsigned low_mask = units & 0xFF;
+    const unsigned high_mask = units >> 8;
+    const __m256i shuffle = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(table.shuffle[low_mask]))),
+        _mm_load_si128(reinterpret_cast<const __m128i*>(table.shuffle[high_mask])), 1);
+    const __m256i packed = _mm256_shuffle_epi8(lanes, shuffle);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+    out += table.count[low_mask];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_extracti128_si256(packed, 1));
+    out += table.count[high_mask];
+}
+
+// Widen 16 ASCII bytes to code units, which shifting gives in the other byte order
+template <bool Swap>
+SSTRING_TARGET("avx2")
+inline __m256i widen_ascii_avx2(__m128i ascii) {
+    const __m256i units = _mm256_cvtepu8_epi16(ascii);
+    return Swap ? _mm256_slli_epi16(units, 8) : units;
+}
+
+// Blocks are decoded while this many bytes are left. The last window of a
+// block reads 4 bytes past it, and a window writes 16 code units, at most 3
+// more than the bytes of the sequences before it.
+constexpr std::size_t DECODE_BLOCK_MIN = 88;
+
+// Decode the sequences of a valid 64-byte block, given the masks of the bytes
+// that start sequences and of those that start 4-byte sequences. Returns the
+// number of bytes decoded: all but a sequence cut off at the end of the block.
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+inline std::size_t decode_block_sse42(const unsigned char* str, std::uint64_t leads, std::uint64_t four_byte,
+                                      char16_t*& out) {
+    const std::size_t length = complete_length(str, 64);
+    leads &= ~std::uint64_t{0} >> (64 - length);
+    for (std::size_t window = 0; window < length; window += WINDOW_STEP) {
+        decode_window_sse42<Swap>(str + window, window_units(leads, four_byte & leads, window), out);
+    }
+    return length;
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx2")
+inline std::size_t decode_block_avx2(const unsigned char* str, std::uint64_t leads, std::uint64_t four_byte,
+                                     char16_t*& out) {
+    const std::size_t length = complete_length(str, 64);
+    leads &= ~std::uint64_t{0} >> (64 - length);
+    for (std::size_t window = 0; window < length; window += WINDOW_STEP) {
+        decode_window_avx2<Swap>(str + window, window_units(leads, four_byte & leads, window), out);
+    }
+    return length;
+}
+
+// Decode the bytes after the blocks, a valid 16-byte window at a time while
+// there are as many, and otherwise one group at a time
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+inline void decode_tail_sse42(const unsigned char* str, const unsigned char* end, char16_t*& out) {
+    while (end - str >= 16) {
+        const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str));
+        const __m128i error = utf8_errors_sse42(input, _mm_setzero_si128());
+        if (!_mm_testz_si128(error, error)) {
+            str = decode_groups<Swap>(str, str + 16, end, out);
+            continue;
+        }
+        // Continuation bytes are 0x80 to 0xBF, the signed bytes below -64
+        const std::size_t length = complete_length(str, 16);
+        const unsigned leads = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmplt_epi8(input, _mm_set1_epi8(-64)))) &
+                               ((1u << length) - 1);
+        const unsigned four_byte = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_max_epu8(input, _mm_set1_epi8(static_cast<char>(0xF0))), input))) & leads;
+        decode_window_sse42<Swap>(str, leads | (four_byte << 1), out);
+        str += length;
+    }
+    decode_groups<Swap>(str, end, end, out);
+}
+
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+std::size_t utf8_to_utf16_sse42(const char* data, std::size_t length, char16_t* out) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    char16_t* const start = out;
+    const __m128i zero = _mm_setzero_si128();
+    while (static_cast<std::size_t>(end - str) >= DECODE_BLOCK_MIN) {
+        __m128i in[4];
+        for (int i = 0; i < 4; ++i) {
+            in[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + 16 * i));
+        }
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(in[0], in[1]), _mm_or_si128(in[2], in[3]))) == 0) {
+            // Interleaving with zeros puts them in the high or the low bytes
+            for (int i = 0; i < 4; ++i) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * i),
+                                 Swap ? _mm_unpacklo_epi8(zero, in[i]) : _mm_unpacklo_epi8(in[i], zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * i + 8),
+                                 Swap ? _mm_unpackhi_epi8(zero, in[i]) : _mm_unpackhi_epi8(in[i], zero));
+            }
+            str += 64;
+            out += 64;
+            continue;
+        }
+        __m128i error = utf8_errors_sse42(in[0], zero);
+        for (int i = 1; i < 4; ++i) {
+            error = _mm_or_si128(error, utf8_errors_sse42(in[i], in[i - 1]));
+        }
+        if (!_mm_testz_si128(error, error)) {
+            // Invalid bytes: decode the block one group at a time
+            str = decode_groups<Swap>(str, str + 64, end, out);
+            continue;
+        }
+        std::uint64_t continuation = 0;
+        std::uint64_t four_byte = 0;
+        for (int i = 0; i < 4; ++i) {
+            continuation |= static_cast<std::uint64_t>(static_cast<unsigned>(
+                _mm_movemask_epi8(_mm_cmplt_epi8(in[i], _mm_set1_epi8(-64))))) << (16 * i);
+            four_byte |= static_cast<std::uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_max_epu8(in[i], _mm_set1_epi8(static_cast<char>(0xF0))), in[i])))) << (16 * i);
+        }
+        str += decode_block_sse42<Swap>(str, ~continuation, four_byte, out);
+    }
+    decode_tail_sse42<Swap>(str, end, out);
+    return static_cast<std::size_t>(out - start);
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx2")
+std::size_t utf8_to_utf16_avx2(const char* data, std::size_t length, char16_t* out) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    char16_t* const start = out;
+    while (static_cast<std::size_t>(end - str) >= DECODE_BLOCK_MIN) {
+        const __m256i in0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str));
+        const __m256i in1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + 32));
+        if (_mm256_movemask_epi8(_mm256_or_si256(in0, in1)) == 0) {
+            __m256i* units = reinterpret_cast<__m256i*>(out);
+            _mm256_storeu_si256(units, widen_ascii_avx2<Swap>(_mm256_castsi256_si128(in0)));
+            _mm256_storeu_si256(units + 1, widen_ascii_avx2<Swap>(_mm256_extracti128_si256(in0, 1)));
+            _mm256_storeu_si256(units + 2, widen_ascii_avx2<Swap>(_mm256_castsi256_si128(in1)));
+            _mm256_storeu_si256(units + 3, widen_ascii_avx2<Swap>(_mm256_extracti128_si256(in1, 1)));
+            str += 64;
+            out += 64;
+            continue;
+        }
+        const __m256i error = _mm256_or_si256(utf8_errors_avx2(in0, _mm256_setzero_si256()),
+                                              utf8_errors_avx2(in1, in0));
+        if (!_mm256_testz_si256(error, error)) {
+            str = decode_groups<Swap>(str, str + 64, end, out);
+            continue;
+        }
+        const __m256i continuation_max = _mm256_set1_epi8(-64);
+        const __m256i four_byte_min = _mm256_set1_epi8(static_cast<char>(0xF0));
+        const std::uint64_t continuation =
+            static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(continuation_max, in0))) |
+            static_cast<std::uint64_t>(static_cast<std::uint32_t>(
+                _mm256_movemask_epi8(_mm256_cmpgt_epi8(continuation_max, in1)))) << 32;
+        const std::uint64_t four_byte =
+            static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_max_epu8(in0, four_byte_min), in0))) |
+            static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_max_epu8(in1, four_byte_min), in1)))) << 32;
+        str += decode_block_avx2<Swap>(str, ~continuation, four_byte, out);
+    }
+    decode_tail_sse42<Swap>(str, end, out);
+    return static_cast<std::size_t>(out - start);
+}
+
+// Decode 32 bytes of a valid block, each byte in a 16-bit lane of its own, and
+// write the code units selected by a mask next to each other. Reads 2 bytes
+// past the 32 and writes 32 code units.
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw,avx512vbmi2,popcnt")
+inline void decode_half_avx512(const unsigned char* str, std::uint32_t units, char16_t*& out) {
+    const __m512i byte0 = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(str)));
+    const __m512i byte1 = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + 1)));
+    const __m512i byte2 = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + 2)));
+    const __m512i payload1 = _mm512_and_si512(byte1, _mm512_set1_epi16(0x3F));
+    const __m512i payload2 = _mm512_and_si512(byte2, _mm512_set1_epi16(0x3F));
+    const __m512i low = _mm512_or_si512(_mm512_or_si512(_mm512_set1_epi16(static_cast<short>(0xDC00)), payload2),
+                                        _mm512_slli_epi16(_mm512_and_si512(byte1, _mm512_set1_epi16(0x0F)), 6));
+    const __m512i two = _mm512_or_si512(_mm512_slli_epi16(_mm512_and_si512(byte0, _mm512_set1_epi16(0x1F)), 6),
+                                        payload1);
+    const __m512i three = _mm512_or_si512(_mm512_or_si512(_mm512_slli_epi16(byte0, 12), _mm512_slli_epi16(payload1, 6)),
+                                          payload2);
+    const __m512i high = _mm512_add_epi16(
+        _mm512_or_si512(_mm512_or_si512(_mm512_slli_epi16(_mm512_and_si512(byte0, _mm512_set1_epi16(0x07)), 8),
+                                        _mm512_slli_epi16(payload1, 2)),
+                        _mm512_srli_epi16(payload2, 4)),
+        _mm512_set1_epi16(static_cast<short>(0xD7C0)));
+    __m512i lanes = _mm512_mask_mov_epi16(byte0, _mm512_cmpgt_epi16_mask(byte0, _mm512_set1_epi16(0x7F)), low);
+    lanes = _mm512_mask_mov_epi16(lanes, _mm512_cmpgt_epi16_mask(byte0, _mm512_set1_epi16(0xBF)), two);
+    lanes = _mm512_mask_mov_epi16(lanes, _mm512_cmpgt_epi16_mask(byte0, _mm512_set1_epi16(0xDF)), three);
+    lanes = _mm512_mask_mov_epi16(lanes, _mm512_cmpgt_epi16_mask(byte0, _mm512_set1_epi16(0xEF)), high);
+    const __m512i packed = _mm512_maskz_compress_epi16(units, lanes);
+    _mm512_storeu_si512(out, Swap ? _mm512_or_si512(_mm512_slli_epi16(packed, 8), _mm512_srli_epi16(packed, 8))
+                                  : packed);
+    out += _mm_popcnt_u32(units);
+}
+
+// With AVX-512 VBMI2, a block is decoded in two halves of 32 lanes that
+// vpcompressw packs, so no window has to be decoded twice. A 4-byte sequence
+// may straddle the halves: its low surrogate is decoded from the lane of its
+// second byte, which only reads bytes of the same sequence.
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw,avx512vbmi2,popcnt,bmi")
+std::size_t utf8_to_utf16_avx512(const char* data, std::size_t length, char16_t* out) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    char16_t* const start = out;
+    while (static_cast<std::size_t>(end - str) >= DECODE_BLOCK_MIN) {
+        const __m512i input = _mm512_loadu_si512(str);
+        if (_mm512_movepi8_mask(input) == 0) {
+            const __m512i low = _mm512_cvtepu8_epi16(_mm512_castsi512_si256(input));
+            const __m512i high = _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(input, 1));
+            _mm512_storeu_si512(out, Swap ? _mm512_slli_epi16(low, 8) : low);
+            _mm512_storeu_si512(out + 32, Swap ? _mm512_slli_epi16(high, 8) : high);
+            str += 64;
+            out += 64;
+            continue;
+        }
+        const __m512i error = utf8_errors_avx512(input, _mm512_setzero_si512());
+        if (_mm512_test_epi8_mask(error, error) != 0) {
+            str = decode_groups<Swap>(str, str + 64, end, out);
+            continue;
+        }
+        // The block ends before a sequence cut off at its end (tzcnt gives 64 for 0)
+        const std::uint64_t two_byte = _mm512_cmpge_epu8_mask(input, _mm512_set1_epi8(static_cast<char>(0xC0)));
+        const std::uint64_t three_byte = _mm512_cmpge_epu8_mask(input, _mm512_set1_epi8(static_cast<char>(0xE0)));
+        std::uint64_t four_byte = _mm512_cmpge_epu8_mask(input, _mm512_set1_epi8(static_cast<char>(0xF0)));
+        const std::size_t block = _tzcnt_u64((two_byte & 0x8000000000000000) | (three_byte & 0x4000000000000000) |
+                                             (four_byte & 0x2000000000000000));
+        const std::uint64_t leads = ~_mm512_cmplt_epi8_mask(input, _mm512_set1_epi8(-64)) &
+                                    (~std::uint64_t{0} >> (64 - block));
+        four_byte &= leads;
+        const std::uint64_t units = leads | (four_byte << 1);
+        decode_half_avx512<Swap>(str, static_cast<std::uint32_t>(units), out);
+        decode_half_avx512<Swap>(str + 32, static_cast<std::uint32_t>(units >> 32), out);
+        str += block;
+    }
+    decode_tail_sse42<Swap>(str, end, out);
+    return static_cast<std::size_t>(out - start);
+}
+
+// UTF-16 to UTF-32, for UTF-32 output decoded through UTF-16 (see
+// utf8_to_utf32_chunks()). Vectors of code units without surrogates are
+// zero-extended, and their byte order swapped with a shuffle; the others are
+// widened one code unit or surrogate pair at a time.
+
+alignas(16) constexpr unsigned char SWAP_32[16] = {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12};
+
+// The end of the code units of a vector with surrogates, past the low
+// surrogate of a pair it cuts off
+inline const char16_t* widen_stop(const char16_t* units, std::size_t count) noexcept {
+    return units + count + (units[count - 1] >= 0xD800 && units[count - 1] <= 0xDBFF);
+}
+
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+char32_t* utf16_to_utf32_sse42(const char16_t* units, const char16_t* end, char32_t* out) noexcept {
+    const __m128i swap = _mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32));
+    while (end - units >= 8) {
+        const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(units));
+        // Surrogates are 0xD800 to 0xDFFF
+        const __m128i surrogates = _mm_cmpeq_epi16(_mm_and_si128(input, _mm_set1_epi16(static_cast<short>(0xF800))),
+                                                   _mm_set1_epi16(static_cast<short>(0xD800)));
+        if (!_mm_testz_si128(surrogates, surrogates)) {
+            const char16_t* stop = widen_stop(units, 8);
+            out = widen_units<Swap>(units, stop, out);
+            units = stop;
+            continue;
+        }
+        __m128i low = _mm_cvtepu16_epi32(input);
+        __m128i high = _mm_unpackhi_epi16(input, _mm_setzero_si128());
+        if (Swap) {
+            low = _mm_shuffle_epi8(low, swap);
+            high = _mm_shuffle_epi8(high, swap);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), low);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), high);
+        units += 8;
+        out += 8;
+    }
+    return widen_units<Swap>(units, end, out);
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx2")
+char32_t* utf16_to_utf32_avx2(const char16_t* units, const char16_t* end, char32_t* out) noexcept {
+    const __m256i swap = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32)));
+    while (end - units >= 16) {
+        const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(units));
+        const __m256i surrogates = _mm256_cmpeq_epi16(
+            _mm256_and_si256(input, _mm256_set1_epi16(static_cast<short>(0xF800))),
+            _mm256_set1_epi16(static_cast<short>(0xD800)));
+        if (!_mm256_testz_si256(surrogates, surrogates)) {
+            const char16_t* stop = widen_stop(units, 16);
+            out = widen_units<Swap>(units, stop, out);
+            units = stop;
+            continue;
+        }
+        __m256i low = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(input));
+        __m256i high = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(input, 1));
+        if (Swap) {
+            low = _mm256_shuffle_epi8(low, swap);
+            high = _mm256_shuffle_epi8(high, swap);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), high);
+        units += 16;
+        out += 16;
+    }
+    return widen_units<Swap>(units, end, out);
+}
+
+// With AVX-512, UTF-32 is decoded directly, from valid UTF-8 only: a block in
+// four quarters of 16 bytes, each byte in a 32-bit lane of its own, with the
+// code points of the lead bytes packed by vpcompressd and written with a
+// masked store.
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw,popcnt")
+inline void decode_quarter_avx512(const unsigned char* str, unsigned leads, char32_t*& out) {
+    const __m512i byte0 = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str)));
+    const __m512i byte1 = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str + 1)));
+    const __m512i byte2 = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str + 2)));
+    const __m512i byte3 = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str + 3)));
+    const __m512i payload = _mm512_set1_epi32(0x3F);
+    const __m512i payload1 = _mm512_and_si512(byte1, payload);
+    const __m512i payload2 = _mm512_and_si512(byte2, payload);
+    const __m512i two = _mm512_or_si512(_mm512_slli_epi32(_mm512_and_si512(byte0, _mm512_set1_epi32(0x1F)), 6),
+                                        payload1);
+    const __m512i three = _mm512_or_si512(
+        _mm512_or_si512(_mm512_slli_epi32(_mm512_and_si512(byte0, _mm512_set1_epi32(0x0F)), 12),
+                        _mm512_slli_epi32(payload1, 6)),
+        payload2);
+    const __m512i four = _mm512_or_si512(
+        _mm512_or_si512(_mm512_slli_epi32(_mm512_and_si512(byte0, _mm512_set1_epi32(0x07)), 18),
+                        _mm512_slli_epi32(payload1, 12)),
+        _mm512_or_si512(_mm512_slli_epi32(payload2, 6), _mm512_and_si512(byte3, payload)));
+    __m512i lanes = _mm512_mask_mov_epi32(byte0, _mm512_cmpgt_epi32_mask(byte0, _mm512_set1_epi32(0xBF)), two);
+    lanes = _mm512_mask_mov_epi32(lanes, _mm512_cmpgt_epi32_mask(byte0, _mm512_set1_epi32(0xDF)), three);
+    lanes = _mm512_mask_mov_epi32(lanes, _mm512_cmpgt_epi32_mask(byte0, _mm512_set1_epi32(0xEF)), four);
+    __m512i packed = _mm512_maskz_compress_epi32(static_cast<__mmask16>(leads), lanes);
+    if (Swap) {
+        packed = _mm512_shuffle_epi8(packed, _mm512_broadcast_i32x4(
+            _mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32))));
+    }
+    const unsigned count = static_cast<unsigned>(_mm_popcnt_u32(leads));
+    _mm512_mask_storeu_epi32(out, static_cast<__mmask16>((1u << count) - 1), packed);
+    out += count;
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw,popcnt,bmi")
+std::size_t utf8_to_utf32_avx512(const char* data, std::size_t length, char32_t* out) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    char32_t* const start = out;
+    while (static_cast<std::size_t>(end - str) >= DECODE_BLOCK_MIN) {
+        const __m512i input = _mm512_loadu_si512(str);
+        if (_mm512_movepi8_mask(input) == 0) {
+            for (int quarter = 0; quarter < 4; ++quarter) {
+                const __m512i values = _mm512_cvtepu8_epi32(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + 16 * quarter)));
+                _mm512_storeu_si512(out + 16 * quarter, Swap ? _mm512_slli_epi32(values, 24) : values);
+            }
+            str += 64;
+            out += 64;
+            continue;
+        }
+        const std::uint64_t two_byte = _mm512_cmpge_epu8_mask(input, _mm512_set1_epi8(static_cast<char>(0xC0)));
+        const std::uint64_t three_byte = _mm512_cmpge_epu8_mask(input, _mm512_set1_epi8(static_cast<char>(0xE0)));
+        const std::uint64_t four_byte = _mm512_cmpge_epu8_mask(input, _mm512_set1_epi8(static_cast<char>(0xF0)));
+        const std::size_t block = _tzcnt_u64((two_byte & 0x8000000000000000) | (three_byte & 0x4000000000000000) |
+                                             (four_byte & 0x2000000000000000));
+        const std::uint64_t leads = ~_mm512_cmplt_epi8_mask(input, _mm512_set1_epi8(-64)) &
+                                    (~std::uint64_t{0} >> (64 - block));
+        for (int quarter = 0; quarter < 4; ++quarter) {
+            decode_quarter_avx512<Swap>(str + 16 * quarter, static_cast<unsigned>(leads >> (16 * quarter)) & 0xFFFF,
+                                        out);
+        }
+        str += block;
+    }
+    return static_cast<std::size_t>(out - start) +
+           utf8_to_utf32_scalar<Swap>(reinterpret_cast<const char*>(str), static_cast<std::size_t>(end - str), out);
+}
+
+// Counting. Valid text is counted with byte compares: continuation bytes are
+// those below -64 as signed bytes, and 4-byte leads those the unsigned
+// maximum with 0xF0 leaves unchanged. SSE4.2 and AVX2 add up the matches in
+// 8-bit lanes for up to 255 vectors at a time.
+
+constexpr std::size_t COUNT_BATCH = 255;
+
+SSTRING_TARGET("sse4.2")
+inline std::uint64_t sum_bytes_sse42(__m128i bytes) {
+    const __m128i sums = _mm_sad_epu8(bytes, _mm_setzero_si128());
+    return static_cast<std::uint64_t>(_mm_cvtsi128_si64(sums)) + static_cast<std::uint64_t>(_mm_extract_epi64(sums, 1));
+}
+
+SSTRING_TARGET("sse4.2")
+Utf16Counts count_valid_utf16_sse42(const char* data, std::size_t length) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    std::uint64_t continuation = 0;
+    std::uint64_t four_byte = 0;
+    while (end - str >= 16) {
+        const unsigned char* batch_end = str + std::min<std::size_t>((end - str) / 16, COUNT_BATCH) * 16;
+        __m128i continuation8 = _mm_setzero_si128();
+        __m128i four_byte8 = _mm_setzero_si128();
+        for (; str < batch_end; str += 16) {
+            const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str));
+            // Compares give -1 for each match
+            continuation8 = _mm_sub_epi8(continuation8, _mm_cmplt_epi8(input, _mm_set1_epi8(-64)));
+            four_byte8 = _mm_sub_epi8(four_byte8, _mm_cmpeq_epi8(
+                _mm_max_epu8(input, _mm_set1_epi8(static_cast<char>(0xF0))), input));
+        }
+        continuation += sum_bytes_sse42(continuation8);
+        four_byte += sum_bytes_sse42(four_byte8);
+    }
+    Utf16Counts counts = count_valid_utf16(str, end);
+    const std::size_t code_points = (length - static_cast<std::size_t>(end - str)) - continuation;
+    counts.code_points += code_points;
+    counts.units += code_points + four_byte;
+    return counts;
+}
+
+SSTRING_TARGET("avx2")
+inline std::uint64_t sum_bytes_avx2(__m256i bytes) {
+    const __m256i lanes = _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+    const __m128i sums = _mm_add_epi64(_mm256_castsi256_si128(lanes), _mm256_extracti128_si256(lanes, 1));
+    return static_cast<std::uint64_t>(_mm_cvtsi128_si64(sums)) + static_cast<std::uint64_t>(_mm_extract_epi64(sums, 1));
+}
+
+SSTRING_TARGET("avx2")
+Utf16Counts count_valid_utf16_avx2(const char* data, std::size_t length) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = str + length;
+    std::uint64_t continuation = 0;
+    std::uint64_t four_byte = 0;
+    while (end - str >= 32) {
+        const unsigned char* batch_end = str + std::min<std::size_t>((end - str) / 32, COUNT_BATCH) * 32;
+        __m256i continuation8 = _mm256_setzero_si256();
+        __m256i four_byte8 = _mm256_setzero_si256();
+        for (; str < batch_end; str += 32) {
+            const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str));
+            continuation8 = _mm256_sub_epi8(continuation8, _mm256_cmpgt_epi8(_mm256_set1_epi8(-64), input));
+            four_byte8 = _mm256_sub_epi8(four_byte8, _mm256_cmpeq_epi8(
+                _mm256_max_epu8(input, _mm256_set1_epi8(static_cast<char>(0xF0))), input));
+        }
+        continuation += sum_bytes_avx2(continuation8);
+        four_byte += sum_bytes_avx2(four_byte8);
+    }
+    Utf16Counts counts = count_valid_utf16(str, end);
+    const std::size_t code_points = (length - static_cast<std::size_t>(end - str)) - continuation;
+    counts.code_points += code_points;
+    counts.units += code_points + four_byte;
+    return counts;
+}
+
+// AVX-512 counts the bits of compare masks, and reads the tail with a masked
+// load whose zeros count as ASCII
+SSTRING_TARGET("avx512f,avx512bw,popcnt")
+Utf16Counts count_valid_utf16_avx512(const char* data, std::size_t length) noexcept {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(data);
+    std::uint64_t continuation = 0;
+    std::uint64_t four_byte = 0;
+    for (std::size_t pos = 0; pos < length; pos += 64) {
+        const std::size_t left = length - pos;
+        const __mmask64 bytes = left >= 64 ? ~__mmask64{0} : (__mmask64{1} << left) - 1;
+        const __m512i input = _mm512_maskz_loadu_epi8(bytes, str + pos);
+        continuation += _mm_popcnt_u64(_mm512_cmplt_epi8_mask(input, _mm512_set1_epi8(-64)));
+        four_byte += _mm_popcnt_u64(_mm512_cmpge_epu8_mask(input, _mm512_set1_epi8(static_cast<char>(0xF0))));
+    }
+    return {length - continuation + four_byte, length - continuation};
+}
+
+Utf16Counts count_utf16_sse42(const char* data, std::size_t length) noexcept {
+    return count_utf16_runs(data, length, validate_utf8_sse42, count_valid_utf16_sse42);
+}
+
+Utf16Counts count_utf16_avx2(const char* data, std::size_t length) noexcept {
+    return count_utf16_runs(data, length, validate_utf8_avx2, count_valid_utf16_avx2);
+}
+
+Utf16Counts count_utf16_avx512(const char* data, std::size_t length) noexcept {
+    return count_utf16_runs(data, length, validate_utf8_avx512, count_valid_utf16_avx512);
+}
+
+// UTF-16, UTF-32 and ISO-8859-1 to UTF-8. The bytes of each code unit or code
+// point are put in a lane of its own, first byte lowest, and the lanes packed
+// together: lanes of 16 bits for code units below 0x800, which have one or two
+// bytes, and lanes of 32 bits for any code point. SSE4.2 and AVX2 pack 16 bytes
+// at a time with shuffles looked up by the lengths of the lanes, less one (one
+// bit per 16-bit lane, two per 32-bit lane), which write up to 16 bytes. Every
+// code unit decodes to at least one byte, so vectors are decoded while enough
+// code units are left that their output takes the bytes written past.
+
+struct Utf8PackTable {
+    unsigned char shuffle[256][16];
+    unsigned char length[256];
+};
+
+constexpr Utf8PackTable make_utf8_pack_table(unsigned width) {
+    Utf8PackTable table{};
+    const unsigned bits = width / 2;
+    for (unsigned index = 0; index < 256; ++index) {
+        unsigned length = 0;
+        for (unsigned lane = 0; lane < 16 / width; ++lane) {
+            const unsigned bytes = 1 + ((index >> (bits * lane)) & ((1u << bits) - 1));
+            for (unsigned byte = 0; byte < bytes; ++byte) {
+                table.shuffle[index][length++] = static_cast<unsigned char>(width * lane + byte);
+            }
+        }
+        for (unsigned byte = length; byte < 16; ++byte) {
+            table.shuffle[index][byte] = 0x80;
+        }
+        table.length[index] = static_cast<unsigned char>(length);
+    }
+    return table;
+}
+
+alignas(16) constexpr Utf8PackTable PACK_UTF8_16 = make_utf8_pack_table(2);
+alignas(16) constexpr Utf8PackTable PACK_UTF8_32 = make_utf8_pack_table(4);
+
+// The bits of a mask of four 32-bit lanes moved to the low bits of their 2-bit fields
+constexpr unsigned char SPREAD_LANES[16] = {0, 1, 4, 5, 16, 17, 20, 21, 64, 65, 68, 69, 80, 81, 84, 85};
+
+constexpr std::size_t DECODE_SLACK = 16;
+
+alignas(16) constexpr unsigned char SWAP_16[16] = {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14};
+
+// A 16-bit constant as the code units of a byte order hold it, for tests that
+// need not swap the code units first
+template <bool Swap>
+constexpr short unit_pattern(std::uint16_t value) {
+    return static_cast<short>(Swap ? static_cast<std::uint16_t>((value << 8) | (value >> 8)) : value);
+}
+
+// (high << 10) + low - SURROGATE_OFFSET is the code point of a surrogate pair
+constexpr std::uint32_t SURROGATE_OFFSET = (0xD800u << 10) + 0xDC00u - 0x10000u;
+
+SSTRING_TARGET("sse4.2")
+inline void pack_utf8_sse42(__m128i bytes, const Utf8PackTable& table, unsigned index, char*& out) {
+    const __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(table.shuffle[index]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(bytes, shuffle));
+    out += table.length[index];
+}
+
+// Decode 8 code units below 0x800 in 16-bit lanes
+SSTRING_TARGET("sse4.2")
+inline void decode_units_800_sse42(__m128i units, char*& out) {
+    const __m128i ascii = _mm_cmplt_epi16(units, _mm_set1_epi16(0x80));
+    const __m128i lead = _mm_or_si128(_mm_srli_epi16(units, 6), _mm_set1_epi16(0xC0));
+    const __m128i continuation = _mm_slli_epi16(
+        _mm_or_si128(_mm_and_si128(units, _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80)), 8);
+    const __m128i bytes = _mm_blendv_epi8(_mm_or_si128(lead, continuation), units, ascii);
+    const unsigned two_byte = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(ascii, ascii))) & 0xFF;
+    pack_utf8_sse42(bytes, PACK_UTF8_16, two_byte, out);
+}
+
+// The UTF-8 of 4 code points in 32-bit lanes, and the index of its shuffle
+SSTRING_TARGET("sse4.2")
+inline __m128i utf8_lanes_32_sse42(__m128i code_points, unsigned& index) {
+    const __m128i payload = _mm_set1_epi32(0x3F);
+    const __m128i marker = _mm_set1_epi32(0x80);
+    // The continuation bytes of bits 0-5, 6-11 and 12-17
+    const __m128i last = _mm_or_si128(_mm_and_si128(code_points, payload), marker);
+    const __m128i middle = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(code_points, 6), payload), marker);
+    const __m128i first = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(code_points, 12), payload), marker);
+    const __m128i two = _mm_cmpgt_epi32(code_points, _mm_set1_epi32(0x7F));
+    const __m128i three = _mm_cmpgt_epi32(code_points, _mm_set1_epi32(0x7FF));
+    const __m128i four = _mm_cmpgt_epi32(code_points, _mm_set1_epi32(0xFFFF));
+    __m128i bytes = _mm_blendv_epi8(code_points, _mm_or_si128(
+        _mm_or_si128(_mm_srli_epi32(code_points, 6), _mm_set1_epi32(0xC0)), _mm_slli_epi32(last, 8)), two);
+    bytes = _mm_blendv_epi8(bytes, _mm_or_si128(
+        _mm_or_si128(_mm_srli_epi32(code_points, 12), _mm_set1_epi32(0xE0)),
+        _mm_or_si128(_mm_slli_epi32(middle, 8), _mm_slli_epi32(last, 16))), three);
+    bytes = _mm_blendv_epi8(bytes, _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_srli_epi32(code_points, 18), _mm_set1_epi32(0xF0)), _mm_slli_epi32(first, 8)),
+        _mm_or_si128(_mm_slli_epi32(middle, 16), _mm_slli_epi32(last, 24))), four);
+    index = SPREAD_LANES[_mm_movemask_ps(_mm_castsi128_ps(two))] +
+            SPREAD_LANES[_mm_movemask_ps(_mm_castsi128_ps(three))] +
+            SPREAD_LANES[_mm_movemask_ps(_mm_castsi128_ps(four))];
+    return bytes;
+}
+
+SSTRING_TARGET("sse4.2")
+inline void decode_lanes_32_sse42(__m128i code_points, char*& out) {
+    unsigned index;
+    const __m128i bytes = utf8_lanes_32_sse42(code_points, index);
+    pack_utf8_sse42(bytes, PACK_UTF8_32, index, out);
+}
+
+SSTRING_TARGET("avx2")
+inline void pack_utf8_avx2(__m256i bytes, const Utf8PackTable& table, unsigned low, unsigned high, char*& out) {
+    const __m256i shuffle = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(table.shuffle[low]))),
+        _mm_load_si128(reinterpret_cast<const __m128i*>(table.shuffle[high])), 1);
+    const __m256i packed = _mm256_shuffle_epi8(bytes, shuffle);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+    out += table.length[low];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_extracti128_si256(packed, 1));
+    out += table.length[high];
+}
+
+SSTRING_TARGET("avx2")
+inline void decode_units_800_avx2(__m256i units, char*& out) {
+    const __m256i ascii = _mm256_cmpgt_epi16(_mm256_set1_epi16(0x80), units);
+    const __m256i lead = _mm256_or_si256(_mm256_srli_epi16(units, 6), _mm256_set1_epi16(0xC0));
+    const __m256i continuation = _mm256_slli_epi16(
+        _mm256_or_si256(_mm256_and_si256(units, _mm256_set1_epi16(0x3F)), _mm256_set1_epi16(0x80)), 8);
+    const __m256i bytes = _mm256_blendv_epi8(_mm256_or_si256(lead, continuation), units, ascii);
+    // Packing within the 128-bit lanes puts the masks of the halves in bytes 0-7 and 16-23
+    const unsigned two_byte = ~static_cast<unsigned>(_mm256_movemask_epi8(_mm256_packs_epi16(ascii, ascii)));
+    pack_utf8_avx2(bytes, PACK_UTF8_16, two_byte & 0xFF, (two_byte >> 16) & 0xFF, out);
+}
+
+// The UTF-8 of 8 code points in 32-bit lanes, and the indexes of the shuffles of its halves
+SSTRING_TARGET("avx2")
+inline __m256i utf8_lanes_32_avx2(__m256i code_points, unsigned& low, unsigned& high) {
+    const __m256i payload = _mm256_set1_epi32(0x3F);
+    const __m256i marker = _mm256_set1_epi32(0x80);
+    const __m256i last = _mm256_or_si256(_mm256_and_si256(code_points, payload), marker);
+    const __m256i middle = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(code_points, 6), payload), marker);
+    const __m256i first = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(code_points, 12), payload), marker);
+    const __m256i two = _mm256_cmpgt_epi32(code_points, _mm256_set1_epi32(0x7F));
+    const __m256i three = _mm256_cmpgt_epi32(code_points, _mm256_set1_epi32(0x7FF));
+    const __m256i four = _mm256_cmpgt_epi32(code_points, _mm256_set1_epi32(0xFFFF));
+    __m256i bytes = _mm256_blendv_epi8(code_points, _mm256_or_si256(
+        _mm256_or_si256(_mm256_srli_epi32(code_points, 6), _mm256_set1_epi32(0xC0)), _mm256_slli_epi32(last, 8)), two);
+    bytes = _mm256_blendv_epi8(bytes, _mm256_or_si256(
+        _mm256_or_si256(_mm256_srli_epi32(code_points, 12), _mm256_set1_epi32(0xE0)),
+        _mm256_or_si256(_mm256_slli_epi32(middle, 8), _mm256_slli_epi32(last, 16))), three);
+    bytes = _mm256_blendv_epi8(bytes, _mm256_or_si256(
+        _mm256_or_si256(_mm256_or_si256(_mm256_srli_epi32(code_points, 18), _mm256_set1_epi32(0xF0)),
+                        _mm256_slli_epi32(first, 8)),
+        _mm256_or_si256(_mm256_slli_epi32(middle, 16), _mm256_slli_epi32(last, 24))), four);
+    const unsigned two_mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(two)));
+    const unsigned three_mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(three)));
+    const unsigned four_mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(four)));
+    low = SPREAD_LANES[two_mask & 0xF] + SPREAD_LANES[three_mask & 0xF] + SPREAD_LANES[four_mask & 0xF];
+    high = SPREAD_LANES[two_mask >> 4] + SPREAD_LANES[three_mask >> 4] + SPREAD_LANES[four_mask >> 4];
+    return bytes;
+}
+
+SSTRING_TARGET("avx2")
+inline void decode_lanes_32_avx2(__m256i code_points, char*& out) {
+    unsigned low;
+    unsigned high;
+    const __m256i bytes = utf8_lanes_32_avx2(code_points, low, high);
+    pack_utf8_avx2(bytes, PACK_UTF8_32, low, high, out);
+}
+
+// With AVX-512 VBMI2, vpcompressb packs the bytes of 64-byte vectors, which
+// are written with masked stores
+SSTRING_TARGET("avx512f,avx512bw,avx512vbmi2,popcnt")
+inline void store_utf8_avx512(__m512i bytes, __mmask64 keep, char*& out) {
+    const std::size_t length = _mm_popcnt_u64(keep);
+    const __mmask64 written = length == 64 ? ~__mmask64{0} : (__mmask64{1} << length) - 1;
+    _mm512_mask_storeu_epi8(out, written, _mm512_maskz_compress_epi8(keep, bytes));
+    out += length;
+}
+
+// Decode 32 code units below 0x800, of which those in a mask have two bytes
+SSTRING_TARGET("avx512f,avx512bw,avx512vbmi2,popcnt")
+inline void decode_units_800_avx512(__m512i units, __mmask32 two_byte, char*& out) {
+    const __m512i lead = _mm512_or_si512(_mm512_srli_epi16(units, 6), _mm512_set1_epi16(0xC0));
+    const __m512i continuation = _mm512_slli_epi16(
+        _mm512_or_si512(_mm512_and_si512(units, _mm512_set1_epi16(0x3F)), _mm512_set1_epi16(0x80)), 8);
+    const __m512i bytes = _mm512_mask_mov_epi16(units, two_byte, _mm512_or_si512(lead, continuation));
+    const __mmask64 keep = _mm512_movepi8_mask(
+        _mm512_mask_mov_epi16(_mm512_set1_epi16(0xFF), two_byte, _mm512_set1_epi16(-1)));
+    store_utf8_avx512(bytes, keep, out);
+}
+
+// Decode the code points of the 32-bit lanes in a mask
+SSTRING_TARGET("avx512f,avx512bw,avx512vbmi2,popcnt")
+inline void decode_lanes_32_avx512(__m512i code_points, __mmask16 lanes, char*& out) {
+    const __m512i payload = _mm512_set1_epi32(0x3F);
+    const __m512i marker = _mm512_set1_epi32(0x80);
+    const __m512i last = _mm512_or_si512(_mm512_and_si512(code_points, payload), marker);
+    const __m512i middle = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi32(code_points, 6), payload), marker);
+    const __m512i first = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi32(code_points, 12), payload), marker);
+    const __mmask16 two = _mm512_cmpgt_epu32_mask(code_points, _mm512_set1_epi32(0x7F));
+    const __mmask16 three = _mm512_cmpgt_epu32_mask(code_points, _mm512_set1_epi32(0x7FF));
+    const __mmask16 four = _mm512_cmpgt_epu32_mask(code_points, _mm512_set1_epi32(0xFFFF));
+    __m512i bytes = _mm512_mask_mov_epi32(code_points, two, _mm512_or_si512(
+        _mm512_or_si512(_mm512_srli_epi32(code_points, 6), _mm512_set1_epi32(0xC0)), _mm512_slli_epi32(last, 8)));
+    bytes = _mm512_mask_mov_epi32(bytes, three, _mm512_or_si512(
+        _mm512_or_si512(_mm512_srli_epi32(code_points, 12), _mm512_set1_epi32(0xE0)),
+        _mm512_or_si512(_mm512_slli_epi32(middle, 8), _mm512_slli_epi32(last, 16))));
+    bytes = _mm512_mask_mov_epi32(bytes, four, _mm512_or_si512(
+        _mm512_or_si512(_mm512_or_si512(_mm512_srli_epi32(code_points, 18), _mm512_set1_epi32(0xF0)),
+                        _mm512_slli_epi32(first, 8)),
+        _mm512_or_si512(_mm512_slli_epi32(middle, 16), _mm512_slli_epi32(last, 24))));
+    __m512i kept = _mm512_maskz_mov_epi32(lanes, _mm512_set1_epi32(0xFF));
+    kept = _mm512_mask_mov_epi32(kept, two & lanes, _mm512_set1_epi32(0xFFFF));
+    kept = _mm512_mask_mov_epi32(kept, three & lanes, _mm512_set1_epi32(0xFFFFFF));
+    kept = _mm512_mask_mov_epi32(kept, four & lanes, _mm512_set1_epi32(-1));
+    store_utf8_avx512(bytes, _mm512_movepi8_mask(kept), out);
+}
+
+// UTF-16. Vectors of ASCII are narrowed, vectors below 0x800 decoded in 16-bit
+// lanes, and others in 32-bit lanes. With SSE4.2 and AVX2, each surrogate of a
+// pair gets two of its four bytes: the high surrogate gives the first two, and
+// the low surrogate the last two, from the low two bits of the code unit
+// before it. A pair may then be cut off at the end of a vector.
+
+// The lanes of surrogates of valid code units, given the code units one lane
+// back, with two bytes each
+SSTRING_TARGET("sse4.2")
+inline __m128i surrogate_bytes_sse42(__m128i units, __m128i previous, __m128i high) {
+    const __m128i marker = _mm_set1_epi16(0x80);
+    // 0x10000 + ((unit - 0xD800) << 10) >> 10
+    const __m128i plane = _mm_sub_epi16(units, _mm_set1_epi16(static_cast<short>(0xD7C0)));
+    const __m128i first = _mm_or_si128(_mm_or_si128(_mm_srli_epi16(plane, 8), _mm_set1_epi16(0xF0)), _mm_slli_epi16(
+        _mm_or_si128(_mm_and_si128(_mm_srli_epi16(plane, 2), _mm_set1_epi16(0x3F)), marker), 8));
+    const __m128i last = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(previous, _mm_set1_epi16(3)), 4),
+                                  _mm_and_si128(_mm_srli_epi16(units, 6), _mm_set1_epi16(0xF))), marker),
+        _mm_slli_epi16(_mm_or_si128(_mm_and_si128(units, _mm_set1_epi16(0x3F)), marker), 8));
+    return _mm_blendv_epi8(last, first, high);
+}
+
+// Decode 4 code units in 32-bit lanes, given the bytes of the surrogates among them
+SSTRING_TARGET("sse4.2")
+inline void decode_units_32_sse42(__m128i units, __m128i surrogate_bytes, __m128i surrogates, char*& out) {
+    unsigned index;
+    const __m128i bytes = _mm_blendv_epi8(utf8_lanes_32_sse42(units, index), surrogate_bytes, surrogates);
+    pack_utf8_sse42(bytes, PACK_UTF8_32, index - SPREAD_LANES[_mm_movemask_ps(_mm_castsi128_ps(surrogates))], out);
+}
+
+// The last two bytes of a surrogate pair cut off at the end of the vectors
+template <bool Swap>
+inline void finish_pair(const char* begin, const char*& data, const char* end, char*& out) noexcept {
+    if (data == begin || data == end || (load_unit<char16_t, Swap>(data - 2) & 0xFC00) != 0xD800) {
+        return;
+    }
+    const char16_t high = load_unit<char16_t, Swap>(data - 2);
+    const char16_t low = load_unit<char16_t, Swap>(data);
+    *out++ = static_cast<char>(0x80 | ((high & 3) << 4) | ((low >> 6) & 0xF));
+    *out++ = static_cast<char>(0x80 | (low & 0x3F));
+    data += 2;
+}
+
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+std::size_t utf16_to_utf8_sse42(const char* data, std::size_t units, char* out) noexcept {
+    const char* const begin = data;
+    const char* const end = data + 2 * units;
+    char* const start = out;
+    const __m128i swap = _mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_16));
+    __m128i previous = _mm_setzero_si128();
+    while (static_cast<std::size_t>(end - data) >= 2 * (8 + DECODE_SLACK)) {
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        if (Swap) {
+            input = _mm_shuffle_epi8(input, swap);
+        }
+        const __m128i top = _mm_and_si128(input, _mm_set1_epi16(static_cast<short>(0xF800)));
+        if (_mm_testz_si128(input, _mm_set1_epi16(static_cast<short>(0xFF80)))) {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(input, input));
+            out += 8;
+        } else if (_mm_testz_si128(top, top)) {
+            decode_units_800_sse42(input, out);
+        } else {
+            const __m128i surrogates = _mm_cmpeq_epi16(top, _mm_set1_epi16(static_cast<short>(0xD800)));
+            const __m128i high = _mm_cmpeq_epi16(_mm_and_si128(input, _mm_set1_epi16(static_cast<short>(0xFC00))),
+                                                 _mm_set1_epi16(static_cast<short>(0xD800)));
+            const __m128i pairs = surrogate_bytes_sse42(input, _mm_alignr_epi8(input, previous, 14), high);
+            decode_units_32_sse42(_mm_cvtepu16_epi32(input), _mm_cvtepu16_epi32(pairs),
+                                  _mm_cvtepi16_epi32(surrogates), out);
+            decode_units_32_sse42(_mm_unpackhi_epi16(input, _mm_setzero_si128()),
+                                  _mm_unpackhi_epi16(pairs, _mm_setzero_si128()),
+                                  _mm_unpackhi_epi16(surrogates, surrogates), out);
+        }
+        previous = input;
+        data += 16;
+    }
+    finish_pair<Swap>(begin, data, end, out);
+    return static_cast<std::size_t>(out - start) +
+           utf16_to_utf8_scalar<Swap>(data, static_cast<std::size_t>(end - data) / 2, out);
+}
+
+SSTRING_TARGET("avx2")
+inline __m256i surrogate_bytes_avx2(__m256i units, __m256i previous, __m256i high) {
+    const __m256i marker = _mm256_set1_epi16(0x80);
+    const __m256i plane = _mm256_sub_epi16(units, _mm256_set1_epi16(static_cast<short>(0xD7C0)));
+    const __m256i first = _mm256_or_si256(
+        _mm256_or_si256(_mm256_srli_epi16(plane, 8), _mm256_set1_epi16(0xF0)),
+        _mm256_slli_epi16(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(plane, 2), _mm256_set1_epi16(0x3F)),
+                                          marker), 8));
+    const __m256i last = _mm256_or_si256(
+        _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(previous, _mm256_set1_epi16(3)), 4),
+                                        _mm256_and_si256(_mm256_srli_epi16(units, 6), _mm256_set1_epi16(0xF))),
+                        marker),
+        _mm256_slli_epi16(_mm256_or_si256(_mm256_and_si256(units, _mm256_set1_epi16(0x3F)), marker), 8));
+    return _mm256_blendv_epi8(last, first, high);
+}
+
+SSTRING_TARGET("avx2")
+inline void decode_units_32_avx2(__m256i units, __m256i surrogate_bytes, __m256i surrogates, char*& out) {
+    unsigned low;
+    unsigned high;
+    const __m256i bytes = _mm256_blendv_epi8(utf8_lanes_32_avx2(units, low, high), surrogate_bytes, surrogates);
+    const unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(surrogates)));
+    pack_utf8_avx2(bytes, PACK_UTF8_32, low - SPREAD_LANES[mask & 0xF], high - SPREAD_LANES[mask >> 4], out);
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx2")
+std::size_t utf16_to_utf8_avx2(const char* data, std::size_t units, char* out) noexcept {
+    const char* const begin = data;
+    const char* const end = data + 2 * units;
+    char* const start = out;
+    const __m256i swap = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_16)));
+    __m256i previous = _mm256_setzero_si256();
+    while (static_cast<std::size_t>(end - data) >= 2 * (16 + DECODE_SLACK)) {
+        __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        if (Swap) {
+            input = _mm256_shuffle_epi8(input, swap);
+        }
+        const __m256i top = _mm256_and_si256(input, _mm256_set1_epi16(static_cast<short>(0xF800)));
+        if (_mm256_testz_si256(input, _mm256_set1_epi16(static_cast<short>(0xFF80)))) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(
+                _mm256_castsi256_si128(input), _mm256_extracti128_si256(input, 1)));
+            out += 16;
+        } else if (_mm256_testz_si256(top, top)) {
+            decode_units_800_avx2(input, out);
+        } else {
+            const __m256i surrogates = _mm256_cmpeq_epi16(top, _mm256_set1_epi16(static_cast<short>(0xD800)));
+            const __m256i high = _mm256_cmpeq_epi16(
+                _mm256_and_si256(input, _mm256_set1_epi16(static_cast<short>(0xFC00))),
+                _mm256_set1_epi16(static_cast<short>(0xD800)));
+            // The code units one lane back, across the 128-bit lanes
+            const __m256i back = _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 14);
+            const __m256i pairs = surrogate_bytes_avx2(input, back, high);
+            decode_units_32_avx2(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(input)),
+                                 _mm256_cvtepu16_epi32(_mm256_castsi256_si128(pairs)),
+                                 _mm256_cvtepi16_epi32(_mm256_castsi256_si128(surrogates)), out);
+            decode_units_32_avx2(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(input, 1)),
+                                 _mm256_cvtepu16_epi32(_mm256_extracti128_si256(pairs, 1)),
+                                 _mm256_cvtepi16_epi32(_mm256_extracti128_si256(surrogates, 1)), out);
+        }
+        previous = input;
+        data += 32;
+    }
+    finish_pair<Swap>(begin, data, end, out);
+    return static_cast<std::size_t>(out - start) +
+           utf16_to_utf8_scalar<Swap>(data, static_cast<std::size_t>(end - data) / 2, out);
+}
+
+// Decode 16 code units in 32-bit lanes, given the code units one lane on: the
+// lanes of high surrogates get the code points of their pairs
+SSTRING_TARGET("avx512f,avx512bw,avx512vbmi2,popcnt")
+inline void decode_pairs_avx512(__m256i units, __m256i next, __mmask16 high, __mmask16 lanes, char*& out) {
+    const __m512i code_units = _mm512_cvtepu16_epi32(units);
+    const __m512i pairs = _mm512_sub_epi32(_mm512_add_epi32(_mm512_slli_epi32(code_units, 10), _mm512_cvtepu16_epi32(next)),
+                                           _mm512_set1_epi32(static_cast<int>(SURROGATE_OFFSET)));
+    decode_lanes_32_avx512(_mm512_mask_mov_epi32(code_units, high, pairs), lanes, out);
+}
+
+// With AVX-512, vectors with surrogates are decoded in 32-bit lanes too, with
+// the lanes of low surrogates left out. A high surrogate in the last lane is
+// left to the next vector.
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw,avx512vbmi2,popcnt")
+std::size_t utf16_to_utf8_avx512(const char* data, std::size_t units, char* out) noexcept {
+    const char* const end = data + 2 * units;
+    char* const start = out;
+    while (end - data >= 64) {
+        __m512i input = _mm512_loadu_si512(data);
+        if (Swap) {
+            input = _mm512_or_si512(_mm512_slli_epi16(input, 8), _mm512_srli_epi16(input, 8));
+        }
+        const __mmask32 two_byte = _mm512_cmpgt_epu16_mask(input, _mm512_set1_epi16(0x7F));
+        if (two_byte == 0) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_cvtepi16_epi8(input));
+            out += 32;
+            data += 64;
+            continue;
+        }
+        if (_mm512_cmpgt_epu16_mask(input, _mm512_set1_epi16(0x7FF)) == 0) {
+            decode_units_800_avx512(input, two_byte, out);
+            data += 64;
+            continue;
+        }
+        const __m512i top = _mm512_and_si512(input, _mm512_set1_epi16(static_cast<short>(0xFC00)));
+        const __mmask32 high = _mm512_cmpeq_epi16_mask(top, _mm512_set1_epi16(static_cast<short>(0xD800)));
+        const __mmask32 low = _mm512_cmpeq_epi16_mask(top, _mm512_set1_epi16(static_cast<short>(0xDC00)));
+        __m512i next = _mm512_maskz_loadu_epi16(0x7FFFFFFF, data + 2);
+        if (Swap) {
+            next = _mm512_or_si512(_mm512_slli_epi16(next, 8), _mm512_srli_epi16(next, 8));
+        }
+        const __mmask32 lanes = ~low & ~(high & 0x80000000u);
+        decode_pairs_avx512(_mm512_castsi512_si256(input), _mm512_castsi512_si256(next),
+                            static_cast<__mmask16>(high), static_cast<__mmask16>(lanes), out);
+        decode_pairs_avx512(_mm512_extracti64x4_epi64(input, 1), _mm512_extracti64x4_epi64(next, 1),
+                            static_cast<__mmask16>(high >> 16), static_cast<__mmask16>(lanes >> 16), out);
+        data += 64 - 2 * (high >> 31);
+    }
+    return static_cast<std::size_t>(out - start) +
+           utf16_to_utf8_scalar<Swap>(data, static_cast<std::size_t>(end - data) / 2, out);
+}
+
+// UTF-32. Vectors of ASCII are narrowed, vectors below 0x800 narrowed to
+// 16-bit lanes, and others decoded in 32-bit lanes.
+
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+std::size_t utf32_to_utf8_sse42(const char* data, std::size_t code_points, char* out) noexcept {
+    const char* const end = data + 4 * code_points;
+    char* const start = out;
+    const __m128i swap = _mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32));
+    while (static_cast<std::size_t>(end - data) >= 4 * (8 + DECODE_SLACK)) {
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+        if (Swap) {
+            low = _mm_shuffle_epi8(low, swap);
+            high = _mm_shuffle_epi8(high, swap);
+        }
+        const __m128i any = _mm_or_si128(low, high);
+        if (_mm_testz_si128(any, _mm_set1_epi32(~0x7F))) {
+            const __m128i units = _mm_packus_epi32(low, high);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(units, units));
+            out += 8;
+        } else if (_mm_testz_si128(any, _mm_set1_epi32(~0x7FF))) {
+            decode_units_800_sse42(_mm_packus_epi32(low, high), out);
+        } else {
+            decode_lanes_32_sse42(low, out);
+            decode_lanes_32_sse42(high, out);
+        }
+        data += 32;
+    }
+    return static_cast<std::size_t>(out - start) +
+           utf32_to_utf8_scalar<Swap>(data, static_cast<std::size_t>(end - data) / 4, out);
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx2")
+std::size_t utf32_to_utf8_avx2(const char* data, std::size_t code_points, char* out) noexcept {
+    const char* const end = data + 4 * code_points;
+    char* const start = out;
+    const __m256i swap = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32)));
+    while (static_cast<std::size_t>(end - data) >= 4 * (16 + DECODE_SLACK)) {
+        __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+        if (Swap) {
+            low = _mm256_shuffle_epi8(low, swap);
+            high = _mm256_shuffle_epi8(high, swap);
+        }
+        const __m256i any = _mm256_or_si256(low, high);
+        if (_mm256_testz_si256(any, _mm256_set1_epi32(~0x7FF))) {
+            // Packing works within the 128-bit lanes, which the permute puts back in order
+            const __m256i units = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xD8);
+            if (_mm256_testz_si256(any, _mm256_set1_epi32(~0x7F))) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(
+                    _mm256_castsi256_si128(units), _mm256_extracti128_si256(units, 1)));
+                out += 16;
+            } else {
+                decode_units_800_avx2(units, out);
+            }
+        } else {
+            decode_lanes_32_avx2(low, out);
+            decode_lanes_32_avx2(high, out);
+        }
+        data += 64;
+    }
+    return static_cast<std::size_t>(out - start) +
+           utf32_to_utf8_scalar<Swap>(data, static_cast<std::size_t>(end - data) / 4, out);
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw,avx512vbmi2,popcnt")
+std::size_t utf32_to_utf8_avx512(const char* data, std::size_t code_points, char* out) noexcept {
+    const char* const end = data + 4 * code_points;
+    char* const start = out;
+    const __m512i swap = _mm512_broadcast_i32x4(_mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32)));
+    while (end - data >= 128) {
+        __m512i low = _mm512_loadu_si512(data);
+        __m512i high = _mm512_loadu_si512(data + 64);
+        if (Swap) {
+            low = _mm512_shuffle_epi8(low, swap);
+            high = _mm512_shuffle_epi8(high, swap);
+        }
+        const __m512i any = _mm512_or_si512(low, high);
+        if (_mm512_test_epi32_mask(any, _mm512_set1_epi32(~0x7FF)) == 0) {
+            const __m512i units = _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvtepi32_epi16(low)),
+                                                     _mm512_cvtepi32_epi16(high), 1);
+            const __mmask32 two_byte = _mm512_cmpgt_epu16_mask(units, _mm512_set1_epi16(0x7F));
+            if (two_byte == 0) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_cvtepi16_epi8(units));
+                out += 32;
+            } else {
+                decode_units_800_avx512(units, two_byte, out);
+            }
+        } else {
+            decode_lanes_32_avx512(low, 0xFFFF, out);
+            decode_lanes_32_avx512(high, 0xFFFF, out);
+        }
+        data += 128;
+    }
+    return static_cast<std::size_t>(out - start) +
+           utf32_to_utf8_scalar<Swap>(data, static_cast<std::size_t>(end - data) / 4, out);
+}
+
+// ISO-8859-1. Vectors of ASCII are copied, and others decoded in 16-bit lanes.
+
+SSTRING_TARGET("sse4.2")
+std::size_t latin1_to_utf8_sse42(const char* data, std::size_t length, char* out) noexcept {
+    const char* const end = data + length;
+    char* const start = out;
+    while (static_cast<std::size_t>(end - data) >= 16 + DECODE_SLACK) {
+        const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        if (_mm_movemask_epi8(input) == 0) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), input);
+            out += 16;
+        } else {
+            decode_units_800_sse42(_mm_cvtepu8_epi16(input), out);
+            decode_units_800_sse42(_mm_unpackhi_epi8(input, _mm_setzero_si128()), out);
+        }
+        data += 16;
+    }
+    return static_cast<std::size_t>(out - start) +
+           latin1_to_utf8_scalar(data, static_cast<std::size_t>(end - data), out);
+}
+
+SSTRING_TARGET("avx2")
+std::size_t latin1_to_utf8_avx2(const char* data, std::size_t length, char* out) noexcept {
+    const char* const end = data + length;
+    char* const start = out;
+    while (static_cast<std::size_t>(end - data) >= 32 + DECODE_SLACK) {
+        const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        if (_mm256_movemask_epi8(input) == 0) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), input);
+            out += 32;
+        } else {
+            decode_units_800_avx2(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(input)), out);
+            decode_units_800_avx2(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(input, 1)), out);
+        }
+        data += 32;
+    }
+    return static_cast<std::size_t>(out - start) +
+           latin1_to_utf8_scalar(data, static_cast<std::size_t>(end - data), out);
+}
+
+SSTRING_TARGET("avx512f,avx512bw,avx512vbmi2,popcnt")
+std::size_t latin1_to_utf8_avx512(const char* data, std::size_t length, char* out) noexcept {
+    const char* const end = data + length;
+    char* const start = out;
+    while (end - data >= 64) {
+        const __m512i input = _mm512_loadu_si512(data);
+        const __mmask64 high = _mm512_movepi8_mask(input);
+        if (high == 0) {
+            _mm512_storeu_si512(out, input);
+            out += 64;
+        } else {
+            decode_units_800_avx512(_mm512_cvtepu8_epi16(_mm512_castsi512_si256(input)),
+                                    static_cast<__mmask32>(high), out);
+            decode_units_800_avx512(_mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(input, 1)),
+                                    static_cast<__mmask32>(high >> 32), out);
+        }
+        data += 64;
+    }
+    return static_cast<std::size_t>(out - start) +
+           latin1_to_utf8_scalar(data, static_cast<std::size_t>(end - data), out);
+}
+
+// Validation. A UTF-16 vector is valid if its low surrogates are exactly the
+// code units after its high surrogates, with a high surrogate in the last lane
+// carried over to the next vector.
+
+// The first unpaired surrogate of a vector starting at code unit i, given the
+// mask of the code units that do not match: each is either a low surrogate on
+// its own, or the code unit after a high surrogate on its own
+inline std::size_t unpaired_unit(std::size_t i, std::uint64_t errors, std::uint64_t low) noexcept {
+    const int first = std::countr_zero(errors);
+    return i + static_cast<std::size_t>(first) - ((low >> first) & 1 ? 0 : 1);
+}
+
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+std::size_t validate_utf16_sse42(const char* data, std::size_t units) noexcept {
+    const __m128i surrogate_bits = _mm_set1_epi16(unit_pattern<Swap>(0xFC00));
+    const __m128i high_surrogate = _mm_set1_epi16(unit_pattern<Swap>(0xD800));
+    const __m128i low_surrogate = _mm_set1_epi16(unit_pattern<Swap>(0xDC00));
+    std::size_t i = 0;
+    unsigned carry = 0;
+    for (; units - i >= 8; i += 8) {
+        const __m128i top = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 2 * i)),
+                                          surrogate_bits);
+        const unsigned masks = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_packs_epi16(_mm_cmpeq_epi16(top, high_surrogate), _mm_cmpeq_epi16(top, low_surrogate))));
+        const unsigned high = masks & 0xFF;
+        const unsigned low = masks >> 8;
+        const unsigned errors = (((high << 1) | carry) ^ low) & 0xFF;
+        if (errors != 0) {
+            return unpaired_unit(i, errors, low);
+        }
+        carry = high >> 7;
+    }
+    // The rest is checked from a high surrogate carried over
+    const std::size_t tail = validate_utf16_scalar<Swap>(data + 2 * (i - carry), units - i + carry);
+    return tail == npos ? npos : i - carry + tail;
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx2")
+std::size_t validate_utf16_avx2(const char* data, std::size_t units) noexcept {
+    const __m256i surrogate_bits = _mm256_set1_epi16(unit_pattern<Swap>(0xFC00));
+    const __m256i high_surrogate = _mm256_set1_epi16(unit_pattern<Swap>(0xD800));
+    const __m256i low_surrogate = _mm256_set1_epi16(unit_pattern<Swap>(0xDC00));
+    std::size_t i = 0;
+    unsigned carry = 0;
+    for (; units - i >= 16; i += 16) {
+        const __m256i top = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 2 * i)),
+                                             surrogate_bits);
+        // Packing within the 128-bit lanes interleaves the masks 8 code units at a time
+        const unsigned masks = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_packs_epi16(
+            _mm256_cmpeq_epi16(top, high_surrogate), _mm256_cmpeq_epi16(top, low_surrogate))));
+        const unsigned high = (masks & 0xFF) | ((masks >> 8) & 0xFF00);
+        const unsigned low = ((masks >> 8) & 0xFF) | ((masks >> 16) & 0xFF00);
+        const unsigned errors = (((high << 1) | carry) ^ low) & 0xFFFF;
+        if (errors != 0) {
+            return unpaired_unit(i, errors, low);
+        }
+        carry = high >> 15;
+    }
+    const std::size_t tail = validate_utf16_scalar<Swap>(data + 2 * (i - carry), units - i + carry);
+    return tail == npos ? npos : i - carry + tail;
+}
+
+// AVX-512 reads the tail with a masked load, whose zeros are not surrogates
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw")
+std::size_t validate_utf16_avx512(const char* data, std::size_t units) noexcept {
+    const __m512i surrogate_bits = _mm512_set1_epi16(unit_pattern<Swap>(0xFC00));
+    const __m512i high_surrogate = _mm512_set1_epi16(unit_pattern<Swap>(0xD800));
+    const __m512i low_surrogate = _mm512_set1_epi16(unit_pattern<Swap>(0xDC00));
+    std::uint32_t carry = 0;
+    for (std::size_t i = 0; i < units; i += 32) {
+        const std::size_t left = units - i;
+        const __mmask32 loaded = left >= 32 ? ~__mmask32{0} : (__mmask32{1} << left) - 1;
+        const __m512i top = _mm512_and_si512(_mm512_maskz_loadu_epi16(loaded, data + 2 * i), surrogate_bits);
+        const std::uint32_t high = _mm512_cmpeq_epi16_mask(top, high_surrogate);
+        const std::uint32_t low = _mm512_cmpeq_epi16_mask(top, low_surrogate);
+        const std::uint32_t errors = ((high << 1) | carry) ^ low;
+        if (errors != 0) {
+            return unpaired_unit(i, errors, low);
+        }
+        carry = high >> 31;
+    }
+    return carry ? units - 1 : npos;
+}
+
+// A UTF-32 code point is invalid if it is at least 0x110000 (which the unsigned
+// maximum leaves unchanged) or a surrogate
+
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+std::size_t validate_utf32_sse42(const char* data, std::size_t code_points) noexcept {
+    const __m128i swap = _mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32));
+    std::size_t i = 0;
+    for (; code_points - i >= 4; i += 4) {
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 4 * i));
+        if (Swap) {
+            input = _mm_shuffle_epi8(input, swap);
+        }
+        const __m128i invalid = _mm_or_si128(
+            _mm_cmpeq_epi32(_mm_max_epu32(input, _mm_set1_epi32(0x110000)), input),
+            _mm_cmpeq_epi32(_mm_and_si128(input, _mm_set1_epi32(~0x7FF)), _mm_set1_epi32(0xD800)));
+        const int mask = _mm_movemask_ps(_mm_castsi128_ps(invalid));
+        if (mask != 0) {
+            return i + static_cast<std::size_t>(std::countr_zero(static_cast<unsigned>(mask)));
+        }
+    }
+    const std::size_t tail = validate_utf32_scalar<Swap>(data + 4 * i, code_points - i);
+    return tail == npos ? npos : i + tail;
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx2")
+std::size_t validate_utf32_avx2(const char* data, std::size_t code_points) noexcept {
+    const __m256i swap = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32)));
+    std::size_t i = 0;
+    for (; code_points - i >= 8; i += 8) {
+        __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 4 * i));
+        if (Swap) {
+            input = _mm256_shuffle_epi8(input, swap);
+        }
+        const __m256i invalid = _mm256_or_si256(
+            _mm256_cmpeq_epi32(_mm256_max_epu32(input, _mm256_set1_epi32(0x110000)), input),
+            _mm256_cmpeq_epi32(_mm256_and_si256(input, _mm256_set1_epi32(~0x7FF)), _mm256_set1_epi32(0xD800)));
+        const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(invalid));
+        if (mask != 0) {
+            return i + static_cast<std::size_t>(std::countr_zero(static_cast<unsigned>(mask)));
+        }
+    }
+    const std::size_t tail = validate_utf32_scalar<Swap>(data + 4 * i, code_points - i);
+    return tail == npos ? npos : i + tail;
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw")
+std::size_t validate_utf32_avx512(const char* data, std::size_t code_points) noexcept {
+    const __m512i swap = _mm512_broadcast_i32x4(_mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32)));
+    for (std::size_t i = 0; i < code_points; i += 16) {
+        const std::size_t left = code_points - i;
+        const __mmask16 loaded = left >= 16 ? __mmask16{0xFFFF} : static_cast<__mmask16>((1u << left) - 1);
+        __m512i input = _mm512_maskz_loadu_epi32(loaded, data + 4 * i);
+        if (Swap) {
+            input = _mm512_shuffle_epi8(input, swap);
+        }
+        const unsigned invalid = _mm512_cmpge_epu32_mask(input, _mm512_set1_epi32(0x110000)) |
+            _mm512_cmpeq_epi32_mask(_mm512_and_si512(input, _mm512_set1_epi32(~0x7FF)), _mm512_set1_epi32(0xD800));
+        if (invalid != 0) {
+            return i + static_cast<std::size_t>(std::countr_zero(invalid));
+        }
+    }
+    return npos;
+}
+
+// Lengths of valid input. UTF-16 code units have three bytes, less one below
+// 0x800, one more below 0x80, and one for a surrogate: SSE4.2 and AVX2 count
+// those in 16-bit lanes for up to 0xFFFF / 3 vectors at a time. UTF-32 code
+// points have one byte, and one more from each of 0x80, 0x800 and 0x10000.
+// ISO-8859-1 bytes have one byte, and one more from 0x80.
+
+constexpr std::size_t LENGTH_BATCH = 0xFFFF / 3;
+
+SSTRING_TARGET("sse4.2")
+inline std::uint64_t sum_words_sse42(__m128i words) {
+    return sum_bytes_sse42(_mm_and_si128(words, _mm_set1_epi16(0xFF))) +
+           (sum_bytes_sse42(_mm_srli_epi16(words, 8)) << 8);
+}
+
+SSTRING_TARGET("sse4.2")
+inline std::uint64_t sum_dwords_sse42(__m128i dwords) {
+    const __m128i sums = _mm_add_epi64(_mm_unpacklo_epi32(dwords, _mm_setzero_si128()),
+                                       _mm_unpackhi_epi32(dwords, _mm_setzero_si128()));
+    return static_cast<std::uint64_t>(_mm_cvtsi128_si64(sums)) + static_cast<std::uint64_t>(_mm_extract_epi64(sums, 1));
+}
+
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+std::size_t utf16_length_sse42(const char* data, std::size_t units) noexcept {
+    const __m128i not_ascii = _mm_set1_epi16(unit_pattern<Swap>(0xFF80));
+    const __m128i not_800 = _mm_set1_epi16(unit_pattern<Swap>(0xF800));
+    const __m128i surrogate = _mm_set1_epi16(unit_pattern<Swap>(0xD800));
+    std::size_t i = 0;
+    std::uint64_t fewer = 0;
+    while (units - i >= 8) {
+        const std::size_t batch_end = i + std::min<std::size_t>((units - i) / 8, LENGTH_BATCH) * 8;
+        __m128i fewer16 = _mm_setzero_si128();
+        for (; i < batch_end; i += 8) {
+            const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 2 * i));
+            const __m128i top = _mm_and_si128(input, not_800);
+            // Compares give -1 for each match
+            fewer16 = _mm_sub_epi16(fewer16, _mm_cmpeq_epi16(_mm_and_si128(input, not_ascii), _mm_setzero_si128()));
+            fewer16 = _mm_sub_epi16(fewer16, _mm_cmpeq_epi16(top, _mm_setzero_si128()));
+            fewer16 = _mm_sub_epi16(fewer16, _mm_cmpeq_epi16(top, surrogate));
+        }
+        fewer += sum_words_sse42(fewer16);
+    }
+    return 3 * i - fewer + utf16_length_scalar<Swap>(data + 2 * i, units - i);
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx2")
+std::size_t utf16_length_avx2(const char* data, std::size_t units) noexcept {
+    const __m256i not_ascii = _mm256_set1_epi16(unit_pattern<Swap>(0xFF80));
+    const __m256i not_800 = _mm256_set1_epi16(unit_pattern<Swap>(0xF800));
+    const __m256i surrogate = _mm256_set1_epi16(unit_pattern<Swap>(0xD800));
+    std::size_t i = 0;
+    std::uint64_t fewer = 0;
+    while (units - i >= 16) {
+        const std::size_t batch_end = i + std::min<std::size_t>((units - i) / 16, LENGTH_BATCH) * 16;
+        __m256i fewer16 = _mm256_setzero_si256();
+        for (; i < batch_end; i += 16) {
+            const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 2 * i));
+            const __m256i top = _mm256_and_si256(input, not_800);
+            fewer16 = _mm256_sub_epi16(fewer16, _mm256_cmpeq_epi16(_mm256_and_si256(input, not_ascii),
+                                                                   _mm256_setzero_si256()));
+            fewer16 = _mm256_sub_epi16(fewer16, _mm256_cmpeq_epi16(top, _mm256_setzero_si256()));
+            fewer16 = _mm256_sub_epi16(fewer16, _mm256_cmpeq_epi16(top, surrogate));
+        }
+        fewer += sum_words_sse42(_mm256_castsi256_si128(fewer16)) + sum_words_sse42(_mm256_extracti128_si256(fewer16, 1));
+    }
+    return 3 * i - fewer + utf16_length_scalar<Swap>(data + 2 * i, units - i);
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw,popcnt")
+std::size_t utf16_length_avx512(const char* data, std::size_t units) noexcept {
+    const __m512i not_ascii = _mm512_set1_epi16(unit_pattern<Swap>(0xFF80));
+    const __m512i not_800 = _mm512_set1_epi16(unit_pattern<Swap>(0xF800));
+    const __m512i surrogate = _mm512_set1_epi16(unit_pattern<Swap>(0xD800));
+    std::size_t bytes = units;
+    for (std::size_t i = 0; i < units; i += 32) {
+        const std::size_t left = units - i;
+        const __mmask32 loaded = left >= 32 ? ~__mmask32{0} : (__mmask32{1} << left) - 1;
+        const __m512i input = _mm512_maskz_loadu_epi16(loaded, data + 2 * i);
+        const __m512i top = _mm512_and_si512(input, not_800);
+        bytes += _mm_popcnt_u32(_mm512_test_epi16_mask(input, not_ascii)) +
+                 _mm_popcnt_u32(_mm512_test_epi16_mask(input, not_800)) -
+                 _mm_popcnt_u32(_mm512_cmpeq_epi16_mask(top, surrogate));
+    }
+    return bytes;
+}
+
+template <bool Swap>
+SSTRING_TARGET("sse4.2")
+std::size_t utf32_length_sse42(const char* data, std::size_t code_points) noexcept {
+    const __m128i swap = _mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32));
+    __m128i more32 = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (; code_points - i >= 4; i += 4) {
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 4 * i));
+        if (Swap) {
+            input = _mm_shuffle_epi8(input, swap);
+        }
+        more32 = _mm_sub_epi32(more32, _mm_cmpgt_epi32(input, _mm_set1_epi32(0x7F)));
+        more32 = _mm_sub_epi32(more32, _mm_cmpgt_epi32(input, _mm_set1_epi32(0x7FF)));
+        more32 = _mm_sub_epi32(more32, _mm_cmpgt_epi32(input, _mm_set1_epi32(0xFFFF)));
+    }
+    return i + sum_dwords_sse42(more32) + utf32_length_scalar<Swap>(data + 4 * i, code_points - i);
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx2")
+std::size_t utf32_length_avx2(const char* data, std::size_t code_points) noexcept {
+    const __m256i swap = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32)));
+    __m256i more32 = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; code_points - i >= 8; i += 8) {
+        __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 4 * i));
+        if (Swap) {
+            input = _mm256_shuffle_epi8(input, swap);
+        }
+        more32 = _mm256_sub_epi32(more32, _mm256_cmpgt_epi32(input, _mm256_set1_epi32(0x7F)));
+        more32 = _mm256_sub_epi32(more32, _mm256_cmpgt_epi32(input, _mm256_set1_epi32(0x7FF)));
+        more32 = _mm256_sub_epi32(more32, _mm256_cmpgt_epi32(input, _mm256_set1_epi32(0xFFFF)));
+    }
+    const std::uint64_t more = sum_dwords_sse42(_mm256_castsi256_si128(more32)) +
+                               sum_dwords_sse42(_mm256_extracti128_si256(more32, 1));
+    return i + more + utf32_length_scalar<Swap>(data + 4 * i, code_points - i);
+}
+
+template <bool Swap>
+SSTRING_TARGET("avx512f,avx512bw,popcnt")
+std::size_t utf32_length_avx512(const char* data, std::size_t code_points) noexcept {
+    const __m512i swap = _mm512_broadcast_i32x4(_mm_load_si128(reinterpret_cast<const __m128i*>(SWAP_32)));
+    std::size_t bytes = code_points;
+    for (std::size_t i = 0; i < code_points; i += 16) {
+        const std::size_t left = code_points - i;
+        const __mmask16 loaded = left >= 16 ? __mmask16{0xFFFF} : static_cast<__mmask16>((1u << left) - 1);
+        __m512i input = _mm512_maskz_loadu_epi32(loaded, data + 4 * i);
+        if (Swap) {
+            input = _mm512_shuffle_epi8(input, swap);
+        }
+        bytes += _mm_popcnt_u32(_mm512_cmpgt_epu32_mask(input, _mm512_set1_epi32(0x7F))) +
+                 _mm_popcnt_u32(_mm512_cmpgt_epu32_mask(input, _mm512_set1_epi32(0x7FF))) +
+                 _mm_popcnt_u32(_mm512_cmpgt_epu32_mask(input, _mm512_set1_epi32(0xFFFF)));
+    }
+    return bytes;
+}
+
+SSTRING_TARGET("sse4.2")
+std::size_t latin1_length_sse42(const char* data, std::size_t length) noexcept {
+    std::size_t i = 0;
+    std::uint64_t high = 0;
+    while (length - i >= 16) {
+        const std::size_t batch_end = i + std::min<std::size_t>((length - i) / 16, COUNT_BATCH) * 16;
+        __m128i high8 = _mm_setzero_si128();
+        for (; i < batch_end; i += 16) {
+            const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            high8 = _mm_sub_epi8(high8, _mm_cmplt_epi8(input, _mm_setzero_si128()));
+        }
+        high += sum_bytes_sse42(high8);
+    }
+    return i + high + latin1_length_scalar(data + i, length - i);
+}
+
+SSTRING_TARGET("avx2")
+std::size_t latin1_length_avx2(const char* data, std::size_t length) noexcept {
+    std::size_t i = 0;
+    std::uint64_t high = 0;
+    while (length - i >= 32) {
+        const std::size_t batch_end = i + std::min<std::size_t>((length - i) / 32, COUNT_BATCH) * 32;
+        __m256i high8 = _mm256_setzero_si256();
+        for (; i < batch_end; i += 32) {
+            const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            high8 = _mm256_sub_epi8(high8, _mm256_cmpgt_epi8(_mm256_setzero_si256(), input));
+        }
+        high += sum_bytes_avx2(high8);
+    }
+    return i + high + latin1_length_scalar(data + i, length - i);
+}
+
+SSTRING_TARGET("avx512f,avx512bw,popcnt")
+std::size_t latin1_length_avx512(const char* data, std::size_t length) noexcept {
+    std::size_t bytes = length;
+    for (std::size_t i = 0; i < length; i += 64) {
+        const std::size_t left = length - i;
+        const __mmask64 loaded = left >= 64 ? ~__mmask64{0} : (__mmask64{1} << left) - 1;
+        bytes += _mm_popcnt_u64(_mm512_movepi8_mask(_mm512_maskz_loadu_epi8(loaded, data + i)));
+    }
+    return bytes;
+}
+
+// The registers the operating system saves on context switches (XCR0)
+inline std::uint64_t saved_registers() noexcept {
+    std::uint32_t low;
+    std::uint32_t high;
+    __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return (std::uint64_t{high} << 32) | low;
+}
+
+CpuFeatures detect_cpu_features() noexcept {
+    CpuFeatures features{};
+    unsigned eax;
+    unsigned ebx;
+    unsigned ecx;
+    unsigned edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return features;
+    }
+    features.sse42 = (ecx & bit_SSE4_2) != 0;
+    const std::uint64_t saved = (ecx & bit_OSXSAVE) != 0 ? saved_registers() : 0;
+    // XMM and YMM, and for AVX-512 the opmask and ZMM registers as well
+    const bool ymm = (saved & 0x06) == 0x06;
+    const bool zmm = (saved & 0xE6) == 0xE6;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return features;
+    }
+    features.avx2 = ymm && (ebx & bit_AVX2) != 0;
+    features.avx512bw = zmm && (ebx & bit_AVX512F) != 0 && (ebx & bit_AVX512BW) != 0;
+    features.avx512vbmi2 = features.avx512bw && (ecx & bit_AVX512VBMI2) != 0;
+    features.bmi2 = (ebx & bit_BMI2) != 0;
+    return features;
+}
+
+#else
+
+CpuFeatures detect_cpu_features() noexcept {
+    return {};
+}
+
+#endif // SSTRING_X86_KERNELS
+
+using ValidateUtf8 = std::size_t (*)(const char*, std::size_t) noexcept;
+
+ValidateUtf8 utf8_validator(SimdLevel level) noexcept {
+    switch (level) {
+#if defined(SSTRING_X86_KERNELS)
+        case SimdLevel::SSE42: return validate_utf8_sse42;
+        case SimdLevel::AVX2: return validate_utf8_avx2;
+        case SimdLevel::AVX512: return validate_utf8_avx512;
+#endif
+        default: return validate_utf8_scalar;
+    }
+}
+
+using Utf8ToUtf16 = std::size_t (*)(const char*, std::size_t, char16_t*) noexcept;
+
+template <bool Swap>
+Utf8ToUtf16 utf8_to_utf16_decoder(SimdLevel level) noexcept {
+    switch (level) {
+#if defined(SSTRING_X86_KERNELS)
+        case SimdLevel::SSE42: return utf8_to_utf16_sse42<Swap>;
+        case SimdLevel::AVX2: return utf8_to_utf16_avx2<Swap>;
+        case SimdLevel::AVX512:
+            // The AVX-512 kernel packs code units with vpcompressw
+            return cpu_features().avx512vbmi2 ? utf8_to_utf16_avx512<Swap> : utf8_to_utf16_avx2<Swap>;
+#endif
+        default: return utf8_to_utf16_scalar<Swap>;
+    }
+}
+
+using Utf8ToUtf32 = std::size_t (*)(const char*, std::size_t, char32_t*) noexcept;
+using Utf16ToUtf32 = char32_t* (*)(const char16_t*, const char16_t*, char32_t*) noexcept;
+
+// Decode UTF-8 into UTF-32 through UTF-16 decoded in chunks that stay in the
+// L1 cache, ending every chunk but the last before a sequence it would cut off
+std::size_t utf8_to_utf32_chunks(const char* data, std::size_t length, char32_t* out,
+                                 Utf8ToUtf16 decode, Utf16ToUtf32 widen) noexcept {
+    constexpr std::size_t CHUNK = 4096;
+    char16_t units[CHUNK];
+    char32_t* const start = out;
+    while (length > 0) {
+        std::size_t size = std::min(length, CHUNK);
+        for (int back = 0; back < 3 && size < length && (static_cast<unsigned char>(data[size]) & 0xC0) == 0x80;
+             ++back) {
+            --size;
+        }
+        out = widen(units, units + decode(data, size, units), out);
+        data += size;
+        length -= size;
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+#if defined(SSTRING_X86_KERNELS)
+
+template <bool Swap>
+std::size_t utf8_to_utf32_sse42(const char* data, std::size_t length, char32_t* out) noexcept {
+    return utf8_to_utf32_chunks(data, length, out, utf8_to_utf16_sse42<false>, utf16_to_utf32_sse42<Swap>);
+}
+
+template <bool Swap>
+std::size_t utf8_to_utf32_avx2(const char* data, std::size_t length, char32_t* out) noexcept {
+    return utf8_to_utf32_chunks(data, length, out, utf8_to_utf16_avx2<false>, utf16_to_utf32_avx2<Swap>);
+}
+
+#endif // SSTRING_X86_KERNELS
+
+template <bool Swap>
+Utf8ToUtf32 utf8_to_utf32_decoder(SimdLevel level) noexcept {
+    switch (level) {
+#if defined(SSTRING_X86_KERNELS)
+        case SimdLevel::SSE42: return utf8_to_utf32_sse42<Swap>;
+        case SimdLevel::AVX2: return utf8_to_utf32_avx2<Swap>;
+        case SimdLevel::AVX512: return utf8_to_utf32_avx512<Swap>;
+#endif
+        default: return utf8_to_utf32_scalar<Swap>;
+    }
+}
+
+// Encode the valid text between invalid bytes, which are skipped
+template <typename Unit>
+std::size_t encode_valid_runs(const char* data, std::size_t length, Unit* out, ValidateUtf8 validate,
+                              std::size_t (*encode)(const char*, std::size_t, Unit*) noexcept) noexcept {
+    Unit* const start = out;
+    while (true) {
+        const std::size_t invalid = validate(data, length);
+        out += encode(data, invalid == npos ? length : invalid, out);
+        if (invalid == npos) {
+            return static_cast<std::size_t>(out - start);
+        }
+        data += invalid + 1;
+        length -= invalid + 1;
+    }
+}
+
+// Count the valid text between invalid bytes, which are skipped
+Utf16Counts count_valid_runs(const char* data, std::size_t length, ValidateUtf8 validate,
+                             Utf16Counts (*count)(const char*, std::size_t) noexcept) noexcept {
+    Utf16Counts counts{0, 0};
+    while (true) {
+        const std::size_t invalid = validate(data, length);
+        const Utf16Counts run = count(data, invalid == npos ? length : invalid);
+        counts.units += run.units;
+        counts.code_points += run.code_points;
+        if (invalid == npos) {
+            return counts;
+        }
+        data += invalid + 1;
+        length -= invalid + 1;
+    }
+}
+
+// Whether code units in a byte order are those of this CPU swapped
+constexpr bool swapped(ByteOrder order) noexcept {
+    return (order == ByteOrder::BIG) == (std::endian::native == std::endian::little);
+}
+
+using CountUtf16 = Utf16Counts (*)(const char*, std::size_t) noexcept;
+
+CountUtf16 utf16_counter(SimdLevel level) noexcept {
+    switch (level) {
+#if defined(SSTRING_X86_KERNELS)
+        case SimdLevel::SSE42: return count_utf16_sse42;
+        case SimdLevel::AVX2: return count_utf16_avx2;
+        case SimdLevel::AVX512: return count_utf16_avx512;
+#endif
+        default: return count_utf16_scalar;
+    }
+}
+
+template <bool Swap>
+UnitDecoder utf16_decoder(SimdLevel level) noexcept {
+    switch (level) {
+#if defined(SSTRING_X86_KERNELS)
+        case SimdLevel::SSE42:
+            return {2, validate_utf16_sse42<Swap>, utf16_length_sse42<Swap>, utf16_to_utf8_sse42<Swap>};
+        case SimdLevel::AVX2:
+            return {2, validate_utf16_avx2<Swap>, utf16_length_avx2<Swap>, utf16_to_utf8_avx2<Swap>};
+        case SimdLevel::AVX512:
+            // The AVX-512 decoder packs bytes with vpcompressb
+            return {2, validate_utf16_avx512<Swap>, utf16_length_avx512<Swap>,
+                    cpu_features().avx512vbmi2 ? utf16_to_utf8_avx512<Swap> : utf16_to_utf8_avx2<Swap>};
+#endif
+        default:
+            return {2, validate_utf16_scalar<Swap>, utf16_length_scalar<Swap>, utf16_to_utf8_scalar<Swap>};
+    }
+}
+
+template <bool Swap>
+UnitDecoder utf32_decoder(SimdLevel level) noexcept {
+    switch (level) {
+#if defined(SSTRING_X86_KERNELS)
+        case SimdLevel::SSE42:
+            return {4, validate_utf32_sse42<Swap>, utf32_length_sse42<Swap>, utf32_to_utf8_sse42<Swap>};
+        case SimdLevel::AVX2:
+            return {4, validate_utf32_avx2<Swap>, utf32_length_avx2<Swap>, utf32_to_utf8_avx2<Swap>};
+        case SimdLevel::AVX512:
+            return {4, validate_utf32_avx512<Swap>, utf32_length_avx512<Swap>,
+                    cpu_features().avx512vbmi2 ? utf32_to_utf8_avx512<Swap> : utf32_to_utf8_avx2<Swap>};
+#endif
+        default:
+            return {4, validate_utf32_scalar<Swap>, utf32_length_scalar<Swap>, utf32_to_utf8_scalar<Swap>};
+    }
+}
+
+using MeasureLatin1 = std::size_t (*)(const char*, std::size_t) noexcept;
+using DecodeLatin1 = std::size_t (*)(const char*, std::size_t, char*) noexcept;
+
+MeasureLatin1 latin1_counter(SimdLevel level) noexcept {
+    switch (level) {
+#if defined(SSTRING_X86_KERNELS)
+        case SimdLevel::SSE42: return latin1_length_sse42;
+        case SimdLevel::AVX2: return latin1_length_avx2;
+        case SimdLevel::AVX512: return latin1_length_avx512;
+#endif
+        default: return latin1_length_scalar;
+    }
+}
+
+DecodeLatin1 latin1_decoder(SimdLevel level) noexcept {
+    switch (level) {
+#if defined(SSTRING_X86_KERNELS)
+        case SimdLevel::SSE42: return latin1_to_utf8_sse42;
+        case SimdLevel::AVX2: return latin1_to_utf8_avx2;
+        case SimdLevel::AVX512:
+            return cpu_features().avx512vbmi2 ? latin1_to_utf8_avx512 : latin1_to_utf8_avx2;
+#endif
+        default: return latin1_to_utf8_scalar;
+    }
+}
+
+// The kernels of a level, bound once. Pairs are indexed by whether code units
+// are swapped.
+struct Kernels {
+    SimdLevel level;
+    ValidateUtf8 validate_utf8;
+    Utf8ToUtf16 utf8_to_utf16[2];
+    Utf8ToUtf32 utf8_to_utf32[2];
+    CountUtf16 count_utf16;
+    UnitDecoder utf16[2];
+    UnitDecoder utf32[2];
+    MeasureLatin1 latin1_length;
+    DecodeLatin1 latin1_to_utf8;
+};
+
+Kernels bind_kernels(SimdLevel level) noexcept {
+    return {level,
+            utf8_validator(level),
+            {utf8_to_utf16_decoder<false>(level), utf8_to_utf16_decoder<true>(level)},
+            {utf8_to_utf32_decoder<false>(level), utf8_to_utf32_decoder<true>(level)},
+            utf16_counter(level),
+            {utf16_decoder<false>(level), utf16_decoder<true>(level)},
+            {utf32_decoder<false>(level), utf32_decoder<true>(level)},
+            latin1_counter(level),
+            latin1_decoder(level)};
+}
+
+const Kernels& kernels(SimdLevel level) noexcept {
+    static const Kernels bound[] = {bind_kernels(SimdLevel::SCALAR), bind_kernels(SimdLevel::SSE42),
+                                    bind_kernels(SimdLevel::AVX2), bind_kernels(SimdLevel::AVX512)};
+    return bound[static_cast<std::size_t>(level)];
+}
+
+// The highest supported level up to a level
+SimdLevel supported_level(SimdLevel level) noexcept {
+    while (!simd_supported(level)) {
+        level = static_cast<SimdLevel>(static_cast<int>(level) - 1);
+    }
+    return level;
+}
+
+// The level named by SSTRING_SIMD_LEVEL, or the best one
+SimdLevel initial_simd_level() noexcept {
+    static constexpr struct {
+        const char* name;
+        SimdLevel level;
+    } names[] = {{"scalar", SimdLevel::SCALAR}, {"sse4.2", SimdLevel::SSE42},
+                 {"avx2", SimdLevel::AVX2}, {"avx512", SimdLevel::AVX512}};
+    if (const char* name = std::getenv("SSTRING_SIMD_LEVEL")) {
+        for (const auto& entry : names) {
+            if (std::strcmp(name, entry.name) == 0) {
+                return supported_level(entry.level);
+            }
+        }
+    }
+    return best_simd_level();
+}
+
+std::atomic<const Kernels*>& active_kernels() noexcept {
+    static std::atomic<const Kernels*> active{&kernels(initial_simd_level())};
+    return active;
+}
+
+// The kernels of the functions that take no level
+const Kernels& active() noexcept {
+    return *active_kernels().load(std::memory_order_acquire);
+}
+
+} // namespace
+
+const CpuFeatures& cpu_features() noexcept {
+    static const CpuFeatures features = detect_cpu_features();
+    return features;
+}
+
+bool simd_supported(SimdLevel level) noexcept {
+#if defined(SSTRING_X86_KERNELS)
+    const CpuFeatures& features = cpu_features();
+    switch (level) {
+        case SimdLevel::SCALAR: return true;
+        case SimdLevel::SSE42: return features.sse42;
+        case SimdLevel::AVX2: return features.avx2;
+        case SimdLevel::AVX512: return features.avx512bw && features.bmi2;
+    }
+    return false;
+#else
+    return level == SimdLevel::SCALAR;
+#endif
+}
+
+SimdLevel best_simd_level() noexcept {
+    static const SimdLevel level = supported_level(SimdLevel::AVX512);
+    return level;
+}
+
+SimdLevel active_simd_level() noexcept {
+    return active().level;
+}
+
+SimdLevel set_simd_level(SimdLevel level) noexcept {
+    const Kernels& chosen = kernels(supported_level(level));
+    active_kernels().store(&chosen, std::memory_order_release);
+    return chosen.level;
+}
+
+std::size_t validate_utf8(const char* data, std::size_t length) noexcept {
+    return active().validate_utf8(data, length);
+}
+
+std::size_t validate_utf8(const char* data, std::size_t length, SimdLevel level) noexcept {
+    return kernels(level).validate_utf8(data, length);
+}
+
+std::size_t utf8_to_utf16(const char* data, std::size_t length, char16_t* out) noexcept {
+    return active().utf8_to_utf16[false](data, length, out);
+}
+
+std::size_t utf8_to_utf16(const char* data, std::size_t length, char16_t* out, SimdLevel level) noexcept {
+    return kernels(level).utf8_to_utf16[false](data, length, out);
+}
+
+Utf16Counts count_utf16(const char* data, std::size_t length) noexcept {
+    return active().count_utf16(data, length);
+}
+
+Utf16Counts count_utf16(const char* data, std::size_t length, SimdLevel level) noexcept {
+    return kernels(level).count_utf16(data, length);
+}
+
+Utf16Counts count_encoded_utf16(const char* data, std::size_t length) noexcept {
+    return count_encoded_utf16(data, length, active_simd_level());
+}
+
+Utf16Counts count_encoded_utf16(const char* data, std::size_t length, SimdLevel level) noexcept {
+    const Kernels& bound = kernels(level);
+    return count_valid_runs(data, length, bound.validate_utf8, bound.count_utf16);
+}
+
+std::size_t encode_utf16(const char* data, std::size_t length, ByteOrder order, char16_t* out) noexcept {
+    return encode_utf16(data, length, order, out, active_simd_level());
+}
+
+std::size_t encode_utf16(const char* data, std::size_t length, ByteOrder order, char16_t* out,
+                         SimdLevel level) noexcept {
+    const Kernels& bound = kernels(level);
+    return encode_valid_runs(data, length, out, bound.validate_utf8, bound.utf8_to_utf16[swapped(order)]);
+}
+
+std::size_t encode_utf32(const char* data, std::size_t length, ByteOrder order, char32_t* out) noexcept {
+    return encode_utf32(data, length, order, out, active_simd_level());
+}
+
+std::size_t encode_utf32(const char* data, std::size_t length, ByteOrder order, char32_t* out,
+                         SimdLevel level) noexcept {
+    const Kernels& bound = kernels(level);
+    return encode_valid_runs(data, length, out, bound.validate_utf8, bound.utf8_to_utf32[swapped(order)]);
+}
+
+DecodedLength decoded_length_utf16(const char* data, std::size_t units, ByteOrder order, bool replace) noexcept {
+    return decoded_length_utf16(data, units, order, replace, active_simd_level());
+}
+
+DecodedLength decoded_length_utf16(const char* data, std::size_t units, ByteOrder order, bool replace,
+                                   SimdLevel level) noexcept {
+    return decoded_length_runs(data, units, kernels(level).utf16[swapped(order)], replace);
+}
+
+std::size_t decode_utf16(const char* data, std::size_t units, ByteOrder order, bool replace, char* out) noexcept {
+    return decode_utf16(data, units, order, replace, out, active_simd_level());
+}
+
+std::size_t decode_utf16(const char* data, std::size_t units, ByteOrder order, bool replace, char* out,
+                         SimdLevel level) noexcept {
+    return decode_runs(data, units, out, kernels(level).utf16[swapped(order)], replace);
+}
+
+DecodedLength decoded_length_utf32(const char* data, std::size_t code_points, ByteOrder order,
+                                   bool replace) noexcept {
+    return decoded_length_utf32(data, code_points, order, replace, active_simd_level());
+}
+
+DecodedLength decoded_length_utf32(const char* data, std::size_t code_points, ByteOrder order, bool replace,
+                                   SimdLevel level) noexcept {
+    return decoded_length_runs(data, code_points, kernels(level).utf32[swapped(order)], replace);
+}
+
+std::size_t decode_utf32(const char* data, std::size_t code_points, ByteOrder order, bool replace,
+                         char* out) noexcept {
+    return decode_utf32(data, code_points, order, replace, out, active_simd_level());
+}
+
+std::size_t decode_utf32(const char* data, std::size_t code_points, ByteOrder order, bool replace, char* out,
+                         SimdLevel level) noexcept {
+    return decode_runs(data, code_points, out, kernels(level).utf32[swapped(order)], replace);
+}
+
+std::size_t decoded_length_latin1(const char* data, std::size_t length) noexcept {
+    return active().latin1_length(data, length);
+}
+
+std::size_t decoded_length_latin1(const char* data, std::size_t length, SimdLevel level) noexcept {
+    return kernels(level).latin1_length(data, length);
+}
+
+std::size_t decode_latin1(const char* data, std::size_t length, char* out) noexcept {
+    return active().latin1_to_utf8(data, length, out);
+}
+
+std::size_t decode_latin1(const char* data, std::size_t length, char* out, SimdLevel level) noexcept {
+    return kernels(level).latin1_to_utf8(data, length, out);
+}
+
+} // namespace detail
+} // namespace simple
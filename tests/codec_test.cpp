@@ -0,0 +1,285 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/codec.hpp"
+
+using namespace simple;
+
+namespace {
+
+const Encoding all_encodings[] = {Encoding::UTF_8, Encoding::UTF_16BE, Encoding::UTF_16LE, Encoding::UTF_32BE,
+                                  Encoding::UTF_32LE, Encoding::ISO_8859_1, Encoding::ASCII};
+const BOMPolicy all_policies[] = {BOMPolicy::AUTO, BOMPolicy::INCLUDE, BOMPolicy::EXCLUDE};
+const EncodingErrorHandling all_handlings[] = {EncodingErrorHandling::THROW, EncodingErrorHandling::REPLACE,
+                                               EncodingErrorHandling::IGNORE};
+
+std::vector<uint8_t> bytesOf(const std::string& text) {
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+// The outcome of decoding or encoding: the text or bytes, or the exception
+struct Outcome {
+    std::string result;
+    std::optional<std::size_t> offset;
+    std::string message;
+};
+
+bool operator==(const Outcome& a, const Outcome& b) {
+    return a.result == b.result && a.offset == b.offset && a.message == b.message;
+}
+
+std::ostream& operator<<(std::ostream& out, const Outcome& outcome) {
+    if (outcome.offset) {
+        return out << "exception at " << *outcome.offset << ": " << outcome.message;
+    }
+    return out << '"' << outcome.result << '"';
+}
+
+Outcome decoded_whole(const std::vector<uint8_t>& bytes, Encoding encoding, BOMPolicy bomPolicy,
+                      EncodingErrorHandling errorHandling) {
+    try {
+        return {String::fromBytes(bytes, encoding, bomPolicy, errorHandling).toStdString(), std::nullopt, ""};
+    } catch (const EncodingException& e) {
+        return {"", e.getByteOffset(), e.what()};
+    }
+}
+
+// Decode in chunks with the given sizes, cycling through them
+Outcome decoded_in_chunks(const std::vector<uint8_t>& bytes, Encoding encoding, BOMPolicy bomPolicy,
+                          EncodingErrorHandling errorHandling, const std::vector<std::size_t>& sizes) {
+    Decoder decoder(encoding, bomPolicy, errorHandling);
+    std::string text;
+    try {
+        std::size_t start = 0;
+        for (std::size_t i = 0; start < bytes.size(); ++i) {
+            const std::size_t size = std::min(sizes[i % sizes.size()], bytes.size() - start);
+            text += decoder.decode(bytes.data() + start, size).toStdString();
+            start += size;
+            // Only an incomplete sequence is kept
+            EXPECT_GE(decoder.getByteOffset() + 3, start);
+        }
+        text += decoder.finish().toStdString();
+        return {text, std::nullopt, ""};
+    } catch (const EncodingException& e) {
+        return {"", e.getByteOffset(), e.what()};
+    }
+}
+
+Outcome encoded_whole(const std::string& utf8, Encoding encoding, BOMPolicy bomPolicy,
+                      EncodingErrorHandling errorHandling) {
+    try {
+        const std::vector<uint8_t> bytes = String(utf8).getBytes(encoding, bomPolicy, errorHandling);
+        return {std::string(bytes.begin(), bytes.end()), std::nullopt, ""};
+    } catch (const EncodingException&) {
+        return {"", 0, ""};
+    }
+}
+
+Outcome encoded_in_chunks(const std::string& utf8, Encoding encoding, BOMPolicy bomPolicy,
+                          EncodingErrorHandling errorHandling, const std::vector<std::size_t>& sizes) {
+    Encoder encoder(encoding, bomPolicy, errorHandling);
+    std::string text;
+    try {
+        std::size_t start = 0;
+        for (std::size_t i = 0; start < utf8.size(); ++i) {
+            const std::size_t size = std::min(sizes[i % sizes.size()], utf8.size() - start);
+            const std::vector<uint8_t> bytes = encoder.encode(std::string_view(utf8).substr(start, size));
+            text.append(bytes.begin(), bytes.end());
+            start += size;
+        }
+        const std::vector<uint8_t> bytes = encoder.finish();
+        text.append(bytes.begin(), bytes.end());
+        return {text, std::nullopt, ""};
+    } catch (const EncodingException&) {
+        // The messages of getBytes() depend on the encoding, so compare only whether it failed
+        return {"", 0, ""};
+    }
+}
+
+const std::vector<std::vector<std::size_t>> chunkings = {{1}, {2}, {3}, {5}, {7}, {1, 2, 3}, {4, 1}, {13, 6}};
+
+// Text of every UTF-8 length, with and without a BOM, and with invalid bytes
+std::vector<std::string> sample_texts() {
+    const std::string mixed = "Caf\xC3\xA9 \xE4\xB8\x96\xE7\x95\x8C \xF0\x9F\x98\x80! plain text";
+    return {"",
+            "a",
+            "abc",
+            mixed,
+            "\xEF\xBB\xBF" + mixed,
+            "\xF0\x9F\x98\x80\xF0\x9F\x8C\x8D\xF0\x9F\x9A\x80",
+            "bad \xE4\xB8 byte \xFF and \x80 \xF0\x9F\x98 end \xE4",
+            "latin \xC3\xA9\xC3\xBF only"};
+}
+
+} // namespace
+
+TEST(CodecTest, DecoderMatchesFromBytesForEveryChunking) {
+    for (const std::string& text : sample_texts()) {
+        for (Encoding encoding : all_encodings) {
+            for (BOMPolicy bomPolicy : all_policies) {
+                // Bytes as the encoder of the String writes them, with a BOM for INCLUDE
+                std::vector<uint8_t> bytes;
+                try {
+                    bytes = String(text).getBytes(encoding, bomPolicy, EncodingErrorHandling::REPLACE);
+                } catch (const EncodingException&) {
+                    continue;
+                }
+                for (EncodingErrorHandling errorHandling : all_handlings) {
+                    const Outcome expected = decoded_whole(bytes, encoding, bomPolicy, errorHandling);
+                    for (const auto& sizes : chunkings) {
+                        EXPECT_EQ(decoded_in_chunks(bytes, encoding, bomPolicy, errorHandling, sizes), expected)
+                            << to_string(encoding) << ", " << to_string(bomPolicy) << ", "
+                            << to_string(errorHandling) << ", chunks of " << sizes[0];
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(CodecTest, DecoderMatchesFromBytesOnInvalidBytes) {
+    // Random bytes hit every kind of invalid and incomplete sequence at every chunk boundary
+    std::mt19937 rng(7);
+    const uint8_t interesting[] = {0x00, 0x41, 0x7F, 0x80, 0xBF, 0xC3, 0xE4, 0xEF, 0xF0, 0xFF,
+                                   0xFE, 0xBB, 0xD8, 0xDC, 0x3D, 0x10, 0x11};
+    for (int round = 0; round < 300; ++round) {
+        std::vector<uint8_t> bytes(rng() % 24);
+        for (uint8_t& byte : bytes) {
+            byte = interesting[rng() % sizeof(interesting)];
+        }
+        const std::vector<std::size_t> sizes = {1 + rng() % 5, 1 + rng() % 5};
+        for (Encoding encoding : all_encodings) {
+            for (BOMPolicy bomPolicy : all_policies) {
+                for (EncodingErrorHandling errorHandling : all_handlings) {
+                    EXPECT_EQ(decoded_in_chunks(bytes, encoding, bomPolicy, errorHandling, sizes),
+                              decoded_whole(bytes, encoding, bomPolicy, errorHandling))
+                        << to_string(encoding) << ", " << to_string(bomPolicy) << ", "
+                        << to_string(errorHandling) << ", round " << round;
+                }
+            }
+        }
+    }
+}
+
+TEST(CodecTest, DecoderReportsStreamOffsets) {
+    // "ab", an unpaired high surrogate, then "c", in UTF-16LE after a BOM
+    const std::vector<uint8_t> bytes = {0xFF, 0xFE, 'a', 0, 'b', 0, 0x3D, 0xD8, 'c', 0};
+    Decoder decoder(Encoding::UTF_16LE);
+    EXPECT_EQ(decoder.decode(bytes.data(), 5).toStdString(), "a");
+    EXPECT_EQ(decoder.getByteOffset(), 4u);
+    try {
+        decoder.decode(bytes.data() + 5, bytes.size() - 5);
+        FAIL() << "Expected an EncodingException";
+    } catch (const EncodingException& e) {
+        EXPECT_EQ(e.getByteOffset(), 6u);
+        EXPECT_EQ(e.getEncoding(), Encoding::UTF_16LE);
+    }
+    // The exception resets the decoder for a new stream
+    EXPECT_EQ(decoder.getByteOffset(), 0u);
+    EXPECT_EQ(decoder.decode(bytesOf("\xFF\xFE" "d")).toStdString(), "");
+    EXPECT_THROW(decoder.finish(), EncodingException);
+}
+
+TEST(CodecTest, DecoderAppliesBomPolicyOnlyAtTheStart) {
+    const std::vector<uint8_t> bom = {0xFE, 0xFF};
+    const std::vector<uint8_t> text = {0, 'h', 0, 'i'};
+    Decoder decoder(Encoding::UTF_16BE, BOMPolicy::AUTO);
+    EXPECT_EQ(decoder.decode(bom).toStdString(), "");
+    EXPECT_EQ(decoder.decode(text).toStdString(), "hi");
+    // A BOM in the middle of the stream is a character
+    EXPECT_EQ(decoder.decode(bom).toStdString(), "\xEF\xBB\xBF");
+    EXPECT_EQ(decoder.finish().toStdString(), "");
+
+    Decoder required(Encoding::UTF_16BE, BOMPolicy::INCLUDE);
+    EXPECT_EQ(required.decode(text.data(), 1).toStdString(), "");
+    EXPECT_THROW(required.decode(text.data() + 1, 3), EncodingException);
+    EXPECT_EQ(required.finish().toStdString(), "");
+}
+
+namespace simple {
+
+// Test fixture with access to the rope structure of decoded strings
+class DecoderTest : public ::testing::Test {
+protected:
+    bool isUnflattenedRope(const String& str) {
+        return str.is_unflattened_rope();
+    }
+
+    std::size_t depth(const String& str) {
+        return str.rope_depth();
+    }
+};
+
+TEST_F(DecoderTest, DecodedChunksAreFlat) {
+    // Chunks that complete a sequence kept from the one before come back as
+    // one flat string, not as ropes of the text of that sequence and the rest
+    std::string text;
+    for (int i = 0; i < 100; ++i) {
+        text += "piece " + std::to_string(i) + " caf\xC3\xA9 \xE4\xB8\x96\xE7\x95\x8C \xF0\x9F\x8C\x8D ";
+    }
+    const std::vector<uint8_t> bytes = String(text).getBytes(Encoding::UTF_16LE);
+    Decoder decoder(Encoding::UTF_16LE, BOMPolicy::EXCLUDE);
+    std::string decoded;
+    for (std::size_t start = 0; start < bytes.size(); start += 1001) {
+        const String chunk = decoder.decode(bytes.data() + start, std::min<std::size_t>(1001, bytes.size() - start));
+        EXPECT_FALSE(isUnflattenedRope(chunk)) << start;
+        EXPECT_EQ(depth(chunk), 0u) << start;
+        decoded += chunk.to_string();
+    }
+    decoded += decoder.finish().to_string();
+    EXPECT_EQ(decoded, text);
+}
+
+} // namespace simple
+
+TEST(CodecTest, EncoderMatchesGetBytesForEveryChunking) {
+    std::vector<std::string> texts = sample_texts();
+    texts.push_back("?");
+    texts.push_back("\xE4\xB8\x96\xE7\x95\x8C");
+    texts.push_back("? \xE4\xB8\x96");
+    for (const std::string& text : texts) {
+        for (Encoding encoding : all_encodings) {
+            for (BOMPolicy bomPolicy : all_policies) {
+                for (EncodingErrorHandling errorHandling : all_handlings) {
+                    const Outcome expected = encoded_whole(text, encoding, bomPolicy, errorHandling);
+                    for (const auto& sizes : chunkings) {
+                        EXPECT_EQ(encoded_in_chunks(text, encoding, bomPolicy, errorHandling, sizes), expected)
+                            << to_string(encoding) << ", " << to_string(bomPolicy) << ", "
+                            << to_string(errorHandling) << ", chunks of " << sizes[0] << ", text " << text;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(CodecTest, StreamRoundTrip) {
+    std::mt19937 rng(11);
+    const std::string pieces[] = {"a", "Z ", "\xC3\xA9", "\xE4\xB8\x96", "\xF0\x9F\x98\x80", "\n"};
+    std::string text;
+    for (int i = 0; i < 5000; ++i) {
+        text += pieces[rng() % 6];
+    }
+    for (Encoding encoding : {Encoding::UTF_16BE, Encoding::UTF_16LE, Encoding::UTF_32BE, Encoding::UTF_32LE}) {
+        Encoder encoder(encoding, BOMPolicy::INCLUDE);
+        Decoder decoder(encoding, BOMPolicy::AUTO);
+        std::string decoded;
+        for (std::size_t start = 0; start < text.size(); start += 1000) {
+            const std::vector<uint8_t> bytes = encoder.encode(std::string_view(text).substr(start, 1000));
+            // Hand the bytes over in uneven pieces
+            const std::size_t half = bytes.size() / 2 + 1;
+            decoded += decoder.decode(bytes.data(), std::min(half, bytes.size())).toStdString();
+            if (half < bytes.size()) {
+                decoded += decoder.decode(bytes.data() + half, bytes.size() - half).toStdString();
+            }
+        }
+        const std::vector<uint8_t> rest = encoder.finish();
+        decoded += decoder.decode(rest).toStdString();
+        decoded += decoder.finish().toStdString();
+        EXPECT_EQ(decoded, text) << to_string(encoding);
+    }
+}
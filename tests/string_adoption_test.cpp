@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include "../include/string.hpp"
+#include "../include/encoding.hpp"
+
+namespace simple {
+
+class StringAdoptionTest : public ::testing::Test {
+protected:
+    // First byte of the storage of a String
+    const char* dataOf(const String& str) {
+        return str.view().data();
+    }
+
+    static std::vector<uint8_t> bytesOf(const std::string& str) {
+        return std::vector<uint8_t>(str.begin(), str.end());
+    }
+
+    const std::string text = "Text long enough to be stored on the heap: 世界 🌍";
+};
+
+TEST_F(StringAdoptionTest, MovedStdStringIsNotCopied) {
+    std::string source = text;
+    const char* buffer = source.data();
+
+    String str(std::move(source));
+    EXPECT_EQ(dataOf(str), buffer);
+    EXPECT_EQ(str.toStdString(), text);
+
+    // The adopted std::string is returned as is
+    EXPECT_EQ(str.to_string().data(), buffer);
+}
+
+TEST_F(StringAdoptionTest, MovedShortStdStringIsInline) {
+    std::string source = "short";
+    String str(std::move(source));
+    EXPECT_EQ(str.toStdString(), "short");
+    EXPECT_EQ(str.length(), 5u);
+}
+
+TEST_F(StringAdoptionTest, FromStdStringRvalue) {
+    std::string source = text;
+    const char* buffer = source.data();
+
+    String str = String::fromStdString(std::move(source));
+    EXPECT_EQ(dataOf(str), buffer);
+    EXPECT_TRUE(str.equals(String(text)));
+}
+
+TEST_F(StringAdoptionTest, ValidUtf8BytesAreNotCopied) {
+    std::vector<uint8_t> bytes = bytesOf(text);
+    const uint8_t* buffer = bytes.data();
+
+    String str = String::fromBytes(std::move(bytes));
+    EXPECT_EQ(dataOf(str), reinterpret_cast<const char*>(buffer));
+    EXPECT_EQ(str.toStdString(), text);
+    EXPECT_EQ(str.length(), String(text).length());
+}
+
+TEST_F(StringAdoptionTest, BomIsSkippedWithoutCopying) {
+    std::vector<uint8_t> bytes = bytesOf("\xEF\xBB\xBF" + text);
+    const uint8_t* buffer = bytes.data();
+
+    String str = String::fromBytes(std::move(bytes), Encoding::UTF_8, BOMPolicy::AUTO);
+    EXPECT_EQ(dataOf(str), reinterpret_cast<const char*>(buffer + 3));
+    EXPECT_EQ(str.toStdString(), text);
+
+    // Without BOM handling the BOM stays part of the text
+    String with_bom = String::fromBytes(bytesOf("\xEF\xBB\xBF" + text), Encoding::UTF_8, BOMPolicy::EXCLUDE);
+    EXPECT_EQ(with_bom.toStdString(), "\xEF\xBB\xBF" + text);
+
+    // A required BOM that is missing is still an error
+    EXPECT_THROW(String::fromBytes(bytesOf(text), Encoding::UTF_8, BOMPolicy::INCLUDE), EncodingException);
+}
+
+TEST_F(StringAdoptionTest, InvalidUtf8MatchesCopyingOverload) {
+    const std::string invalid = text + "\xC3" + text;
+
+    EXPECT_THROW(String::fromBytes(bytesOf(invalid)), EncodingException);
+
+    const std::vector<uint8_t> copy = bytesOf(invalid);
+    for (auto handling : {EncodingErrorHandling::REPLACE, EncodingErrorHandling::IGNORE}) {
+        String adopted = String::fromBytes(bytesOf(invalid), Encoding::UTF_8, handling);
+        String copied = String::fromBytes(copy, Encoding::UTF_8, handling);
+        EXPECT_TRUE(adopted.equals(copied));
+    }
+}
+
+TEST_F(StringAdoptionTest, OtherEncodingsAreDecoded) {
+    std::vector<uint8_t> latin1 = {0x63, 0x61, 0x66, 0xE9};
+    String str = String::fromBytes(std::move(latin1), Encoding::ISO_8859_1);
+    EXPECT_EQ(str.toStdString(), "café");
+}
+
+TEST_F(StringAdoptionTest, SubstringsKeepAdoptedBufferAlive) {
+    String sub;
+    {
+        std::vector<uint8_t> bytes = bytesOf(text + text);
+        String str = String::fromBytes(std::move(bytes));
+        sub = str.substring(5, 40);
+    }
+    EXPECT_EQ(sub.toStdString(), text.substr(5, 35));
+}
+
+} // namespace simple
@@ -2,6 +2,8 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <algorithm>
+#include <stdexcept>
 #include "../include/string.hpp"
 #include "../include/encoding.hpp"
 
@@ -332,6 +334,100 @@ TEST_F(StringEncodingTest, ErrorHandlingStrategies) {
     EXPECT_FALSE(ignored.contains(replacement_char));
 }
 
+// Each byte of a sequence UTF-8 forbids is replaced or skipped on its own
+TEST_F(StringEncodingTest, ForbiddenUtf8Sequences) {
+    const std::vector<std::vector<uint8_t>> sequences = {
+        {0xC0, 0xAF},               // overlong '/'
+        {0xED, 0xA0, 0x80},         // surrogate U+D800
+        {0xF4, 0x90, 0x80, 0x80},   // U+110000, past the last code point
+    };
+    const std::string fffd = "\xEF\xBF\xBD";
+    for (const auto& sequence : sequences) {
+        std::vector<uint8_t> bytes = {'a'};
+        bytes.insert(bytes.end(), sequence.begin(), sequence.end());
+        bytes.push_back('b');
+
+        std::string expected = "a";
+        for (std::size_t i = 0; i < sequence.size(); ++i) {
+            expected += fffd;
+        }
+        expected += "b";
+        const String replaced = String::fromBytes(bytes, Encoding::UTF_8, EncodingErrorHandling::REPLACE);
+        EXPECT_EQ(replaced.toStdString(), expected);
+        EXPECT_EQ(replaced.length(), sequence.size() + 2);
+        EXPECT_EQ(String::fromBytes(bytes, Encoding::UTF_8, EncodingErrorHandling::IGNORE).toStdString(), "ab");
+        EXPECT_THROW(String::fromBytes(bytes, Encoding::UTF_8, EncodingErrorHandling::THROW), EncodingException);
+    }
+
+    // Valid sequences around the invalid ones are kept, after a BOM too
+    const std::vector<uint8_t> mixed = {0xEF, 0xBB, 0xBF, 0xE4, 0xB8, 0x96, 0xC0, 0xAF,
+                                        0xF0, 0x9F, 0x8C, 0x8D, 0xE4, 0xB8};
+    EXPECT_EQ(String::fromBytes(mixed, Encoding::UTF_8, EncodingErrorHandling::REPLACE).toStdString(),
+              "\xE4\xB8\x96" + fffd + fffd + "\xF0\x9F\x8C\x8D" + fffd + fffd);
+    EXPECT_EQ(String::fromBytes(mixed, Encoding::UTF_8, EncodingErrorHandling::IGNORE).toStdString(),
+              "\xE4\xB8\x96\xF0\x9F\x8C\x8D");
+}
+
+// Invalid UTF-8 is skipped in UTF-16 and UTF-32 output
+TEST_F(StringEncodingTest, InvalidUtf8IsSkippedInUtfOutput) {
+    String text("a\xFF" "b\xE4\xB8" "c", 6);
+    EXPECT_EQ(text.getBytes(Encoding::UTF_16LE), (std::vector<uint8_t>{'a', 0, 'b', 0, 'c', 0}));
+    EXPECT_EQ(text.getBytes(Encoding::UTF_16BE, BOMPolicy::INCLUDE),
+              (std::vector<uint8_t>{0xFE, 0xFF, 0, 'a', 0, 'b', 0, 'c'}));
+    EXPECT_EQ(text.getBytes(Encoding::UTF_32BE),
+              (std::vector<uint8_t>{0, 0, 0, 'a', 0, 0, 0, 'b', 0, 0, 0, 'c'}));
+    EXPECT_EQ(text.getBytes(Encoding::UTF_32LE, BOMPolicy::INCLUDE),
+              (std::vector<uint8_t>{0xFF, 0xFE, 0, 0, 'a', 0, 0, 0, 'b', 0, 0, 0, 'c', 0, 0, 0}));
+}
+
+// Test unpaired surrogates and out-of-range code points with every error handling strategy
+TEST_F(StringEncodingTest, InvalidUtf16AndUtf32Decoding) {
+    auto offset_of = [](const std::vector<uint8_t>& bytes, Encoding encoding) -> size_t {
+        try {
+            String::fromBytes(bytes, encoding, BOMPolicy::AUTO, EncodingErrorHandling::THROW);
+        } catch (const EncodingException& e) {
+            return e.getByteOffset();
+        }
+        return std::string::npos;
+    };
+
+    // "a", an unpaired low surrogate, "b", a high surrogate before "c", and a pair
+    std::vector<uint8_t> utf16le = {0xFF, 0xFE, 'a', 0, 0x00, 0xDC, 'b', 0, 0x3D, 0xD8, 'c', 0, 0x3D, 0xD8, 0x00, 0xDE};
+    EXPECT_EQ(4u, offset_of(utf16le, Encoding::UTF_16LE));
+    EXPECT_EQ("a\xEF\xBF\xBD" "b\xEF\xBF\xBD" "c\xF0\x9F\x98\x80",
+              String::fromBytes(utf16le, Encoding::UTF_16LE, EncodingErrorHandling::REPLACE).toStdString());
+    EXPECT_EQ("abc\xF0\x9F\x98\x80",
+              String::fromBytes(utf16le, Encoding::UTF_16LE, EncodingErrorHandling::IGNORE).toStdString());
+
+    // A high surrogate at the end, then an odd byte after it
+    std::vector<uint8_t> utf16be = {0, 'a', 0xD8, 0x3D};
+    EXPECT_EQ(2u, offset_of(utf16be, Encoding::UTF_16BE));
+    utf16be.erase(utf16be.begin() + 2, utf16be.end());
+    utf16be.push_back('b');
+    EXPECT_EQ(2u, offset_of(utf16be, Encoding::UTF_16BE));
+    EXPECT_EQ("a\xEF\xBF\xBD",
+              String::fromBytes(utf16be, Encoding::UTF_16BE, EncodingErrorHandling::REPLACE).toStdString());
+    EXPECT_EQ("a", String::fromBytes(utf16be, Encoding::UTF_16BE, EncodingErrorHandling::IGNORE).toStdString());
+
+    // A surrogate code point and one above U+10FFFF, after a BOM, and an incomplete code point
+    std::vector<uint8_t> utf32be = {0, 0, 0xFE, 0xFF, 0, 0, 0, 'a', 0, 0, 0xD8, 0, 0, 0x11, 0, 0, 0, 0, 0, 'b', 0, 0};
+    EXPECT_EQ(8u, offset_of(utf32be, Encoding::UTF_32BE));
+    EXPECT_EQ("a\xEF\xBF\xBD\xEF\xBF\xBD" "b\xEF\xBF\xBD",
+              String::fromBytes(utf32be, Encoding::UTF_32BE, EncodingErrorHandling::REPLACE).toStdString());
+    EXPECT_EQ("ab", String::fromBytes(utf32be, Encoding::UTF_32BE, EncodingErrorHandling::IGNORE).toStdString());
+    std::vector<uint8_t> utf32le = {'a', 0, 0, 0, 0, 0, 0x11, 0};
+    EXPECT_EQ(4u, offset_of(utf32le, Encoding::UTF_32LE));
+    utf32le.resize(6);
+    EXPECT_EQ(4u, offset_of(utf32le, Encoding::UTF_32LE));
+
+    try {
+        String::fromBytes(std::vector<uint8_t>{'a', 0, 0x00, 0xDC}, Encoding::UTF_16LE);
+        FAIL() << "Expected EncodingException";
+    } catch (const EncodingException& e) {
+        EXPECT_NE(std::string(e.what()).find("unpaired low surrogate"), std::string::npos);
+    }
+}
+
 // Test null character handling
 TEST_F(StringEncodingTest, NullCharacterHandling) {
     // Create a string with embedded null characters
@@ -391,3 +487,120 @@ TEST_F(StringEncodingTest, EncodingExceptionDetails) {
                    error_message.find("invalid") != std::string::npos);
     }
 }
+
+// Test the byte offset of invalid UTF-8
+TEST_F(StringEncodingTest, InvalidUtf8ByteOffset) {
+    auto offset_of = [](const std::vector<uint8_t>& bytes, BOMPolicy bomPolicy) -> size_t {
+        try {
+            String::fromBytes(bytes, Encoding::UTF_8, bomPolicy, EncodingErrorHandling::THROW);
+        } catch (const EncodingException& e) {
+            return e.getByteOffset();
+        }
+        return std::string::npos;
+    };
+
+    // The first invalid byte, past any valid multi-byte text
+    std::vector<uint8_t> text(100, 'a');
+    text.insert(text.end(), {0xE4, 0xB8, 0x96, 0xF0, 0x9F, 0x98, 0x80});
+    std::vector<uint8_t> overlong = text;
+    overlong.insert(overlong.end(), {0xC0, 0x80, 0xFF});
+    EXPECT_EQ(107u, offset_of(overlong, BOMPolicy::AUTO));
+
+    // A surrogate, and a sequence cut off at the end
+    std::vector<uint8_t> surrogate = text;
+    surrogate.insert(surrogate.end(), {0xED, 0xA0, 0x80});
+    EXPECT_EQ(107u, offset_of(surrogate, BOMPolicy::AUTO));
+    std::vector<uint8_t> truncated = text;
+    truncated.insert(truncated.end(), {0xF0, 0x9F, 0x98});
+    EXPECT_EQ(107u, offset_of(truncated, BOMPolicy::AUTO));
+    EXPECT_EQ(std::string::npos, offset_of(text, BOMPolicy::AUTO));
+
+    // Offsets count the BOM that was skipped
+    std::vector<uint8_t> with_bom = {0xEF, 0xBB, 0xBF};
+    with_bom.insert(with_bom.end(), overlong.begin(), overlong.end());
+    EXPECT_EQ(110u, offset_of(with_bom, BOMPolicy::AUTO));
+    EXPECT_EQ(110u, offset_of(with_bom, BOMPolicy::EXCLUDE));
+
+    // Invalid bytes are also reported by the overload without a BOM policy
+    try {
+        String::fromBytes(overlong, Encoding::UTF_8);
+        FAIL() << "Expected EncodingException";
+    } catch (const EncodingException& e) {
+        EXPECT_EQ(107u, e.getByteOffset());
+        EXPECT_NE(std::string(e.what()).find("overlong"), std::string::npos);
+    }
+}
+
+// Test encoding into a buffer sized by encoded_size()
+TEST_F(StringEncodingTest, EncodeIntoBuffer) {
+    std::string long_text;
+    while (long_text.size() < 2000) {
+        long_text += "Caf\xC3\xA9 \xE4\xB8\x96\xE7\x95\x8C \xF0\x9F\x98\x80 ";
+    }
+    const std::vector<String> strings = {
+        String(), ascii_string, latin1_string, utf8_string, emoji_string, mixed_string,
+        String("bad \xE4\xB8 byte \xFF and \x80 end \xF0\x9F\x98"), String(long_text),
+        String(long_text + "\xFF" + long_text.substr(0, 997) + "\xE4\xB8"),
+        String(std::string(3000, 'a') + "\xC3\xA9"),
+    };
+    const Encoding encodings[] = {Encoding::UTF_8, Encoding::UTF_16BE, Encoding::UTF_16LE, Encoding::UTF_32BE,
+                                  Encoding::UTF_32LE, Encoding::ISO_8859_1, Encoding::ASCII};
+    const EncodingErrorHandling handlings[] = {EncodingErrorHandling::THROW, EncodingErrorHandling::REPLACE,
+                                               EncodingErrorHandling::IGNORE};
+    for (const String& str : strings) {
+        for (Encoding encoding : encodings) {
+            for (BOMPolicy bomPolicy : {BOMPolicy::EXCLUDE, BOMPolicy::INCLUDE}) {
+                for (EncodingErrorHandling errorHandling : handlings) {
+                    std::vector<uint8_t> expected;
+                    try {
+                        expected = str.getBytes(encoding, bomPolicy, errorHandling);
+                    } catch (const EncodingException&) {
+                        EXPECT_THROW(str.encoded_size(encoding, bomPolicy, errorHandling), EncodingException);
+                        continue;
+                    }
+                    ASSERT_EQ(expected.size(), str.encoded_size(encoding, bomPolicy, errorHandling))
+                        << to_string(encoding) << ", " << str.toStdString().size() << " bytes";
+
+                    // Aligned and unaligned output, with guard bytes around it
+                    for (std::size_t offset : {std::size_t{8}, std::size_t{9}, std::size_t{10}}) {
+                        std::vector<uint8_t> buffer(expected.size() + 16, 0xAA);
+                        const std::size_t written = str.encode_into(
+                            std::span<uint8_t>(buffer.data() + offset, expected.size()),
+                            encoding, bomPolicy, errorHandling);
+                        EXPECT_EQ(expected.size(), written);
+                        EXPECT_TRUE(std::equal(expected.begin(), expected.end(), buffer.begin() + offset))
+                            << to_string(encoding) << ", offset " << offset;
+                        for (std::size_t i = 0; i < offset; ++i) {
+                            EXPECT_EQ(0xAA, buffer[i]);
+                        }
+                        for (std::size_t i = offset + expected.size(); i < buffer.size(); ++i) {
+                            EXPECT_EQ(0xAA, buffer[i]);
+                        }
+                    }
+
+                    if (!expected.empty()) {
+                        std::vector<uint8_t> small(expected.size() - 1);
+                        EXPECT_THROW(str.encode_into(small, encoding, bomPolicy, errorHandling), std::length_error);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Test the offset of the first character an encoding lacks
+TEST_F(StringEncodingTest, NarrowEncodingByteOffset) {
+    try {
+        mixed_string.getBytes(Encoding::ASCII, EncodingErrorHandling::THROW);
+        FAIL() << "Expected EncodingException";
+    } catch (const EncodingException& e) {
+        EXPECT_EQ(7u, e.getByteOffset());
+    }
+    std::vector<uint8_t> buffer(64);
+    try {
+        String("Caf\xC3\xA9 \xE4\xB8\x96").encode_into(buffer, Encoding::ISO_8859_1);
+        FAIL() << "Expected EncodingException";
+    } catch (const EncodingException& e) {
+        EXPECT_EQ(6u, e.getByteOffset());
+    }
+}
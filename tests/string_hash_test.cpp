@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "../include/string.hpp"
+
+using namespace simple;
+using namespace simple::literals;
+
+TEST(StringHashTest, EqualStringsHashEqually) {
+    // Lengths on both sides of the inline limit and of each block size of the hash
+    for (std::size_t length : {0, 1, 3, 4, 8, 15, 16, 17, 23, 48, 49, 100, 1000}) {
+        std::string text;
+        for (std::size_t i = 0; i < length; ++i) {
+            text += static_cast<char>('a' + i % 26);
+        }
+        String a(text);
+        String b(text);
+        EXPECT_EQ(a.hash_code(), b.hash_code()) << "length " << length;
+        EXPECT_EQ(a.hash_code(), StringHash()(std::string_view(text))) << "length " << length;
+        EXPECT_EQ(a.hash_code(), std::hash<String>()(a));
+    }
+}
+
+TEST(StringHashTest, SubstringsHashLikeTheirBytes) {
+    String text("A long text with Unicode 世界 🌍 shared by its substrings");
+    String sub = text.substring(17, 33);
+    EXPECT_EQ(sub.hash_code(), String(sub.to_string()).hash_code());
+    EXPECT_EQ(sub.hash_code(), StringHash()(sub.to_string().c_str()));
+    EXPECT_NE(sub.hash_code(), text.hash_code());
+    // The cached value is returned on later calls
+    EXPECT_EQ(sub.hash_code(), sub.hash_code());
+}
+
+TEST(StringHashTest, DifferentStringsSpreadOut) {
+    std::set<std::size_t> hashes;
+    for (int i = 0; i < 10000; ++i) {
+        hashes.insert(String("key " + std::to_string(i)).hash_code());
+    }
+    EXPECT_EQ(hashes.size(), 10000u);
+    EXPECT_NE(String("ab").hash_code(), String("ba").hash_code());
+    EXPECT_NE(String("").hash_code(), String(std::string(1, '\0')).hash_code());
+}
+
+TEST(StringHashTest, UnorderedContainers) {
+    std::unordered_set<String> set = {String("alpha"), String("beta"), "gamma with a longer text"_s};
+    EXPECT_EQ(set.count(String("beta")), 1u);
+    EXPECT_EQ(set.count(String("gamma with a longer text")), 1u);
+    EXPECT_EQ(set.count(String("delta")), 0u);
+}
+
+TEST(StringHashTest, HeterogeneousLookup) {
+    std::unordered_map<String, int, StringHash, StringEqual> counts;
+    counts[String("short")] = 1;
+    counts[String("a key long enough to be stored on the heap")] = 2;
+
+    auto found = counts.find(std::string_view("short"));
+    ASSERT_NE(found, counts.end());
+    EXPECT_EQ(found->second, 1);
+    EXPECT_EQ(counts.find("a key long enough to be stored on the heap")->second, 2);
+    EXPECT_EQ(counts.count(std::string_view("missing")), 0u);
+    EXPECT_TRUE(counts.contains("short"));
+
+    StringEqual equal;
+    EXPECT_TRUE(equal(String("x"), "x"));
+    EXPECT_TRUE(equal(std::string_view("x"), String("x")));
+    EXPECT_FALSE(equal(String("x"), std::string_view("y")));
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "../include/string.hpp"
+
+namespace simple {
+
+class StringInternTest : public ::testing::Test {
+protected:
+    // Check if two Strings share their bytes
+    bool sharesData(const String& a, const String& b) {
+        return a.shares_data_with(b);
+    }
+
+    // Text unique to a test, so tests do not depend on each other's entries
+    static std::string unique(const std::string& name) {
+        return "interned text of test " + name + " 世界 🌍";
+    }
+};
+
+TEST_F(StringInternTest, EqualStringsShareOneBlock) {
+    const std::string text = unique("EqualStringsShareOneBlock");
+    String a(text);
+    String b(text);
+    EXPECT_FALSE(sharesData(a, b));
+
+    String ia = a.intern();
+    String ib = b.intern();
+    EXPECT_TRUE(sharesData(ia, ib));
+    EXPECT_TRUE(ia.equals(ib));
+    EXPECT_EQ(ib.to_string(), text);
+
+    // The first string interned becomes the canonical one
+    EXPECT_TRUE(sharesData(ia, a));
+    EXPECT_TRUE(sharesData(ia.intern(), ia));
+}
+
+TEST_F(StringInternTest, ShortStringsAreInterned) {
+    String a("id");
+    String b(std::string("i") + "d");
+    EXPECT_TRUE(sharesData(a.intern(), b.intern()));
+    EXPECT_EQ(b.intern().to_string(), "id");
+    EXPECT_EQ(b.intern().length(), 2u);
+}
+
+TEST_F(StringInternTest, SubstringsAreCopied) {
+    const std::string text = unique("SubstringsAreCopied");
+    String whole(text + text);
+    String part = whole.substring(0, String(text).length());
+
+    String interned = part.intern();
+    EXPECT_TRUE(interned.equals(String(text)));
+    // The canonical string does not keep the larger buffer alive
+    EXPECT_FALSE(sharesData(interned, whole));
+    EXPECT_TRUE(sharesData(String(text).intern(), interned));
+}
+
+TEST_F(StringInternTest, StatsCountEntriesAndSavings) {
+    const std::string text = unique("StatsCountEntriesAndSavings");
+    const String::InternStats before = String::intern_stats();
+
+    String canonical = String(text).intern();
+    const String::InternStats added = String::intern_stats();
+    EXPECT_EQ(added.entries, before.entries + 1);
+    EXPECT_EQ(added.bytes, before.bytes + text.size());
+
+    String duplicate = String(text).intern();
+    String again = canonical.intern();
+    const String::InternStats after = String::intern_stats();
+    EXPECT_EQ(after.entries, added.entries);
+    EXPECT_EQ(after.hits, added.hits + 2);
+    // Interning the canonical string itself saves nothing
+    EXPECT_EQ(after.bytes_saved, added.bytes_saved + text.size());
+}
+
+TEST_F(StringInternTest, PurgeDropsUnreferencedEntries) {
+    const std::string kept_text = unique("PurgeDropsUnreferencedEntries kept");
+    String kept = String(kept_text).intern();
+    {
+        String dropped = String(unique("PurgeDropsUnreferencedEntries dropped")).intern();
+    }
+    const std::size_t entries = String::intern_stats().entries;
+
+    EXPECT_GE(String::purge_interned(), 1u);
+    EXPECT_LT(String::intern_stats().entries, entries);
+
+    // Entries still in use survive the purge
+    EXPECT_TRUE(sharesData(String(kept_text).intern(), kept));
+}
+
+TEST_F(StringInternTest, TableIsSweptAutomatically) {
+    String::purge_interned();
+    const std::size_t count = 200000;
+    for (std::size_t i = 0; i < count; ++i) {
+        String("transient interned string " + std::to_string(i)).intern();
+    }
+    // Nothing refers to these strings anymore, so most of them have been swept
+    EXPECT_LT(String::intern_stats().entries, count);
+    String::purge_interned();
+}
+
+TEST_F(StringInternTest, ConcurrentInterning) {
+#if defined(SSTRING_NONATOMIC_REFCOUNT)
+    GTEST_SKIP() << "Strings cannot be shared between threads with non-atomic reference counts";
+#endif
+    std::vector<std::string> texts;
+    for (int i = 0; i < 100; ++i) {
+        texts.push_back(unique("ConcurrentInterning " + std::to_string(i)));
+    }
+
+    std::vector<std::vector<String>> results(4);
+    std::vector<std::thread> threads;
+    for (auto& result : results) {
+        threads.emplace_back([&texts, &result] {
+            for (const auto& text : texts) {
+                result.push_back(String(text).intern());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (std::size_t i = 0; i < texts.size(); ++i) {
+        for (const auto& result : results) {
+            EXPECT_TRUE(sharesData(result[i], results[0][i]));
+        }
+    }
+}
+
+} // namespace simple
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "../include/string.hpp"
+
+namespace simple {
+
+using namespace literals;
+
+class StringLiteralTest : public ::testing::Test {
+protected:
+    // First byte of the storage of a String
+    const char* dataOf(const String& str) {
+        return str.view().data();
+    }
+
+    // Check if two Strings share their bytes
+    bool sharesData(const String& a, const String& b) {
+        return a.shares_data_with(b);
+    }
+
+    // Check if a String is backed by an immortal block
+    bool isImmortal(const String& str) {
+        detail::ImplRef copy = str.pimpl();
+        return copy && copy.get() == str.pimpl().get() && !copy.counted();
+    }
+};
+
+TEST_F(StringLiteralTest, LiteralBytesAreNotCopied) {
+    String str = "A literal long enough for the heap"_s;
+    EXPECT_EQ(str.to_string(), "A literal long enough for the heap");
+    EXPECT_TRUE(isImmortal(str));
+
+    // Every evaluation of the literal refers to the same bytes
+    String again = "A literal long enough for the heap"_s;
+    EXPECT_EQ(dataOf(str), dataOf(again));
+    EXPECT_TRUE(sharesData(str, again));
+    EXPECT_EQ(str, String::literal<"A literal long enough for the heap">());
+}
+
+TEST_F(StringLiteralTest, CopiesShareTheLiteral) {
+    String str = "true"_s;
+    String copy = str;
+    String assigned;
+    assigned = copy;
+    EXPECT_TRUE(isImmortal(copy));
+    EXPECT_TRUE(isImmortal(assigned));
+    EXPECT_EQ(dataOf(assigned), dataOf(str));
+
+    String moved = std::move(copy);
+    EXPECT_TRUE(isImmortal(moved));
+    EXPECT_EQ(moved.to_string(), "true");
+}
+
+TEST_F(StringLiteralTest, UnicodeLiterals) {
+    String str = "Hello 世界 🌍 and some more text"_s;
+    EXPECT_EQ(str.length(), 30u);
+    EXPECT_EQ(str.char_at(6).value(), 0x4E16);
+    EXPECT_EQ(str.code_point_at(9).value(), 0x1F30Du);
+    EXPECT_EQ(str.indexOf(String("and")), Index(12));
+
+    // Substrings view the bytes of the literal
+    String sub = str.substring(6, 29);
+    EXPECT_EQ(sub.to_string(), "世界 🌍 and some more tex");
+    EXPECT_TRUE(sharesData(sub, str));
+}
+
+TEST_F(StringLiteralTest, EmbeddedNullCharacters) {
+    String str = "a\0b"_s;
+    EXPECT_EQ(str.length(), 3u);
+    EXPECT_EQ(str.to_string(), std::string("a\0b", 3));
+}
+
+TEST_F(StringLiteralTest, ValueOfConstantsAreLiterals) {
+    EXPECT_TRUE(isImmortal(String::valueOf(true)));
+    EXPECT_TRUE(isImmortal(String::valueOf(false)));
+    EXPECT_TRUE(sharesData(String::valueOf(true), String::valueOf(true)));
+    EXPECT_EQ(String::valueOf(0.0 / 0.0).to_string(), "NaN");
+    EXPECT_TRUE(isImmortal(String::valueOf(-1.0f / 0.0f)));
+    EXPECT_EQ(String::valueOf(-1.0f / 0.0f).to_string(), "-Infinity");
+}
+
+TEST_F(StringLiteralTest, EmptyString) {
+    EXPECT_TRUE(String::EMPTY.is_empty());
+    EXPECT_EQ(String::EMPTY.length(), 0u);
+    EXPECT_EQ(String("some text here").substring(4, 4), String::EMPTY);
+    EXPECT_EQ(String("   \t ").trim(), String::EMPTY);
+    EXPECT_TRUE(""_s.equals(String::EMPTY));
+}
+
+TEST_F(StringLiteralTest, ConcurrentCopies) {
+    const String shared = "Shared between threads without any counting"_s;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&shared] {
+            for (int i = 0; i < 10000; ++i) {
+                String copy = shared;
+                String sub = copy.substring(7, 14);
+                (void)sub;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(shared.substring(7, 14).to_string(), "between");
+}
+
+} // namespace simple
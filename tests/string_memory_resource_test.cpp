@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "../include/string.hpp"
+
+using namespace simple;
+
+namespace {
+
+// Memory resource counting the allocations it forwards to the global heap
+class CountingResource : public std::pmr::memory_resource {
+public:
+    std::size_t allocations = 0;
+    std::size_t deallocations = 0;
+    std::size_t bytes = 0;  ///< Bytes currently allocated
+
+private:
+    void* do_allocate(std::size_t size, std::size_t alignment) override {
+        ++allocations;
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t size, std::size_t alignment) override {
+        ++deallocations;
+        bytes -= size;
+        std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+const std::string long_text = "Text long enough to be stored on the heap: 世界 🌍";
+
+} // namespace
+
+TEST(StringMemoryResourceTest, ExplicitResource) {
+    CountingResource resource;
+    {
+        String str(long_text, &resource);
+        EXPECT_EQ(resource.allocations, 1u);
+        EXPECT_EQ(str.to_string(), long_text);
+        EXPECT_EQ(str.length(), String(long_text).length());
+
+        String copy = str;
+        EXPECT_EQ(resource.allocations, 1u);
+
+        // Short strings are stored inline
+        String word("word", 4, &resource);
+        EXPECT_EQ(resource.allocations, 1u);
+    }
+    EXPECT_EQ(resource.deallocations, 1u);
+    EXPECT_EQ(resource.bytes, 0u);
+}
+
+TEST(StringMemoryResourceTest, SubstringsUseTheResourceOfTheirBuffer) {
+    CountingResource resource;
+    {
+        String str(long_text + long_text, &resource);
+        String sub = str.substring(3, 40);
+        EXPECT_EQ(resource.allocations, 2u);
+        EXPECT_EQ(sub.to_string(), long_text.substr(3, 37));
+
+        // Compacted copies stay in the same resource
+        String compacted = sub.compact();
+        EXPECT_EQ(resource.allocations, 3u);
+        EXPECT_TRUE(compacted.equals(sub));
+
+        String trimmed = String("  " + long_text + "  ", &resource).trim();
+        EXPECT_EQ(resource.allocations, 5u);
+        EXPECT_EQ(trimmed.to_string(), long_text);
+    }
+    EXPECT_EQ(resource.deallocations, resource.allocations);
+    EXPECT_EQ(resource.bytes, 0u);
+}
+
+TEST(StringMemoryResourceTest, ScopeDirectsAllocations) {
+    CountingResource resource;
+    EXPECT_EQ(String::memory_resource(), nullptr);
+    {
+        String::MemoryScope scope(&resource);
+        EXPECT_EQ(String::memory_resource(), &resource);
+
+        String str(long_text);
+        EXPECT_EQ(resource.allocations, 1u);
+
+        String replaced = str.replace(String("heap"), String("arena"));
+        EXPECT_EQ(resource.allocations, 2u);
+        EXPECT_EQ(replaced.indexOf(String("arena")), Index(37));
+
+        std::vector<uint8_t> bytes(long_text.begin(), long_text.end());
+        String decoded = String::fromBytes(bytes);
+        String adopted = String::fromBytes(std::move(bytes));
+        String number = String::valueOf(1.0e300);
+        EXPECT_EQ(resource.allocations, 5u);
+    }
+    EXPECT_EQ(String::memory_resource(), nullptr);
+    EXPECT_EQ(resource.bytes, 0u);
+
+    // Outside the scope strings come from the global heap again
+    String str(long_text);
+    EXPECT_EQ(resource.allocations, 5u);
+}
+
+TEST(StringMemoryResourceTest, ScopesNest) {
+    CountingResource outer;
+    CountingResource inner;
+    String::MemoryScope outer_scope(&outer);
+    {
+        String::MemoryScope inner_scope(&inner);
+        String str(long_text);
+        EXPECT_EQ(inner.allocations, 1u);
+    }
+    String str(long_text);
+    EXPECT_EQ(outer.allocations, 1u);
+    EXPECT_EQ(inner.allocations, 1u);
+}
+
+TEST(StringMemoryResourceTest, InternedStringsOutliveTheResource) {
+    String interned;
+    {
+        std::pmr::monotonic_buffer_resource arena;
+        String::MemoryScope scope(&arena);
+        interned = String("interned from a request-scoped arena 世界").intern();
+    }
+    EXPECT_EQ(interned.to_string(), "interned from a request-scoped arena 世界");
+}
+
+TEST(StringMemoryResourceTest, ArenaAllocationBenchmark) {
+    const int REQUESTS = 20;
+    const int STRINGS = 1000;
+
+    // Each request builds strings and cuts substrings out of them
+    auto handle_request = [] {
+        std::size_t total = 0;
+        for (int i = 0; i < STRINGS; ++i) {
+            String line("request line " + std::to_string(i) + " with a payload of 世界 🌍");
+            String field = line.substring(5, 30);
+            total += field.length() + line.trim().length();
+        }
+        return total;
+    };
+
+    CountingResource heap;
+    auto start = std::chrono::high_resolution_clock::now();
+    std::size_t heap_total = 0;
+    for (int r = 0; r < REQUESTS; ++r) {
+        String::MemoryScope scope(&heap);
+        heap_total += handle_request();
+    }
+    auto heap_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now() - start);
+
+    CountingResource upstream;
+    start = std::chrono::high_resolution_clock::now();
+    std::size_t arena_total = 0;
+    for (int r = 0; r < REQUESTS; ++r) {
+        std::pmr::monotonic_buffer_resource arena(64 * 1024, &upstream);
+        String::MemoryScope scope(&arena);
+        arena_total += handle_request();
+    }
+    auto arena_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now() - start);
+
+    std::cout << "\nArena Allocation Benchmark (" << REQUESTS << " requests of " << STRINGS << " strings):\n"
+              << "  Heap allocations of String blocks: " << heap.allocations << " (" << heap_time.count()
+              << " microseconds)\n"
+              << "  Heap allocations with an arena per request: " << upstream.allocations << " ("
+              << arena_time.count() << " microseconds)\n";
+
+    EXPECT_EQ(heap_total, arena_total);
+    EXPECT_EQ(heap.bytes, 0u);
+    EXPECT_EQ(upstream.bytes, 0u);
+    EXPECT_LT(upstream.allocations * 100, heap.allocations);
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "../include/string.hpp"
+
+using namespace simple;
+
+namespace {
+
+// Text long enough to be stored in a block, with non-ASCII characters
+std::string long_text(std::size_t repeat) {
+    std::string text;
+    for (std::size_t i = 0; i < repeat; ++i) {
+        text += "line " + std::to_string(i) + " 世界 🌍\n";
+    }
+    return text;
+}
+
+} // namespace
+
+TEST(StringMemoryUsageTest, InlineStringsUseNoHeap) {
+    String small("short");
+    String::MemoryUsage usage = small.memory_usage();
+    EXPECT_EQ(usage.owned_bytes, 0u);
+    EXPECT_EQ(usage.shared_bytes, 0u);
+    EXPECT_EQ(usage.cache_bytes, 0u);
+    EXPECT_FALSE(usage.utf16_index);
+}
+
+TEST(StringMemoryUsageTest, OwnedAndSharedBytes) {
+    const std::string text = long_text(100);
+    String str(text);
+    String::MemoryUsage usage = str.memory_usage();
+    EXPECT_GT(usage.owned_bytes, text.size());
+    EXPECT_EQ(usage.shared_bytes, 0u);
+
+    // A copy shares the block
+    {
+        String copy = str;
+        usage = str.memory_usage();
+        EXPECT_EQ(usage.owned_bytes, 0u);
+        EXPECT_GT(usage.shared_bytes, text.size());
+    }
+    EXPECT_GT(str.memory_usage().owned_bytes, text.size());
+
+    // A substring owns its small block and shares the buffer of its parent
+    String part = str.substring(10, 500);
+    usage = part.memory_usage();
+    EXPECT_GT(usage.owned_bytes, 0u);
+    EXPECT_LT(usage.owned_bytes, text.size());
+    EXPECT_GT(usage.shared_bytes, text.size());
+}
+
+TEST(StringMemoryUsageTest, CachesAreCounted) {
+    String str(long_text(100));
+    const String::MemoryUsage before = str.memory_usage();
+    EXPECT_EQ(before.cache_bytes, 0u);
+    EXPECT_FALSE(before.utf16_index);
+
+    str.char_at(1000);
+    String::MemoryUsage after = str.memory_usage();
+    EXPECT_TRUE(after.utf16_index);
+    EXPECT_GT(after.cache_bytes, 0u);
+    EXPECT_EQ(after.owned_bytes, before.owned_bytes + after.cache_bytes);
+
+    // The std::string copy made for to_string() by a substring
+    String part = str.substring(0, 1000);
+    const std::size_t part_cache = part.memory_usage().cache_bytes;
+    part.to_string();
+    EXPECT_GT(part.memory_usage().cache_bytes, part_cache + 1000);
+}
+
+TEST(StringMemoryUsageTest, RopesCountTheirParts) {
+    String left(long_text(50));
+    String right(long_text(60));
+    String rope = left.concat(right);
+
+    // The parts are shared with left and right
+    String::MemoryUsage usage = rope.memory_usage();
+    EXPECT_GT(usage.owned_bytes, 0u);
+    EXPECT_GE(usage.shared_bytes, left.to_string().size() + right.to_string().size());
+    EXPECT_EQ(rope.retained_bytes(), rope.visible_bytes());
+}
+
+TEST(StringMemoryUsageTest, GlobalCounters) {
+    const String::MemoryStats before = String::memory_stats();
+    const std::string text = long_text(20);
+    {
+        std::vector<String> strings;
+        for (int i = 0; i < 100; ++i) {
+            strings.emplace_back(text);
+        }
+        String::MemoryStats during = String::memory_stats();
+        EXPECT_EQ(during.live_blocks, before.live_blocks + 100);
+        EXPECT_GE(during.block_bytes, before.block_bytes + 100 * text.size());
+
+        strings[0].char_at(100);
+        strings[1].to_string();
+        during = String::memory_stats();
+        EXPECT_EQ(during.cache_builds, before.cache_builds + 2);
+        EXPECT_EQ(during.live_caches, before.live_caches + 2);
+        EXPECT_GT(during.cache_bytes, before.cache_bytes);
+    }
+    const String::MemoryStats after = String::memory_stats();
+    EXPECT_EQ(after.live_blocks, before.live_blocks);
+    EXPECT_EQ(after.block_bytes, before.block_bytes);
+    EXPECT_EQ(after.live_caches, before.live_caches);
+    EXPECT_EQ(after.cache_bytes, before.cache_bytes);
+    EXPECT_EQ(after.cache_builds, before.cache_builds + 2);
+}
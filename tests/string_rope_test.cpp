@@ -0,0 +1,264 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "../include/string.hpp"
+#include "../include/string_view.hpp"
+
+namespace simple {
+
+class StringRopeTest : public ::testing::Test {
+protected:
+    std::size_t depth(const String& str) {
+        return str.rope_depth();
+    }
+
+    bool isUnflattenedRope(const String& str) {
+        return str.is_unflattened_rope();
+    }
+
+    // Mixed text: ASCII, 2- and 3-byte sequences and surrogate pairs
+    static std::string piece(int i) {
+        return "piece " + std::to_string(i) + " café 世界 🌍 ";
+    }
+};
+
+TEST_F(StringRopeTest, ShortConcatenationsAreFlat) {
+    String a("Hello, ");
+    String b("world");
+    String joined = a.concat(b);
+    EXPECT_EQ(joined.to_string(), "Hello, world");
+    EXPECT_EQ(depth(joined), 0u);
+
+    EXPECT_EQ(a.concat(String()).to_string(), "Hello, ");
+    EXPECT_EQ(String().concat(b).to_string(), "world");
+}
+
+TEST_F(StringRopeTest, LongConcatenationsAreRopes) {
+    std::string left_bytes(400, 'a');
+    std::string right_bytes = std::string(300, 'b') + "🌍";
+    String left(left_bytes);
+    String right(right_bytes);
+
+    String joined = left.concat(right);
+    EXPECT_EQ(depth(joined), 1u);
+    EXPECT_TRUE(isUnflattenedRope(joined));
+    EXPECT_EQ(joined.length(), 702u);
+    EXPECT_FALSE(joined.is_empty());
+
+    // The bytes are only copied when asked for
+    EXPECT_EQ(joined.to_string(), left_bytes + right_bytes);
+    EXPECT_FALSE(isUnflattenedRope(joined));
+    EXPECT_TRUE(joined.equals(String(left_bytes + right_bytes)));
+    EXPECT_EQ(joined.hash_code(), String(left_bytes + right_bytes).hash_code());
+}
+
+TEST_F(StringRopeTest, AppendingStaysBalanced) {
+    String rope;
+    std::string expected;
+    const int PIECES = 5000;
+    for (int i = 0; i < PIECES; ++i) {
+        rope = rope.concat(String(piece(i)));
+        expected += piece(i);
+    }
+
+    // Short pieces are merged into leaves of a few hundred bytes, and the
+    // tree over them stays within the AVL bound of 1.44 log2(leaves)
+    EXPECT_TRUE(isUnflattenedRope(rope));
+    EXPECT_LE(depth(rope), 20u);
+
+    String flat(expected);
+    EXPECT_EQ(rope.length(), flat.length());
+    EXPECT_EQ(rope.code_point_count(0, rope.length()), flat.code_point_count(0, flat.length()));
+    EXPECT_TRUE(isUnflattenedRope(rope));
+    EXPECT_EQ(rope.to_string(), expected);
+}
+
+TEST_F(StringRopeTest, IndexingMatchesFlatStrings) {
+    String rope;
+    std::string expected;
+    for (int i = 0; i < 200; ++i) {
+        rope = rope.concat(String(piece(i)));
+        expected += piece(i);
+    }
+    String flat(expected);
+    ASSERT_EQ(rope.length(), flat.length());
+
+    for (std::size_t i = 0; i < flat.length(); ++i) {
+        ASSERT_EQ(rope.char_at(i), flat.char_at(i)) << "at " << i;
+        ASSERT_EQ(rope.code_point_at(i), flat.code_point_at(i)) << "at " << i;
+    }
+    EXPECT_THROW(rope.char_at(flat.length()), StringIndexOutOfBoundsException);
+    EXPECT_THROW(rope.code_point_at(flat.length()), StringIndexOutOfBoundsException);
+
+    // Indexing walks the tree without flattening the rope
+    EXPECT_TRUE(isUnflattenedRope(rope));
+}
+
+TEST_F(StringRopeTest, SubstringsMatchFlatStrings) {
+    String rope;
+    std::string expected;
+    for (int i = 0; i < 200; ++i) {
+        rope = rope.concat(String(piece(i)));
+        expected += piece(i);
+    }
+    String flat(expected);
+    const std::size_t length = flat.length();
+
+    std::mt19937 random(42);
+    std::uniform_int_distribution<std::size_t> index(0, length);
+    for (int i = 0; i < 500; ++i) {
+        std::size_t begin = index(random);
+        std::size_t end = index(random);
+        if (begin > end) {
+            std::swap(begin, end);
+        }
+        // Indices inside surrogate pairs round up as in flat strings
+        String part = rope.substring(begin, end);
+        ASSERT_EQ(part.to_string(), flat.substring(begin, end).to_string()) << begin << ".." << end;
+        ASSERT_EQ(part.length(), flat.substring(begin, end).length());
+        ASSERT_EQ(rope.substring(begin).to_string(), flat.substring(begin).to_string()) << begin;
+    }
+    EXPECT_TRUE(isUnflattenedRope(rope));
+
+    // Long parts of a rope are ropes sharing its leaves
+    String half = rope.substring(10, length - 10);
+    EXPECT_TRUE(isUnflattenedRope(half));
+    EXPECT_LE(depth(half), depth(rope) + 1);
+
+    EXPECT_TRUE(rope.substring(5, 5).is_empty());
+    EXPECT_THROW(rope.substring(length + 1), StringIndexOutOfBoundsException);
+    EXPECT_THROW(rope.substring(0, length + 1), StringIndexOutOfBoundsException);
+    EXPECT_THROW(rope.substring(10, 5), StringIndexOutOfBoundsException);
+}
+
+TEST_F(StringRopeTest, Insert) {
+    String text("Hello world");
+    EXPECT_EQ(text.insert(5, String(",")).to_string(), "Hello, world");
+    EXPECT_EQ(text.insert(0, String(">> ")).to_string(), ">> Hello world");
+    EXPECT_EQ(text.insert(text.length(), String("!")).to_string(), "Hello world!");
+    EXPECT_THROW(text.insert(text.length() + 1, String("!")), StringIndexOutOfBoundsException);
+
+    // An index inside a surrogate pair inserts after the pair
+    String emoji("a🌍b");
+    EXPECT_EQ(emoji.insert(2, String("-")).to_string(), "a🌍-b");
+
+    // Repeated insertions into long text build a rope
+    String expected(std::string(1000, 'x'));
+    String rope = expected;
+    for (int i = 0; i < 100; ++i) {
+        const std::size_t at = (i * 37) % (rope.length() + 1);
+        rope = rope.insert(at, String(piece(i)));
+        // The same insertion, copying flat strings
+        expected = String(expected.substring(0, at).to_string() + piece(i) + expected.substring(at).to_string());
+    }
+    EXPECT_TRUE(isUnflattenedRope(rope));
+    EXPECT_EQ(rope.to_string(), expected.to_string());
+}
+
+TEST_F(StringRopeTest, InvalidUtf8AtTheBoundary) {
+    // A lead byte at the end of one part and continuation bytes at the start
+    // of the other decode as one character when joined
+    String left(std::string(600, 'a') + "\xE4");
+    String right(std::string("\xB8\x96") + std::string(600, 'b'));
+    EXPECT_EQ(left.length(), 601u);
+    EXPECT_EQ(right.length(), 602u);
+
+    String joined = left.concat(right);
+    EXPECT_EQ(joined.length(), 1201u);
+    EXPECT_EQ(joined.char_at(600), Char(u'\u4E16'));
+    EXPECT_EQ(joined.to_string(), left.to_string() + right.to_string());
+
+    // Invalid bytes followed by other characters decode the same way when joined
+    String invalid(std::string(600, 'a') + "\xE4");
+    String joined_invalid = invalid.concat(String(std::string(600, 'b')));
+    EXPECT_TRUE(isUnflattenedRope(joined_invalid));
+    EXPECT_EQ(joined_invalid.length(), 1201u);
+    EXPECT_EQ(joined_invalid.char_at(600), Char(u'\uFFFD'));
+}
+
+TEST_F(StringRopeTest, FlattenedRopesSupportAllOperations) {
+    String rope;
+    std::string expected;
+    for (int i = 0; i < 100; ++i) {
+        rope = rope.concat(String(piece(i)));
+        expected += piece(i);
+    }
+    String flat(expected);
+
+    EXPECT_EQ(rope.indexOf(String("piece 99")), flat.indexOf(String("piece 99")));
+    EXPECT_FALSE(isUnflattenedRope(rope));
+    EXPECT_EQ(rope.getBytes(Encoding::UTF_16LE), flat.getBytes(Encoding::UTF_16LE));
+    EXPECT_EQ(rope.char_at(1000), flat.char_at(1000));
+    EXPECT_EQ(rope.substring(100, 200).to_string(), flat.substring(100, 200).to_string());
+    EXPECT_EQ(rope.trim().to_string(), flat.trim().to_string());
+    EXPECT_EQ(rope.compare_to(flat), CompareResult::EQUAL);
+}
+
+TEST_F(StringRopeTest, ReleaseCachesKeepsTheFlattenedCopyOfViews) {
+    String rope;
+    for (int i = 0; i < 20; ++i) {
+        rope = rope.concat(String(piece(i)));
+    }
+    const std::string expected = rope.to_string();
+
+    {
+        // Views of a rope point into its flattened copy, and so do parts of them...
+        const StringView view(rope);
+        const StringView part = view.substring(10, 100);
+        const std::string part_text = part.to_string();
+        EXPECT_FALSE(isUnflattenedRope(rope));
+        EXPECT_EQ(view.view(), expected);
+
+        // ...which keep it alive, so release_caches() leaves it in place
+        EXPECT_LT(rope.release_caches(), expected.size());
+        EXPECT_FALSE(isUnflattenedRope(rope));
+        EXPECT_EQ(view.view(), expected);
+        EXPECT_EQ(part.view(), part_text);
+    }
+
+    // Once they are gone it is freed
+    EXPECT_GT(rope.release_caches(), expected.size());
+    EXPECT_TRUE(isUnflattenedRope(rope));
+    const StringView view(rope);
+    EXPECT_EQ(view.view(), expected);
+
+    // The copy of a rope shared with another string is kept
+    const String copy = rope;
+    EXPECT_EQ(rope.release_caches(), 0u);
+    EXPECT_FALSE(isUnflattenedRope(rope));
+}
+
+TEST_F(StringRopeTest, InsertBenchmark) {
+    const int INSERTS = 2000;
+    std::string base(1000000, 'x');
+    // ASCII pieces, so byte offsets and UTF-16 indices agree
+    auto ascii_piece = [](int i) { return "piece " + std::to_string(i) + " "; };
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string flat = base;
+    for (int i = 0; i < INSERTS; ++i) {
+        flat.insert((i * 7919) % flat.size(), ascii_piece(i));
+    }
+    auto flat_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now() - start);
+
+    start = std::chrono::high_resolution_clock::now();
+    String rope(base);
+    for (int i = 0; i < INSERTS; ++i) {
+        rope = rope.insert((i * 7919) % rope.length(), String(ascii_piece(i)));
+    }
+    auto rope_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now() - start);
+
+    std::cout << "\nInsert Benchmark (" << INSERTS << " inserts into 1000000 characters):\n"
+              << "  std::string::insert: " << flat_time.count() << " microseconds\n"
+              << "  String::insert (rope): " << rope_time.count() << " microseconds, depth "
+              << depth(rope) << "\n";
+
+    EXPECT_EQ(rope.to_string(), flat);
+}
+
+} // namespace simple
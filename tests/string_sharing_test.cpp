@@ -1,4 +1,5 @@
 #include "../include/string.hpp"
+#include "../include/string_view.hpp"
 #include <atomic>
 #include <gtest/gtest.h>
 #include <thread>
@@ -15,11 +16,21 @@ protected:
 	bool sharingData(const String &s1, const String &s2) {
 		return s1.shares_data_with(s2);
 	}
+
+	// Helper method to check if a string is stored inline
+	bool isInline(const String &s) { return s.is_inline(); }
+
+	// Helper method to check if a string is a rope that has not been flattened
+	bool isUnflattenedRope(const String &s) { return s.is_unflattened_rope(); }
+
+	// Content too long to be stored inline, so copies share a heap block
+	const char *hello = "Hello, this text is too long to be stored inline";
+	const char *world = "World, this text is too long to be stored inline";
 };
 
 TEST_F(StringSharing, CopyConstructorSharing) {
 	// Create original string
-	String original("Hello");
+	String original(hello);
 
 	// Create copy through copy constructor
 	String copy(original);
@@ -30,8 +41,8 @@ TEST_F(StringSharing, CopyConstructorSharing) {
 
 TEST_F(StringSharing, AssignmentSharing) {
 	// Create two strings
-	String str1("Hello");
-	String str2("World");
+	String str1(hello);
+	String str2(world);
 
 	// Assignment should share data
 	str2 = str1;
@@ -50,13 +61,16 @@ TEST_F(StringSharing, IndependentStrings) {
 }
 
 TEST_F(StringSharing, ThreadSafety) {
+#if defined(SSTRING_NONATOMIC_REFCOUNT)
+	GTEST_SKIP() << "Strings cannot be shared between threads with non-atomic reference counts";
+#endif
 	const int NUM_THREADS = 10;
 	const int ITERATIONS = 10000; // Increased for better stress testing
 	std::atomic<bool> failed{false};
 	std::vector<std::thread> threads;
 
 	// Create a shared string
-	String shared("Test String");
+	String shared("Test String, too long to be stored inline");
 
 	// Function to test string operations
 	auto test_func = [&]() {
@@ -94,9 +108,59 @@ TEST_F(StringSharing, ThreadSafety) {
 	EXPECT_FALSE(failed) << "Thread safety test failed";
 }
 
+#if defined(SSTRING_NONATOMIC_REFCOUNT) && !defined(NDEBUG)
+TEST_F(StringSharing, NonAtomicCountsStayOnTheirThread) {
+	String shared(hello);
+	// Copies on the creating thread are fine
+	String copy = shared;
+	EXPECT_TRUE(sharingData(copy, shared));
+
+	EXPECT_DEATH(
+		{
+			std::thread([&shared] { String other = shared; }).join();
+		},
+		"non-atomic reference counts");
+}
+#endif
+
+TEST_F(StringSharing, ConcurrentUtf16CacheInitialization) {
+	const int NUM_THREADS = 8;
+	const int ITERATIONS = 50;
+	std::atomic<bool> failed{false};
+
+	for (int round = 0; round < ITERATIONS && !failed; ++round) {
+		// A fresh shared string, so every round races on the first decode
+		const String shared("Shared 世界 🌍 constant used by all workers");
+		const String needle("🌍");
+		std::atomic<int> ready{0};
+		std::vector<std::thread> threads;
+
+		for (int t = 0; t < NUM_THREADS; ++t) {
+			threads.emplace_back([&]() {
+				// Start all threads at once to maximize contention
+				ready.fetch_add(1);
+				while (ready.load() < NUM_THREADS) {
+					std::this_thread::yield();
+				}
+				if (shared.char_at(7).value() != 0x4E16 ||
+					shared.indexOf(needle) != Index(10) ||
+					shared.length() != 41) {
+					failed = true;
+				}
+			});
+		}
+
+		for (auto &thread : threads) {
+			thread.join();
+		}
+	}
+
+	EXPECT_FALSE(failed) << "Concurrent UTF-16 decoding returned wrong results";
+}
+
 TEST_F(StringSharing, ImmutabilityMaintained) {
 	// Create a string
-	String str1("Hello");
+	String str1(hello);
 
 	// Create a copy that shares the same data
 	String str2 = str1;
@@ -112,15 +176,15 @@ TEST_F(StringSharing, ImmutabilityMaintained) {
 
 	// Data should still be shared and unchanged
 	EXPECT_TRUE(sharingData(str1, str2));
-	EXPECT_EQ(str1.to_string(), "Hello");
-	EXPECT_EQ(str2.to_string(), "Hello");
+	EXPECT_EQ(str1.to_string(), hello);
+	EXPECT_EQ(str2.to_string(), hello);
 }
 
 TEST_F(StringSharing, VectorCopies) {
 	std::vector<String> strings;
 
 	// Add original string
-	strings.push_back(String("Hello"));
+	strings.push_back(String(hello));
 
 	// Add copies through push_back
 	for (int i = 1; i < 5; ++i) {
@@ -167,8 +231,8 @@ TEST_F(StringSharing, EmptyStringSharing) {
 
 TEST_F(StringSharing, NullCharacterSharing) {
 	// Create strings with embedded null characters
-	std::string str1("hello\0world", 11);
-	std::string str2("hello\0world", 11);
+	std::string str1("hello, long enough\0world, long enough", 38);
+	std::string str2("hello, long enough\0world, long enough", 38);
 
 	String s1(str1);
 	String s2(str2);
@@ -181,8 +245,8 @@ TEST_F(StringSharing, NullCharacterSharing) {
 	EXPECT_TRUE(sharingData(s1, s3));
 
 	// Verify the entire content is shared, including after null
-	EXPECT_EQ(s1.to_string().length(), 11);
-	EXPECT_EQ(s3.to_string().length(), 11);
+	EXPECT_EQ(s1.to_string().length(), 38);
+	EXPECT_EQ(s3.to_string().length(), 38);
 	EXPECT_TRUE(std::equal(s1.to_string().begin(), s1.to_string().end(),
 						   s3.to_string().begin()));
 }
@@ -209,7 +273,7 @@ TEST_F(StringSharing, LongStringSharing) {
 
 TEST_F(StringSharing, UnicodeSharing) {
 	// Test with various Unicode sequences
-	const char *utf8_str = "Hello 世界 🌍"; // Mix of ASCII, CJK, and emoji
+	const char *utf8_str = "Hello 世界 🌍 Hello 世界 🌍"; // Mix of ASCII, CJK, and emoji
 	String original(utf8_str);
 	String copy = original;
 
@@ -221,7 +285,7 @@ TEST_F(StringSharing, UnicodeSharing) {
 	EXPECT_EQ(original.length(), copy.length());
 
 	// Test with combining characters (e + combining acute)
-	const char *combining = "e\xcc\x81"; // e + COMBINING ACUTE ACCENT (U+0301)
+	const char *combining = "e\xcc\x81" "e\xcc\x81" "e\xcc\x81" "e\xcc\x81" "e\xcc\x81" "e\xcc\x81" "e\xcc\x81" "e\xcc\x81"; // e + COMBINING ACUTE ACCENT (U+0301)
 	String combining1(combining);
 	String combining2 = combining1;
 
@@ -229,6 +293,198 @@ TEST_F(StringSharing, UnicodeSharing) {
 	EXPECT_EQ(combining1.length(), combining2.length());
 }
 
+TEST_F(StringSharing, SubstringSharesBlock) {
+	String original(std::string(64, 'x') + "tail");
+
+	// Substrings point into the block of the original string
+	String sub = original.substring(10, 60);
+	EXPECT_TRUE(sharingData(original, sub));
+
+	// Substrings of substrings still point into the same block
+	String subsub = sub.substring(2, 40);
+	EXPECT_TRUE(sharingData(original, subsub));
+	EXPECT_EQ(subsub.to_string(), std::string(38, 'x'));
+}
+
+TEST_F(StringSharing, SubstringOutlivesOriginal) {
+	String tail;
+	{
+		String original(std::string(64, 'x') + "tail");
+		tail = original.substring(64);
+	}
+
+	// The block stays alive as long as a substring refers to it
+	EXPECT_EQ(tail.to_string(), "tail");
+	EXPECT_EQ(tail.length(), 4);
+}
+
+TEST_F(StringSharing, SubstringToStringIsIndependent) {
+	// Substrings long enough to share the bytes of the original
+	String original("Hello, a world of words long enough to be shared");
+	String hello = original.substring(0, 32);
+	String world = original.substring(9, 41);
+
+	// Each substring materializes its own std::string
+	const std::string &hello_str = hello.to_string();
+	const std::string &world_str = world.to_string();
+	EXPECT_EQ(hello_str, "Hello, a world of words long eno");
+	EXPECT_EQ(world_str, "world of words long enough to be");
+	EXPECT_NE(&hello_str, &world_str);
+}
+
+TEST_F(StringSharing, ShortStringsAreInline) {
+	String empty;
+	String token("true");
+	String longer(hello);
+
+	EXPECT_TRUE(isInline(empty));
+	EXPECT_TRUE(isInline(token));
+	EXPECT_FALSE(isInline(longer));
+
+	// Copies of inline strings are independent values, not shared data
+	String copy = token;
+	EXPECT_TRUE(isInline(copy));
+	EXPECT_FALSE(sharingData(token, copy));
+	EXPECT_TRUE(copy.equals(token));
+	EXPECT_EQ(copy.to_string(), "true");
+}
+
+TEST_F(StringSharing, InlineCapacity) {
+	// The inline bytes share the storage of the block pointer
+	static_assert(sizeof(String) == String::INLINE_CAPACITY + 1);
+
+	const std::string full(String::INLINE_CAPACITY, 'x');
+	String fits(full);
+	String spills(full + "x");
+	EXPECT_TRUE(isInline(fits));
+	EXPECT_FALSE(isInline(spills));
+	EXPECT_EQ(fits.to_string(), full);
+	EXPECT_EQ(fits.length(), String::INLINE_CAPACITY);
+
+	// Moving and assigning switch between inline and heap storage
+	String moved(std::move(spills));
+	EXPECT_FALSE(isInline(moved));
+	EXPECT_TRUE(isInline(spills));
+	EXPECT_EQ(moved.to_string(), full + "x");
+	fits = moved;
+	EXPECT_TRUE(sharingData(fits, moved));
+	moved = String("short");
+	EXPECT_TRUE(isInline(moved));
+	EXPECT_EQ(moved.to_string(), "short");
+	EXPECT_EQ(fits.to_string(), full + "x");
+}
+
+TEST_F(StringSharing, InlineToStringLeavesStringInline) {
+	const String token("token");
+	const StringView view(token);
+	EXPECT_EQ(token.to_string(), "token");
+	// The string is not changed, so views of its inline bytes stay valid
+	EXPECT_TRUE(isInline(token));
+	EXPECT_EQ(view.view(), "token");
+	EXPECT_EQ(const_cast<String&>(token).release_caches(), 0u);
+}
+
+TEST_F(StringSharing, InlineToStringOnSharedConstants) {
+	static const String constant("constant");
+	std::atomic<int> mismatches{0};
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&mismatches] {
+			for (int i = 0; i < 1000; ++i) {
+				if (constant.to_string() != "constant" || !String::EMPTY.to_string().empty()) {
+					++mismatches;
+				}
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	EXPECT_EQ(mismatches.load(), 0);
+	EXPECT_TRUE(isInline(constant));
+}
+
+TEST_F(StringSharing, ShortSubstringsAreInline) {
+	String original(hello);
+
+	// Short slices are copied inline rather than pinning the original block
+	String word = original.substring(0, 5);
+	EXPECT_TRUE(isInline(word));
+	EXPECT_FALSE(sharingData(original, word));
+	EXPECT_EQ(word.to_string(), "Hello");
+}
+
+TEST_F(StringSharing, InlineStringOperations) {
+	String s("h\xC3\xA9llo \xF0\x9F\x8C\x8D");  // "héllo 🌍"
+	ASSERT_TRUE(isInline(s));
+
+	EXPECT_EQ(s.length(), 8);
+	EXPECT_EQ(s.char_at(1).value(), 0x00E9);
+	EXPECT_EQ(s.code_point_at(6).value(), 0x1F30D);
+	EXPECT_EQ(s.indexOf(String("llo")).value(), 2);
+	EXPECT_EQ(s.substring(0, 5).to_string(), "h\xC3\xA9llo");
+	EXPECT_TRUE(s.startsWith(String("h\xC3\xA9")));
+	EXPECT_EQ(s.getBytes(), std::vector<uint8_t>(s.to_string().begin(), s.to_string().end()));
+}
+
+TEST_F(StringSharing, CompactCopiesTheVisibleRange) {
+	std::string document;
+	for (int i = 0; i < 1000; ++i) {
+		document += "line " + std::to_string(i) + " 世界\n";
+	}
+	String original(document);
+	String token = original.substring(10, 40);
+	ASSERT_TRUE(sharingData(original, token));
+	EXPECT_EQ(token.visible_bytes(), token.to_string().size());
+	EXPECT_EQ(token.retained_bytes(), document.size());
+
+	String compacted = token.compact();
+	EXPECT_FALSE(sharingData(original, compacted));
+	EXPECT_TRUE(compacted.equals(token));
+	EXPECT_EQ(compacted.length(), 30u);
+	EXPECT_EQ(compacted.retained_bytes(), compacted.visible_bytes());
+
+	// A rope of slices is copied from its leaves without being flattened
+	String rope = original.substring(0, 400).concat(original.substring(5000, 5400));
+	ASSERT_TRUE(isUnflattenedRope(rope));
+	EXPECT_EQ(rope.retained_bytes(), 2 * document.size());
+	String compactedRope = rope.compact();
+	EXPECT_TRUE(isUnflattenedRope(rope));
+	EXPECT_FALSE(isUnflattenedRope(compactedRope));
+	EXPECT_EQ(compactedRope.retained_bytes(), compactedRope.visible_bytes());
+	EXPECT_EQ(compactedRope.length(), 800u);
+	EXPECT_TRUE(compactedRope.equals(rope));
+}
+
+TEST_F(StringSharing, CompactKeepsStringsThatOwnTheirBytes) {
+	String original(hello);
+	EXPECT_EQ(original.retained_bytes(), original.visible_bytes());
+	EXPECT_TRUE(sharingData(original.compact(), original));
+
+	String word("word");
+	EXPECT_EQ(word.retained_bytes(), 4u);
+	EXPECT_EQ(word.compact().to_string(), "word");
+}
+
+TEST_F(StringSharing, AutomaticCompaction) {
+	String original(std::string(1000, 'x') + hello);
+	EXPECT_EQ(String::compaction_threshold(), 0.0);
+
+	String::set_compaction_threshold(0.25);
+	String small = original.substring(900, 1030);   // 13% of the buffer
+	String large = original.substring(100, 1030);   // 89% of the buffer
+	String::set_compaction_threshold(0.0);
+
+	EXPECT_FALSE(sharingData(original, small));
+	EXPECT_EQ(small.retained_bytes(), 130u);
+	EXPECT_EQ(small.to_string(), std::string(100, 'x') + std::string(hello).substr(0, 30));
+	EXPECT_TRUE(sharingData(original, large));
+
+	EXPECT_TRUE(sharingData(original, original.substring(900, 1030)));
+	EXPECT_THROW(String::set_compaction_threshold(1.5), std::invalid_argument);
+	EXPECT_THROW(String::set_compaction_threshold(-0.1), std::invalid_argument);
+}
+
 TEST_F(StringSharing, LengthCalculationBenchmark) {
 	// Create strings with different characteristics
 	std::vector<String> testStrings = {
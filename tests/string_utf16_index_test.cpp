@@ -0,0 +1,275 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "../include/string.hpp"
+
+using namespace simple;
+
+class StringUtf16IndexTest : public ::testing::Test {
+protected:
+    // "a世🌍é" repeated: 10 bytes and 5 UTF-16 code units per repetition,
+    // so checkpoints fall on every kind of character, including between
+    // the halves of a surrogate pair
+    static constexpr std::size_t REPEAT = 1000;
+    static constexpr std::size_t UNITS = 5;
+    static constexpr char16_t PATTERN[UNITS] = {u'a', 0x4E16, 0xD83C, 0xDF0D, 0xE9};
+
+    StringUtf16IndexTest() {
+        std::string text;
+        for (std::size_t i = 0; i < REPEAT; ++i) {
+            text += "a世🌍é";
+        }
+        long_text = String(text + "xyz");
+    }
+
+    String long_text;
+};
+
+TEST_F(StringUtf16IndexTest, RandomAccessAcrossCheckpoints) {
+    ASSERT_EQ(long_text.length(), REPEAT * UNITS + 3);
+
+    // Walk backwards so lookups land on checkpoints built out of order
+    for (std::size_t i = REPEAT * UNITS; i-- > 0; ) {
+        ASSERT_EQ(long_text.char_at(i).value(), PATTERN[i % UNITS]) << "index " << i;
+    }
+    EXPECT_EQ(long_text.char_at(REPEAT * UNITS + 2).value(), u'z');
+    EXPECT_THROW(long_text.char_at(REPEAT * UNITS + 3), StringIndexOutOfBoundsException);
+}
+
+TEST_F(StringUtf16IndexTest, CodePointsAcrossCheckpoints) {
+    for (std::size_t i = 0; i < REPEAT; ++i) {
+        const std::size_t base = i * UNITS;
+        ASSERT_EQ(long_text.code_point_at(base + 2).value(), 0x1F30Du);
+        ASSERT_EQ(long_text.code_point_at(base + 3).value(), 0xDF0Du);
+        ASSERT_EQ(long_text.code_point_before(base + 4).value(), 0x1F30Du);
+    }
+    EXPECT_EQ(long_text.code_point_count(0, long_text.length()), REPEAT * 4 + 3);
+    // A range cutting surrogate pairs counts each half once
+    EXPECT_EQ(long_text.code_point_count(3, 8), 5u);
+}
+
+TEST_F(StringUtf16IndexTest, SubstringFarIntoString) {
+    const std::size_t base = 700 * UNITS;
+    EXPECT_EQ(long_text.substring(base, base + UNITS).to_string(), "a世🌍é");
+    EXPECT_EQ(long_text.substring(REPEAT * UNITS).to_string(), "xyz");
+
+    // An index between the halves of a surrogate pair rounds up to the end of the pair
+    EXPECT_EQ(long_text.substring(base, base + 3).to_string(), "a世🌍");
+    EXPECT_EQ(long_text.substring(base + 3, base + UNITS).to_string(), "é");
+}
+
+TEST_F(StringUtf16IndexTest, SearchFarIntoString) {
+    const std::size_t end = REPEAT * UNITS;
+    EXPECT_EQ(long_text.indexOf(Char(u'x')), Index(end));
+    EXPECT_EQ(long_text.indexOf(String("🌍x")), Index::invalid);
+    EXPECT_EQ(long_text.indexOf(String("éx")), Index(end - 1));
+    EXPECT_EQ(long_text.indexOf(String("🌍"), Index(600 * UNITS + 1)), Index(600 * UNITS + 2));
+    EXPECT_EQ(long_text.indexOf(Char(u'\xDF0D'), Index(600 * UNITS)), Index(600 * UNITS + 3));
+    EXPECT_EQ(long_text.lastIndexOf(Char(u'世')), Index(end - 4));
+    EXPECT_EQ(long_text.lastIndexOf(String("a世"), Index(600 * UNITS)), Index(600 * UNITS));
+    EXPECT_TRUE(long_text.startsWith(String("🌍éa"), Index(600 * UNITS + 2)));
+    EXPECT_FALSE(long_text.startsWith(String("é"), Index(600 * UNITS + 3)));
+    EXPECT_TRUE(long_text.endsWith(String("éxyz")));
+}
+
+TEST_F(StringUtf16IndexTest, InvalidBytesAreOneCodeUnitEach) {
+    // Overlong sequence followed by ASCII
+    String overlong(std::string("\xC0\x80") + "abc");
+    EXPECT_EQ(overlong.length(), 5u);
+    EXPECT_EQ(overlong.char_at(1).value(), 0xFFFD);
+    EXPECT_EQ(overlong.char_at(2).value(), u'a');
+    EXPECT_EQ(overlong.substring(2).to_string(), "abc");
+    EXPECT_EQ(overlong.indexOf(Char(u'a')), Index(2));
+    EXPECT_EQ(overlong.indexOf(Char(u'\xFFFD'), Index(1)), Index(1));
+
+    // Stray continuation bytes in a long string
+    std::string text(100, 'x');
+    text += "\x80\x80" "世";
+    String stray(text);
+    EXPECT_EQ(stray.length(), 103u);
+    EXPECT_EQ(stray.char_at(101).value(), 0xFFFD);
+    EXPECT_EQ(stray.char_at(102).value(), 0x4E16);
+    EXPECT_EQ(stray.indexOf(String("世")), Index(102));
+    EXPECT_EQ(stray.substring(101).to_string(), "\x80" "世");
+}
+
+TEST_F(StringUtf16IndexTest, ConcurrentLookups) {
+    const String shared = long_text;
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4, 0);
+    for (std::size_t t = 0; t < failures.size(); ++t) {
+        threads.emplace_back([&shared, &failures, t] {
+            // Each thread starts at a different end of the string
+            for (std::size_t step = 0; step < REPEAT * UNITS; step += 7) {
+                const std::size_t i = (t % 2 == 0) ? step : REPEAT * UNITS - 1 - step;
+                if (shared.char_at(i).value() != PATTERN[i % UNITS]) {
+                    ++failures[t];
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int count : failures) {
+        EXPECT_EQ(count, 0);
+    }
+}
+
+TEST_F(StringUtf16IndexTest, AsciiStringsIndexBytesDirectly) {
+    std::string text;
+    for (int i = 0; i < 200; ++i) {
+        text += "abcde";
+    }
+    String ascii(text + "!");
+    EXPECT_EQ(ascii.length(), 1001u);
+    EXPECT_EQ(ascii.char_at(997).value(), u'c');
+    EXPECT_EQ(ascii.substring(995, 1001).to_string(), "abcde!");
+    EXPECT_EQ(ascii.indexOf(Char(u'!')), Index(1000));
+    EXPECT_EQ(ascii.lastIndexOf(String("ab"), Index(999)), Index(995));
+    EXPECT_EQ(ascii.code_point_count(10, 20), 10u);
+    EXPECT_THROW(ascii.substring(0, 1002), StringIndexOutOfBoundsException);
+}
+
+TEST_F(StringUtf16IndexTest, AsciiSubstringOfUnicodeString) {
+    // The substring shares the bytes of a non-ASCII string but is ASCII itself
+    String text(std::string("世界") + std::string(100, 'x') + "end");
+    String tail = text.substring(2);
+    EXPECT_EQ(tail.length(), 103u);
+    EXPECT_EQ(tail.char_at(100).value(), u'e');
+    EXPECT_EQ(tail.indexOf(String("end")), Index(100));
+    EXPECT_EQ(tail.substring(100).to_string(), "end");
+}
+
+TEST_F(StringUtf16IndexTest, CodePointCountWithoutSurrogatePairs) {
+    std::string text;
+    for (int i = 0; i < 100; ++i) {
+        text += "世界é";
+    }
+    String bmp(text);
+    EXPECT_EQ(bmp.code_point_count(0, bmp.length()), 300u);
+    EXPECT_EQ(bmp.code_point_count(7, 7), 0u);
+    EXPECT_THROW(bmp.code_point_count(0, 301), StringIndexOutOfBoundsException);
+}
+
+TEST_F(StringUtf16IndexTest, CountsCarryOverToSubstrings) {
+    const std::size_t total = REPEAT * UNITS + 3;
+    EXPECT_EQ(long_text.length(), total);
+    EXPECT_EQ(long_text.code_point_count(0, total), REPEAT * 4 + 3);
+    // Repeated calls return the memoized counts
+    EXPECT_EQ(long_text.length(), total);
+    EXPECT_EQ(long_text.code_point_count(0, total), REPEAT * 4 + 3);
+
+    String middle = long_text.substring(UNITS, REPEAT * UNITS);
+    EXPECT_EQ(middle.length(), (REPEAT - 1) * UNITS);
+    EXPECT_EQ(middle.code_point_count(0, middle.length()), (REPEAT - 1) * 4);
+
+    // Rounding up from the middle of a surrogate pair shortens the substring
+    String from_pair = long_text.substring(3);
+    EXPECT_EQ(from_pair.length(), total - 4);
+    EXPECT_EQ(from_pair.char_at(0).value(), 0xE9);
+
+    String padded(std::string("  ") + long_text.to_string() + "\t\n");
+    EXPECT_EQ(padded.length(), total + 4);
+    EXPECT_EQ(padded.trim().length(), total);
+    EXPECT_TRUE(padded.trim().equals(long_text));
+}
+
+TEST_F(StringUtf16IndexTest, PrewarmBuildsTheWholeIndex) {
+    EXPECT_FALSE(long_text.memory_usage().utf16_index);
+    long_text.prewarm_utf16();
+    const String::MemoryUsage usage = long_text.memory_usage();
+    EXPECT_TRUE(usage.utf16_index);
+    // One checkpoint per 64 code units, up to the end
+    EXPECT_GE(usage.cache_bytes, (REPEAT * UNITS / 64) * 2 * sizeof(std::size_t));
+
+    // Lookups anywhere add nothing
+    long_text.char_at(REPEAT * UNITS - 1);
+    EXPECT_EQ(long_text.memory_usage().cache_bytes, usage.cache_bytes);
+
+    // ASCII strings need no index
+    String ascii(std::string(1000, 'a'));
+    ascii.prewarm_utf16();
+    EXPECT_FALSE(ascii.memory_usage().utf16_index);
+}
+
+TEST_F(StringUtf16IndexTest, LookupsPastTheLastCheckpoint) {
+    // A complete index answers lookups between its last checkpoint and the
+    // end from the checkpoints alone
+    long_text.prewarm_utf16();
+    const std::size_t length = REPEAT * UNITS + 3;
+    for (std::size_t i = length - 70; i < REPEAT * UNITS; ++i) {
+        EXPECT_EQ(long_text.char_at(i).value(), PATTERN[i % UNITS]) << i;
+    }
+    EXPECT_EQ(long_text.char_at(length - 1).value(), u'z');
+    EXPECT_EQ(long_text.indexOf(String("xyz")).value(), REPEAT * UNITS);
+    EXPECT_EQ(long_text.substring(length - 4).to_string(), "\xC3\xA9xyz");
+    EXPECT_THROW(long_text.char_at(length), StringIndexOutOfBoundsException);
+}
+
+TEST_F(StringUtf16IndexTest, ReleaseCaches) {
+    // A substring has both an index and a std::string copy for to_string(),
+    // and the buffer it no longer shares has the index used by substring()
+    String part = long_text.substring(1);
+    long_text = String();
+    part.char_at(REPEAT * UNITS - 2);
+    part.to_string();
+    const std::size_t cache_bytes = part.memory_usage().cache_bytes;
+    EXPECT_GT(cache_bytes, REPEAT * 10);
+
+    const String::MemoryStats before = String::memory_stats();
+    EXPECT_EQ(part.release_caches(), cache_bytes);
+    const String::MemoryStats after = String::memory_stats();
+    EXPECT_EQ(after.live_caches, before.live_caches - 3);
+    EXPECT_EQ(after.cache_bytes, before.cache_bytes - cache_bytes);
+    EXPECT_EQ(part.memory_usage().cache_bytes, 0u);
+    EXPECT_FALSE(part.memory_usage().utf16_index);
+
+    // The caches are rebuilt on demand
+    EXPECT_EQ(part.char_at(REPEAT * UNITS - 2).value(), PATTERN[UNITS - 1]);
+    EXPECT_TRUE(part.memory_usage().utf16_index);
+
+    // Caches of a shared block are kept
+    String copy = part;
+    EXPECT_EQ(copy.release_caches(), 0u);
+    EXPECT_TRUE(part.memory_usage().utf16_index);
+}
+
+TEST_F(StringUtf16IndexTest, NeverCachePolicy) {
+    String copy = long_text;
+    long_text.set_utf16_cache_policy(String::Utf16CachePolicy::NEVER);
+    for (std::size_t i = 0; i < REPEAT * UNITS; i += 997) {
+        ASSERT_EQ(long_text.char_at(i).value(), PATTERN[i % UNITS]) << "index " << i;
+    }
+    EXPECT_EQ(long_text.substring(REPEAT * UNITS).to_string(), "xyz");
+    EXPECT_EQ(long_text.indexOf(String("xyz")), Index(REPEAT * UNITS));
+    EXPECT_FALSE(long_text.memory_usage().utf16_index);
+    long_text.prewarm_utf16();
+    EXPECT_FALSE(long_text.memory_usage().utf16_index);
+
+    // Substrings inherit the policy; copies made before keep the default
+    String part = long_text.substring(100);
+    part.char_at(1000);
+    EXPECT_FALSE(part.memory_usage().utf16_index);
+    copy.char_at(1000);
+    EXPECT_TRUE(copy.memory_usage().utf16_index);
+    EXPECT_TRUE(copy.equals(long_text));
+}
+
+TEST_F(StringUtf16IndexTest, DefaultCachePolicy) {
+    EXPECT_EQ(String::default_utf16_cache_policy(), String::Utf16CachePolicy::CACHE);
+    String::set_default_utf16_cache_policy(String::Utf16CachePolicy::NEVER);
+    long_text.char_at(1000);
+    EXPECT_FALSE(long_text.memory_usage().utf16_index);
+
+    // A policy of its own overrides the default
+    String cached = long_text.substring(0);
+    cached.set_utf16_cache_policy(String::Utf16CachePolicy::CACHE);
+    cached.char_at(1000);
+    EXPECT_TRUE(cached.memory_usage().utf16_index);
+
+    String::set_default_utf16_cache_policy(String::Utf16CachePolicy::CACHE);
+    long_text.char_at(1000);
+    EXPECT_TRUE(long_text.memory_usage().utf16_index);
+}
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "../include/string.hpp"
+#include "../include/string_view.hpp"
+
+using namespace simple;
+
+class StringViewTest : public ::testing::Test {
+protected:
+    // Texts covering ASCII, BMP, surrogate pairs, whitespace and invalid bytes
+    const std::vector<std::string> texts = {
+        "",
+        "plain ascii text",
+        "  \t padded ascii \n ",
+        "Hello, 世界! 🌍 and 🌎",
+        " 　 unicode spaces  ",
+        std::string("bad \xC0\x80 bytes \x80 here"),
+        "🌍🌎🌏",
+        "‍ joiner at the start  ",
+    };
+};
+
+TEST_F(StringViewTest, QueriesMatchString) {
+    for (const auto& text : texts) {
+        const String str(text);
+        for (const StringView& view : {StringView(str), StringView(text)}) {
+            SCOPED_TRACE(text);
+            ASSERT_EQ(view.length(), str.length());
+            for (std::size_t i = 0; i < str.length(); ++i) {
+                EXPECT_EQ(view.char_at(i).value(), str.char_at(i).value());
+                EXPECT_EQ(view.code_point_at(i).value(), str.code_point_at(i).value());
+                EXPECT_EQ(view.code_point_before(i + 1).value(), str.code_point_before(i + 1).value());
+                EXPECT_EQ(view.code_point_count(i, str.length()), str.code_point_count(i, str.length()));
+                EXPECT_EQ(view.substring(i).to_string(), str.substring(i).to_string());
+                EXPECT_EQ(view.substring(0, i).to_string(), str.substring(0, i).to_string());
+                EXPECT_EQ(view.substring(i).length(), str.substring(i).length());
+            }
+            for (const char* needle : {"a", "世", "🌍", "\xC0", " ", "and 🌎", ""}) {
+                EXPECT_EQ(view.indexOf(StringView(needle)), str.indexOf(String(needle))) << needle;
+                EXPECT_EQ(view.lastIndexOf(StringView(needle)), str.lastIndexOf(String(needle))) << needle;
+                EXPECT_EQ(view.indexOf(needle, Index(3)), str.indexOf(String(needle), Index(3))) << needle;
+                EXPECT_EQ(view.contains(needle), str.contains(String(needle))) << needle;
+                EXPECT_EQ(view.startsWith(needle), str.startsWith(String(needle))) << needle;
+                EXPECT_EQ(view.endsWith(needle), str.endsWith(String(needle))) << needle;
+            }
+            for (char16_t ch : {u'a', u' ', u'世', char16_t(0xD83C), char16_t(0xFFFD)}) {
+                EXPECT_EQ(view.indexOf(Char(ch)), str.indexOf(Char(ch)));
+                EXPECT_EQ(view.lastIndexOf(Char(ch)), str.lastIndexOf(Char(ch)));
+            }
+            EXPECT_EQ(view.trim().to_string(), str.trim().to_string());
+            EXPECT_EQ(view.strip().to_string(), str.strip().to_string());
+            EXPECT_EQ(view.stripLeading().to_string(), str.stripLeading().to_string());
+            EXPECT_EQ(view.stripTrailing().to_string(), str.stripTrailing().to_string());
+            EXPECT_EQ(view.isStripped(), str.isStripped());
+            EXPECT_EQ(view.hash_code(), str.hash_code());
+        }
+    }
+}
+
+TEST_F(StringViewTest, WalksMatchString) {
+    // Lookups scan on from the previous one, so walk each way and jump around
+    for (const auto& text : texts) {
+        const String str(text);
+        const StringView view(text);
+        SCOPED_TRACE(text);
+        for (std::size_t i = str.length(); i > 0; --i) {
+            EXPECT_EQ(view.char_at(i - 1).value(), str.char_at(i - 1).value());
+            EXPECT_EQ(view.code_point_before(i).value(), str.code_point_before(i).value());
+        }
+        for (std::size_t i = 0; i < str.length(); ++i) {
+            const std::size_t j = (i * 7) % str.length();
+            EXPECT_EQ(view.code_point_at(j).value(), str.code_point_at(j).value());
+            EXPECT_EQ(view.indexOf(Char(u' '), Index(j)), str.indexOf(Char(u' '), Index(j)));
+        }
+    }
+}
+
+TEST_F(StringViewTest, ErrorsMatchString) {
+    const String str("a世🌍");
+    const StringView view = str;
+    EXPECT_THROW(view.char_at(4), StringIndexOutOfBoundsException);
+    EXPECT_THROW(view.code_point_before(0), StringIndexOutOfBoundsException);
+    EXPECT_THROW(view.substring(5), StringIndexOutOfBoundsException);
+    EXPECT_THROW(view.substring(2, 1), StringIndexOutOfBoundsException);
+    EXPECT_THROW(view.code_point_count(0, 5), StringIndexOutOfBoundsException);
+    EXPECT_THROW(view.startsWith("a", Index(5)), StringIndexOutOfBoundsException);
+}
+
+TEST_F(StringViewTest, ViewsDoNotCopy) {
+    const String str("A text long enough to be stored on the heap: 世界 🌍");
+    const StringView view = str;
+    EXPECT_EQ(view.length(), str.length());
+
+    // Parts of a view point into the same bytes
+    const StringView word = view.substring(2, 6);
+    EXPECT_EQ(word.view().data(), view.view().data() + 2);
+    EXPECT_EQ(word, StringView("text"));
+
+    const std::string text = "  key = value  ";
+    const StringView line(text);
+    const StringView key = line.substring(0, line.indexOf(Char(u'=')).value()).trim();
+    EXPECT_EQ(key.view().data(), text.data() + 2);
+    EXPECT_EQ(key.to_string(), "key");
+}
+
+TEST_F(StringViewTest, BytesAreScannedOnFirstUse) {
+    // Creating a view does not read the bytes
+    std::string text(1000, 'a');
+    const StringView ascii(text);
+    text[10] = '\xC3';
+    text[11] = '\xA9';
+    EXPECT_EQ(ascii.length(), 999u);
+
+    // The character classes and the UTF-16 length are found by the first query
+    // that needs them: rewriting the bytes afterwards does not change them, so
+    // later queries do not rescan
+    std::string plain(1000, 'a');
+    const StringView view(plain);
+    EXPECT_EQ(view.length(), 1000u);
+    plain[10] = '\xC3';
+    plain[11] = '\xA9';
+    EXPECT_EQ(view.length(), 1000u);
+    EXPECT_EQ(view.char_at(12).value(), u'a');
+    EXPECT_EQ(view.indexOf(Char(u'a'), Index(999)), Index(999));
+
+    // Copies and parts of a view take what it has found over
+    const StringView copy = view;
+    EXPECT_EQ(copy.length(), 1000u);
+    EXPECT_EQ(view.substring(500).length(), 500u);
+}
+
+TEST_F(StringViewTest, ConversionToString) {
+    const StringView view("owned text long enough to be stored on the heap");
+    const String owned = String::fromStringView(view.substring(6));
+    EXPECT_EQ(owned.to_string(), "text long enough to be stored on the heap");
+    EXPECT_TRUE(StringView(owned).equals(view.substring(6)));
+}
+
+TEST_F(StringViewTest, Comparison) {
+    EXPECT_EQ(StringView("abc"), StringView(String("abc")));
+    EXPECT_NE(StringView("abc"), StringView("abd"));
+    EXPECT_LT(StringView("abc"), StringView("abd"));
+    EXPECT_EQ(StringView("b").compare_to("a"), CompareResult::GREATER);
+    EXPECT_TRUE(StringView().is_empty());
+    EXPECT_EQ(StringView().length(), 0u);
+    EXPECT_EQ(StringView(std::string("a\0b", 3)).length(), 3u);
+}
@@ -0,0 +1,714 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/transcode.hpp"
+
+using namespace simple;
+using detail::SimdLevel;
+
+namespace {
+
+const std::size_t npos = std::string_view::npos;
+
+const char* level_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SCALAR: return "scalar";
+        case SimdLevel::SSE42: return "SSE4.2";
+        case SimdLevel::AVX2: return "AVX2";
+        case SimdLevel::AVX512: return "AVX-512";
+    }
+    return "?";
+}
+
+// The levels this CPU can run
+std::vector<SimdLevel> supported_levels() {
+    std::vector<SimdLevel> levels;
+    for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE42, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (detail::simd_supported(level)) {
+            levels.push_back(level);
+        }
+    }
+    return levels;
+}
+
+// The first byte that decodes to U+FFFD on its own, one group at a time
+std::size_t reference_invalid(const std::string& text) {
+    const unsigned char* begin = reinterpret_cast<const unsigned char*>(text.data());
+    const unsigned char* end = begin + text.size();
+    for (const unsigned char* str = begin; str < end; ) {
+        const detail::Utf16Group group = detail::decode_group(str, end);
+        if (group.bytes == 1 && *str >= 0x80) {
+            return static_cast<std::size_t>(str - begin);
+        }
+        str += group.bytes;
+    }
+    return npos;
+}
+
+// UTF-16 of UTF-8 one group at a time
+std::u16string reference_utf16(const std::string& text) {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(text.data());
+    const unsigned char* end = str + text.size();
+    std::u16string units;
+    units.reserve(text.size());
+    while (str < end) {
+        const detail::Utf16Group group = detail::decode_group(str, end);
+        units.push_back(group.unit[0]);
+        if (group.units == 2) {
+            units.push_back(group.unit[1]);
+        }
+        str += group.bytes;
+    }
+    return units;
+}
+
+std::u16string utf16_of(const std::string& text, SimdLevel level) {
+    std::u16string units(text.size(), u'\0');
+    units.resize(detail::utf8_to_utf16(text.data(), text.size(), units.data(), level));
+    return units;
+}
+
+void expect_all_levels(const std::string& text, std::size_t expected) {
+    for (SimdLevel level : supported_levels()) {
+        EXPECT_EQ(detail::validate_utf8(text.data(), text.size(), level), expected)
+            << level_name(level) << ", " << text.size() << " bytes";
+    }
+}
+
+void expect_utf16_all_levels(const std::string& text) {
+    const std::u16string expected = reference_utf16(text);
+    for (SimdLevel level : supported_levels()) {
+        EXPECT_TRUE(utf16_of(text, level) == expected) << level_name(level) << ", " << text.size() << " bytes";
+    }
+}
+
+void expect_counts_all_levels(const std::string& text) {
+    const std::u16string units = reference_utf16(text);
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(text.data());
+    const unsigned char* end = str + text.size();
+    std::size_t code_points = 0;
+    for (; str < end; ++code_points) {
+        str += detail::decode_group(str, end).bytes;
+    }
+    for (SimdLevel level : supported_levels()) {
+        const detail::Utf16Counts counts = detail::count_utf16(text.data(), text.size(), level);
+        EXPECT_EQ(counts.units, units.size()) << level_name(level) << ", " << text.size() << " bytes";
+        EXPECT_EQ(counts.code_points, code_points) << level_name(level) << ", " << text.size() << " bytes";
+    }
+}
+
+// UTF-32 of the valid groups of UTF-8, skipping invalid bytes, in a byte order
+std::u32string reference_utf32(const std::string& text, detail::ByteOrder order) {
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(text.data());
+    const unsigned char* end = str + text.size();
+    std::u32string code_points;
+    while (str < end) {
+        const detail::Utf16Group group = detail::decode_group(str, end);
+        if (group.bytes > 1 || *str < 0x80) {
+            char32_t value = group.unit[0];
+            if (group.units == 2) {
+                value = 0x10000 + ((value - 0xD800) << 10) + (group.unit[1] - 0xDC00);
+            }
+            code_points.push_back(value);
+        }
+        str += group.bytes;
+    }
+    if (order == detail::ByteOrder::BIG) {
+        for (char32_t& value : code_points) {
+            value = (value << 24) | ((value & 0xFF00) << 8) | ((value >> 8) & 0xFF00) | (value >> 24);
+        }
+    }
+    return code_points;
+}
+
+// The same as UTF-16
+std::u16string reference_utf16_skipping(const std::string& text, detail::ByteOrder order) {
+    std::u16string units;
+    for (char32_t value : reference_utf32(text, detail::ByteOrder::LITTLE)) {
+        if (value >= 0x10000) {
+            units.push_back(static_cast<char16_t>(0xD800 + ((value - 0x10000) >> 10)));
+            units.push_back(static_cast<char16_t>(0xDC00 + (value & 0x3FF)));
+        } else {
+            units.push_back(static_cast<char16_t>(value));
+        }
+    }
+    if (order == detail::ByteOrder::BIG) {
+        for (char16_t& unit : units) {
+            unit = static_cast<char16_t>((unit << 8) | (unit >> 8));
+        }
+    }
+    return units;
+}
+
+void expect_encoded_all_levels(const std::string& text) {
+    for (detail::ByteOrder order : {detail::ByteOrder::LITTLE, detail::ByteOrder::BIG}) {
+        const std::u16string expected16 = reference_utf16_skipping(text, order);
+        const std::u32string expected32 = reference_utf32(text, order);
+        for (SimdLevel level : supported_levels()) {
+            std::u16string units(expected16.size() + detail::ENCODE_UTF16_SLACK, u'\0');
+            units.resize(detail::encode_utf16(text.data(), text.size(), order, units.data(), level));
+            EXPECT_TRUE(units == expected16) << level_name(level) << ", " << text.size() << " bytes";
+            std::u32string code_points(expected32.size(), U'\0');
+            code_points.resize(detail::encode_utf32(text.data(), text.size(), order, code_points.data(), level));
+            EXPECT_TRUE(code_points == expected32) << level_name(level) << ", " << text.size() << " bytes";
+            // The sizes are known before encoding
+            const detail::Utf16Counts counts = detail::count_encoded_utf16(text.data(), text.size(), level);
+            EXPECT_EQ(counts.units, expected16.size()) << level_name(level) << ", " << text.size() << " bytes";
+            EXPECT_EQ(counts.code_points, expected32.size()) << level_name(level) << ", " << text.size() << " bytes";
+        }
+    }
+}
+
+// Valid sequences of every length, and sequences that are invalid on their own
+const std::vector<std::string> valid_pieces = {
+    "a", "text ", "\xC2\xA9", "\xDF\xBF", "\xE0\xA0\x80", "\xE4\xB8\x96", "\xED\x9F\xBF", "\xEF\xBF\xBD",
+    "\xF0\x90\x80\x80", "\xF0\x9F\x8C\x8D", "\xF4\x8F\xBF\xBF",
+};
+const std::vector<std::string> invalid_pieces = {
+    "\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xC2", "\xE0\x80\x80", "\xE0\x9F\xBF", "\xE4\xB8", "\xED\xA0\x80",
+    "\xED\xBF\xBF", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF", "\xF0\x9F\x8C", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80",
+    "\xF8", "\xFF", "\xC2\xA9\xA9",
+};
+
+std::string random_text(std::mt19937& rng, std::size_t pieces, int invalid_percent) {
+    std::string text;
+    for (std::size_t i = 0; i < pieces; ++i) {
+        if (static_cast<int>(rng() % 100) < invalid_percent) {
+            text += invalid_pieces[rng() % invalid_pieces.size()];
+        } else {
+            text += valid_pieces[rng() % valid_pieces.size()];
+        }
+    }
+    return text;
+}
+
+// UTF-8 of a code point
+void append_utf8(std::string& out, char32_t value) {
+    if (value < 0x80) {
+        out += static_cast<char>(value);
+    } else if (value < 0x800) {
+        out += static_cast<char>(0xC0 | (value >> 6));
+        out += static_cast<char>(0x80 | (value & 0x3F));
+    } else if (value < 0x10000) {
+        out += static_cast<char>(0xE0 | (value >> 12));
+        out += static_cast<char>(0x80 | ((value >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (value & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (value >> 18));
+        out += static_cast<char>(0x80 | ((value >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((value >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (value & 0x3F));
+    }
+}
+
+// Code units or code points as bytes in a byte order
+template <typename Unit>
+std::string bytes_of(const std::vector<Unit>& units, detail::ByteOrder order) {
+    std::string bytes;
+    for (Unit unit : units) {
+        for (std::size_t i = 0; i < sizeof(Unit); ++i) {
+            const std::size_t shift = order == detail::ByteOrder::BIG ? 8 * (sizeof(Unit) - 1 - i) : 8 * i;
+            bytes += static_cast<char>((static_cast<std::uint32_t>(unit) >> shift) & 0xFF);
+        }
+    }
+    return bytes;
+}
+
+// UTF-8 with each invalid code unit as U+FFFD or nothing, and the first invalid one
+struct ReferenceDecoding {
+    std::string utf8;
+    std::size_t invalid = npos;
+};
+
+ReferenceDecoding reference_utf16_decoding(const std::vector<char16_t>& units, bool replace) {
+    ReferenceDecoding result;
+    for (std::size_t i = 0; i < units.size(); ++i) {
+        char32_t value = units[i];
+        if (value >= 0xD800 && value <= 0xDFFF) {
+            if (value <= 0xDBFF && i + 1 < units.size() && units[i + 1] >= 0xDC00 && units[i + 1] <= 0xDFFF) {
+                value = 0x10000 + ((value - 0xD800) << 10) + (units[++i] - 0xDC00);
+            } else {
+                result.invalid = std::min(result.invalid, i);
+                if (replace) {
+                    append_utf8(result.utf8, 0xFFFD);
+                }
+                continue;
+            }
+        }
+        append_utf8(result.utf8, value);
+    }
+    return result;
+}
+
+ReferenceDecoding reference_utf32_decoding(const std::vector<char32_t>& code_points, bool replace) {
+    ReferenceDecoding result;
+    for (std::size_t i = 0; i < code_points.size(); ++i) {
+        if (code_points[i] > 0x10FFFF || (code_points[i] >= 0xD800 && code_points[i] <= 0xDFFF)) {
+            result.invalid = std::min(result.invalid, i);
+            if (replace) {
+                append_utf8(result.utf8, 0xFFFD);
+            }
+        } else {
+            append_utf8(result.utf8, code_points[i]);
+        }
+    }
+    return result;
+}
+
+void expect_utf16_decoded_all_levels(const std::vector<char16_t>& units) {
+    for (detail::ByteOrder order : {detail::ByteOrder::LITTLE, detail::ByteOrder::BIG}) {
+        const std::string bytes = bytes_of(units, order);
+        for (bool replace : {true, false}) {
+            const ReferenceDecoding expected = reference_utf16_decoding(units, replace);
+            for (SimdLevel level : supported_levels()) {
+                const detail::DecodedLength length = detail::decoded_length_utf16(bytes.data(), units.size(), order,
+                                                                                  replace, level);
+                EXPECT_EQ(length.bytes, expected.utf8.size()) << level_name(level) << ", " << units.size() << " units";
+                EXPECT_EQ(length.invalid, expected.invalid) << level_name(level) << ", " << units.size() << " units";
+                std::string utf8(length.bytes, '\0');
+                utf8.resize(detail::decode_utf16(bytes.data(), units.size(), order, replace, utf8.data(), level));
+                EXPECT_EQ(utf8, expected.utf8) << level_name(level) << ", " << units.size() << " units";
+            }
+        }
+    }
+}
+
+void expect_utf32_decoded_all_levels(const std::vector<char32_t>& code_points) {
+    for (detail::ByteOrder order : {detail::ByteOrder::LITTLE, detail::ByteOrder::BIG}) {
+        const std::string bytes = bytes_of(code_points, order);
+        for (bool replace : {true, false}) {
+            const ReferenceDecoding expected = reference_utf32_decoding(code_points, replace);
+            for (SimdLevel level : supported_levels()) {
+                const detail::DecodedLength length = detail::decoded_length_utf32(bytes.data(), code_points.size(),
+                                                                                  order, replace, level);
+                EXPECT_EQ(length.bytes, expected.utf8.size()) << level_name(level) << ", " << code_points.size();
+                EXPECT_EQ(length.invalid, expected.invalid) << level_name(level) << ", " << code_points.size();
+                std::string utf8(length.bytes, '\0');
+                utf8.resize(detail::decode_utf32(bytes.data(), code_points.size(), order, replace, utf8.data(),
+                                                 level));
+                EXPECT_EQ(utf8, expected.utf8) << level_name(level) << ", " << code_points.size();
+            }
+        }
+    }
+}
+
+// Code units of every UTF-8 length, surrogate pairs, and unpaired surrogates
+std::vector<char16_t> random_utf16(std::mt19937& rng, std::size_t pieces, int invalid_percent) {
+    static const std::vector<std::vector<char16_t>> valid = {
+        {u'a'}, {u' '}, {0x7F}, {0x80}, {0xE9}, {0x7FF}, {0x800}, {0x4E16}, {0xD7FF}, {0xE000}, {0xFFFD}, {0xFFFF},
+        {0xD800, 0xDC00}, {0xD83C, 0xDF0D}, {0xDBFF, 0xDFFF},
+    };
+    static const std::vector<std::vector<char16_t>> invalid = {{0xD800}, {0xDBFF}, {0xDC00}, {0xDFFF}};
+    std::vector<char16_t> units;
+    for (std::size_t i = 0; i < pieces; ++i) {
+        const auto& piece = static_cast<int>(rng() % 100) < invalid_percent ? invalid[rng() % invalid.size()]
+                                                                             : valid[rng() % valid.size()];
+        units.insert(units.end(), piece.begin(), piece.end());
+    }
+    return units;
+}
+
+std::vector<char32_t> random_utf32(std::mt19937& rng, std::size_t count, int invalid_percent) {
+    static const std::vector<char32_t> valid = {U'a', 0x7F, 0x80, 0xE9, 0x7FF, 0x800, 0x4E16, 0xD7FF, 0xE000,
+                                                0xFFFF, 0x10000, 0x1F30D, 0x10FFFF};
+    static const std::vector<char32_t> invalid = {0xD800, 0xDFFF, 0x110000, 0x7FFFFFFF, 0xFFFFFFFF};
+    std::vector<char32_t> code_points;
+    for (std::size_t i = 0; i < count; ++i) {
+        code_points.push_back(static_cast<int>(rng() % 100) < invalid_percent ? invalid[rng() % invalid.size()]
+                                                                              : valid[rng() % valid.size()]);
+    }
+    return code_points;
+}
+
+} // namespace
+
+TEST(TranscodeTest, ScalarIsAlwaysSupported) {
+    EXPECT_TRUE(detail::simd_supported(SimdLevel::SCALAR));
+    EXPECT_TRUE(detail::simd_supported(detail::best_simd_level()));
+}
+
+TEST(TranscodeTest, LevelsFollowCpuFeatures) {
+    const detail::CpuFeatures& features = detail::cpu_features();
+    EXPECT_EQ(detail::simd_supported(SimdLevel::SSE42), features.sse42);
+    EXPECT_EQ(detail::simd_supported(SimdLevel::AVX2), features.avx2);
+    EXPECT_EQ(detail::simd_supported(SimdLevel::AVX512), features.avx512bw && features.bmi2);
+    EXPECT_TRUE(!features.avx512vbmi2 || features.avx512bw);
+    EXPECT_TRUE(detail::simd_supported(detail::active_simd_level()));
+}
+
+TEST(TranscodeTest, SetSimdLevelSwitchesDefaultKernels) {
+    const SimdLevel initial = detail::active_simd_level();
+    const std::string text = "caf\xC3\xA9 \xF0\x9F\x98\x80 \xFF tail of plain ASCII text";
+    for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE42, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        const SimdLevel active = detail::set_simd_level(level);
+        // Unsupported levels are lowered to the best supported one below them
+        EXPECT_TRUE(detail::simd_supported(active)) << level_name(level);
+        EXPECT_LE(static_cast<int>(active), static_cast<int>(level)) << level_name(level);
+        EXPECT_EQ(active, detail::active_simd_level());
+        EXPECT_EQ(detail::validate_utf8(text.data(), text.size()), 11u) << level_name(active);
+        std::u16string units(text.size(), u'\0');
+        units.resize(detail::utf8_to_utf16(text.data(), text.size(), units.data()));
+        EXPECT_EQ(units, reference_utf16(text)) << level_name(active);
+    }
+    EXPECT_EQ(detail::set_simd_level(initial), initial);
+}
+
+TEST(TranscodeTest, ValidateUtf8KnownSequences) {
+    expect_all_levels("", npos);
+    expect_all_levels("plain ascii", npos);
+    for (const auto& piece : valid_pieces) {
+        expect_all_levels(piece, npos);
+    }
+    for (const auto& piece : invalid_pieces) {
+        SCOPED_TRACE(piece);
+        const std::size_t expected = reference_invalid(piece);
+        ASSERT_NE(expected, npos);
+        expect_all_levels(piece, expected);
+        expect_all_levels("ab" + piece + "cd", expected + 2);
+    }
+}
+
+TEST(TranscodeTest, ValidateUtf8ErrorAtEveryOffset) {
+    // Errors on both sides of every block boundary, after text of every class
+    for (const std::string unit : {"a", "\xC2\xA9", "\xE4\xB8\x96", "\xF0\x9F\x8C\x8D"}) {
+        std::string base;
+        while (base.size() < 200) {
+            base += unit;
+        }
+        expect_all_levels(base, npos);
+        for (std::size_t cut = 0; cut <= base.size(); cut += unit.size()) {
+            for (const std::string bad : {"\xFF", "\x80", "\xE4\xB8", "\xF0\x9F\x8C", "\xED\xA0\x80"}) {
+                const std::string text = base.substr(0, cut) + bad + base.substr(cut);
+                expect_all_levels(text, cut);
+                // Cut off at the end of the input
+                expect_all_levels(base.substr(0, cut) + bad, cut);
+            }
+        }
+    }
+}
+
+TEST(TranscodeTest, ValidateUtf8MatchesReferenceOnRandomText) {
+    std::mt19937 rng(20261016);
+    for (int round = 0; round < 2000; ++round) {
+        const std::string text = random_text(rng, rng() % 120, round % 3 == 0 ? 0 : 2);
+        expect_all_levels(text, reference_invalid(text));
+    }
+    // Random bytes
+    for (int round = 0; round < 2000; ++round) {
+        std::string text(rng() % 150, '\0');
+        for (auto& byte : text) {
+            byte = static_cast<char>(rng() % 4 == 0 ? rng() : rng() % 0x80);
+        }
+        expect_all_levels(text, reference_invalid(text));
+    }
+}
+
+TEST(TranscodeTest, ValidateUtf8Benchmark) {
+    std::mt19937 rng(42);
+    const std::string ascii(16 << 20, 'x');
+    const std::string mixed = random_text(rng, 4 << 20, 0);
+
+    std::cout << "\nvalidate_utf8 Benchmark (16 MB ASCII, " << (mixed.size() >> 20) << " MB mixed):\n";
+    for (SimdLevel level : supported_levels()) {
+        for (const std::string* text : {&ascii, &mixed}) {
+            auto start = std::chrono::high_resolution_clock::now();
+            const std::size_t invalid = detail::validate_utf8(text->data(), text->size(), level);
+            auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - start);
+            EXPECT_EQ(invalid, npos);
+            std::cout << "  " << level_name(level) << (text == &ascii ? " ASCII: " : " mixed: ")
+                      << time.count() << " microseconds\n";
+        }
+    }
+}
+
+TEST(TranscodeTest, Utf8ToUtf16MatchesReference) {
+    for (const auto& piece : invalid_pieces) {
+        expect_utf16_all_levels(piece);
+    }
+    // Invalid pieces at every offset, and cut off at the end
+    for (const std::string unit : {"a", "\xC2\xA9", "\xE4\xB8\x96", "\xF0\x9F\x8C\x8D", "a\xC2\xA9\xE4\xB8\x96"}) {
+        std::string base;
+        while (base.size() < 100) {
+            base += unit;
+        }
+        expect_utf16_all_levels(base);
+        for (std::size_t cut = 0; cut <= base.size(); ++cut) {
+            for (const std::string bad : {"\xFF", "\x80", "\xE4\xB8", "\xF0\x9F\x8C", "\xED\xA0\x80", "\xC0\xAF"}) {
+                expect_utf16_all_levels(base.substr(0, cut) + bad + base.substr(cut));
+                expect_utf16_all_levels(base.substr(0, cut) + bad);
+            }
+        }
+    }
+    std::mt19937 rng(7);
+    for (int round = 0; round < 3000; ++round) {
+        expect_utf16_all_levels(random_text(rng, rng() % 150, round % 3 == 0 ? 0 : 3));
+    }
+}
+
+TEST(TranscodeTest, Utf8ToUtf16Benchmark) {
+    // Prose mixing ASCII with Latin, CJK and the occasional emoji
+    std::string mixed;
+    while (mixed.size() < (8 << 20)) {
+        mixed += "The caf\xC3\xA9 on the corner (\xE4\xB8\x96\xE7\x95\x8C\xE3\x81\xAE\xE5\xBA\x97) "
+                 "serves cr\xC3\xA8me br\xC3\xBBl\xC3\xA9" "e \xF0\x9F\x8D\xAE" " and \xE6\x8A\xB9\xE8\x8C\xB6 "
+                 "\xE3\x83\xA9\xE3\x83\x86. ";
+    }
+    std::string cjk;
+    while (cjk.size() < (8 << 20)) {
+        cjk += "\xE4\xB8\x96\xE7\x95\x8C\xE3\x81\xAE\xE5\xBA\x97\xE3\x81\xA7\xE6\x8A\xB9\xE8\x8C\xB6";
+    }
+
+    // Best of three runs into buffers that are already allocated
+    auto best_time = [](auto&& run) {
+        std::chrono::microseconds best = std::chrono::microseconds::max();
+        for (int i = 0; i < 3; ++i) {
+            auto start = std::chrono::high_resolution_clock::now();
+            run();
+            best = std::min(best, std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - start));
+        }
+        return best.count();
+    };
+
+    std::cout << "\nutf8_to_utf16 Benchmark (8 MB each):\n";
+    for (const std::string* text : {&mixed, &cjk}) {
+        const char* name = text == &mixed ? "mixed" : "CJK";
+        const std::u16string expected = reference_utf16(*text);
+        // One group at a time, appending to the string as get_utf16() used to
+        std::u16string appended;
+        appended.reserve(text->size());
+        const auto append_time = best_time([&] {
+            appended.clear();
+            const unsigned char* str = reinterpret_cast<const unsigned char*>(text->data());
+            const unsigned char* end = str + text->size();
+            while (str < end) {
+                const detail::Utf16Group group = detail::decode_group(str, end);
+                appended.push_back(group.unit[0]);
+                if (group.units == 2) {
+                    appended.push_back(group.unit[1]);
+                }
+                str += group.bytes;
+            }
+        });
+        std::cout << "  decode_group + push_back " << name << ": " << append_time << " microseconds\n";
+
+        std::u16string units(text->size(), u'\0');
+        for (SimdLevel level : supported_levels()) {
+            std::size_t written = 0;
+            const auto time = best_time([&] {
+                written = detail::utf8_to_utf16(text->data(), text->size(), units.data(), level);
+            });
+            EXPECT_TRUE(std::u16string_view(units.data(), written) == expected);
+            std::cout << "  " << level_name(level) << " " << name << ": " << time << " microseconds\n";
+        }
+    }
+}
+
+TEST(TranscodeTest, CountUtf16MatchesReference) {
+    expect_counts_all_levels("");
+    for (const auto& piece : invalid_pieces) {
+        expect_counts_all_levels(piece);
+    }
+    // Invalid pieces at every offset, and cut off at the end
+    for (const std::string unit : {"a", "\xC2\xA9", "\xE4\xB8\x96", "\xF0\x9F\x8C\x8D"}) {
+        std::string base;
+        while (base.size() < 100) {
+            base += unit;
+        }
+        expect_counts_all_levels(base);
+        for (std::size_t cut = 0; cut <= base.size(); ++cut) {
+            for (const std::string bad : {"\xFF", "\x80", "\xE4\xB8", "\xF0\x9F\x8C", "\xED\xA0\x80", "\xF4\x90\x80\x80"}) {
+                expect_counts_all_levels(base.substr(0, cut) + bad + base.substr(cut));
+                expect_counts_all_levels(base.substr(0, cut) + bad);
+            }
+        }
+    }
+    std::mt19937 rng(11);
+    for (int round = 0; round < 3000; ++round) {
+        expect_counts_all_levels(random_text(rng, rng() % 150, round % 3 == 0 ? 0 : 3));
+    }
+    // Long enough for the byte counters of SSE4.2 and AVX2 to be added up more than once
+    const std::string long_text = random_text(rng, 20000, 0);
+    expect_counts_all_levels(long_text);
+    expect_counts_all_levels(long_text + "\xFF" + long_text);
+}
+
+TEST(TranscodeTest, CountUtf16Benchmark) {
+    std::mt19937 rng(42);
+    const std::string mixed = random_text(rng, 4 << 20, 0);
+    const std::string invalid = random_text(rng, 1 << 20, 1);
+
+    std::cout << "\ncount_utf16 Benchmark (" << (mixed.size() >> 20) << " MB mixed, "
+              << (invalid.size() >> 20) << " MB with 1% invalid pieces):\n";
+    for (SimdLevel level : supported_levels()) {
+        for (const std::string* text : {&mixed, &invalid}) {
+            auto start = std::chrono::high_resolution_clock::now();
+            const detail::Utf16Counts counts = detail::count_utf16(text->data(), text->size(), level);
+            auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - start);
+            EXPECT_GT(counts.units, 0u);
+            std::cout << "  " << level_name(level) << (text == &mixed ? " mixed: " : " invalid: ")
+                      << time.count() << " microseconds\n";
+        }
+    }
+}
+
+TEST(TranscodeTest, EncodeUtf16AndUtf32MatchReference) {
+    expect_encoded_all_levels("");
+    for (const auto& piece : invalid_pieces) {
+        expect_encoded_all_levels(piece);
+    }
+    for (const std::string unit : {"a", "\xC2\xA9", "\xE4\xB8\x96", "\xF0\x9F\x8C\x8D", "a\xC2\xA9\xE4\xB8\x96"}) {
+        std::string base;
+        while (base.size() < 100) {
+            base += unit;
+        }
+        expect_encoded_all_levels(base);
+        for (std::size_t cut = 0; cut <= base.size(); cut += 7) {
+            for (const std::string bad : {"\xFF", "\xE4\xB8", "\xED\xA0\x80"}) {
+                expect_encoded_all_levels(base.substr(0, cut) + bad + base.substr(cut));
+            }
+        }
+    }
+    std::mt19937 rng(5);
+    for (int round = 0; round < 1000; ++round) {
+        expect_encoded_all_levels(random_text(rng, rng() % 150, round % 3 == 0 ? 0 : 3));
+    }
+    // Longer than the chunks UTF-32 is decoded through
+    expect_encoded_all_levels(random_text(rng, 10000, 0));
+}
+
+TEST(TranscodeTest, EncodeBenchmark) {
+    std::mt19937 rng(42);
+    const std::string mixed = random_text(rng, 2 << 20, 0);
+    std::u16string units(mixed.size() + detail::ENCODE_UTF16_SLACK, u'\0');
+    std::u32string code_points(mixed.size(), U'\0');
+
+    std::cout << "\nencode_utf16/encode_utf32 Benchmark (" << (mixed.size() >> 20) << " MB mixed, big-endian):\n";
+    for (SimdLevel level : supported_levels()) {
+        auto start = std::chrono::high_resolution_clock::now();
+        const std::size_t written16 = detail::encode_utf16(mixed.data(), mixed.size(), detail::ByteOrder::BIG,
+                                                           units.data(), level);
+        auto middle = std::chrono::high_resolution_clock::now();
+        const std::size_t written32 = detail::encode_utf32(mixed.data(), mixed.size(), detail::ByteOrder::BIG,
+                                                           code_points.data(), level);
+        auto end = std::chrono::high_resolution_clock::now();
+        EXPECT_GE(written16, written32);
+        std::cout << "  " << level_name(level) << " UTF-16: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(middle - start).count()
+                  << " microseconds, UTF-32: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(end - middle).count()
+                  << " microseconds\n";
+    }
+}
+
+TEST(TranscodeTest, DecodeUtf16MatchesReference) {
+    expect_utf16_decoded_all_levels({});
+    for (const auto& base : {std::vector<char16_t>{u'a'}, {0xE9}, {0x4E16}, {0xD83C, 0xDF0D},
+                             {u'a', 0xE9, 0x4E16, 0xD83C, 0xDF0D}}) {
+        std::vector<char16_t> units;
+        while (units.size() < 100) {
+            units.insert(units.end(), base.begin(), base.end());
+        }
+        expect_utf16_decoded_all_levels(units);
+        // Unpaired surrogates at every position a vector may start, end or carry over
+        for (std::size_t cut = 0; cut <= units.size(); ++cut) {
+            for (char16_t bad : {char16_t{0xD800}, char16_t{0xDC00}}) {
+                std::vector<char16_t> broken = units;
+                broken.insert(broken.begin() + static_cast<std::ptrdiff_t>(cut), bad);
+                expect_utf16_decoded_all_levels(broken);
+            }
+        }
+    }
+    std::mt19937 rng(11);
+    for (int round = 0; round < 1000; ++round) {
+        expect_utf16_decoded_all_levels(random_utf16(rng, rng() % 150, round % 3 == 0 ? 0 : 3));
+    }
+    expect_utf16_decoded_all_levels(random_utf16(rng, 10000, 0));
+}
+
+TEST(TranscodeTest, DecodeUtf32MatchesReference) {
+    expect_utf32_decoded_all_levels({});
+    std::mt19937 rng(12);
+    for (int round = 0; round < 1000; ++round) {
+        expect_utf32_decoded_all_levels(random_utf32(rng, rng() % 150, round % 3 == 0 ? 0 : 3));
+    }
+    for (char32_t value : {U'a', char32_t{0xE9}, char32_t{0x4E16}, char32_t{0x1F30D}}) {
+        std::vector<char32_t> code_points(100, value);
+        expect_utf32_decoded_all_levels(code_points);
+        for (std::size_t cut = 0; cut < code_points.size(); cut += 3) {
+            std::vector<char32_t> broken = code_points;
+            broken[cut] = 0xDC00;
+            expect_utf32_decoded_all_levels(broken);
+        }
+    }
+}
+
+TEST(TranscodeTest, DecodeLatin1MatchesReference) {
+    std::mt19937 rng(13);
+    for (int round = 0; round < 1000; ++round) {
+        std::string text(rng() % 300, '\0');
+        for (char& byte : text) {
+            // Mostly ASCII, with some runs of it long enough to be copied a vector at a time
+            byte = static_cast<char>(round % 4 == 0 ? rng() % 0x80 : rng() % 0x100);
+        }
+        std::string expected;
+        for (char byte : text) {
+            append_utf8(expected, static_cast<unsigned char>(byte));
+        }
+        for (SimdLevel level : supported_levels()) {
+            const std::size_t length = detail::decoded_length_latin1(text.data(), text.size(), level);
+            EXPECT_EQ(length, expected.size()) << level_name(level) << ", " << text.size() << " bytes";
+            std::string utf8(length, '\0');
+            utf8.resize(detail::decode_latin1(text.data(), text.size(), utf8.data(), level));
+            EXPECT_EQ(utf8, expected) << level_name(level) << ", " << text.size() << " bytes";
+        }
+    }
+}
+
+TEST(TranscodeTest, DecodeBenchmark) {
+    std::mt19937 rng(42);
+    const std::vector<char16_t> units = random_utf16(rng, 2 << 20, 0);
+    const std::string utf16 = bytes_of(units, detail::ByteOrder::BIG);
+    std::vector<char32_t> code_points;
+    for (std::size_t i = 0; i < units.size(); ++i) {
+        char32_t value = units[i];
+        if (value >= 0xD800 && value <= 0xDBFF) {
+            value = 0x10000 + ((value - 0xD800) << 10) + (units[++i] - 0xDC00);
+        }
+        code_points.push_back(value);
+    }
+    const std::string utf32 = bytes_of(code_points, detail::ByteOrder::LITTLE);
+    const std::size_t size = reference_utf16_decoding(units, true).utf8.size();
+    std::string utf8(size, '\0');
+
+    std::cout << "\ndecode_utf16/decode_utf32 Benchmark (" << units.size() << " mixed code units, UTF-16BE, UTF-32LE):\n";
+    for (SimdLevel level : supported_levels()) {
+        auto start = std::chrono::high_resolution_clock::now();
+        const detail::DecodedLength length16 = detail::decoded_length_utf16(utf16.data(), units.size(),
+                                                                            detail::ByteOrder::BIG, true, level);
+        const std::size_t written16 = detail::decode_utf16(utf16.data(), units.size(), detail::ByteOrder::BIG, true,
+                                                           utf8.data(), level);
+        auto middle = std::chrono::high_resolution_clock::now();
+        const detail::DecodedLength length32 = detail::decoded_length_utf32(utf32.data(), code_points.size(),
+                                                                            detail::ByteOrder::LITTLE, true, level);
+        const std::size_t written32 = detail::decode_utf32(utf32.data(), code_points.size(),
+                                                           detail::ByteOrder::LITTLE, true, utf8.data(), level);
+        auto end = std::chrono::high_resolution_clock::now();
+        EXPECT_EQ(length16.bytes, size);
+        EXPECT_EQ(written16, size);
+        EXPECT_EQ(length32.bytes, size);
+        EXPECT_EQ(written32, size);
+        std::cout << "  " << level_name(level) << " UTF-16: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(middle - start).count()
+                  << " microseconds, UTF-32: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(end - middle).count()
+                  << " microseconds\n";
+    }
+}